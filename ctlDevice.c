@@ -0,0 +1,465 @@
+/* Dispositivo di controllo /dev/singlefilefs (interfaccia in filesystem/singlefilefs_ctl.h).
+ *
+ * Il dispositivo espone l'intero insieme delle operazioni delle system call del modulo (ctl_execute()) senza passare dalla
+ * system call table: SFS_CTL_OP esegue una singola operazione, SFS_CTL_BATCH un array di operazioni con una sola chiamata.
+ * Le system call restano disponibili se al caricamento del modulo viene indicato l'indirizzo della system call table.
+ *
+ * Ogni apertura del dispositivo può inoltre predisporre una coppia di code circolari (richieste e completamenti) allocate con
+ * vmalloc_user() e mappate dal processo con mmap(). Un kthread dedicato preleva a lotti le richieste accodate, le esegue con
+ * ctl_execute() nello spazio di indirizzamento del processo (kthread_use_mm()), per cui i buffer delle richieste sono normali
+ * indirizzi user, e accoda i completamenti. Un processo che accoda richieste a ritmo sostenuto non esegue quindi alcuna system
+ * call per messaggio: ne serve una soltanto per risvegliare il kthread quando questo, trovata la coda vuota, si è addormentato
+ * (SFS_RING_NEED_WAKEUP).
+ *
+ * Tutto ciò che si trova nella mappatura può essere modificato dall'utente in qualsiasi momento: le richieste vengono copiate
+ * prima di essere esaminate e gli indici scritti dal kernel sono mantenuti in copia privata (struct sfs_ring).
+ */
+
+#include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/log2.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/sched/mm.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,8,0)
+#include <linux/mmu_context.h>
+#define kthread_use_mm(mm) use_mm(mm)
+#define kthread_unuse_mm(mm) unuse_mm(mm)
+#endif
+
+#include "filesystem/singlefilefs_ctl.h"
+
+#define RING_BATCH 256      //richieste eseguite dal kthread tra un risveglio dei processi in attesa dei completamenti e l'altro
+#define CTL_BATCH_CHUNK 32  //operazioni di SFS_CTL_BATCH copiate in kernel space alla volta
+
+
+//numero di richieste accodate e non ancora prelevate (al più sq_entries, anche se l'utente ha alterato sq_tail).
+//la lettura di sq_tail ha semantica acquire: le richieste fino a sq_tail sono visibili nella loro versione pubblicata.
+static inline uint32_t ring_sq_pending(struct sfs_ring *ring) {
+
+    uint32_t pending = smp_load_acquire(&(ring->ctl->sq_tail)) - ring->sq_head;
+
+    return pending > ring->sq_entries ? ring->sq_entries : pending;
+
+}
+
+//numero di completamenti non ancora consumati dall'utente (al più cq_entries, anche se l'utente ha alterato cq_head).
+static inline uint32_t ring_cq_ready(struct sfs_ring *ring) {
+
+    uint32_t ready = READ_ONCE(ring->cq_tail) - READ_ONCE(ring->ctl->cq_head);
+
+    return ready > ring->cq_entries ? ring->cq_entries : ready;
+
+}
+
+//il kthread ha lavoro da svolgere se c'è almeno una richiesta accodata e c'è posto per il suo completamento.
+static inline int ring_has_work(struct sfs_ring *ring) {
+
+    return ring_sq_pending(ring) > 0 && ring_cq_ready(ring) < ring->cq_entries;
+
+}
+
+//esegue l'operazione op e ne restituisce il risultato (quello della system call corrispondente, vedi devFunctions.c).
+//va invocata con il contatore degli utilizzi del file system già incrementato, nello spazio di indirizzamento a cui appartiene buf.
+static long ctl_execute(const struct sfs_op *op) {
+
+    struct write_condition cond = {.checks = COND_SEQ | COND_VERSION, .seq = op->seq, .version = op->version};
+    char *buf = (char *)(unsigned long)op->buf;
+    int64_t offset;
+
+    switch (op->opcode) {
+        case SFS_OP_PUT:
+            return do_put_data(buf, op->len, 0, 0, NULL);
+        case SFS_OP_GET:
+            return do_get_data(op->address, buf, op->len, 0, 0);
+        case SFS_OP_INVALIDATE:
+            return do_invalidate_data(op->address, 0, 0, NULL);
+        case SFS_OP_PUT_KEYED:
+            return do_put_data(buf, op->len, BLOCK_KEYED, op->key, NULL);
+        case SFS_OP_GET_BY_KEY:
+        case SFS_OP_INVALIDATE_BY_KEY:
+            offset = au_info.is_mounted ? lookup_key(op->key) : 0;
+            if (offset < 0)
+                return -ENODATA; //-ENODATA = chiave non associata ad alcun messaggio
+            if (op->opcode == SFS_OP_GET_BY_KEY)
+                return do_get_data(offset, buf, op->len, BLOCK_KEYED, op->key);
+            return do_invalidate_data(offset, BLOCK_KEYED, op->key, NULL);
+        case SFS_OP_UPDATE:
+            return do_update_data(op->address, buf, op->len, UPDATE_REPLACE, NULL);
+        case SFS_OP_UPDATE_TO_TAIL:
+            return do_update_data(op->address, buf, op->len, UPDATE_TO_TAIL, NULL);
+        case SFS_OP_APPEND:
+            return do_update_data(op->address, buf, op->len, UPDATE_APPEND, NULL);
+        case SFS_OP_PUT_IF_TAIL:
+            cond.checks = COND_SEQ;
+            return do_put_data(buf, op->len, 0, 0, &cond);
+        case SFS_OP_UPDATE_IF:
+            return do_update_data(op->address, buf, op->len, UPDATE_REPLACE, &cond);
+        case SFS_OP_INVALIDATE_IF:
+            return do_invalidate_data(op->address, 0, 0, &cond);
+        default:
+            return -EINVAL; //-EINVAL = operazione sconosciuta
+    }
+
+}
+
+//preleva ed esegue al più RING_BATCH richieste, accodandone i completamenti. Va invocata nello spazio di indirizzamento del
+//processo che ha predisposto le code.
+static void ring_drain(struct sfs_ring *ring) {
+
+    struct sfs_sqe sqe;
+    struct sfs_cqe *cqe;
+    struct sfs_op op;
+    unsigned int done;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    for(done=0; done<RING_BATCH && ring_has_work(ring); done++) {
+        //la richiesta viene copiata prima di essere esaminata (l'utente potrebbe modificarla nel frattempo), dopodiché il suo
+        //elemento della coda viene restituito all'utente.
+        memcpy(&sqe, &(ring->sqes[ring->sq_head & (ring->sq_entries - 1)]), sizeof(sqe));
+        ring->sq_head++;
+        smp_store_release(&(ring->ctl->sq_head), ring->sq_head);
+
+        cqe = &(ring->cqes[ring->cq_tail & (ring->cq_entries - 1)]);
+        cqe->user_data = sqe.user_data;
+        op.opcode = sqe.opcode;
+        op.address = sqe.address;
+        op.key = sqe.key;
+        op.buf = sqe.buf;
+        op.len = sqe.len;
+        op.seq = sqe.seq;
+        op.version = sqe.version;
+        cqe->result = ctl_execute(&op);
+        //il completamento viene pubblicato dopo essere stato scritto
+        WRITE_ONCE(ring->cq_tail, ring->cq_tail + 1);
+        smp_store_release(&(ring->ctl->cq_tail), ring->cq_tail);
+    }
+
+    atomic_fetch_add(-1, &(au_info.usages));
+
+}
+
+//corpo del kthread associato a una coppia di code: esegue le richieste finché ce ne sono, altrimenti si addormenta.
+static int ring_worker(void *data) {
+
+    struct sfs_ring *ring = (struct sfs_ring *)data;
+
+    while (!kthread_should_stop()) {
+        if (!ring_has_work(ring)) {
+            //prima di addormentarsi il kthread lo annuncia e ricontrolla le code (nella condizione di wait_event_interruptible()):
+            //l'utente pubblica sq_tail prima di leggere flags, per cui una richiesta accodata dopo il controllo verrà
+            //seguita da SFS_CTL_RING_ENTER.
+            WRITE_ONCE(ring->ctl->flags, SFS_RING_NEED_WAKEUP);
+            smp_mb();
+            wait_event_interruptible(ring->sq_wait, ring_has_work(ring) || kthread_should_stop());
+            WRITE_ONCE(ring->ctl->flags, 0);
+            continue;
+        }
+
+        if (!mmget_not_zero(ring->mm)) {
+            //il processo che ha predisposto le code è terminato (il file è rimasto aperto altrove): i buffer delle richieste
+            //non esistono più e nessuno può consumare i completamenti.
+            wait_event_interruptible(ring->sq_wait, kthread_should_stop());
+            break;
+        }
+        kthread_use_mm(ring->mm);
+        ring_drain(ring);
+        kthread_unuse_mm(ring->mm);
+        mmput(ring->mm);
+
+        wake_up_interruptible(&(ring->cq_wait));
+        cond_resched();
+    }
+
+    return 0;
+
+}
+
+//rilascia le code (il kthread deve essere già terminato).
+static void ring_free(struct sfs_ring *ring) {
+
+    if (ring->mm)
+        mmdrop(ring->mm);
+    vfree(ring->mem);
+    kfree(ring);
+
+}
+
+//SFS_CTL_RING_SETUP: alloca le code di questa apertura del dispositivo e avvia il kthread che le serve.
+static long ring_setup(struct file *filp, struct sfs_ring_params *user_params) {
+
+    struct ctl_file *ctl = (struct ctl_file *)filp->private_data;
+    struct sfs_ring_params params;
+    struct sfs_ring *ring;
+    size_t sqes_off, cqes_off;
+    long ret;
+
+    if (copy_from_user(&params, user_params, sizeof(params)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    if (params.sq_entries == 0 || params.sq_entries > SFS_RING_MAX_ENTRIES)
+        return -EINVAL; //-EINVAL = dimensione della coda non valida
+    if (!current->mm)
+        return -EINVAL; //-EINVAL = chiamante senza spazio di indirizzamento user
+
+    ring = kzalloc(sizeof(struct sfs_ring), GFP_KERNEL);
+    if (!ring)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    ring->sq_entries = roundup_pow_of_two(params.sq_entries);
+    ring->cq_entries = 2 * ring->sq_entries;   //il kthread può prelevare nuove richieste anche se l'utente è in ritardo coi completamenti
+
+    //layout della mappatura: indici, richieste, completamenti
+    sqes_off = sizeof(struct sfs_ring_ctl);
+    cqes_off = sqes_off + ring->sq_entries * sizeof(struct sfs_sqe);
+    ring->size = PAGE_ALIGN(cqes_off + ring->cq_entries * sizeof(struct sfs_cqe));
+    ring->mem = vmalloc_user(ring->size);      //azzerata
+    if (!ring->mem) {
+        kfree(ring);
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    }
+    ring->ctl = (struct sfs_ring_ctl *)ring->mem;
+    ring->sqes = (struct sfs_sqe *)((char *)ring->mem + sqes_off);
+    ring->cqes = (struct sfs_cqe *)((char *)ring->mem + cqes_off);
+    ring->ctl->sq_mask = ring->sq_entries - 1;
+    ring->ctl->cq_mask = ring->cq_entries - 1;
+    init_waitqueue_head(&(ring->sq_wait));
+    init_waitqueue_head(&(ring->cq_wait));
+    //il kthread esegue le richieste nello spazio di indirizzamento del chiamante: mmgrab() mantiene in vita la mm_struct,
+    //mentre ogni lotto di richieste si assicura con mmget_not_zero() che lo spazio di indirizzamento esista ancora.
+    mmgrab(current->mm);
+    ring->mm = current->mm;
+
+    params.sq_entries = ring->sq_entries;
+    params.cq_entries = ring->cq_entries;
+    params.size = ring->size;
+    params.sqes_off = sqes_off;
+    params.cqes_off = cqes_off;
+
+    mutex_lock(&(ctl->lock));
+    if (ctl->ring) {
+        ret = -EBUSY;   //-EBUSY = code già predisposte per questa apertura del dispositivo
+        goto out_free;
+    }
+    if (copy_to_user(user_params, &params, sizeof(params))) {
+        ret = -EFAULT;  //-EFAULT = indirizzo non valido
+        goto out_free;
+    }
+    ring->worker = kthread_run(ring_worker, ring, "singlefilefs_ring/%d", current->pid);
+    if (IS_ERR(ring->worker)) {
+        ret = PTR_ERR(ring->worker);
+        goto out_free;
+    }
+    smp_store_release(&(ctl->ring), ring);    //ctl_mmap() e ring_enter() leggono ring senza acquisire il lock
+    mutex_unlock(&(ctl->lock));
+
+    printk("%s: ring of %u entries successfully set up\n", MOD_NAME, ring->sq_entries);
+    return 0;
+
+out_free:
+    mutex_unlock(&(ctl->lock));
+    ring_free(ring);
+    return ret;
+
+}
+
+//SFS_CTL_RING_ENTER: risveglia il kthread e attende eventualmente i completamenti.
+static long ring_enter(struct file *filp, struct sfs_ring_enter *user_enter) {
+
+    struct ctl_file *ctl = (struct ctl_file *)filp->private_data;
+    struct sfs_ring *ring = smp_load_acquire(&(ctl->ring));
+    struct sfs_ring_enter enter;
+    uint64_t min_complete;
+
+    if (!ring)
+        return -EINVAL; //-EINVAL = code non predisposte
+    if (current->mm != ring->mm)
+        return -EPERM;  //-EPERM = le code appartengono a un altro processo
+    if (copy_from_user(&enter, user_enter, sizeof(enter)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+
+    wake_up_interruptible(&(ring->sq_wait));
+
+    //non si possono attendere più completamenti di quanti ne contenga la coda
+    min_complete = enter.min_complete > ring->cq_entries ? ring->cq_entries : enter.min_complete;
+    if (min_complete > 0 && wait_event_interruptible(ring->cq_wait, ring_cq_ready(ring) >= min_complete))
+        return -EINTR;  //-EINTR = attesa interrotta da un segnale
+
+    enter.ready = ring_cq_ready(ring);
+    if (copy_to_user(&(user_enter->ready), &(enter.ready), sizeof(enter.ready)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    return 0;
+
+}
+
+//SFS_CTL_OP: esegue una singola operazione e ne scrive il risultato.
+static long ctl_op(struct sfs_op *user_op) {
+
+    struct sfs_op op;
+
+    if (copy_from_user(&op, user_op, sizeof(op)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    op.result = ctl_execute(&op);
+    atomic_fetch_add(-1, &(au_info.usages));
+
+    if (op.result < 0)
+        return op.result;
+    if (copy_to_user(&(user_op->result), &(op.result), sizeof(op.result)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    return 0;
+
+}
+
+//SFS_CTL_BATCH: esegue in ordine le operazioni dell'array indicato, CTL_BATCH_CHUNK alla volta, scrivendo il risultato di ciascuna.
+//tra un gruppo e l'altro il lotto può essere interrotto da un segnale: done indica quante operazioni sono state eseguite.
+static long ctl_batch(struct sfs_batch *user_batch) {
+
+    struct sfs_batch batch;
+    struct sfs_op *ops;
+    struct sfs_op *user_ops;
+    uint64_t done, chunk, i;
+    long ret = 0;
+    int stop = 0;
+
+    if (copy_from_user(&batch, user_batch, sizeof(batch)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    ops = kmalloc_array(CTL_BATCH_CHUNK, sizeof(struct sfs_op), GFP_KERNEL);
+    if (!ops)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    user_ops = (struct sfs_op *)(unsigned long)batch.ops;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    for(done=0; done<batch.count && !stop; done+=chunk) {
+        if (done > 0 && signal_pending(current))
+            break;
+        chunk = min_t(uint64_t, batch.count - done, CTL_BATCH_CHUNK);
+        if (copy_from_user(ops, user_ops + done, chunk * sizeof(struct sfs_op))) {
+            ret = -EFAULT;  //-EFAULT = indirizzo non valido
+            break;
+        }
+        for(i=0; i<chunk; i++) {
+            ops[i].result = ctl_execute(&ops[i]);
+            if (ops[i].result < 0 && (batch.flags & SFS_BATCH_STOP_ON_ERROR)) {
+                chunk = i + 1;
+                stop = 1;
+                break;
+            }
+        }
+        if (copy_to_user(user_ops + done, ops, chunk * sizeof(struct sfs_op))) {
+            //le operazioni del blocco sono state comunque eseguite (e non vanno ripetute), anche se i loro risultati sono persi
+            done += chunk;
+            ret = -EFAULT;  //-EFAULT = indirizzo non valido
+            break;
+        }
+    }
+
+    atomic_fetch_add(-1, &(au_info.usages));
+    kfree(ops);
+
+    //done viene riportato anche in caso di errore, in modo che l'utente sappia quali operazioni sono state eseguite
+    if (copy_to_user(&(user_batch->done), &done, sizeof(done)) && ret == 0)
+        ret = -EFAULT;  //-EFAULT = indirizzo non valido
+    return ret;
+
+}
+
+//la ctl_ioctl() implementa i comandi definiti in singlefilefs_ctl.h.
+static long ctl_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+
+    switch (cmd) {
+        case SFS_CTL_OP:
+            return ctl_op((struct sfs_op *)arg);
+        case SFS_CTL_BATCH:
+            return ctl_batch((struct sfs_batch *)arg);
+        case SFS_CTL_RING_SETUP:
+            return ring_setup(filp, (struct sfs_ring_params *)arg);
+        case SFS_CTL_RING_ENTER:
+            return ring_enter(filp, (struct sfs_ring_enter *)arg);
+        default:
+            return -ENOTTY;  //-ENOTTY = comando ioctl() non supportato
+    }
+
+}
+
+//la ctl_mmap() mappa le code predisposte con SFS_CTL_RING_SETUP (a partire dall'offset 0).
+static int ctl_mmap(struct file *filp, struct vm_area_struct *vma) {
+
+    struct ctl_file *ctl = (struct ctl_file *)filp->private_data;
+    struct sfs_ring *ring = smp_load_acquire(&(ctl->ring));
+
+    if (!ring)
+        return -EINVAL; //-EINVAL = code non predisposte
+    if (current->mm != ring->mm)
+        return -EPERM;  //-EPERM = le code appartengono a un altro processo
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > ring->size)
+        return -EINVAL; //-EINVAL = intervallo non valido
+
+    //i buffer indicati nelle richieste appartengono allo spazio di indirizzamento di questo processo: un figlio creato con fork()
+    //non deve ereditare la mappatura.
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+        vm_flags_set(vma, VM_DONTCOPY);
+    #else
+        vma->vm_flags |= VM_DONTCOPY;
+    #endif
+    return remap_vmalloc_range(vma, ring->mem, 0);
+
+}
+
+//la ctl_open() alloca lo stato dell'apertura del dispositivo di controllo.
+static int ctl_open(struct inode *inode, struct file *file) {
+
+    struct ctl_file *ctl;
+
+    ctl = kzalloc(sizeof(struct ctl_file), GFP_KERNEL);
+    if (!ctl)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    mutex_init(&(ctl->lock));
+    file->private_data = ctl;
+    return 0;
+
+}
+
+//la ctl_release() ferma il kthread (attendendo il lotto di richieste in corso) e rilascia le code.
+static int ctl_release(struct inode *inode, struct file *file) {
+
+    struct ctl_file *ctl = (struct ctl_file *)file->private_data;
+
+    if (ctl->ring) {
+        kthread_stop(ctl->ring->worker);
+        ring_free(ctl->ring);
+    }
+    kfree(ctl);
+    return 0;
+
+}
+
+static const struct file_operations ctl_fops = {
+  .owner = THIS_MODULE,
+  .open = ctl_open,
+  .release = ctl_release,
+  .unlocked_ioctl = ctl_ioctl,
+#if defined(CONFIG_COMPAT) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+  .compat_ioctl = compat_ptr_ioctl,
+#endif
+  .mmap = ctl_mmap,
+};
+
+//il dispositivo è accessibile a tutti gli utenti, come le system call del modulo.
+static struct miscdevice ctl_device = {
+  .minor = MISC_DYNAMIC_MINOR,
+  .name = "singlefilefs",
+  .fops = &ctl_fops,
+  .mode = 0666,
+};
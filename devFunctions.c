@@ -1,4 +1,4 @@
-/* DISCLAIMER 1: per l'acquisizione dei mutex write_mutex e off_mutex si è scelto di utilizzare la funzione mutex_trylock()
+/* DISCLAIMER 1: per l'acquisizione del mutex write_mutex si è scelto di utilizzare la funzione mutex_trylock()
  * anziché la funzione mutex_lock() (e quindi di gestire le retry dell'acquisizione del lock a livello user) poiché ho
  * avuto problemi con l'esecuzione concorrente nel caso in cui si utilizza mutex_lock(): in particolare, se due thread
  * provano ad acquisire uno stesso lock concorrentemente, solo un thread riesce ad acquisirlo mentre l'altro resta in
@@ -14,8 +14,13 @@
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 #include <linux/srcu.h>
 #include <linux/syscalls.h>
 #include <linux/types.h>
@@ -30,62 +35,111 @@
 #include "filesystem/singlefilefs.h"
 #include "filesystem/singlefilefs_init.h"
 #include "filesystem/singlefilefs_ker.h"
+#include "filesystem/singlefilefs_ioctl.h"
 #include "devFunctions.h"
 #include "utils.c"
 
-int is_first_call = YES;    //variabile globale che indica se il chiamante di dev_read() si trova alla prima iterazione o meno
-int is_last_call = NO;      //variabile globale che indica se il chiamante di dev_read() si trova all'ultima iterazione o meno
+/* OPERAZIONI SUI BLOCCHI
+ * Le funzioni do_*() implementano le operazioni esposte dalle system call e vanno invocate con il contatore degli utilizzi
+ * del file system già incrementato. Con BLOCK_KEYED in flags, l'operazione riguarda il messaggio con chiave key: per get e
+ * invalidate il blocco (individuato con lookup_key()) deve contenere ancora un messaggio valido con quella chiave.
+ * Con una condizione (cond diverso da NULL) l'operazione viene eseguita solo se, all'interno della sezione critica degli
+ * scrittori, il messaggio interessato ha il numero di sequenza e/o la versione attesi; altrimenti termina con -ECANCELED
+ * senza modificare nulla. Per put la condizione riguarda l'ultimo messaggio valido (numero di sequenza 0 se non ne esistono).
+ */
+
+#define COND_SEQ 0x1        //il numero di sequenza del messaggio deve valere seq
+#define COND_VERSION 0x2    //la versione del messaggio deve valere version
+
+//condizione di una scrittura condizionale
+struct write_condition {
+    uint32_t checks;        //COND_*
+    uint64_t seq;
+    uint64_t version;
+};
+
+//restituisce 1 se il messaggio con numero di sequenza seq e versione version soddisfa la condizione cond (sempre vero senza condizione).
+static inline int condition_holds(const struct write_condition *cond, uint64_t seq, uint64_t version) {
+    if (cond == NULL)
+        return 1;
+    if ((cond->checks & COND_SEQ) && seq != cond->seq)
+        return 0;
+    if ((cond->checks & COND_VERSION) && version != cond->version)
+        return 0;
+    return 1;
+}
+
+//questa funzione scrive il messaggio source (size byte, in user space) in un blocco libero e lo accoda alla catena dei blocchi validi.
+//con l'opzione di montaggio "pack" un messaggio breve senza chiave viene invece impacchettato, come nuovo slot, nell'ultimo blocco
+//della catena (se è impacchettato e ha spazio), oppure nel primo slot di un nuovo blocco impacchettato.
+//restituisce l'indirizzo del messaggio scritto (l'indice del blocco, con lo slot per un messaggio impacchettato) oppure un codice di errore negativo.
+static long do_put_data(char *source, size_t size, uint32_t flags, uint64_t key, const struct write_condition *cond) {
 
-//SYSTEM CALLS
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
-__SYSCALL_DEFINEx(2, _put_data, char *, source, size_t, size)
-#else
-asmlinkage int sys_put_data(char *source, size_t size)
-#endif
-{
     char *kernel_lvl_src;       //buffer di livello kernel (inizializzato con una copy_from_user()) in cui verrà posto l'input della put
     size_t bytes_to_write;      //non è detto che size e la lunghezza di source corrispondano.
-    int offset; //variabile che tiene traccia del numero di iterazione all'interno del ciclo che itera sui blocchi; sarà il valore di ritorno della system call.
-    int ret;
+    int64_t offset; //variabile che tiene traccia del numero di iterazione all'interno del ciclo che itera sui blocchi; sarà il valore di ritorno della system call.
+    long ret;
     unsigned long ulong_ret;    //serve specificatamente per la copy_from_user().
-    int new_first_valid;        //nuovo valore che dovrà assumere first_valid nel superblocco; sarà diverso dall'originale solo se quest'ultimo è pari a -1.
+    char *compressed;           //messaggio compresso (solo con l'opzione di montaggio "compress")
+    size_t compressed_len;
+    char *packed;               //payload del nuovo blocco impacchettato
+    uint16_t slot_flags;        //flag dello slot del messaggio impacchettato
+    int slot;
+    int reclaim;                //flag che indica se lo spazio dei messaggi invalidati dell'ultimo blocco può essere recuperato
+    int64_t new_first_valid;    //nuovo valore che dovrà assumere first_valid nel superblocco; sarà diverso dall'originale solo se quest'ultimo è pari a -1.
     struct onefilefs_sb_info *sb_disk;
-    struct data_block_metadata *db_meta;
-
-    //incremento del contatore atomico degli utilizzi del file system
-    atomic_fetch_add(1, &(au_info.usages));
+    struct data_block_metadata *tail_meta;
+    struct data_block_content *tail_cont;
+    struct packed_header *hdr;
+    uint64_t tail_seq;          //numero di sequenza dell'ultimo messaggio valido (0 se non ve ne sono)
 
     //sanity checks
     if (!au_info.is_mounted) {
         printk("%s: impossibile eseguire la system call put_data(): il file system non è stato montato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -ENODEV; //-ENODEV = file system non esistente
     }
     if (size > DEFAULT_BLOCK_SIZE-METADATA_SIZE) {
         printk("%s: impossibile eseguire la system call put_data(): la dimensione dei dati da scrivere eccede la dimensione di un blocco\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EINVAL; //-EINVAL = parametri non validi (in questo caso size_t size)
     }
     if (source == NULL) {
         printk("%s: impossibile eseguire la system call put_data(): non vi sono dati da scrivere\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EINVAL; //-EINVAL = parametri non validi (in questo caso size_t size e/o char *source)
     }
 
     kernel_lvl_src = kmalloc(size, GFP_KERNEL);
     if (!kernel_lvl_src) {
         printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con l'allocazione della memoria\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria         
     }
     ulong_ret = copy_from_user(kernel_lvl_src, source, (unsigned long)size);  //ulong_ret è il numero di byte NON copiati (su un massimo di size).
     bytes_to_write = size - (size_t)ulong_ret;    //il numero di byte da scrivere nel blocco è pari a size meno i residui di copy_from_user().
 
+    //con l'opzione di montaggio "compress" il messaggio viene memorizzato compresso con LZ4, se in questo modo occupa meno spazio.
+    //la compressione avviene prima di acquisire write_mutex, per non allungare la sezione critica degli scrittori.
+    if (au_info.compress) {
+        compressed_len = compress_message(kernel_lvl_src, bytes_to_write, &compressed);
+        if (compressed_len > 0) {
+            kfree(kernel_lvl_src);
+            kernel_lvl_src = compressed;
+            bytes_to_write = compressed_len;
+            flags |= BLOCK_COMPRESSED;
+        }
+    }
+
+    //con l'opzione di montaggio "pack" i messaggi brevi senza chiave vengono impacchettati: la compressione diventa un attributo dello slot.
+    packed = NULL;
+    slot_flags = 0;
+    if (au_info.pack && !(flags & BLOCK_KEYED) && bytes_to_write <= PACKED_MAX_MESSAGE) {
+        if (flags & BLOCK_COMPRESSED)
+            slot_flags = SLOT_COMPRESSED;
+        flags = (flags & ~BLOCK_COMPRESSED) | BLOCK_PACKED;
+    }
+
     //utilizzo di mutex per sincronizzare le scritture tra loro
     ret = mutex_trylock(&(au_info.write_mutex));
     if (ret == 0) {
         kfree(kernel_lvl_src);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EBUSY;
     }
     printk("%s: [put_data] mutex_lock correttamente acquisito\n", MOD_NAME);
@@ -94,65 +148,127 @@ asmlinkage int sys_put_data(char *source, size_t size)
     sb_disk = get_superblock_info(global_sb);
     if (sb_disk == NULL) {
         printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore col recupero dei dati del superblocco\n", MOD_NAME);
-        kfree(kernel_lvl_src);
-        mutex_unlock(&(au_info.write_mutex));
-        printk("%s: [put_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
-        return -EIO; //-EIO = errore di input/output
+        ret = -EIO; //-EIO = errore di input/output
+        goto put_out;
     }
 
-    //iterazione sui blocchi del dispositivo per cercare un blocco libero.
-    for(offset=0; offset<sb_disk->total_data_blocks; offset++) {
-
-        db_meta = get_block_metadata(global_sb, offset+2);  //il +2 è dato dal fatto che bisogna contare anche superblocco e inode del file.
-        if (db_meta == NULL) {
-            printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore col recupero dei metadati del blocco %d\n", MOD_NAME, offset);
-            kfree(kernel_lvl_src);
-            mutex_unlock(&(au_info.write_mutex));
-            printk("%s: [put_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
-            return -EIO; //-EIO = errore di input/output
+    //verifica dell'eventuale condizione sull'ultimo messaggio valido
+    if (cond) {
+        tail_seq = 0;
+        if (sb_disk->last_valid != -1 && last_message_of(global_sb, sb_disk->last_valid, &tail_seq) < 0) {
+            printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore col recupero dei metadati del blocco %lld\n", MOD_NAME, sb_disk->last_valid);
+            ret = -EIO; //-EIO = errore di input/output
+            goto put_out;
+        }
+        if (!condition_holds(cond, tail_seq, 0)) {
+            printk("%s: la system call put_data() non è stata eseguita: l'ultimo messaggio valido ha numero di sequenza %llu\n", MOD_NAME, tail_seq);
+            ret = -ECANCELED; //-ECANCELED = condizione non soddisfatta
+            goto put_out;
         }
+    }
 
-        if (!(db_meta->is_valid))   //sto cercando un blocco libero, ovvero un blocco non valido.
-            break;
+    //un messaggio da impacchettare viene accodato all'ultimo blocco della catena se è impacchettato, ha spazio e il suo ultimo slot è
+    //il messaggio scritto per ultimo (i numeri di sequenza degli slot di un blocco sono consecutivi). Il blocco resta al suo posto
+    //nella catena, per cui non serve attendere la fine del grace period: i lettori vedono il nuovo slot solo quando è completo.
+    if ((flags & BLOCK_PACKED) && sb_disk->last_valid != -1) {
+        tail_meta = get_block_metadata(global_sb, sb_disk->last_valid);
+        tail_cont = get_block_content(global_sb, sb_disk->last_valid);
+        if (tail_meta == NULL || tail_cont == NULL) {
+            printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore col recupero dei dati del blocco %lld\n", MOD_NAME, sb_disk->last_valid);
+            ret = -EIO; //-EIO = errore di input/output
+            goto put_out;
+        }
+        hdr = (struct packed_header *)tail_cont->payload;
+        //se il messaggio non trova posto solo a causa dei messaggi invalidati, il loro spazio viene recuperato: dopo un grace period
+        //nessun lettore può più leggerli, a meno che non li contenga uno snapshot (che non può essere creato, dato che write_mutex è acquisito).
+        if ((tail_meta->flags & BLOCK_PACKED) && tail_meta->seq + hdr->slots == au_info.next_seq && !packed_room(hdr, bytes_to_write) &&
+            packed_reclaimable(hdr, bytes_to_write)) {
+            mutex_lock(&(au_info.snap_mutex));
+            reclaim = list_empty(&(au_info.snapshots));
+            mutex_unlock(&(au_info.snap_mutex));
+            if (reclaim) {
+                synchronize_srcu(&(au_info.srcu));
+                if (reclaim_packed_space(global_sb, sb_disk->last_valid) < 0) {
+                    printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con la scrittura dei dati sul blocco %lld\n", MOD_NAME, sb_disk->last_valid);
+                    ret = -EIO; //-EIO = errore di input/output
+                    goto put_out;
+                }
+            }
+        }
+        if ((tail_meta->flags & BLOCK_PACKED) && tail_meta->seq + hdr->slots == au_info.next_seq && packed_room(hdr, bytes_to_write)) {
+            slot = add_packed_message(global_sb, sb_disk->last_valid, kernel_lvl_src, bytes_to_write, slot_flags);
+            if (slot < 0) {
+                printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con la scrittura dei dati sul blocco %lld\n", MOD_NAME, sb_disk->last_valid);
+                ret = -EIO; //-EIO = errore di input/output
+                goto put_out;
+            }
+            au_info.next_seq++;
+            au_info.valid_messages++;
+            printk("%s: la system call put_data() sullo slot %d del blocco %lld è stata eseguita con successo\n", MOD_NAME, slot, sb_disk->last_valid);
+            ret = origin_address(PACKED_ADDRESS(sb_disk->last_valid, slot));     //l'ultimo blocco può essere stato spostato dalla compattazione
+            goto put_out;
+        }
+    }
 
-        else if (db_meta->is_valid && offset==(sb_disk->total_data_blocks)-1) { //arrivo qui se nessun nodo è libero.
-            printk("%s: impossibile eseguire la system call put_data(): non ci sono blocchi liberi\n", MOD_NAME);
-            kfree(kernel_lvl_src);
-            mutex_unlock(&(au_info.write_mutex));
-            printk("%s: [put_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
-            return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    //il primo messaggio di un nuovo blocco impacchettato occupa il suo primo slot
+    if (flags & BLOCK_PACKED) {
+        packed = kmalloc(DEFAULT_BLOCK_SIZE-METADATA_SIZE, GFP_KERNEL);
+        if (!packed) {
+            printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con l'allocazione della memoria\n", MOD_NAME);
+            ret = -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+            goto put_out;
         }
+        init_packed_payload(packed, kernel_lvl_src, bytes_to_write, slot_flags);
+        kfree(kernel_lvl_src);
+        kernel_lvl_src = packed;
+        bytes_to_write += sizeof(struct packed_header);
+    }
+
+    //ricerca di un blocco libero sulla bitmap di allocazione in RAM (nessun accesso al dispositivo).
+    offset = find_free_block(global_sb, sb_disk->total_data_blocks);
+    if (offset < 0) {   //arrivo qui se nessun nodo è libero.
+        printk("%s: impossibile eseguire la system call put_data(): non ci sono blocchi liberi\n", MOD_NAME);
+        ret = -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        goto put_out;
+    }
 
+    //la chiave viene registrata prima di modificare il dispositivo: se è già in uso, la scrittura non avviene.
+    if (flags & BLOCK_KEYED) {
+        ret = insert_key(key, offset);
+        if (ret < 0) {
+            printk("%s: impossibile eseguire la system call put_data(): la chiave %llu è già in uso (o memoria esaurita)\n", MOD_NAME, key);
+            goto put_out;   //-EEXIST = chiave già associata a un messaggio valido
+        }
     }
 
     //attesa della fine del grace period
     synchronize_srcu(&(au_info.srcu));
 
-    //aggiornamento del campo next_valid del vecchio ultimo blocco valido
-    ret = set_block_metadata(global_sb, (sb_disk->last_valid)+2, offset, YES);
-    if (ret < 0) {
-        printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con la scrittura dei metadati sul blocco %llu\n", MOD_NAME, sb_disk->last_valid);
-        kfree(kernel_lvl_src);
-        mutex_unlock(&(au_info.write_mutex));
-        printk("%s: [put_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
-        return -EIO; //-EIO = errore di input/output        
+    //aggiornamento del campo next_valid del vecchio ultimo blocco valido (se esiste: con last_valid pari a -1 si finirebbe sull'inode del file)
+    if (sb_disk->last_valid != -1) {
+        ret = set_block_metadata(global_sb, sb_disk->last_valid, offset, YES);
+        if (ret < 0) {
+            printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con la scrittura dei metadati sul blocco %lld\n", MOD_NAME, sb_disk->last_valid);
+            ret = -EIO; //-EIO = errore di input/output
+            goto put_unkey;
+        }
     }
 
-    //scrittura del blocco target (metadati+payload)
-    ret = set_block_content(global_sb, offset+2, sb_disk->last_valid, kernel_lvl_src, bytes_to_write);
+    //scrittura del blocco target (metadati+payload), col prossimo numero di sequenza (un eventuale fallimento lascia solo un buco nella numerazione)
+    ret = set_block_content(global_sb, offset, sb_disk->last_valid, au_info.next_seq++, flags, key, kernel_lvl_src, bytes_to_write);
     if (ret < 0) {
-        printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con la scrittura dei dati sul blocco %d\n", MOD_NAME, offset);
-        kfree(kernel_lvl_src);
-        mutex_unlock(&(au_info.write_mutex));
-        printk("%s: [put_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
-        return -EIO; //-EIO = errore di input/output        
+        printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con la scrittura dei dati sul blocco %lld\n", MOD_NAME, offset);
+        ret = -EIO; //-EIO = errore di input/output
+        goto put_unkey;
     }
 
+    //aggiornamento dell'indice in RAM dei blocchi allocati (e delle eventuali mappature del file)
+    publish_block_state(global_sb, offset, YES);
+    au_info.valid_blocks++;
+    au_info.valid_messages++;
+    if (flags & BLOCK_KEYED)
+        au_info.keyed_blocks++;
+
     if (sb_disk->first_valid == -1) //se prima della put_data() non vi erano blocchi validi, allora first_valid deve essere settato nel superblocco.
         new_first_valid = offset;
     else                            //altrimenti first_valid resta invariato.
@@ -162,46 +278,48 @@ asmlinkage int sys_put_data(char *source, size_t size)
     ret = set_superblock_info(global_sb, new_first_valid, offset);
     if (ret < 0) {
         printk("%s: impossibile eseguire la system call put_data(): si è verificato un errore con la scrittura dei dati sul superblocco\n", MOD_NAME);
-        kfree(kernel_lvl_src);
-        mutex_unlock(&(au_info.write_mutex));
-        printk("%s: [put_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
-        return -EIO; //-EIO = errore di input/output        
+        ret = -EIO; //-EIO = errore di input/output
+        goto put_out;
     }
 
+    printk("%s: la system call put_data() sul blocco %lld è stata eseguita con successo\n", MOD_NAME, offset);
+    ret = (flags & BLOCK_PACKED) ? PACKED_ADDRESS(offset, 0) : offset;
+    goto put_out;
+
+put_unkey:
+    if (flags & BLOCK_KEYED)
+        remove_key(key, offset);
+put_out:
     //cleanup
-    printk("%s: la system call put_data() sul blocco %d è stata eseguita con successo\n", MOD_NAME, offset);
     kfree(kernel_lvl_src);
     mutex_unlock(&(au_info.write_mutex));
     printk("%s: [put_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-    atomic_fetch_add(-1, &(au_info.usages));
-    return offset;
+    return ret;
 
 }
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
-__SYSCALL_DEFINEx(3, _get_data, int, offset, char *, destination, size_t, size)
-#else
-asmlinkage int sys_get_data(int offset, char *destination, size_t size)
-#endif
-{   
+//questa funzione consegna all'utente (destination) al più size byte del messaggio di indirizzo address (vedi do_put_data()).
+//restituisce il numero di byte consegnati oppure un codice di errore negativo.
+static long do_get_data(int64_t address, char *destination, size_t size, uint32_t flags, uint64_t key) {
+
+    int64_t offset;                 //indice del data block del messaggio
+    int slot;                       //slot del messaggio (-1 = messaggio che occupa l'intero blocco)
     int srcu_idx;
     int lost_bytes_copy_to_user;    //numero di byte (tra quelli letti con kernel_read()) che non è stato possibile consegnare all'utente con copy_to_user()
+    unsigned int payload_seq;       //valore del seqcount del payload all'inizio della copia
+    int corrupted;                  //flag che indica se il payload non corrisponde al suo checksum (solo con l'opzione di montaggio "verify")
+    char *message;                  //messaggio decompresso (solo per i messaggi memorizzati compressi o impacchettati)
     struct onefilefs_sb_info *sb_disk;
     struct data_block_content *db_cont;
-
-    //incremento del contatore atomico degli utilizzi del file system
-    atomic_fetch_add(1, &(au_info.usages));
+    struct data_block_metadata *db_meta;
 
     //sanity checks (notare che il caso size>DEFAULT_BLOCK_SIZE-METADATA_SIZE viene accettato e omologato al caso size==DEFAULT_BLOCK_SIZE-METADATA_SIZE)
     if (!au_info.is_mounted) {
         printk("%s: impossibile eseguire la system call get_data(): il file system non è stato montato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -ENODEV; //-ENODEV = file system non esistente
     }
     if (destination == NULL) {
         printk("%s: impossibile eseguire la system call get_data(): non è stato specificato alcun buffer di destinazione\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EINVAL; //-EINVAL = parametri non validi (in questo caso char *destination)
     }
 
@@ -209,7 +327,9 @@ asmlinkage int sys_get_data(int offset, char *destination, size_t size)
         size = DEFAULT_BLOCK_SIZE-METADATA_SIZE;    //in tal modo si leggono esclusivamente i dati posti nel blocco
     }
 
-    //acquisizione della sleepable RCU read lock
+    //acquisizione della sleepable RCU read lock, mantenuta fino alla consegna del messaggio: la compattazione invalida il vecchio
+    //blocco di un messaggio spostato (e lo rende riutilizzabile) solo dopo un grace period, per cui il blocco trovato con
+    //resolve_address() all'interno della sezione non può cambiare contenuto durante la lettura.
     srcu_idx = srcu_read_lock(&(au_info.srcu));
     printk("%s: [get_data] srcu_read_lock correttamente acquisito\n", MOD_NAME);
 
@@ -219,62 +339,101 @@ asmlinkage int sys_get_data(int offset, char *destination, size_t size)
         printk("%s: impossibile eseguire la system call get_data(): si è verificato un errore col recupero dei dati del superblocco\n", MOD_NAME);
         srcu_read_unlock(&(au_info.srcu), srcu_idx);
         printk("%s: [get_data] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EIO; //-EIO = errore di input/output
     }
-    if (offset < 0 || offset >= sb_disk->total_data_blocks) {    //stiamo assumendo offset che vanno da 0 a NBLOCKS-1.
-        printk("%s: impossibile eseguire la system call get_data(): il blocco specificato (%d) non esiste\n", MOD_NAME, offset);
+
+get_resolve:
+    offset = split_address(resolve_address(address), &slot);     //il blocco del messaggio può essere stato spostato dalla compattazione
+    if (offset < 0 || (uint64_t)offset >= sb_disk->total_data_blocks || slot >= PACKED_MAX_SLOTS) {    //stiamo assumendo offset che vanno da 0 a NBLOCKS-1.
+        printk("%s: impossibile eseguire la system call get_data(): il messaggio specificato (%lld) non esiste\n", MOD_NAME, address);
         srcu_read_unlock(&(au_info.srcu), srcu_idx);
         printk("%s: [get_data] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EINVAL; //-EINVAL = parametri non validi (in questo caso int offset)
     }
 
-    //recupero del contenuto del blocco da leggere
-    db_cont = get_block_content(global_sb, offset+2);   //il +2 è dato dal fatto che bisogna contare anche superblocco e inode del file.
-    if (db_cont == NULL) {
-        printk("%s: impossibile eseguire la system call get_data(): si è verificato un errore col recupero dei dati del blocco %d\n", MOD_NAME, offset);
+    //recupero dei metadati e del contenuto del blocco da leggere (con la tabella dei metadati si trovano in due blocchi distinti)
+    db_meta = get_block_metadata(global_sb, offset);
+    db_cont = get_block_content(global_sb, offset);
+    if (db_meta == NULL || db_cont == NULL) {
+        printk("%s: impossibile eseguire la system call get_data(): si è verificato un errore col recupero dei dati del blocco %lld\n", MOD_NAME, offset);
         srcu_read_unlock(&(au_info.srcu), srcu_idx);
         printk("%s: [get_data] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EIO; //-EIO = errore di input/output
     }
+    printk("%s: lettura sul blocco %lld - next_valid=%lld - prev_valid=%lld - is_valid=%u - first_valid=%lld - last_valid=%lld\n", MOD_NAME, offset, db_meta->next_valid, db_meta->prev_valid, db_meta->is_valid, sb_disk->first_valid, sb_disk->last_valid);
+
+    //check sulla validità del messaggio target (e, per una lettura per chiave, sulla sua chiave)
+    if(!message_is_live(db_meta, db_cont, slot) || ((flags & BLOCK_KEYED) && (!(db_meta->flags & BLOCK_KEYED) || db_meta->key != key))) {
+        //se nel frattempo la compattazione ha spostato il blocco, il messaggio va cercato nella nuova posizione
+        if (ADDRESS_BLOCK(resolve_address(address)) != offset)
+            goto get_resolve;
+        printk("%s: impossibile eseguire la system call get_data(): il messaggio specificato (%lld) non è valido\n", MOD_NAME, address);
+        srcu_read_unlock(&(au_info.srcu), srcu_idx);
+        printk("%s: [get_data] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
+        return -ENODATA; //-ENODATA = nessun dato disponibile
+    }
+
+    //un messaggio memorizzato compresso o impacchettato viene prima estratto in un buffer di livello kernel
+    message = NULL;
+    if ((db_meta->flags & BLOCK_COMPRESSED) || slot >= 0) {
+        message = kmalloc(DEFAULT_BLOCK_SIZE-METADATA_SIZE, GFP_KERNEL);
+        if (!message) {
+            printk("%s: impossibile eseguire la system call get_data(): si è verificato un errore con l'allocazione della memoria\n", MOD_NAME);
+            srcu_read_unlock(&(au_info.srcu), srcu_idx);
+            printk("%s: [get_data] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
+            return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        }
+    }
+
+    //consegna dei dati all'utente, ripetuta se nel frattempo il payload è stato modificato in place (update_data(), append_data()).
+    //con l'opzione di montaggio "verify", un payload che non corrisponde al suo checksum non viene consegnato.
+    do {
+        payload_seq = read_seqcount_begin(payload_seqcount(offset));
+        corrupted = au_info.verify_on_read && !payload_intact(db_meta, db_cont);
+        if (!corrupted && message)
+            corrupted = read_message(db_meta, db_cont, slot, message) < 0;
+        else if (!corrupted)
+            lost_bytes_copy_to_user = copy_to_user(destination, &(db_cont->payload[0]), size);
+    } while (read_seqcount_retry(payload_seqcount(offset), payload_seq));
 
     //rilascio della sleepable RCU read lock
     srcu_read_unlock(&(au_info.srcu), srcu_idx);
     printk("%s: [get_data] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
-    printk("%s: lettura sul blocco %d - next_valid=%d - prev_valid=%d - is_valid=%d - first_valid=%lld - last_valid=%lld\n", MOD_NAME, offset, db_cont->metadata.next_valid, db_cont->metadata.prev_valid, db_cont->metadata.is_valid, sb_disk->first_valid, sb_disk->last_valid);
 
-    //check sulla validità del blocco target
-    if(!(db_cont->metadata.is_valid)) {
-        printk("%s: impossibile eseguire la system call get_data(): il blocco specificato (%d) non è valido\n", MOD_NAME, offset);
-        atomic_fetch_add(-1, &(au_info.usages));
-        return -ENODATA; //-ENODATA = nessun dato disponibile
+    if (corrupted) {
+        printk("%s: impossibile eseguire la system call get_data(): il messaggio %lld è danneggiato\n", MOD_NAME, address);
+        kfree(message);
+        return -EBADMSG; //-EBADMSG = messaggio corrotto
+    }
+    if (message) {
+        lost_bytes_copy_to_user = copy_to_user(destination, message, size);
+        kfree(message);
     }
 
-    //consegna dei dati all'utente
-    lost_bytes_copy_to_user = copy_to_user(destination, &(db_cont->payload[0]), size);
-
-    printk("%s: la system call get_data() sul blocco %d è stata eseguita con successo\n", MOD_NAME, offset);
-    atomic_fetch_add(-1, &(au_info.usages));
+    printk("%s: la system call get_data() sul messaggio %lld è stata eseguita con successo\n", MOD_NAME, address);
     return size - lost_bytes_copy_to_user;
 
 }
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
-__SYSCALL_DEFINEx(1, _invalidate_data, int, offset)
-#else
-asmlinkage int sys_invalidate_data(int offset)
-#endif
-{
+//questa funzione invalida il messaggio di indirizzo address (vedi do_put_data()): il suo data block viene tolto dalla catena dei
+//blocchi validi, a meno che non sia un blocco impacchettato che contiene altri messaggi validi (in tal caso si invalida solo lo slot).
+//restituisce 0 oppure un codice di errore negativo.
+static long do_invalidate_data(int64_t address, uint32_t flags, uint64_t key, const struct write_condition *cond) {
+
+    int64_t offset;         //indice del data block del messaggio
+    int slot;               //slot del messaggio (-1 = messaggio che occupa l'intero blocco)
     int ret;
     int superblock_to_set;  //booleano che indica se bisognerà aggiornare first_valid e/o last_valid nel superblocco
     int next_to_set;        //booleano che indica se bisognerà aggiornare prev_valid nel blocco successivo a quello da invalidare
     int prev_to_set;        //booleano che indica se bisognerà aggiornare next_valid nel blocco precedente a quello da invalidare
-    int new_first_valid;
-    int new_last_valid;
+    int64_t new_first_valid;
+    int64_t new_last_valid;
     struct onefilefs_sb_info *sb_disk;
     struct data_block_metadata *db_meta;
+    struct data_block_content *db_cont;
+    struct packed_header *hdr;
+    struct retained_block *retained;    //descrittore del messaggio, se deve essere trattenuto per qualche snapshot
+    uint64_t seq;
 
     superblock_to_set = NO;
     next_to_set = NO;
@@ -282,60 +441,98 @@ asmlinkage int sys_invalidate_data(int offset)
     new_first_valid = -1;
     new_last_valid = -1;
 
-    //incremento del contatore atomico degli utilizzi del file system
-    atomic_fetch_add(1, &(au_info.usages));
-
     //sanity checks
     if (!au_info.is_mounted) {
         printk("%s: impossibile eseguire la system call invalidate_data(): il file system non è stato montato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -ENODEV; //-ENODEV = file system non esistente
     }
 
     //utilizzo di mutex per sincronizzare le scritture tra loro (di fatto anche l'invalidazione risulta essere una scrittura nel device)
     ret = mutex_trylock(&(au_info.write_mutex));
     if (ret == 0) {
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EBUSY;
     }
     printk("%s: [invalidate_data] mutex_lock correttamente acquisito\n", MOD_NAME);
 
+    //l'indirizzo viene tradotto con write_mutex acquisito, per cui la compattazione non può spostare il blocco nel frattempo
+    address = resolve_address(address);
+    offset = split_address(address, &slot);
+
     //recupero dei dati memorizzati nel superblocco
     sb_disk = get_superblock_info(global_sb);
     if (sb_disk == NULL) {
         printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore col recupero dei dati del superblocco\n", MOD_NAME);
         mutex_unlock(&(au_info.write_mutex));
         printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EIO; //-EIO = errore di input/output
     }
-    if (offset < 0 || offset >= sb_disk->total_data_blocks) {   //stiamo assumendo offset che vanno da 0 a NBLOCKS-1
-        printk("%s: impossibile eseguire la system call invalidate_data(): il blocco specificato (%d) non esiste\n", MOD_NAME, offset);
+    if (offset < 0 || (uint64_t)offset >= sb_disk->total_data_blocks || slot >= PACKED_MAX_SLOTS) {   //stiamo assumendo offset che vanno da 0 a NBLOCKS-1
+        printk("%s: impossibile eseguire la system call invalidate_data(): il messaggio specificato (%lld) non esiste\n", MOD_NAME, address);
         mutex_unlock(&(au_info.write_mutex));
         printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EINVAL; //-EINVAL = parametri non validi (in questo caso int offset)
     }
 
-    //recupero dei metadati del blocco da leggere
-    db_meta = get_block_metadata(global_sb, offset+2);   //il +2 è dato dal fatto che bisogna contare anche superblocco e inode del file.
-    if (db_meta == NULL) {
-        printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore col recupero dei metadati del blocco %d\n", MOD_NAME, offset);
+    //recupero dei metadati e del contenuto (per la directory degli slot) del blocco da invalidare
+    db_meta = get_block_metadata(global_sb, offset);
+    db_cont = get_block_content(global_sb, offset);
+    if (db_meta == NULL || db_cont == NULL) {
+        printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore col recupero dei dati del blocco %lld\n", MOD_NAME, offset);
         mutex_unlock(&(au_info.write_mutex));
         printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EIO; //-EIO = errore di input/output
     }
 
-    //check sulla validità del blocco target
-    if (!(db_meta->is_valid)) {
-        printk("%s: impossibile eseguire la system call invalidate_data(): il blocco specificato (%d) è già invalido\n", MOD_NAME, offset);
+    //check sulla validità del messaggio target (e, per un'invalidazione per chiave, sulla sua chiave)
+    if (!message_is_live(db_meta, db_cont, slot) || ((flags & BLOCK_KEYED) && (!(db_meta->flags & BLOCK_KEYED) || db_meta->key != key))) {
+        printk("%s: impossibile eseguire la system call invalidate_data(): il messaggio specificato (%lld) è già invalido\n", MOD_NAME, address);
         mutex_unlock(&(au_info.write_mutex));
         printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -ENODATA; //-ENODATA = nessun dato disponibile
     }
 
+    //verifica dell'eventuale condizione sul messaggio da invalidare (gli slot di un blocco impacchettato hanno numeri di sequenza consecutivi)
+    seq = db_meta->seq + (slot >= 0 ? slot : 0);
+    if (!condition_holds(cond, seq, db_meta->version)) {
+        printk("%s: la system call invalidate_data() non è stata eseguita: l'indirizzo %lld contiene un messaggio diverso da quello atteso\n", MOD_NAME, address);
+        mutex_unlock(&(au_info.write_mutex));
+        printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
+        return -ECANCELED; //-ECANCELED = condizione non soddisfatta
+    }
+
+    //se il messaggio fa parte di qualche snapshot attivo, il blocco verrà trattenuto: il descrittore viene allocato prima di modificare il dispositivo.
+    retained = NULL;
+    if (seq && snapshot_contains(seq)) {
+        retained = kmalloc(sizeof(struct retained_block), GFP_KERNEL);
+        if (!retained) {
+            mutex_unlock(&(au_info.write_mutex));
+            printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
+            return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        }
+    }
+
+    //se il blocco impacchettato contiene altri messaggi validi, si invalida solo lo slot: il blocco resta nella catena e il contenuto
+    //dello slot resta intatto, per cui non serve attendere la fine del grace period.
+    hdr = (struct packed_header *)db_cont->payload;
+    if (slot >= 0 && hdr->live > 1) {
+        ret = invalidate_packed_slot(global_sb, offset, slot);
+        if (ret < 0) {
+            printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dello slot %d del blocco %lld\n", MOD_NAME, slot, offset);
+            kfree(retained);
+            mutex_unlock(&(au_info.write_mutex));
+            printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
+            return -EIO; //-EIO = errore di input/output
+        }
+        au_info.inval_epoch++;
+        if (retained)
+            retain_block(retained, address, seq);
+        au_info.valid_messages--;
+        printk("%s: la system call invalidate_data() sullo slot %d del blocco %lld è stata eseguita con successo\n", MOD_NAME, slot, offset);
+        mutex_unlock(&(au_info.write_mutex));
+        printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
+        return 0;
+    }
+
     //attesa della fine del grace period
     synchronize_srcu(&(au_info.srcu));
 
@@ -368,217 +565,1720 @@ asmlinkage int sys_invalidate_data(int offset)
     if (superblock_to_set == YES) {
         ret = set_superblock_info(global_sb, new_first_valid, new_last_valid);
         if (ret < 0) {
-            printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %d\n", MOD_NAME, offset);
+            printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %lld\n", MOD_NAME, offset);
+            kfree(retained);
             mutex_unlock(&(au_info.write_mutex));
             printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
             return -EIO; //-EIO = errore di input/output        
         }
 
     }
 
     if (prev_to_set == YES) {
-        ret = set_block_metadata(global_sb, (db_meta->prev_valid)+2, db_meta->next_valid, YES);
+        ret = set_block_metadata(global_sb, db_meta->prev_valid, db_meta->next_valid, YES);
         if (ret < 0) {
-            printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %d\n", MOD_NAME, offset);
+            printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %lld\n", MOD_NAME, offset);
+            kfree(retained);
             mutex_unlock(&(au_info.write_mutex));
             printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
             return -EIO; //-EIO = errore di input/output        
         }
 
     }
 
     if (next_to_set == YES) {
-        ret = set_block_metadata(global_sb, (db_meta->next_valid)+2, db_meta->prev_valid, NO);
+        ret = set_block_metadata(global_sb, db_meta->next_valid, db_meta->prev_valid, NO);
         if (ret < 0) {
-            printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %d\n", MOD_NAME, offset);
+            printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %lld\n", MOD_NAME, offset);
+            kfree(retained);
             mutex_unlock(&(au_info.write_mutex));
             printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
             return -EIO; //-EIO = errore di input/output        
         }
 
     }
 
+    //se il blocco è stato spostato dalla compattazione, il suo indice originario (la lapide BLOCK_MOVED) torna libero
+    ret = drop_relocation(global_sb, offset);
+    if (ret < 0) {
+        printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %lld\n", MOD_NAME, offset);
+        kfree(retained);
+        mutex_unlock(&(au_info.write_mutex));
+        printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
+        return -EIO; //-EIO = errore di input/output        
+    }
+
     //invalidazione del blocco (interessano in particolar modo solo i metadati)
-    ret = invalidate_block_content(global_sb, offset+2);    //il +2 è dato dal fatto che bisogna contare anche superblocco e inode del file.
+    ret = invalidate_block_content(global_sb, offset);
     if (ret < 0) {
-        printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %d\n", MOD_NAME, offset);
+        printk("%s: impossibile eseguire la system call invalidate_data(): si è verificato un errore con l'invalidazione dei dati sul blocco %lld\n", MOD_NAME, offset);
+        kfree(retained);
         mutex_unlock(&(au_info.write_mutex));
         printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
         return -EIO; //-EIO = errore di input/output        
     }
 
-    printk("%s: la system call invalidate_data() sul blocco %d è stata eseguita con successo\n", MOD_NAME, offset);
+    //aggiornamento dell'indice in RAM dei blocchi allocati: da qui in poi il blocco può essere riutilizzato da put_data()
+    //(se non è trattenuto per qualche snapshot) e il suo payload non è più visibile attraverso le mappature del file.
+    au_info.inval_epoch++;
+    if (retained)
+        retain_block(retained, address, seq);
+    publish_block_state(global_sb, offset, NO);
+    au_info.valid_blocks--;
+    au_info.valid_messages--;
+    //la chiave del messaggio invalidato torna disponibile
+    if (db_meta->flags & BLOCK_KEYED) {
+        remove_key(db_meta->key, offset);
+        au_info.keyed_blocks--;
+    }
+
+    printk("%s: la system call invalidate_data() sul blocco %lld è stata eseguita con successo\n", MOD_NAME, offset);
     mutex_unlock(&(au_info.write_mutex));
     printk("%s: [invalidate_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
-    atomic_fetch_add(-1, &(au_info.usages));
     return 0;
 
 }
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
-long sys_put_data = (unsigned long) __x64_sys_put_data;
-long sys_get_data = (unsigned long) __x64_sys_get_data;
-long sys_invalidate_data = (unsigned long) __x64_sys_invalidate_data;
-#endif
-
-//FILE OPERATIONS
-static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
-static int dev_open(struct inode *, struct file *);
-static int dev_release(struct inode *, struct file *);
-
-//la dev_read() legge i dati dal blocco del dispositivo corrispondente alla posizione indicata dall'offset off.
-static ssize_t dev_read(struct file *filp, char *buf, size_t len, loff_t *off) {
-
-    struct inode *the_inode;
-    uint64_t file_size;
-    int ret;
-    int block_to_read;  //index of the block to be read from device
-
-    //qui iniziano le variabili definite da me
+//modalità di do_update_data()
+#define UPDATE_REPLACE 0x0      //il payload viene sostituito dai nuovi dati
+#define UPDATE_APPEND 0x1       //i nuovi dati vengono accodati al messaggio (dopo la sua lunghezza, vedi payload_length())
+#define UPDATE_TO_TAIL 0x2      //il messaggio viene spostato in fondo alla catena, con un nuovo numero di sequenza
+
+//questa funzione modifica in place il payload del data block valido di indice offset, secondo mode (vedi sopra).
+//collegamenti e numero di sequenza cambiano solo con UPDATE_TO_TAIL, ovvero quando cambia l'ordine dei messaggi. I messaggi
+//impacchettati non possono essere modificati (lo slot non ha spazio per crescere). Restituisce la nuova
+//lunghezza del payload oppure un codice di errore negativo.
+static long do_update_data(int64_t address, char *source, size_t size, int mode, const struct write_condition *cond) {
+
+    int64_t offset;             //indice del data block del messaggio
+    int slot;                   //slot del messaggio (-1 = messaggio che occupa l'intero blocco)
+    char *kernel_lvl_src;       //buffer di livello kernel (inizializzato con una copy_from_user()) in cui verranno posti i nuovi dati
+    size_t bytes_to_write;
+    size_t pos;                 //posizione del payload da cui vengono scritti i nuovi dati
+    char *message;              //messaggio decompresso (solo per accodare dati a un messaggio memorizzato compresso)
+    long ret;
+    int64_t prev;
+    int64_t next;
+    int64_t last;
+    int64_t new_first_valid;
     struct onefilefs_sb_info *sb_disk;
+    struct data_block_metadata *db_meta;
     struct data_block_content *db_cont;
-    char *read_data;
-    int srcu_idx;
-
-    //incremento del contatore atomico degli utilizzi del file system
-    atomic_fetch_add(1, &(au_info.usages));
-
-    the_inode = filp->f_inode;
-    file_size = the_inode->i_size;
-    db_cont = NULL;
-
-    printk("%s: read operation called with len %ld\n", MOD_NAME, len);
 
-    //sanity check
+    //sanity checks
     if (!au_info.is_mounted) {
-        printk("%s: impossibile leggere il dispositivo: il file system non è stato montato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
+        printk("%s: impossibile eseguire la system call update_data(): il file system non è stato montato\n", MOD_NAME);
         return -ENODEV; //-ENODEV = file system non esistente
     }
+    if (size > DEFAULT_BLOCK_SIZE-METADATA_SIZE) {
+        printk("%s: impossibile eseguire la system call update_data(): la dimensione dei dati da scrivere eccede la dimensione di un blocco\n", MOD_NAME);
+        return -EINVAL; //-EINVAL = parametri non validi (in questo caso size_t size)
+    }
+    if (source == NULL) {
+        printk("%s: impossibile eseguire la system call update_data(): non vi sono dati da scrivere\n", MOD_NAME);
+        return -EINVAL; //-EINVAL = parametri non validi (in questo caso char *source)
+    }
 
-    if (is_first_call == YES) {    //caso in cui la lettura deve ancora iniziare
-        //blocco off_mutex, il quale mi serve per bloccare anche gli accessi a is_first_call, is_last_call e *off.
-        ret = mutex_trylock(&(au_info.off_mutex));
-        if (ret == 0) {
-            atomic_fetch_add(-1, &(au_info.usages));
-            return -EBUSY;
-        }
-        printk("%s: [dev_read] mutex_lock correttamente acquisito\n", MOD_NAME);
+    message = NULL;
+    kernel_lvl_src = kmalloc(size ? size : 1, GFP_KERNEL);
+    if (!kernel_lvl_src) {
+        printk("%s: impossibile eseguire la system call update_data(): si è verificato un errore con l'allocazione della memoria\n", MOD_NAME);
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    }
+    bytes_to_write = size - (size_t)copy_from_user(kernel_lvl_src, source, (unsigned long)size);
+
+    //utilizzo di mutex per sincronizzare le scritture tra loro
+    ret = mutex_trylock(&(au_info.write_mutex));
+    if (ret == 0) {
+        kfree(kernel_lvl_src);
+        return -EBUSY;
+    }
+    printk("%s: [update_data] mutex_lock correttamente acquisito\n", MOD_NAME);
 
-        //acquisizione della sleepable RCU read lock
-        srcu_idx = srcu_read_lock(&(au_info.srcu));
-        printk("%s: [dev_read] srcu_read_lock correttamente acquisito\n", MOD_NAME);
+    //l'indirizzo viene tradotto con write_mutex acquisito, per cui la compattazione non può spostare il blocco nel frattempo
+    address = resolve_address(address);
+    offset = split_address(address, &slot);
 
-        //recupero il superblocco perché mi serve per ottenere il primo blocco valido.
-        sb_disk = get_superblock_info(filp->f_path.dentry->d_inode->i_sb);
-        if (sb_disk == NULL) {
-            printk("%s: impossibile leggere il dispositivo: si è verificato un errore col recupero dei dati del superblocco\n", MOD_NAME);
-            srcu_read_unlock(&(au_info.srcu), srcu_idx);
-            mutex_unlock(&(au_info.off_mutex));
-            printk("%s: [dev_read] srcu_read_lock e mutex_lock correttamente rilasciati\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
-            return -EIO; //-EIO = errore di input/output
-        }
+    //recupero dei dati memorizzati nel superblocco
+    sb_disk = get_superblock_info(global_sb);
+    if (sb_disk == NULL) {
+        printk("%s: impossibile eseguire la system call update_data(): si è verificato un errore col recupero dei dati del superblocco\n", MOD_NAME);
+        ret = -EIO; //-EIO = errore di input/output
+        goto update_out;
+    }
+    if (offset < 0 || (uint64_t)offset >= sb_disk->total_data_blocks || slot >= PACKED_MAX_SLOTS) {   //stiamo assumendo offset che vanno da 0 a NBLOCKS-1
+        printk("%s: impossibile eseguire la system call update_data(): il messaggio specificato (%lld) non esiste\n", MOD_NAME, address);
+        ret = -EINVAL; //-EINVAL = parametri non validi (in questo caso int offset)
+        goto update_out;
+    }
 
-        //rilascio della sleepable RCU read lock
-        srcu_read_unlock(&(au_info.srcu), srcu_idx);
-        printk("%s: [dev_read] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
+    //recupero dei metadati e del contenuto del blocco da modificare
+    db_meta = get_block_metadata(global_sb, offset);
+    db_cont = get_block_content(global_sb, offset);
+    if (db_meta == NULL || db_cont == NULL) {
+        printk("%s: impossibile eseguire la system call update_data(): si è verificato un errore col recupero dei dati del blocco %lld\n", MOD_NAME, offset);
+        ret = -EIO; //-EIO = errore di input/output
+        goto update_out;
+    }
+    if (!message_is_live(db_meta, db_cont, slot)) {
+        printk("%s: impossibile eseguire la system call update_data(): il messaggio specificato (%lld) non è valido\n", MOD_NAME, address);
+        ret = -ENODATA; //-ENODATA = nessun dato disponibile
+        goto update_out;
+    }
+    if (slot >= 0) {
+        printk("%s: impossibile eseguire la system call update_data(): il messaggio %lld è impacchettato\n", MOD_NAME, address);
+        ret = -EOPNOTSUPP; //-EOPNOTSUPP = operazione non supportata
+        goto update_out;
+    }
+    //verifica dell'eventuale condizione sul messaggio da modificare
+    if (!condition_holds(cond, db_meta->seq, db_meta->version)) {
+        printk("%s: la system call update_data() non è stata eseguita: il blocco %lld contiene un messaggio diverso da quello atteso\n", MOD_NAME, offset);
+        ret = -ECANCELED; //-ECANCELED = condizione non soddisfatta
+        goto update_out;
+    }
+    //gli snapshot leggono il payload direttamente dal blocco: un messaggio che fa parte di uno snapshot attivo non può cambiare.
+    if (db_meta->seq && snapshot_contains(db_meta->seq)) {
+        printk("%s: impossibile eseguire la system call update_data(): il blocco %lld fa parte di uno snapshot attivo\n", MOD_NAME, offset);
+        ret = -ETXTBSY; //-ETXTBSY = risorsa in uso
+        goto update_out;
+    }
 
-        //controllo se c'è almeno un blocco da leggere. Se non c'è, imposto a YES is_last_call.
-        if (sb_disk->first_valid != -1) {
-            *off = (loff_t)(sb_disk->first_valid * DEFAULT_BLOCK_SIZE); //ora *off indica il primo blocco da leggere.
+    //con UPDATE_APPEND i nuovi dati vengono scritti dopo il payload attuale, che deve poterli contenere. Un messaggio memorizzato
+    //compresso viene prima decompresso: il messaggio esteso viene riscritto per intero (non compresso) a partire dall'inizio del payload.
+    if ((mode & UPDATE_APPEND) && (db_meta->flags & BLOCK_COMPRESSED)) {
+        message = kmalloc(DEFAULT_BLOCK_SIZE-METADATA_SIZE, GFP_KERNEL);
+        if (!message) {
+            ret = -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+            goto update_out;
         }
-        else {
-            *off = (loff_t)file_size;
-            is_last_call = YES;
+        ret = read_message(db_meta, db_cont, -1, message);
+        if (ret < 0) {
+            printk("%s: impossibile eseguire la system call append_data(): il payload del blocco %lld è danneggiato\n", MOD_NAME, offset);
+            ret = -EBADMSG; //-EBADMSG = messaggio corrotto
+            goto update_out;
         }
+        pos = ret;
+    }
+    else
+        pos = (mode & UPDATE_APPEND) ? payload_length(db_meta, db_cont->payload) : 0;
+    if (pos + bytes_to_write > DEFAULT_BLOCK_SIZE-METADATA_SIZE) {
+        printk("%s: impossibile eseguire la system call append_data(): il blocco %lld non può contenere altri %zu byte\n", MOD_NAME, offset, bytes_to_write);
+        ret = -EFBIG; //-EFBIG = dimensione massima del messaggio superata
+        goto update_out;
+    }
 
-        is_first_call = NO;
+    //spostamento del messaggio in fondo alla catena, come se fosse stato appena scritto con put_data()
+    if (mode & UPDATE_TO_TAIL) {
+        prev = db_meta->prev_valid;
+        next = db_meta->next_valid;
+        last = sb_disk->last_valid;
+        new_first_valid = sb_disk->first_valid;
+        ret = 0;
+
+        //attesa della fine del grace period
+        synchronize_srcu(&(au_info.srcu));
+
+        if (offset != last) {   //se il blocco è già l'ultimo, cambia solo il numero di sequenza
+            //distacco del blocco dalla posizione corrente (next esiste, dato che il blocco non è l'ultimo)
+            if (prev != -1)
+                ret = set_block_metadata(global_sb, prev, next, YES);
+            else
+                new_first_valid = next;
+            if (ret == 0)
+                ret = set_block_metadata(global_sb, next, prev, NO);
+            //aggancio in coda
+            if (ret == 0)
+                ret = set_block_metadata(global_sb, last, offset, YES);
+            prev = last;
+        }
+        if (ret == 0)
+            ret = set_block_links(global_sb, offset, prev, -1, au_info.next_seq++);
+        if (ret == 0)
+            ret = set_superblock_info(global_sb, new_first_valid, offset);
+        if (ret < 0) {
+            printk("%s: impossibile eseguire la system call update_data(): si è verificato un errore con lo spostamento del blocco %lld\n", MOD_NAME, offset);
+            ret = -EIO; //-EIO = errore di input/output
+            goto update_out;
+        }
+    }
 
+    //scrittura del payload (i lettori concorrenti vedono la versione precedente oppure quella nuova, vedi set_block_payload()).
+    //avviene per ultima: se lo spostamento in fondo alla catena fallisce, il messaggio conserva il contenuto precedente.
+    if (message) {
+        memcpy(message + pos, kernel_lvl_src, bytes_to_write);
+        ret = set_block_payload(global_sb, offset, 0, message, pos + bytes_to_write);
+    }
+    else
+        ret = set_block_payload(global_sb, offset, pos, kernel_lvl_src, bytes_to_write);
+    if (ret < 0) {
+        printk("%s: impossibile eseguire la system call update_data(): si è verificato un errore con la scrittura dei dati sul blocco %lld\n", MOD_NAME, offset);
+        ret = -EIO; //-EIO = errore di input/output
+        goto update_out;
     }
 
-    if (is_last_call == NO) {   //caso in cui ci sono ancora dei dati da leggere   
+    printk("%s: la system call update_data() sul blocco %lld è stata eseguita con successo\n", MOD_NAME, offset);
+    ret = pos + bytes_to_write;
 
-        if (len == 0) {
-            printk("%s: len == 0: nothing to do\n", MOD_NAME);
-            is_first_call = YES;
-            mutex_unlock(&(au_info.off_mutex));
-            printk("%s: [dev_read] mutex_lock correttamente rilasciato\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
-            return 0;
-        }
-        else if (len + METADATA_SIZE > DEFAULT_BLOCK_SIZE)           
-            len = DEFAULT_BLOCK_SIZE - METADATA_SIZE;  //il numero di byte da leggere a ogni iterazione è al più pari al numero di byte di payload di un singolo blocco.
-        
-        block_to_read = (*off / DEFAULT_BLOCK_SIZE) + 2; //the value 2 accounts for superblock and file-inode on device.
-        printk("%s: read operation must access block %d of the device", MOD_NAME, block_to_read-2);
-
-        //acquisizione della sleepable RCU read lock
-        srcu_idx = srcu_read_lock(&(au_info.srcu));
-        printk("%s: [dev_read] srcu_read_lock correttamente acquisito\n", MOD_NAME);
-
-        //acquisizione del contenuto del blocco da leggere (quello di cui abbiamo appena calcolato l'indice).
-        db_cont = get_block_content(filp->f_path.dentry->d_inode->i_sb, block_to_read);
-        if(!db_cont){
-            printk("%s: impossibile leggere il dispositivo: si è verificato un errore con la lettura del blocco %d\n", MOD_NAME, block_to_read);
-            is_first_call = YES;
-            srcu_read_unlock(&(au_info.srcu), srcu_idx);
-            mutex_unlock(&(au_info.off_mutex));
-            printk("%s: [dev_read] srcu_read_lock e mutex_lock correttamente rilasciati\n", MOD_NAME);
-            atomic_fetch_add(-1, &(au_info.usages));
-	        return -EIO;
-        }
+update_out:
+    //cleanup
+    kfree(message);
+    kfree(kernel_lvl_src);
+    mutex_unlock(&(au_info.write_mutex));
+    printk("%s: [update_data] mutex_lock correttamente rilasciato\n", MOD_NAME);
+    return ret;
 
-        //rilascio della sleepable RCU read lock
-        srcu_read_unlock(&(au_info.srcu), srcu_idx);
-        printk("%s: [dev_read] srcu_read_lock correttamente rilasciato\n", MOD_NAME);
+}
 
-        read_data = &(db_cont->payload[0]); //l'offset da cui far partire ciascuna lettura di un singolo blocco deve corrispondere alla fine dei metadati.
-        //ora si copiano i dati dal buffer del kernel (db_cont+METADATA_SIZE) al buffer dell'applicazione (buf), passato come parametro a onefilefs_read().
-        ret = copy_to_user(buf, read_data, len);
+/* COMPATTAZIONE
+ * Con l'opzione di montaggio "compact" un kthread sposta periodicamente i blocchi validi in modo che blocchi consecutivi nella
+ * catena occupino posizioni consecutive del dispositivo: una lettura completa nell'ordine delle scritture (dev_read(), le scansioni
+ * delle ioctl, singlefileexport) diventa così una lettura sequenziale. Un blocco viene spostato nella posizione che segue quella del
+ * suo predecessore nella catena, se è libera; l'indice originario del messaggio resta riservato e viene tradotto in quello attuale
+ * (resolve_address()) finché il messaggio non viene invalidato, per cui gli indirizzi già restituiti da put_data() restano validi.
+ * La tabella di traduzione è resa persistente dalle lapidi: il blocco dell'indice originario resta non valido con il flag BLOCK_MOVED
+ * e next_valid che indica la posizione attuale, da cui il montaggio successivo ricostruisce la tabella. Un blocco già spostato può
+ * essere spostato di nuovo (si aggiornano la voce della tabella e la lapide, senza riservare altri indici) e, se torna nella sua
+ * posizione originaria, la voce e la lapide scompaiono. Non vengono spostati l'ultimo blocco della catena (a cui put_data() accoda i
+ * messaggi impacchettati) e quelli trattenuti per uno snapshot; mentre esiste uno snapshot la compattazione è sospesa, dato che le
+ * letture attraverso lo snapshot non verificano il contenuto dei blocchi.
+ */
 
-        //controllo se c'è ancora un blocco successivo da leggere. Se non c'è, imposto a YES is_last_call.
-        if (db_cont->metadata.next_valid != -1) {
-            *off = (loff_t)(db_cont->metadata.next_valid * DEFAULT_BLOCK_SIZE); //ora *off indica il prossimo blocco da leggere.
-        }
-        else {
-            *off = (loff_t)file_size;
-            is_last_call = YES;
-        }
+//questa funzione sposta il data block valido di indice from, che non è l'ultimo della catena, nel data block libero di indice to
+//(deve essere invocata con write_mutex acquisito). Restituisce 0 oppure un codice di errore negativo.
+static int relocate_block(struct onefilefs_sb_info *sb_disk, int64_t from, int64_t to) {
 
-        printk("%s: block %d successfully read\n", MOD_NAME, block_to_read-2);
-        atomic_fetch_add(-1, &(au_info.usages));       
-        return len-ret;
+    struct data_block_metadata *db_meta;
+    void *entry;
+    int64_t origin;     //indice originario del messaggio (quello degli indirizzi restituiti da put_data())
+    int64_t prev;
+    int64_t next;
+    uint32_t flags;
+    uint64_t key;
+    int ret;
 
+    db_meta = get_block_metadata(global_sb, from);
+    if (db_meta == NULL)
+        return -EIO;    //-EIO = errore di input/output
+    prev = db_meta->prev_valid;
+    next = db_meta->next_valid;
+    flags = db_meta->flags;
+    key = db_meta->key;
+    entry = xa_load(&(au_info.relocated), from);
+    origin = entry ? (int64_t)xa_to_value(entry) : from;
+
+    //le voci della tabella di traduzione vengono allocate prima di modificare il dispositivo (un blocco già spostato ha già la sua
+    //voce in remap; se torna nella posizione originaria non serve alcuna voce)
+    if (origin == from && xa_reserve(&(au_info.remap), from, GFP_KERNEL) < 0)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    if (origin != to && xa_reserve(&(au_info.relocated), to, GFP_KERNEL) < 0) {
+        if (origin == from)
+            xa_release(&(au_info.remap), from);
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
     }
-    else {  //caso in cui la lettura è stata completata
-        printk("%s: read operation completed\n", MOD_NAME);
-        is_first_call = YES;
-        is_last_call = NO;
-        mutex_unlock(&(au_info.off_mutex));
-        printk("%s: [dev_read] mutex_lock correttamente rilasciato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
-        return 0;
 
+    //copia del blocco nella nuova posizione, che prende il posto della vecchia nella catena: i collegamenti del vecchio blocco restano
+    //invariati, per cui un lettore che lo sta attraversando prosegue regolarmente lungo la catena.
+    ret = copy_block(global_sb, from, to);
+    if (ret == 0)
+        ret = set_block_metadata(global_sb, next, to, NO);
+    if (ret == 0)
+        ret = (prev != -1) ? set_block_metadata(global_sb, prev, to, YES) : set_superblock_info(global_sb, to, sb_disk->last_valid);
+    if (ret < 0) {
+        if (origin != to)
+            xa_release(&(au_info.relocated), to);
+        if (origin == from)
+            xa_release(&(au_info.remap), from);
+        return -EIO;    //-EIO = errore di input/output
+    }
+    publish_block_state(global_sb, to, YES);
+    if (origin == to) {
+        xa_erase(&(au_info.remap), origin);
+        au_info.relocated_blocks--;
+    }
+    else {
+        xa_store(&(au_info.remap), origin, xa_mk_value(to), GFP_KERNEL);
+        xa_store(&(au_info.relocated), to, xa_mk_value(origin), GFP_KERNEL);
+        if (origin == from)
+            au_info.relocated_blocks++;
+    }
+    if (flags & BLOCK_KEYED)
+        move_key(key, from, to);
+
+    //attesa della fine del grace period prima di invalidare il vecchio blocco, come in invalidate_data(): un cursore di lettura rimasto
+    //sul vecchio blocco lo trova invalido e ritrova il messaggio nella nuova posizione (cursor_resolve()). Il blocco dell'indice
+    //originario diventa (o resta) la lapide che punta alla nuova posizione, a meno che il messaggio non vi sia appena tornato
+    //(copy_block() ha già sovrascritto la lapide); un blocco intermedio torna invece libero. Anche la voce di from in relocated viene
+    //rimossa solo ora, perché fino alla fine del grace period un lettore può tradurre from nell'indirizzo originario (origin_address()).
+    synchronize_srcu(&(au_info.srcu));
+    if (origin != from) {
+        xa_erase(&(au_info.relocated), from);
+        ret = invalidate_block_content(global_sb, from);
     }
+    if (origin != to && ret == 0)
+        ret = set_block_forward(global_sb, origin, to);
+    publish_block_state(global_sb, from, NO);
+    return (ret < 0) ? -EIO : 0;    //-EIO = errore di input/output
 
 }
 
-//la dev_open() apre il dispositivo (deve farlo in modalità di sola scrittura).
-static int dev_open(struct inode *inode, struct file *file) {
+//questa funzione esegue una passata della compattazione: percorre al più COMPACT_SCAN_BLOCKS blocchi della catena, a partire da
+//quello in cui si era fermata la passata precedente, e ne sposta al più COMPACT_BATCH. Restituisce il numero di blocchi spostati.
+static long compact_chain(void) {
 
-    //incremento del contatore atomico degli utilizzi del file system
-    atomic_fetch_add(1, &(au_info.usages));
+    struct onefilefs_sb_info *sb_disk;
+    struct data_block_metadata *db_meta;
+    int64_t curr;
+    int64_t next;
+    int64_t target;     //posizione che segue quella del blocco precedente nella catena (-1 = nessuna)
+    uint64_t seq;
+    uint64_t scanned;
+    long moved;
+    int idle;
+
+    //gli scrittori hanno la precedenza: se write_mutex è occupato, si riprova alla passata successiva
+    if (!mutex_trylock(&(au_info.write_mutex)))
+        return 0;
+    mutex_lock(&(au_info.snap_mutex));
+    idle = !list_empty(&(au_info.snapshots));
+    mutex_unlock(&(au_info.snap_mutex));
+    moved = 0;
+    sb_disk = get_superblock_info(global_sb);
+    if (idle || sb_disk == NULL || sb_disk->first_valid == -1)
+        goto compact_out;
+
+    //ripresa dal blocco in cui si era fermata la passata precedente, se contiene ancora lo stesso messaggio
+    curr = sb_disk->first_valid;
+    target = -1;
+    if (au_info.compact_block != -1) {
+        db_meta = get_block_metadata(global_sb, au_info.compact_block);
+        if (db_meta != NULL && db_meta->is_valid && db_meta->seq == au_info.compact_seq) {
+            curr = db_meta->next_valid;
+            target = au_info.compact_block + 1;
+        }
+    }
 
-    //sanity checks
-    if (!au_info.is_mounted) {
-        printk("%s: impossibile aprire il dispositivo: il file system non è stato montato\n", MOD_NAME);
-        atomic_fetch_add(-1, &(au_info.usages));
-        return -ENODEV; //-ENODEV = file system non esistente
+    for(scanned=0; curr!=-1 && scanned<COMPACT_SCAN_BLOCKS && moved<COMPACT_BATCH; scanned++) {
+        db_meta = get_block_metadata(global_sb, curr);
+        if (db_meta == NULL)
+            break;
+        next = db_meta->next_valid;
+        seq = db_meta->seq;
+        if (target != -1 && curr != target && curr != sb_disk->last_valid && (uint64_t)target < au_info.total_data_blocks &&
+            !test_bit(curr, au_info.retained_bitmap) && !test_bit(target, au_info.valid_bitmap) && !test_bit(target, au_info.retained_bitmap) &&
+            //la lapide di un altro messaggio non è libera, quella del messaggio stesso sì (il messaggio torna nella posizione originaria)
+            (!xa_load(&(au_info.remap), target) || xa_load(&(au_info.relocated), curr) == xa_mk_value(target)) &&
+            //gli indici originari riservati non possono sottrarre a put_data() più di una parte dei blocchi non validi: oltre questa
+            //soglia vengono spostati soltanto i blocchi già spostati, che non riservano altri indici
+            (xa_load(&(au_info.relocated), curr) || au_info.relocated_blocks < (au_info.total_data_blocks - au_info.valid_blocks) / COMPACT_RESERVE_SHARE)) {
+            if (relocate_block(sb_disk, curr, target) < 0) {
+                printk("%s: la compattazione non è riuscita a spostare il blocco %lld nel blocco %lld\n", MOD_NAME, curr, target);
+                break;
+            }
+            curr = target;
+            moved++;
+        }
+        au_info.compact_block = curr;
+        au_info.compact_seq = seq;
+        target = curr + 1;
+        curr = next;
+    }
+    if (curr == -1)     //catena percorsa per intero: la passata successiva riparte da first_valid
+        au_info.compact_block = -1;
+
+compact_out:
+    mutex_unlock(&(au_info.write_mutex));
+    return moved;
+
+}
+
+//corpo del kthread di compattazione, avviato al montaggio con l'opzione "compact" e fermato allo smontaggio.
+int compaction_thread(void *data) {
+
+    long moved;
+
+    while (!kthread_should_stop()) {
+        schedule_timeout_interruptible(msecs_to_jiffies(COMPACT_INTERVAL_MS));
+        if (kthread_should_stop())
+            break;
+        moved = compact_chain();
+        if (moved > 0)
+            printk("%s: la compattazione ha spostato %ld blocchi (%llu blocchi spostati in tutto)\n", MOD_NAME, moved, au_info.relocated_blocks);
+    }
+    return 0;
+
+}
+
+//SYSTEM CALLS
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(2, _put_data, char *, source, size_t, size)
+#else
+asmlinkage long sys_put_data(char *source, size_t size)
+#endif
+{
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_put_data(source, size, 0, 0, NULL);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(3, _get_data, long, offset, char *, destination, size_t, size)
+#else
+asmlinkage long sys_get_data(long offset, char *destination, size_t size)
+#endif
+{
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_get_data(offset, destination, size, 0, 0);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(1, _invalidate_data, long, offset)
+#else
+asmlinkage long sys_invalidate_data(long offset)
+#endif
+{
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_invalidate_data(offset, 0, 0, NULL);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//put_keyed_data() scrive il messaggio con la chiave key, che non deve essere già associata a un messaggio valido (-EEXIST).
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(3, _put_keyed_data, uint64_t, key, char *, source, size_t, size)
+#else
+asmlinkage long sys_put_keyed_data(uint64_t key, char *source, size_t size)
+#endif
+{
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_put_data(source, size, BLOCK_KEYED, key, NULL);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//get_data_by_key() è l'equivalente di get_data() per il messaggio con chiave key (il blocco viene individuato con l'indice delle chiavi).
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(3, _get_data_by_key, uint64_t, key, char *, destination, size_t, size)
+#else
+asmlinkage long sys_get_data_by_key(uint64_t key, char *destination, size_t size)
+#endif
+{
+    int64_t offset;
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    offset = au_info.is_mounted ? lookup_key(key) : 0;
+    if (offset < 0) {
+        printk("%s: impossibile eseguire la system call get_data_by_key(): la chiave %llu non è associata ad alcun messaggio\n", MOD_NAME, key);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODATA; //-ENODATA = nessun dato disponibile
+    }
+    ret = do_get_data(offset, destination, size, BLOCK_KEYED, key);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//invalidate_data_by_key() è l'equivalente di invalidate_data() per il messaggio con chiave key.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(1, _invalidate_data_by_key, uint64_t, key)
+#else
+asmlinkage long sys_invalidate_data_by_key(uint64_t key)
+#endif
+{
+    int64_t offset;
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    offset = au_info.is_mounted ? lookup_key(key) : 0;
+    if (offset < 0) {
+        printk("%s: impossibile eseguire la system call invalidate_data_by_key(): la chiave %llu non è associata ad alcun messaggio\n", MOD_NAME, key);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODATA; //-ENODATA = nessun dato disponibile
+    }
+    ret = do_invalidate_data(offset, BLOCK_KEYED, key, NULL);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//update_data() sostituisce il payload del messaggio valido del blocco offset; con keep_order pari a 0 il messaggio viene anche
+//spostato in fondo all'ordine delle scritture. Restituisce la nuova lunghezza del payload.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(4, _update_data, long, offset, char *, source, size_t, size, int, keep_order)
+#else
+asmlinkage long sys_update_data(long offset, char *source, size_t size, int keep_order)
+#endif
+{
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_update_data(offset, source, size, keep_order ? UPDATE_REPLACE : UPDATE_TO_TAIL, NULL);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//append_data() accoda size byte al payload del messaggio valido del blocco offset, senza cambiarne la posizione nell'ordine delle
+//scritture. Restituisce la nuova lunghezza del payload (-EFBIG se il blocco non può contenere i nuovi dati).
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(3, _append_data, long, offset, char *, source, size_t, size)
+#else
+asmlinkage long sys_append_data(long offset, char *source, size_t size)
+#endif
+{
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_update_data(offset, source, size, UPDATE_APPEND, NULL);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//put_data_if_tail() scrive il messaggio solo se l'ultimo messaggio valido ha numero di sequenza tail_seq (0 = nessun messaggio
+//valido), altrimenti termina con -ECANCELED: più produttori possono così accodare messaggi in modo ottimistico.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(3, _put_data_if_tail, char *, source, size_t, size, uint64_t, tail_seq)
+#else
+asmlinkage long sys_put_data_if_tail(char *source, size_t size, uint64_t tail_seq)
+#endif
+{
+    struct write_condition cond = {.checks = COND_SEQ, .seq = tail_seq};
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_put_data(source, size, 0, 0, &cond);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//update_data_if() è l'equivalente di update_data() (senza spostamento del messaggio) eseguito solo se il blocco offset contiene
+//ancora il messaggio con numero di sequenza seq e versione version, altrimenti termina con -ECANCELED.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(5, _update_data_if, long, offset, char *, source, size_t, size, uint64_t, seq, uint64_t, version)
+#else
+asmlinkage long sys_update_data_if(long offset, char *source, size_t size, uint64_t seq, uint64_t version)
+#endif
+{
+    struct write_condition cond = {.checks = COND_SEQ | COND_VERSION, .seq = seq, .version = version};
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_update_data(offset, source, size, UPDATE_REPLACE, &cond);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//invalidate_data_if() è l'equivalente di invalidate_data() eseguito solo se il blocco offset contiene ancora il messaggio con
+//numero di sequenza seq e versione version, altrimenti termina con -ECANCELED.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(3, _invalidate_data_if, long, offset, uint64_t, seq, uint64_t, version)
+#else
+asmlinkage long sys_invalidate_data_if(long offset, uint64_t seq, uint64_t version)
+#endif
+{
+    struct write_condition cond = {.checks = COND_SEQ | COND_VERSION, .seq = seq, .version = version};
+    long ret;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+    ret = do_invalidate_data(offset, 0, 0, &cond);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+long sys_put_data = (unsigned long) __x64_sys_put_data;
+long sys_get_data = (unsigned long) __x64_sys_get_data;
+long sys_invalidate_data = (unsigned long) __x64_sys_invalidate_data;
+long sys_put_keyed_data = (unsigned long) __x64_sys_put_keyed_data;
+long sys_get_data_by_key = (unsigned long) __x64_sys_get_data_by_key;
+long sys_invalidate_data_by_key = (unsigned long) __x64_sys_invalidate_data_by_key;
+long sys_update_data = (unsigned long) __x64_sys_update_data;
+long sys_append_data = (unsigned long) __x64_sys_append_data;
+long sys_put_data_if_tail = (unsigned long) __x64_sys_put_data_if_tail;
+long sys_update_data_if = (unsigned long) __x64_sys_update_data_if;
+long sys_invalidate_data_if = (unsigned long) __x64_sys_invalidate_data_if;
+#endif
+
+//FILE OPERATIONS
+static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
+static int dev_open(struct inode *, struct file *);
+static int dev_release(struct inode *, struct file *);
+static loff_t dev_llseek(struct file *, loff_t, int);
+static long dev_ioctl(struct file *, unsigned int, unsigned long);
+static int dev_mmap(struct file *, struct vm_area_struct *);
+static ssize_t dev_splice_read(struct file *, loff_t *, struct pipe_inode_info *, size_t, unsigned int);
+
+/* FUNZIONI DEL CURSORE DI LETTURA
+ * La posizione del file è l'indice del prossimo messaggio valido da leggere nell'ordine temporale delle scritture,
+ * mentre il numero di sequenza (seq) ne è l'identità stabile: se il blocco del cursore viene invalidato, il cursore
+ * prosegue dal primo messaggio successivo ancora valido. Le funzioni seguenti vanno invocate col mutex del cursore
+ * e la srcu_read_lock acquisiti; restituiscono 0 oppure un codice di errore negativo.
+ */
+
+//restituisce in *address e *seq il primo messaggio valido del data block valido di indice block a partire dallo slot from (per un
+//blocco non impacchettato, il suo messaggio se from è 0); *address vale -1 (e *seq resta invariato) se il blocco non ne contiene altri.
+static int block_message(struct super_block *sb, int64_t block, int from, int64_t *address, uint64_t *seq) {
+
+    struct data_block_metadata *db_meta;
+    struct data_block_content *db_cont;
+    int slot;
+
+    db_meta = get_block_metadata(sb, block);
+    if (db_meta == NULL)
+        return -EIO;    //-EIO = errore di input/output
+    *address = -1;
+    if (!(db_meta->flags & BLOCK_PACKED)) {
+        if (from == 0) {
+            *address = block;
+            *seq = db_meta->seq;
+        }
+        return 0;
+    }
+    db_cont = get_block_content(sb, block);
+    if (db_cont == NULL)
+        return -EIO;    //-EIO = errore di input/output
+    slot = next_live_slot(db_cont, from);
+    if (slot >= 0) {
+        *address = PACKED_ADDRESS(block, slot);
+        *seq = db_meta->seq + slot;
+    }
+    return 0;
+
+}
+
+//restituisce in *address e *seq il primo messaggio valido della catena a partire dal blocco block (-1 = fine della catena) e dal suo
+//slot from; *address vale -1 (e *seq resta invariato) se non ne esistono.
+static int chain_message(struct super_block *sb, int64_t block, int from, int64_t *address, uint64_t *seq) {
+
+    struct data_block_metadata *db_meta;
+    uint64_t steps;
+    int ret;
+
+    *address = -1;
+    for(steps=0; block!=-1 && steps<au_info.total_data_blocks; steps++, from=0) {
+        ret = block_message(sb, block, from, address, seq);
+        if (ret < 0 || *address != -1)
+            return ret;
+        db_meta = get_block_metadata(sb, block);
+        if (db_meta == NULL)
+            return -EIO;    //-EIO = errore di input/output
+        block = db_meta->next_valid;
+    }
+    return 0;
+
+}
+
+//restituisce in *next e *seq il messaggio valido che segue, nella catena, quello di indirizzo address (*next = -1 se non esiste).
+static int next_message(struct super_block *sb, int64_t address, int64_t *next, uint64_t *seq) {
+
+    struct data_block_metadata *db_meta;
+    int64_t block;
+    int slot;
+    int ret;
+
+    block = split_address(address, &slot);
+    if (slot >= 0) {
+        ret = block_message(sb, block, slot + 1, next, seq);
+        if (ret < 0 || *next != -1)
+            return ret;
+    }
+    db_meta = get_block_metadata(sb, block);
+    if (db_meta == NULL)
+        return -EIO;    //-EIO = errore di input/output
+    return chain_message(sb, db_meta->next_valid, 0, next, seq);
+
+}
+
+//restituisce 1 se l'indirizzo address contiene ancora il messaggio valido con numero di sequenza seq, 0 altrimenti (oppure un codice di errore negativo).
+static int message_still_live(struct super_block *sb, int64_t address, uint64_t seq) {
+
+    struct data_block_metadata *db_meta;
+    struct data_block_content *db_cont;
+    int64_t block;
+    int slot;
+
+    block = split_address(address, &slot);
+    db_meta = get_block_metadata(sb, block);
+    db_cont = get_block_content(sb, block);
+    if (db_meta == NULL || db_cont == NULL)
+        return -EIO;    //-EIO = errore di input/output
+    return message_is_live(db_meta, db_cont, slot) && db_meta->seq + (slot >= 0 ? slot : 0) == seq;
+
+}
+
+//cerca, risalendo la catena a partire da last_valid, il primo messaggio valido con numero di sequenza non inferiore a seq:
+//in *address viene restituito il suo indirizzo (-1 se non esiste) e in *found_seq il suo numero di sequenza (seq se non esiste).
+static int find_live_message(struct super_block *sb, uint64_t seq, int64_t *address, uint64_t *found_seq) {
+
+    struct onefilefs_sb_info *sb_disk;
+    struct data_block_metadata *db_meta;
+    struct data_block_content *db_cont;
+    int64_t curr;
+    uint64_t steps;
+    int slot;
+
+    sb_disk = get_superblock_info(sb);
+    if (sb_disk == NULL)
+        return -EIO;    //-EIO = errore di input/output
+    *address = -1;
+    *found_seq = seq;
+    for(curr=sb_disk->last_valid, steps=0; curr!=-1 && steps<au_info.total_data_blocks; curr=db_meta->prev_valid, steps++) {
+        db_meta = get_block_metadata(sb, curr);
+        if (db_meta == NULL)
+            return -EIO;    //-EIO = errore di input/output
+        if (!(db_meta->flags & BLOCK_PACKED)) {
+            if (db_meta->seq < seq)
+                break;
+            *address = curr;
+            *found_seq = db_meta->seq;
+            continue;
+        }
+        //gli slot di un blocco impacchettato si esaminano a ritroso, come i blocchi
+        db_cont = get_block_content(sb, curr);
+        if (db_cont == NULL)
+            return -EIO;    //-EIO = errore di input/output
+        for(slot=prev_live_slot(db_cont, PACKED_MAX_SLOTS); slot>=0 && db_meta->seq + slot >= seq; slot=prev_live_slot(db_cont, slot)) {
+            *address = PACKED_ADDRESS(curr, slot);
+            *found_seq = db_meta->seq + slot;
+        }
+        if (slot >= 0 || db_meta->seq < seq)
+            break;
+    }
+    return 0;
+
+}
+
+/* Lettura attraverso uno snapshot: il messaggio corrente è quello con il minimo numero di sequenza (non inferiore a from e
+ * inferiore a snap->seq) tra il prossimo messaggio della catena corrente e i messaggi trattenuti invalidati dopo la creazione
+ * dello snapshot. Il blocco del messaggio corrente non può essere riutilizzato finché lo snapshot è attivo: se il messaggio viene
+ * invalidato, viene trattenuto da invalidate_data().
+ */
+static int snapshot_locate(struct super_block *sb, struct read_cursor *cursor, uint64_t from) {
+
+    struct retained_block *rb;
+    unsigned long seq;
+    uint64_t live;
+    int ret;
+
+    //posizione nella catena corrente: se il messaggio è stato invalidato nel frattempo, la si ricerca a partire dalla coda.
+    if (cursor->live_block != -1) {
+        ret = message_still_live(sb, cursor->live_block, cursor->live_seq);
+        if (ret < 0)
+            return ret;
+        if (!ret) {
+            ret = find_live_message(sb, cursor->live_seq, &(cursor->live_block), &(cursor->live_seq));
+            if (ret < 0)
+                return ret;
+        }
+    }
+    while (cursor->live_block != -1 && cursor->live_seq < from) {
+        ret = next_message(sb, cursor->live_block, &(cursor->live_block), &(cursor->live_seq));
+        if (ret < 0)
+            return ret;
+    }
+    live = (cursor->live_block != -1 && cursor->live_seq < cursor->snap->seq) ? cursor->live_seq : cursor->snap->seq;
+
+    //messaggi trattenuti con numero di sequenza compreso in [from, live)
+    cursor->next_block = -1;
+    cursor->block_pos = 0;
+    mutex_lock(&(au_info.snap_mutex));
+    seq = from;
+    for(rb=(from < live) ? xa_find(&(au_info.retained), &seq, live - 1, XA_PRESENT) : NULL; rb; rb=xa_find_after(&(au_info.retained), &seq, live - 1, XA_PRESENT)) {
+        if (rb->epoch > cursor->snap->epoch) {
+            cursor->next_block = rb->block;
+            cursor->seq = seq;
+            break;
+        }
+    }
+    mutex_unlock(&(au_info.snap_mutex));
+
+    if (cursor->next_block == -1 && live < cursor->snap->seq) {
+        cursor->next_block = cursor->live_block;
+        cursor->seq = cursor->live_seq;
+    }
+    if (cursor->next_block == -1)
+        cursor->seq = cursor->snap->seq;    //fine dello snapshot
+    return 0;
+
+}
+
+//riavvia la lettura anticipata del cursore dal messaggio corrente: va invocata quando il cursore salta in un punto della catena
+//diverso da quello raggiunto dall'attraversamento, perché la finestra già accodata riguarda i blocchi successivi alla vecchia posizione.
+static inline void cursor_restart_prefetch(struct super_block *sb, struct read_cursor *cursor) {
+    cursor->prefetch.block = -1;
+    cursor->prefetch.ahead = 0;
+    prefetch_step(sb, &(cursor->prefetch), cursor->next_block);
+}
+
+//posiziona il cursore sul primo messaggio valido.
+static int cursor_rewind(struct super_block *sb, struct read_cursor *cursor) {
+
+    struct onefilefs_sb_info *sb_disk;
+    int ret;
+
+    sb_disk = get_superblock_info(sb);
+    if (sb_disk == NULL)
+        return -EIO;    //-EIO = errore di input/output
+    cursor->block_pos = 0;
+    cursor->index = 0;
+    cursor->started = 1;
+    cursor->seq = au_info.next_seq;     //numero di sequenza atteso se non ci sono messaggi validi
+    ret = chain_message(sb, sb_disk->first_valid, 0, &(cursor->next_block), &(cursor->seq));
+    if (ret < 0)
+        return ret;
+    cursor_restart_prefetch(sb, cursor);
+    if (cursor->snap) {
+        cursor->live_block = cursor->next_block;
+        cursor->live_seq = cursor->seq;
+        return snapshot_locate(sb, cursor, 0);
+    }
+    return 0;
+
+}
+
+//sposta il cursore (che non deve trovarsi alla fine del file) sul messaggio successivo.
+static int cursor_advance(struct super_block *sb, struct read_cursor *cursor) {
+
+    int64_t next;
+    uint64_t seq;
+    int ret;
+
+    //attraverso uno snapshot la catena è percorsa da live_block (i messaggi trattenuti sono fuori dalla catena)
+    if (cursor->snap) {
+        ret = snapshot_locate(sb, cursor, cursor->seq + 1);
+        if (ret == 0) {
+            cursor->index++;
+            prefetch_step(sb, &(cursor->prefetch), cursor->live_block);
+        }
+        return ret;
+    }
+
+    ret = next_message(sb, cursor->next_block, &next, &seq);
+    if (ret < 0)
+        return ret;
+    prefetch_step(sb, &(cursor->prefetch), next);
+    cursor->next_block = next;
+    cursor->block_pos = 0;
+    cursor->index++;
+    if (cursor->next_block == -1)
+        cursor->seq++;  //alla fine del file si attendono i messaggi con numero di sequenza successivo all'ultimo letto
+    else
+        cursor->seq = seq;
+    return 0;
+
+}
+
+//verifica che l'indirizzo del cursore contenga ancora il messaggio atteso. Se è stato invalidato (ed eventualmente riutilizzato),
+//oppure se il cursore è alla fine del file, il cursore viene spostato sul primo messaggio valido con numero di sequenza non inferiore
+//a quello atteso, risalendo la catena a partire da last_valid: in questo modo una lettura alla fine del file vede i messaggi scritti nel frattempo.
+//con uno snapshot non c'è nulla da verificare: il contenuto dello snapshot non cambia.
+static int cursor_resolve(struct super_block *sb, struct read_cursor *cursor) {
+
+    int64_t found;
+    uint64_t found_seq;
+    int ret;
+
+    if (!cursor->started)
+        return cursor_rewind(sb, cursor);
+    if (cursor->snap)
+        return 0;
+    if (cursor->next_block != -1) {
+        ret = message_still_live(sb, cursor->next_block, cursor->seq);
+        if (ret != 0)
+            return (ret < 0) ? ret : 0;
+        //il blocco può essere stato spostato dalla compattazione: in tal caso il messaggio si trova nella nuova posizione
+        found = resolve_address(cursor->next_block);
+        if (found != cursor->next_block && message_still_live(sb, found, cursor->seq) > 0) {
+            cursor->next_block = found;
+            cursor_restart_prefetch(sb, cursor);
+            return 0;
+        }
+    }
+
+    ret = find_live_message(sb, cursor->seq, &found, &found_seq);
+    if (ret < 0)
+        return ret;
+    //se il messaggio atteso non esiste più, l'indice resta quello che aveva (i messaggi precedenti possono essere stati invalidati).
+    if (found != cursor->next_block) {
+        cursor->block_pos = 0;
+        cursor->next_block = found;
+        cursor_restart_prefetch(sb, cursor);
+    }
+    cursor->seq = found_seq;
+    return 0;
+
+}
+
+//restituisce 1 se il cursore non ha altri messaggi da leggere (fine del file oppure limite impostato con SFS_IOC_SET_LIMIT).
+static inline int cursor_at_end(struct read_cursor *cursor) {
+    return cursor->next_block == -1 || (cursor->limit_seq && cursor->seq >= cursor->limit_seq);
+}
+
+//posiziona il cursore sul messaggio di indice index (o alla fine del file, se i messaggi validi sono meno di index+1).
+static int cursor_seek_index(struct super_block *sb, struct read_cursor *cursor, uint64_t index) {
+
+    int ret;
+
+    ret = cursor_resolve(sb, cursor);
+    if (ret == 0 && index < cursor->index)
+        ret = cursor_rewind(sb, cursor);    //la catena si percorre solo in avanti a partire dalla posizione corrente
+    if (ret == 0 && index == cursor->index)
+        cursor->block_pos = 0;
+    while (ret == 0 && cursor->index < index && cursor->next_block != -1)
+        ret = cursor_advance(sb, cursor);
+    return ret;
+
+}
+
+//posiziona il cursore sul primo messaggio valido con numero di sequenza non inferiore a seq.
+static int cursor_seek_seq(struct super_block *sb, struct read_cursor *cursor, uint64_t seq) {
+
+    int ret;
+
+    //la catena si percorre solo in avanti: si riparte dall'inizio soltanto se il messaggio cercato precede la posizione corrente
+    ret = cursor_resolve(sb, cursor);
+    if (ret == 0 && seq < cursor->seq)
+        ret = cursor_rewind(sb, cursor);
+    if (ret == 0 && cursor->seq >= seq)
+        cursor->block_pos = 0;
+    while (ret == 0 && cursor->next_block != -1 && cursor->seq < seq)
+        ret = cursor_advance(sb, cursor);
+    if (ret == 0 && cursor->next_block == -1 && cursor->seq < seq)
+        cursor->seq = seq;
+    return ret;
+
+}
+
+//posiziona il cursore sul primo messaggio della partizione part (restituita da SFS_IOC_PARTITION) e ne imposta il limite end_seq.
+//il cursore viene portato direttamente all'indirizzo del messaggio: se questo non contiene più il messaggio atteso, cursor_resolve()
+//cerca il primo messaggio valido con numero di sequenza non inferiore. Attraverso uno snapshot la posizione si cerca per numero di sequenza.
+static int cursor_seek_partition(struct super_block *sb, struct read_cursor *cursor, struct sfs_partition *part) {
+
+    int64_t block;
+    int slot;
+
+    block = split_address(part->start_block, &slot);
+    if (block < 0 || block >= au_info.total_data_blocks || slot >= PACKED_MAX_SLOTS)
+        return -EINVAL; //-EINVAL = argomento non valido
+    cursor->limit_seq = part->end_seq;
+    if (cursor->snap)
+        return cursor_seek_seq(sb, cursor, part->start_seq);
+
+    cursor->started = 1;
+    cursor->next_block = resolve_address(part->start_block);
+    cursor->seq = part->start_seq;
+    cursor->index = part->start_index;
+    cursor->block_pos = 0;
+    cursor_restart_prefetch(sb, cursor);
+    return cursor_resolve(sb, cursor);
+
+}
+
+//la dev_read() legge i messaggi validi nell'ordine temporale delle scritture, a partire dalla posizione del cursore di lettura.
+//ogni chiamata restituisce al più il payload (residuo) di un solo blocco; la posizione *off è l'indice del prossimo messaggio da leggere.
+static ssize_t dev_read(struct file *filp, char *buf, size_t len, loff_t *off) {
+
+    struct super_block *sb;
+    struct read_cursor *cursor;
+    struct data_block_content *db_cont;
+    struct data_block_metadata *db_meta;
+    unsigned long not_copied;
+    unsigned int payload_seq;
+    int corrupted;
+    char *message;          //messaggio estratto (solo per i messaggi memorizzati compressi o impacchettati)
+    int cached;             //1 se message contiene già il messaggio corrente
+    uint64_t version;       //versione del messaggio estratto
+    int64_t block;          //data block del messaggio corrente
+    int slot;               //slot del messaggio corrente (-1 = messaggio che occupa l'intero blocco)
+    ssize_t ret;
+    int srcu_idx;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    printk("%s: read operation called with len %ld\n", MOD_NAME, len);
+
+    //sanity check
+    if (!au_info.is_mounted) {
+        printk("%s: impossibile leggere il dispositivo: il file system non è stato montato\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODEV; //-ENODEV = file system non esistente
+    }
+
+    sb = filp->f_path.dentry->d_inode->i_sb;
+    cursor = (struct read_cursor *)filp->private_data;
+
+    //il mutex del cursore riguarda soltanto i thread che condividono questa apertura del file, per cui si può attendere.
+    mutex_lock(&(cursor->lock));
+    srcu_idx = srcu_read_lock(&(au_info.srcu));
+
+    //una posizione diversa dall'ultima comunicata (pread(), oppure f_pos modificata dall'esterno) riposiziona il cursore.
+    if (*off != cursor->pos)
+        ret = (*off < 0) ? -EINVAL : cursor_seek_index(sb, cursor, *off);
+    else
+        ret = cursor_resolve(sb, cursor);
+    if (ret == 0 && cursor->next_block != -1 && cursor->block_pos == DEFAULT_BLOCK_SIZE - METADATA_SIZE)
+        ret = cursor_advance(sb, cursor);   //il payload del blocco corrente è già stato restituito per intero
+    if (ret < 0 || cursor_at_end(cursor) || len == 0)
+        goto read_out;
+
+    if (len > DEFAULT_BLOCK_SIZE - METADATA_SIZE - cursor->block_pos)
+        len = DEFAULT_BLOCK_SIZE - METADATA_SIZE - cursor->block_pos;  //al più il payload residuo del blocco corrente
+
+    block = split_address(cursor->next_block, &slot);
+    db_cont = get_block_content(sb, block);
+    if (db_cont == NULL) {
+        printk("%s: impossibile leggere il dispositivo: si è verificato un errore con la lettura del blocco %lld\n", MOD_NAME, block);
+        ret = -EIO; //-EIO = errore di input/output
+        goto read_out;
+    }
+
+    db_meta = get_block_metadata(sb, block);
+    if (db_meta == NULL) {
+        printk("%s: impossibile leggere il dispositivo: si è verificato un errore con la lettura dei metadati del blocco %lld\n", MOD_NAME, block);
+        ret = -EIO; //-EIO = errore di input/output
+        goto read_out;
+    }
+    //un messaggio memorizzato compresso o impacchettato viene estratto per intero nel buffer del cursore, dove resta a disposizione
+    //delle chiamate successive che ne leggono il resto: viene estratto di nuovo solo se nel frattempo è stato modificato.
+    message = NULL;
+    if ((db_meta->flags & BLOCK_COMPRESSED) || slot >= 0) {
+        if (!cursor->message) {
+            cursor->message = kmalloc(DEFAULT_BLOCK_SIZE - METADATA_SIZE, GFP_KERNEL);
+            if (!cursor->message) {
+                ret = -ENOMEM;  //-ENOMEM = errore di esaurimento della memoria
+                goto read_out;
+            }
+            cursor->message_block = -1;
+        }
+        message = cursor->message;
+    }
+
+    //ora si copiano i dati dal payload del blocco al buffer dell'applicazione (buf), passato come parametro a dev_read():
+    //la copia viene ripetuta se nel frattempo il payload è stato modificato in place. Con l'opzione di montaggio "verify"
+    //il checksum del payload viene verificato all'inizio della lettura di ogni messaggio.
+    do {
+        payload_seq = read_seqcount_begin(payload_seqcount(block));
+        corrupted = au_info.verify_on_read && cursor->block_pos == 0 && !payload_intact(db_meta, db_cont);
+        version = db_meta->version;
+        cached = message && cursor->message_block == cursor->next_block && cursor->message_seq == cursor->seq &&
+            cursor->message_version == version;
+        if (!corrupted && message && !cached) {
+            cursor->message_block = -1;     //il buffer viene sovrascritto: non contiene più il messaggio precedente
+            corrupted = read_message(db_meta, db_cont, slot, message) < 0;
+        }
+        else if (!corrupted && !message)
+            not_copied = copy_to_user(buf, &(db_cont->payload[cursor->block_pos]), len);
+    } while (read_seqcount_retry(payload_seqcount(block), payload_seq));
+    if (corrupted) {
+        //il cursore resta sul messaggio: con lseek() si può proseguire dal messaggio successivo
+        printk("%s: impossibile leggere il dispositivo: il messaggio %lld è danneggiato\n", MOD_NAME, cursor->next_block);
+        ret = -EBADMSG; //-EBADMSG = messaggio corrotto
+        goto read_out;
+    }
+    if (message) {
+        cursor->message_block = cursor->next_block;
+        cursor->message_seq = cursor->seq;
+        cursor->message_version = version;
+        not_copied = copy_to_user(buf, message + cursor->block_pos, len);
+    }
+    if (not_copied == len) {
+        ret = -EFAULT;  //-EFAULT = indirizzo non valido
+        goto read_out;
+    }
+    ret = len - not_copied;
+    cursor->block_pos += ret;
+    printk("%s: message %lld successfully read\n", MOD_NAME, cursor->next_block);
+    if (cursor->block_pos == DEFAULT_BLOCK_SIZE - METADATA_SIZE)
+        cursor_advance(sb, cursor); //in caso di errore lo spostamento viene ritentato dalla prossima chiamata
+
+read_out:
+    if (ret >= 0)
+        *off = cursor->pos = cursor->index;
+    srcu_read_unlock(&(au_info.srcu), srcu_idx);
+    mutex_unlock(&(cursor->lock));
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+/* la dev_llseek() sposta il cursore di lettura con granularità di messaggio. La posizione restituita è l'indice del messaggio:
+ * - SEEK_SET: offset è l'indice del messaggio; se contiene il flag SFS_SEEK_SEQ, i bit restanti sono un numero di sequenza e il
+ *   cursore si sposta sul primo messaggio valido con numero di sequenza non inferiore;
+ * - SEEK_CUR: offset è relativo al messaggio corrente; con offset pari a SFS_SEEK_SEQ il cursore non si sposta e viene restituito
+ *   il numero di sequenza del messaggio corrente (alla fine del file, quello del prossimo messaggio atteso);
+ * - SEEK_END: offset è relativo al numero di messaggi validi.
+ * Una posizione oltre la fine del file viene ricondotta alla fine del file. Gli indici sono relativi alla catena al momento dello
+ * spostamento (le invalidazioni successive non spostano il cursore), mentre il numero di sequenza identifica un messaggio in modo stabile.
+ */
+static loff_t dev_llseek(struct file *filp, loff_t offset, int whence) {
+
+    struct super_block *sb;
+    struct read_cursor *cursor;
+    loff_t target;
+    loff_t ret;
+    int srcu_idx;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    //sanity check
+    if (!au_info.is_mounted) {
+        printk("%s: impossibile spostarsi sul dispositivo: il file system non è stato montato\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODEV; //-ENODEV = file system non esistente
+    }
+
+    sb = filp->f_path.dentry->d_inode->i_sb;
+    cursor = (struct read_cursor *)filp->private_data;
+
+    mutex_lock(&(cursor->lock));
+    srcu_idx = srcu_read_lock(&(au_info.srcu));
+
+    switch (whence) {
+        case SEEK_SET:
+            if (offset > 0 && (offset & SFS_SEEK_SEQ))
+                ret = cursor_seek_seq(sb, cursor, offset & ~SFS_SEEK_SEQ);
+            else
+                ret = (offset < 0) ? -EINVAL : cursor_seek_index(sb, cursor, offset);
+            break;
+        case SEEK_CUR:
+            if (offset == SFS_SEEK_SEQ) {
+                ret = cursor_resolve(sb, cursor);
+                if (ret == 0)
+                    ret = cursor->seq;
+                goto seek_out;
+            }
+            ret = cursor_resolve(sb, cursor);
+            target = cursor->index + offset;
+            if (ret == 0)
+                ret = (target < 0) ? -EINVAL : cursor_seek_index(sb, cursor, target);
+            break;
+        case SEEK_END:
+            target = (cursor->snap ? cursor->snap->count : au_info.valid_messages) + offset;
+            ret = (target < 0) ? -EINVAL : cursor_seek_index(sb, cursor, target);
+            break;
+        default:
+            ret = -EINVAL;  //-EINVAL = argomento non valido
+    }
+
+    if (ret == 0) {
+        filp->f_pos = cursor->pos = cursor->index;
+        ret = cursor->index;
+    }
+
+seek_out:
+    srcu_read_unlock(&(au_info.srcu), srcu_idx);
+    mutex_unlock(&(cursor->lock));
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+/* questa funzione suddivide i messaggi validi in (al più) req->parts partizioni contigue nell'ordine delle scritture, ciascuna
+ * descritta dall'intervallo [start_seq, end_seq) dei numeri di sequenza. Lo snapshot è definito da next_seq al momento della
+ * chiamata: i messaggi scritti successivamente (che si trovano in coda alla catena) non ne fanno parte. Poiché le partizioni sono
+ * intervalli di numeri di sequenza, esse restano disgiunte e coprono l'intero snapshot anche se nel frattempo alcuni messaggi vengono
+ * invalidati; il campo count è il numero di messaggi al momento della suddivisione.
+ * I confini delle partizioni vengono calcolati in anticipo dal numero di messaggi validi, per cui la catena viene attraversata una
+ * sola volta e soltanto fino al primo messaggio dell'ultima partizione, senza memorizzare i numeri di sequenza di tutti i messaggi;
+ * il conteggio dell'ultima partizione (e il totale) è quello dei contatori, che con scritture o invalidazioni concorrenti è una stima.
+ * Di ogni partizione vengono restituiti anche l'indirizzo e l'indice del primo messaggio: un lettore si posiziona con
+ * SFS_IOC_SEEK_PARTITION direttamente su quel messaggio (se nel frattempo è stato invalidato, sul primo successivo), dopodiché legge
+ * la partizione con read() fino alla fine del file.
+ */
+static long partition_messages(struct super_block *sb, struct sfs_partition_request *user_req) {
+
+    struct sfs_partition_request req;
+    struct sfs_partition *parts;
+    struct onefilefs_sb_info *sb_disk;
+    uint64_t snapshot;
+    uint64_t expected;  //numero di messaggi dello snapshot secondo i contatori
+    uint64_t seq;
+    uint64_t prev_seq;
+    uint64_t num;       //indice del messaggio corrente
+    uint64_t next;      //indice del primo messaggio della prossima partizione
+    uint64_t out;
+    uint64_t k;
+    int64_t curr;
+    struct chain_prefetch prefetch;
+    long ret;
+    int srcu_idx;
+
+    if (copy_from_user(&req, user_req, sizeof(req)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    if (req.parts == 0 || req.parts > SFS_MAX_PARTITIONS)
+        return -EINVAL; //-EINVAL = argomento non valido
+
+    //i messaggi con numero di sequenza inferiore a snapshot sono quelli validi subito dopo la lettura di next_seq (a meno di una
+    //put_data() in corso, che incrementa next_seq prima di contare il messaggio).
+    snapshot = READ_ONCE(au_info.next_seq);
+    smp_rmb();
+    expected = READ_ONCE(au_info.valid_messages);
+    parts = kcalloc(req.parts, sizeof(struct sfs_partition), GFP_KERNEL);
+    if (!parts)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+
+    //la partizione k inizia dal messaggio di indice expected*k/parts; le partizioni vuote vengono omesse.
+    ret = 0;
+    num = 0;
+    next = 0;
+    out = 0;
+    k = 0;
+    prev_seq = 0;
+    prefetch.block = -1;
+    prefetch.ahead = 0;
+    srcu_idx = srcu_read_lock(&(au_info.srcu));
+    sb_disk = get_superblock_info(sb);
+    if (sb_disk == NULL)
+        ret = -EIO; //-EIO = errore di input/output
+    else
+        ret = chain_message(sb, sb_disk->first_valid, 0, &curr, &seq);
+    while (ret == 0 && curr != -1 && seq < snapshot) {
+        if (num > 0 && seq <= prev_seq) {
+            printk("%s: impossibile suddividere i messaggi: i numeri di sequenza non sono crescenti lungo la catena (messaggio %lld)\n", MOD_NAME, curr);
+            ret = -EINVAL;  //-EINVAL = argomento non valido
+            break;
+        }
+        if (num == next) {
+            parts[out].start_seq = seq;
+            parts[out].start_block = origin_address(curr);
+            parts[out].start_index = num;
+            out++;
+            while (k < req.parts && expected * k / req.parts <= num)
+                k++;
+            if (k == req.parts)
+                break;  //il resto della catena appartiene all'ultima partizione
+            next = expected * k / req.parts;
+        }
+        prev_seq = seq;
+        num++;
+        prefetch_step(sb, &prefetch, curr);
+        ret = next_message(sb, curr, &curr, &seq);
+    }
+    srcu_read_unlock(&(au_info.srcu), srcu_idx);
+    if (ret < 0)
+        goto partition_out;
+
+    //se l'attraversamento si è fermato all'ultima partizione, il totale è quello dei contatori; altrimenti è esatto.
+    req.total = (k == req.parts) ? max(expected, parts[out-1].start_index + 1) : num;
+    for(k=0; k<out; k++) {
+        parts[k].end_seq = (k+1 < out) ? parts[k+1].start_seq : snapshot;
+        parts[k].count = ((k+1 < out) ? parts[k+1].start_index : req.total) - parts[k].start_index;
+    }
+    req.parts = out;
+    req.snapshot_seq = snapshot;
+    if (copy_to_user((void *)(unsigned long)req.partitions, parts, out * sizeof(struct sfs_partition)) ||
+        copy_to_user(user_req, &req, sizeof(req)))
+        ret = -EFAULT;  //-EFAULT = indirizzo non valido
+
+partition_out:
+    kfree(parts);
+    return ret;
+
+}
+
+//questa funzione rilascia uno snapshot, insieme ai blocchi trattenuti che non servono più ad alcuno snapshot attivo.
+static void release_snapshot(struct read_snapshot *snap) {
+
+    mutex_lock(&(au_info.snap_mutex));
+    list_del(&(snap->list));
+    prune_retained_blocks();
+    mutex_unlock(&(au_info.snap_mutex));
+    kfree(snap);
+
+}
+
+//questa funzione fissa uno snapshot dei messaggi validi e lo associa all'apertura del file filp, riportandola all'inizio.
+//lo snapshot viene creato con write_mutex acquisito, per cui non può cogliere a metà una put_data() o una invalidate_data().
+static long pin_snapshot(struct file *filp, uint64_t *user_seq) {
+
+    struct read_cursor *cursor;
+    struct read_snapshot *snap;
+    struct read_snapshot *old;
+    int ret;
+
+    cursor = (struct read_cursor *)filp->private_data;
+    snap = kmalloc(sizeof(struct read_snapshot), GFP_KERNEL);
+    if (!snap)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+
+    ret = mutex_trylock(&(au_info.write_mutex));
+    if (ret == 0) {
+        kfree(snap);
+        return -EBUSY;
+    }
+    snap->seq = au_info.next_seq;
+    snap->epoch = au_info.inval_epoch;
+    snap->count = au_info.valid_messages;
+    mutex_lock(&(au_info.snap_mutex));
+    list_add(&(snap->list), &(au_info.snapshots));
+    mutex_unlock(&(au_info.snap_mutex));
+    mutex_unlock(&(au_info.write_mutex));
+
+    mutex_lock(&(cursor->lock));
+    old = cursor->snap;
+    cursor->snap = snap;
+    cursor->started = 0;
+    cursor->index = 0;
+    cursor->pos = 0;
+    filp->f_pos = 0;
+    mutex_unlock(&(cursor->lock));
+    if (old)
+        release_snapshot(old);
+
+    printk("%s: snapshot created (%llu messages, sequence numbers below %llu)\n", MOD_NAME, snap->count, snap->seq);
+    if (copy_to_user(user_seq, &(snap->seq), sizeof(uint64_t)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    return 0;
+
+}
+
+//questa funzione rilascia lo snapshot associato all'apertura del file filp, che torna a leggere la catena corrente dall'inizio.
+static long unpin_snapshot(struct file *filp) {
+
+    struct read_cursor *cursor;
+    struct read_snapshot *old;
+
+    cursor = (struct read_cursor *)filp->private_data;
+    mutex_lock(&(cursor->lock));
+    old = cursor->snap;
+    cursor->snap = NULL;
+    cursor->started = 0;
+    cursor->index = 0;
+    cursor->pos = 0;
+    filp->f_pos = 0;
+    mutex_unlock(&(cursor->lock));
+    if (!old)
+        return -EINVAL; //-EINVAL = argomento non valido (nessuno snapshot associato)
+    release_snapshot(old);
+    return 0;
+
+}
+
+#define SEARCH_BATCH 64     //messaggi esaminati da search_messages() tra un rilascio e l'altro della srcu_read_lock
+
+/* questa funzione cerca la sequenza di byte req->pattern nel payload dei messaggi con numero di sequenza non inferiore a
+ * req->start_seq, nell'ordine delle scritture, senza copiare i payload in user space: vengono restituiti soltanto blocco e numero
+ * di sequenza dei messaggi che la contengono. La ricerca usa un cursore proprio (la posizione di lettura di filp non cambia) ma,
+ * se filp ha uno snapshot, avviene nello snapshot; il mutex del cursore di filp resta acquisito per tutta la ricerca, per cui lo
+ * snapshot non può essere rilasciato nel frattempo. Ogni SEARCH_BATCH messaggi la srcu_read_lock viene rilasciata, per non ritardare
+ * troppo a lungo le invalidazioni, e il cursore viene poi verificato con cursor_resolve() come in dev_read().
+ * Se l'array hits si riempie, in req->start_seq viene restituito il numero di sequenza da cui proseguire la ricerca (0 se è completata).
+ */
+static long search_messages(struct file *filp, struct sfs_search_request *user_req) {
+
+    struct sfs_search_request req;
+    struct sfs_search_hit *hits;
+    struct super_block *sb;
+    struct read_cursor *file_cursor;
+    struct read_cursor cursor;
+    struct data_block_content *db_cont;
+    struct data_block_metadata *db_meta;
+    char pattern[SFS_MAX_PATTERN];
+    char *message;          //buffer in cui vengono estratti i messaggi memorizzati compressi o impacchettati
+    int64_t block;
+    int slot;
+    const char *text;
+    long text_len;
+    const char *match;
+    unsigned int payload_seq;
+    uint64_t batch;
+    long ret;
+    int srcu_idx;
+
+    if (copy_from_user(&req, user_req, sizeof(req)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    if (req.pattern_len == 0 || req.pattern_len > SFS_MAX_PATTERN || req.max_hits == 0)
+        return -EINVAL; //-EINVAL = argomento non valido
+    if (copy_from_user(pattern, (void *)(unsigned long)req.pattern, req.pattern_len))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    //ogni chiamata restituisce al più SFS_MAX_HITS risultati (la ricerca prosegue con start_seq), per cui il buffer dei risultati
+    //ha una dimensione limitata indipendentemente dal valore scelto dal chiamante.
+    if (req.max_hits > SFS_MAX_HITS)
+        req.max_hits = SFS_MAX_HITS;
+    hits = kmalloc_array(req.max_hits, sizeof(struct sfs_search_hit), GFP_KERNEL);
+    message = kmalloc(DEFAULT_BLOCK_SIZE - METADATA_SIZE, GFP_KERNEL);
+    if (!hits || !message) {
+        kfree(hits);
+        kfree(message);
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    }
+
+    sb = filp->f_path.dentry->d_inode->i_sb;
+    file_cursor = (struct read_cursor *)filp->private_data;
+    memset(&cursor, 0, sizeof(cursor));
+
+    mutex_lock(&(file_cursor->lock));
+    cursor.snap = file_cursor->snap;
+    req.found = 0;
+    req.scanned = 0;
+    srcu_idx = srcu_read_lock(&(au_info.srcu));
+    ret = cursor_seek_seq(sb, &cursor, req.start_seq);
+    for(batch=0; ret == 0 && cursor.next_block != -1; batch++) {
+        if (batch == SEARCH_BATCH) {
+            srcu_read_unlock(&(au_info.srcu), srcu_idx);
+            cond_resched();
+            if (fatal_signal_pending(current)) {
+                srcu_idx = srcu_read_lock(&(au_info.srcu));
+                ret = -EINTR;   //-EINTR = chiamata interrotta da un segnale
+                break;
+            }
+            srcu_idx = srcu_read_lock(&(au_info.srcu));
+            batch = 0;
+            ret = cursor_resolve(sb, &cursor);
+            if (ret < 0 || cursor.next_block == -1)
+                break;
+        }
+        if (req.found == req.max_hits)
+            break;  //la ricerca proseguirà (con un'altra chiamata) dal messaggio corrente
+        block = split_address(cursor.next_block, &slot);
+        db_cont = get_block_content(sb, block);
+        db_meta = get_block_metadata(sb, block);
+        if (db_cont == NULL || db_meta == NULL) {
+            printk("%s: impossibile completare la ricerca: si è verificato un errore con la lettura del blocco %lld\n", MOD_NAME, block);
+            ret = -EIO; //-EIO = errore di input/output
+            break;
+        }
+        //la ricerca copre l'intero messaggio (la lunghezza registrata nei metadati, vedi payload_length()), anche oltre eventuali
+        //byte nulli; viene ripetuta se nel frattempo il payload è stato modificato in place.
+        do {
+            payload_seq = read_seqcount_begin(payload_seqcount(block));
+            //un messaggio compresso o impacchettato viene cercato dopo averlo estratto (se è danneggiato, non contiene il pattern)
+            text = db_cont->payload;
+            if ((db_meta->flags & BLOCK_COMPRESSED) || slot >= 0) {
+                text_len = read_message(db_meta, db_cont, slot, message);
+                text = message;
+                if (text_len < 0)
+                    text_len = 0;
+            }
+            else
+                text_len = payload_length(db_meta, db_cont->payload);
+            match = find_pattern(text, text_len, pattern, req.pattern_len);
+        } while (read_seqcount_retry(payload_seqcount(block), payload_seq));
+        if (match) {
+            hits[req.found].block = origin_address(cursor.next_block);
+            hits[req.found].seq = cursor.seq;
+            req.found++;
+        }
+        req.scanned++;
+        ret = cursor_advance(sb, &cursor);
+    }
+    req.start_seq = (ret == 0 && cursor.next_block != -1) ? cursor.seq : 0;
+    srcu_read_unlock(&(au_info.srcu), srcu_idx);
+    mutex_unlock(&(file_cursor->lock));
+
+    if (ret == 0) {
+        if (copy_to_user((void *)(unsigned long)req.hits, hits, req.found * sizeof(struct sfs_search_hit)) ||
+            copy_to_user(user_req, &req, sizeof(req)))
+            ret = -EFAULT;  //-EFAULT = indirizzo non valido
+    }
+    kfree(hits);
+    kfree(message);
+    return ret;
+
+}
+
+//questa funzione restituisce lo stato del messaggio di indirizzo indicato in user_info (-1 = ultimo messaggio valido).
+static long block_info(struct super_block *sb, struct sfs_block_info *user_info) {
+
+    struct sfs_block_info info;
+    struct onefilefs_sb_info *sb_disk;
+    struct data_block_metadata *db_meta;
+    struct data_block_content *db_cont;
+    struct packed_header *hdr;
+    int64_t block;
+    int slot;
+    uint64_t seq;
+    unsigned int payload_seq;
+    char *message;          //buffer in cui viene decompresso un messaggio memorizzato compresso, per misurarne la lunghezza
+    int len;
+    long ret;
+    int srcu_idx;
+
+    if (copy_from_user(&info, user_info, sizeof(info)))
+        return -EFAULT; //-EFAULT = indirizzo non valido
+    message = kmalloc(DEFAULT_BLOCK_SIZE - METADATA_SIZE, GFP_KERNEL);
+    if (!message)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+
+    ret = 0;
+    srcu_idx = srcu_read_lock(&(au_info.srcu));
+    sb_disk = get_superblock_info(sb);
+    if (sb_disk == NULL) {
+        ret = -EIO; //-EIO = errore di input/output
+        goto info_out;
+    }
+    if (info.block == -1 && sb_disk->last_valid != -1) {
+        info.block = last_message_of(sb, sb_disk->last_valid, &seq);
+        if (info.block < 0) {
+            ret = -EIO; //-EIO = errore di input/output
+            goto info_out;
+        }
+        info.block = origin_address(info.block);    //viene restituito l'indirizzo noto all'utente, anche se il blocco è stato spostato
+    }
+    block = split_address(resolve_address(info.block), &slot);
+    if (info.block != -1 && (block < 0 || (uint64_t)block >= sb_disk->total_data_blocks || slot >= PACKED_MAX_SLOTS)) {
+        ret = -EINVAL;  //-EINVAL = argomento non valido
+        goto info_out;
+    }
+    memset(&(info.is_valid), 0, sizeof(info) - offsetof(struct sfs_block_info, is_valid));
+    if (info.block == -1)
+        goto info_out;  //nessun messaggio valido: l'ultimo numero di sequenza vale 0
+
+    db_meta = get_block_metadata(sb, block);
+    db_cont = get_block_content(sb, block);
+    if (db_meta == NULL || db_cont == NULL) {
+        ret = -EIO; //-EIO = errore di input/output
+        goto info_out;
+    }
+    //versione e lunghezza vengono lette in modo coerente con la modifica in place del payload
+    hdr = (struct packed_header *)db_cont->payload;
+    do {
+        payload_seq = read_seqcount_begin(payload_seqcount(block));
+        info.version = db_meta->version;
+        //la lunghezza è quella registrata nei metadati (vedi payload_length() e read_message()), anche oltre eventuali byte nulli
+        if (slot >= 0) {
+            info.stored_length = (db_meta->flags & BLOCK_PACKED) && slot < min_t(int, hdr->slots, PACKED_MAX_SLOTS) ? hdr->slot[slot].length : 0;
+            len = read_message(db_meta, db_cont, slot, message);
+            info.length = (len < 0) ? 0 : len;
+        }
+        else if (db_meta->flags & BLOCK_COMPRESSED) {
+            info.stored_length = db_meta->stored_len;
+            len = read_message(db_meta, db_cont, -1, message);
+            info.length = (len < 0) ? 0 : len;
+        }
+        else
+            info.stored_length = info.length = payload_length(db_meta, db_cont->payload);
+    } while (read_seqcount_retry(payload_seqcount(block), payload_seq));
+    info.is_valid = message_is_live(db_meta, db_cont, slot);
+    info.seq = db_meta->seq + (slot >= 0 ? slot : 0);
+    info.flags = db_meta->flags;
+    info.key = db_meta->key;
+
+info_out:
+    srcu_read_unlock(&(au_info.srcu), srcu_idx);
+    kfree(message);
+    if (ret == 0 && copy_to_user(user_info, &info, sizeof(info)))
+        ret = -EFAULT;  //-EFAULT = indirizzo non valido
+    return ret;
+
+}
+
+//la dev_ioctl() implementa i comandi definiti in singlefilefs_ioctl.h.
+static long dev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+
+    struct read_cursor *cursor;
+    struct super_block *sb;
+    struct sfs_partition part;
+    uint64_t limit;
+    long ret;
+    int srcu_idx;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    //sanity check
+    if (!au_info.is_mounted) {
+        printk("%s: impossibile eseguire ioctl() sul dispositivo: il file system non è stato montato\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODEV; //-ENODEV = file system non esistente
+    }
+
+    cursor = (struct read_cursor *)filp->private_data;
+
+    switch (cmd) {
+        case SFS_IOC_PARTITION:
+            ret = partition_messages(filp->f_path.dentry->d_inode->i_sb, (struct sfs_partition_request *)arg);
+            break;
+        case SFS_IOC_SET_LIMIT:
+            if (copy_from_user(&limit, (uint64_t *)arg, sizeof(limit))) {
+                ret = -EFAULT;  //-EFAULT = indirizzo non valido
+                break;
+            }
+            mutex_lock(&(cursor->lock));
+            cursor->limit_seq = limit;
+            mutex_unlock(&(cursor->lock));
+            ret = 0;
+            break;
+        case SFS_IOC_SEEK_PARTITION:
+            if (copy_from_user(&part, (struct sfs_partition *)arg, sizeof(part))) {
+                ret = -EFAULT;  //-EFAULT = indirizzo non valido
+                break;
+            }
+            sb = filp->f_path.dentry->d_inode->i_sb;
+            mutex_lock(&(cursor->lock));
+            srcu_idx = srcu_read_lock(&(au_info.srcu));
+            ret = cursor_seek_partition(sb, cursor, &part);
+            if (ret == 0)
+                filp->f_pos = cursor->pos = cursor->index;
+            srcu_read_unlock(&(au_info.srcu), srcu_idx);
+            mutex_unlock(&(cursor->lock));
+            break;
+        case SFS_IOC_SNAPSHOT:
+            ret = pin_snapshot(filp, (uint64_t *)arg);
+            break;
+        case SFS_IOC_RELEASE_SNAPSHOT:
+            ret = unpin_snapshot(filp);
+            break;
+        case SFS_IOC_SEARCH:
+            ret = search_messages(filp, (struct sfs_search_request *)arg);
+            break;
+        case SFS_IOC_BLOCK_INFO:
+            ret = block_info(filp->f_path.dentry->d_inode->i_sb, (struct sfs_block_info *)arg);
+            break;
+        default:
+            ret = -ENOTTY;  //-ENOTTY = comando ioctl() non supportato
+    }
+
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
+//la dev_open() apre il dispositivo (deve farlo in modalità di sola scrittura).
+static int dev_open(struct inode *inode, struct file *file) {
+
+    struct read_cursor *cursor;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    //sanity checks
+    if (!au_info.is_mounted) {
+        printk("%s: impossibile aprire il dispositivo: il file system non è stato montato\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODEV; //-ENODEV = file system non esistente
     }
     if (file->f_mode & FMODE_WRITE) {    //il dispositivo deve essere aperto in modalità read only
         printk("%s: impossibile aprire il dispositivo in modalità scrittura\n", MOD_NAME);
@@ -586,6 +2286,16 @@ static int dev_open(struct inode *inode, struct file *file) {
         return -EPERM;  //-EPERM = operazione non consentita
     }
 
+    //allocazione del cursore di lettura di questa apertura del file
+    cursor = kzalloc(sizeof(struct read_cursor), GFP_KERNEL);
+    if (!cursor) {
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    }
+    mutex_init(&(cursor->lock));
+    cursor->message_block = -1;
+    file->private_data = cursor;
+
     printk("%s: device successfully opened\n", MOD_NAME);
     atomic_fetch_add(-1, &(au_info.usages));
   	return 0;
@@ -605,15 +2315,272 @@ static int dev_release(struct inode *inode, struct file *file) {
         return -ENODEV; //-ENODEV = file system non esistente
     }
 
+    //rilascio dell'eventuale snapshot e deallocazione del cursore di lettura
+    if (((struct read_cursor *)file->private_data)->snap)
+        release_snapshot(((struct read_cursor *)file->private_data)->snap);
+    kfree(((struct read_cursor *)file->private_data)->message);
+    kfree(file->private_data);
+    file->private_data = NULL;
+
     printk("%s: device successfully closed\n", MOD_NAME);
     atomic_fetch_add(-1, &(au_info.usages));
   	return 0;
 
 }
 
+//installa la pagina page all'indirizzo del fault vmf con vm_insert_page(), che ne prende un riferimento (la mappatura è VM_MIXEDMAP).
+static vm_fault_t dev_mmap_insert(struct vm_fault *vmf, struct page *page) {
+
+    int err;
+
+    err = vm_insert_page(vmf->vma, vmf->address, page);
+    if (err == 0 || err == -EBUSY)  //-EBUSY: la PTE è già stata installata da un fault concorrente
+        return VM_FAULT_NOPAGE;
+    return (err == -ENOMEM) ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+
+}
+
+/* la dev_mmap_fault() risolve i page fault sulle mappature del file. La mappatura è indicizzata per blocco:
+ * - la pagina i (i < total_data_blocks) è il data block di indice i, con i metadati in testa e il payload dall'offset METADATA_SIZE;
+ *   i blocchi non validi al momento del fault vengono mappati sulla zero page condivisa del kernel (nessuna allocazione).
+ * - con FEAT_META_TABLE, le pagine successive pubblicano la tabella dei metadati (METADATA_PER_BLOCK voci per pagina).
+ * Le pagine valide sono quelle del buffer cache del dispositivo (nessuna copia): i metadati che vi si leggono sono quindi
+ * sempre aggiornati e sono il riferimento per stabilire la validità di un blocco.
+ * Le pagine del buffer cache appartengono al mapping del block device, non a quello del file: vengono quindi installate con
+ * vm_insert_page() (non restituite in vmf->page), per cui il riferimento preso da ciascuna PTE le trattiene in memoria. Le rmap walk
+ * del reclaim e della migrazione, che partono dal mapping della pagina, non trovano queste PTE: una pagina mappata non può essere
+ * liberata né migrata finché la mappatura non viene rimossa, cosa che avviene con munmap() oppure quando il blocco cambia stato
+ * (unmap_mapping_range() sul mapping del file in publish_block_state()).
+ */
+static vm_fault_t dev_mmap_fault(struct vm_fault *vmf) {
+
+    struct super_block *sb;
+    struct buffer_head *bh;
+    struct page *page;
+    uint64_t table_page;
+    vm_fault_t ret;
+    int srcu_idx;
+
+    sb = vmf->vma->vm_file->f_inode->i_sb;
+    if (!au_info.is_mounted)
+        return VM_FAULT_SIGBUS;
+
+    srcu_idx = srcu_read_lock(&(au_info.srcu));
+
+    //pagine della tabella dei metadati
+    if (vmf->pgoff >= au_info.total_data_blocks) {
+        table_page = vmf->pgoff - au_info.total_data_blocks;
+        if (!(au_info.features & FEAT_META_TABLE) || table_page >= DIV_ROUND_UP(au_info.total_data_blocks, METADATA_PER_BLOCK)) {
+            srcu_read_unlock(&(au_info.srcu), srcu_idx);
+            return VM_FAULT_SIGBUS;
+        }
+        bh = sb_bread(sb, au_info.meta_start + table_page);
+        if (!bh) {
+            srcu_read_unlock(&(au_info.srcu), srcu_idx);
+            return VM_FAULT_SIGBUS;
+        }
+        ret = dev_mmap_insert(vmf, bh->b_page);
+        brelse(bh);
+        srcu_read_unlock(&(au_info.srcu), srcu_idx);
+        return ret;
+    }
+
+    //pagine dei data block: la validità viene controllata, e la pagina installata, con la pagina bloccata (vedi publish_block_state()).
+    bh = sb_bread(sb, data_block_number(vmf->pgoff));
+    if (!bh) {
+        srcu_read_unlock(&(au_info.srcu), srcu_idx);
+        return VM_FAULT_SIGBUS;
+    }
+    page = bh->b_page;
+    lock_page(page);
+    if (test_bit(vmf->pgoff, au_info.valid_bitmap))
+        ret = dev_mmap_insert(vmf, page);
+    else
+        ret = dev_mmap_insert(vmf, ZERO_PAGE(vmf->address));
+    unlock_page(page);
+    brelse(bh);
+    srcu_read_unlock(&(au_info.srcu), srcu_idx);
+    return ret;
+
+}
+
+static const struct vm_operations_struct dev_vm_ops = {
+    .fault = dev_mmap_fault,
+};
+
+//la dev_mmap() mappa il file in sola lettura (vedi dev_mmap_fault() per il contenuto della mappatura).
+static int dev_mmap(struct file *filp, struct vm_area_struct *vma) {
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    //sanity checks
+    if (!au_info.is_mounted) {
+        printk("%s: impossibile mappare il dispositivo: il file system non è stato montato\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODEV; //-ENODEV = file system non esistente
+    }
+    if (filp->f_inode->i_sb->s_blocksize != PAGE_SIZE) {   //ogni pagina della mappatura deve corrispondere esattamente a un blocco
+        printk("%s: impossibile mappare il dispositivo: la dimensione dei blocchi è diversa da quella delle pagine\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODEV; //-ENODEV = mappatura non supportata
+    }
+    if (vma->vm_flags & VM_WRITE) { //la mappatura deve essere in sola lettura
+        printk("%s: impossibile mappare il dispositivo in modalità scrittura\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -EPERM;  //-EPERM = operazione non consentita
+    }
+
+    //la mappatura non potrà diventare scrivibile neanche con mprotect()
+    //le pagine vengono installate con vm_insert_page() (vedi dev_mmap_fault()), che richiede una mappatura VM_MIXEDMAP.
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+        vm_flags_clear(vma, VM_MAYWRITE);
+        vm_flags_set(vma, VM_MIXEDMAP);
+    #else
+        vma->vm_flags &= ~VM_MAYWRITE;
+        vma->vm_flags |= VM_MIXEDMAP;
+    #endif
+    vma->vm_ops = &dev_vm_ops;
+
+    printk("%s: device successfully mapped\n", MOD_NAME);
+    atomic_fetch_add(-1, &(au_info.usages));
+    return 0;
+
+}
+
+//operazioni dei buffer inseriti nella pipe da dev_splice_read(): la pagina privata del buffer viene rilasciata quando il
+//consumatore della pipe ha terminato di usarla.
+static const struct pipe_buf_operations dev_pipe_buf_ops = {
+    .release = generic_pipe_buf_release,
+    .get = generic_pipe_buf_get,
+};
+
+/* la dev_splice_read() trasferisce i messaggi validi (nell'ordine temporale delle scritture, come dev_read()) verso una pipe,
+ * in modo che sendfile()/splice() inoltrino il file verso socket e pipe senza passare da un buffer di livello user.
+ * Lo stream è lo stesso di dev_read(): per ogni messaggio l'intero payload (DEFAULT_BLOCK_SIZE-METADATA_SIZE byte), ovvero il
+ * messaggio (decompresso, se memorizzato compresso) completato con byte nulli.
+ * Il trasferimento non è zero-copy: ogni messaggio viene copiato (una sola volta, nel kernel) in una pagina allocata allo scopo, che
+ * viene ceduta alla pipe. La copia avviene all'interno della sezione di lettura del seqcount del blocco, per cui il buffer contiene il
+ * messaggio così com'era in un preciso istante, anche se il blocco viene poi modificato in place, invalidato o riutilizzato da
+ * put_data() prima che il consumatore della pipe lo legga (un buffer che puntasse alla pagina del buffer cache ne rifletterebbe invece
+ * il nuovo contenuto). La posizione nello stream è mantenuta nel cursore di lettura dell'apertura del file, per cui un messaggio può
+ * essere trasferito anche in più chiamate.
+ */
+static ssize_t dev_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags) {
+
+    struct read_cursor *cursor;
+    struct super_block *sb;
+    struct data_block_metadata *db_meta;
+    struct data_block_content *db_cont;
+    struct page *page;          //pagina privata in cui viene copiato il messaggio
+    struct pipe_buffer buf;
+    int64_t block;              //data block del messaggio corrente
+    int slot;                   //slot del messaggio corrente (-1 = messaggio che occupa l'intero blocco)
+    unsigned int payload_seq;   //valore del seqcount del payload all'inizio della copia
+    int corrupted;
+    size_t chunk;
+    ssize_t spliced;
+    ssize_t ret;
+    int srcu_idx;
+
+    //incremento del contatore atomico degli utilizzi del file system
+    atomic_fetch_add(1, &(au_info.usages));
+
+    //sanity check
+    if (!au_info.is_mounted) {
+        printk("%s: impossibile leggere il dispositivo: il file system non è stato montato\n", MOD_NAME);
+        atomic_fetch_add(-1, &(au_info.usages));
+        return -ENODEV; //-ENODEV = file system non esistente
+    }
+
+    cursor = (struct read_cursor *)in->private_data;
+    sb = in->f_inode->i_sb;
+    spliced = 0;
+    ret = 0;
+
+    //il mutex del cursore riguarda soltanto i thread che condividono questa apertura del file, per cui si può attendere.
+    mutex_lock(&(cursor->lock));
+    srcu_idx = srcu_read_lock(&(au_info.srcu));
+
+    ret = cursor_resolve(sb, cursor);
+    if (ret < 0)
+        goto splice_out;
+
+    while (spliced < len && !cursor_at_end(cursor)) {
+        //un payload già trasferito per intero da una chiamata precedente non va estratto di nuovo
+        if (cursor->block_pos >= DEFAULT_BLOCK_SIZE - METADATA_SIZE) {
+            ret = cursor_advance(sb, cursor);
+            if (ret < 0)
+                break;
+            continue;
+        }
+        block = split_address(cursor->next_block, &slot);
+        db_meta = get_block_metadata(sb, block);
+        db_cont = get_block_content(sb, block);
+        if (db_meta == NULL || db_cont == NULL) {
+            printk("%s: impossibile leggere il dispositivo: si è verificato un errore con la lettura del blocco %lld\n", MOD_NAME, block);
+            ret = -EIO; //-EIO = errore di input/output
+            break;
+        }
+        page = alloc_page(GFP_KERNEL);
+        if (!page) {
+            ret = -ENOMEM;  //-ENOMEM = errore di esaurimento della memoria
+            break;
+        }
+        do {
+            payload_seq = read_seqcount_begin(payload_seqcount(block));
+            corrupted = read_message(db_meta, db_cont, slot, page_address(page)) < 0;
+        } while (read_seqcount_retry(payload_seqcount(block), payload_seq));
+        if (corrupted) {
+            printk("%s: impossibile leggere il dispositivo: il messaggio %lld è danneggiato\n", MOD_NAME, cursor->next_block);
+            put_page(page);
+            ret = -EBADMSG; //-EBADMSG = messaggio corrotto
+            break;
+        }
+        chunk = min_t(size_t, DEFAULT_BLOCK_SIZE - METADATA_SIZE - cursor->block_pos, len - spliced);
+        memset(&buf, 0, sizeof(buf));
+        buf.page = page;    //l'unico riferimento alla pagina viene ceduto alla pipe (add_to_pipe() lo rilascia in caso di errore)
+        buf.offset = cursor->block_pos;
+        buf.len = chunk;
+        buf.ops = &dev_pipe_buf_ops;
+        ret = add_to_pipe(pipe, &buf);
+        if (ret < 0)
+            break;
+        spliced += chunk;
+        cursor->block_pos += chunk;
+        if (cursor->block_pos < DEFAULT_BLOCK_SIZE - METADATA_SIZE)
+            break;  //il resto del payload verrà trasferito dalla prossima chiamata
+
+        ret = cursor_advance(sb, cursor);
+        if (ret < 0)
+            break;
+    }
+
+splice_out:
+    //la posizione dello splice è in byte (il chiamante la usa per contabilizzare quanto è stato trasferito): la si registra nel
+    //cursore come ultima posizione comunicata, così che una dev_read() successiva prosegua senza riposizionarsi.
+    if (spliced > 0) {
+        *ppos += spliced;
+        cursor->pos = *ppos;
+        ret = spliced;
+    }
+    srcu_read_unlock(&(au_info.srcu), srcu_idx);
+    mutex_unlock(&(cursor->lock));
+    atomic_fetch_add(-1, &(au_info.usages));
+    return ret;
+
+}
+
 const struct file_operations fops = {
   .owner = THIS_MODULE,
   .read = dev_read,
   .open = dev_open,
   .release = dev_release,
+  .llseek = dev_llseek,
+  .unlocked_ioctl = dev_ioctl,
+#if defined(CONFIG_COMPAT) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+  .compat_ioctl = compat_ptr_ioctl,
+#endif
+  .mmap = dev_mmap,
+  .splice_read = dev_splice_read,
 };
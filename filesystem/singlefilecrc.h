@@ -0,0 +1,77 @@
+#ifndef _ONEFILEFSCRC_H
+#define _ONEFILEFSCRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "singlefilefs.h"
+
+/*
+	CRC32C (polinomio di Castagnoli, forma riflessa 0x82F63B78) dei payload, calcolato dai tool di livello user esattamente
+	come fa il modulo con crc32c() del kernel: seme PAYLOAD_CSUM_SEED e nessuna inversione finale. Su x86-64 con SSE4.2
+	si usa l'istruzione crc32 (8 byte alla volta), altrimenti una tabella da 256 voci costruita all'avvio del programma.
+*/
+
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[256];
+
+//costruisce la tabella del calcolo software (eseguita prima di main(), per cui i thread la trovano già pronta)
+__attribute__((constructor)) static void crc32c_init_table(void) {
+
+	uint32_t crc;
+	int i, j;
+
+	for(i=0; i<256; i++) {
+		crc = i;
+		for(j=0; j<8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[i] = crc;
+	}
+
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t len) {
+
+	while (len--)
+		crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return crc;
+
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t len) {
+
+	uint64_t crc64 = crc;
+	uint64_t word;
+
+	for(; len >= sizeof(uint64_t); data += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+		memcpy(&word, data, sizeof(uint64_t));
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+	for(; len; data++, len--)
+		crc = __builtin_ia32_crc32qi(crc, *data);
+	return crc;
+
+}
+#endif
+
+//aggiorna il CRC32C crc con len byte di data
+static uint32_t sfs_crc32c(uint32_t crc, const void *data, size_t len) {
+
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		return crc32c_hw(crc, data, len);
+#endif
+	return crc32c_sw(crc, data, len);
+
+}
+
+//CRC32C dell'intero payload di un data block, come registrato nel campo checksum dei metadati
+static inline uint32_t payload_checksum(const char *payload) {
+	return sfs_crc32c(PAYLOAD_CSUM_SEED, payload, DEFAULT_BLOCK_SIZE-METADATA_SIZE);
+}
+
+#endif
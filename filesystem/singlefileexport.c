@@ -0,0 +1,290 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "singlefilefs.h"
+#include "singlefilefs_ioctl.h"
+#include "singlefileimg.h"
+#include "singlefilelz4.h"
+
+/*
+	singlefileexport esporta i messaggi validi di un'immagine di singlefilefs NON montata, seguendo l'ordine temporale
+	delle scritture (catena next_valid a partire da first_valid) e senza passare dal modulo kernel.
+	Ogni messaggio viene emesso come record composto da una lunghezza a 32 bit little-endian seguita dal payload:
+	è lo stesso formato accettato da "singlefilemakefs -i <file> -l", per cui l'output può essere usato come backup.
+	I record vengono accumulati in un buffer da EXPORT_BUFFER_SIZE byte e scritti con poche write() di grandi dimensioni.
+	I messaggi di riepilogo vengono stampati su stderr, dato che stdout può essere l'output dell'esportazione.
+	I messaggi memorizzati compressi (BLOCK_COMPRESSED) vengono decompressi, per cui l'output contiene sempre i messaggi originali;
+	di un blocco impacchettato (BLOCK_PACKED) vengono emessi gli slot validi, nell'ordine degli slot.
+	Con l'opzione -s l'argomento è invece il file di un singlefilefs montato, che viene letto attraverso uno snapshot
+	(SFS_IOC_SNAPSHOT): l'esportazione è consistente anche se nel frattempo vengono scritti o invalidati dei messaggi.
+*/
+
+#define EXPORT_BUFFER_SIZE (4<<20)	//dimensione del buffer di output
+#define EXPORT_READAHEAD_BLOCKS 32	//data block della catena di cui viene richiesta in anticipo la lettura (solo con la tabella dei metadati)
+
+//buffer di output
+struct out_buffer {
+	int fd;
+	char *data;
+	size_t used;
+	uint64_t written;		//byte scritti in totale
+};
+
+//FUNCTIONS PROTOTYPES
+int flush_output(struct out_buffer *);
+int append_record(struct out_buffer *, const char *, uint32_t);
+long extract_message(const char *, size_t, int, char *);
+void prefetch_chain(struct sfs_image *, int64_t, int);
+int export_image(const char *, struct out_buffer *, uint64_t *);
+int export_mounted(const char *, struct out_buffer *, uint64_t *);
+
+//scrive su disco il contenuto del buffer di output. Restituisce 0 in caso di successo, -1 altrimenti.
+int flush_output(struct out_buffer *out) {
+
+	ssize_t ret;
+	size_t done;
+
+	for(done=0; done<out->used; done+=ret) {
+		ret = write(out->fd, out->data + done, out->used - done);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			perror("Error writing the output");
+			return -1;
+		}
+	}
+	out->written += out->used;
+	out->used = 0;
+	return 0;
+
+}
+
+//accoda al buffer di output il record (lunghezza + payload) del messaggio payload di size byte.
+int append_record(struct out_buffer *out, const char *payload, uint32_t size) {
+
+	unsigned char *length;
+
+	if (out->used + sizeof(uint32_t) + size > EXPORT_BUFFER_SIZE && flush_output(out) < 0)
+		return -1;
+	length = (unsigned char *)out->data + out->used;
+	length[0] = size & 0xff;
+	length[1] = (size >> 8) & 0xff;
+	length[2] = (size >> 16) & 0xff;
+	length[3] = (size >> 24) & 0xff;
+	memcpy(out->data + out->used + sizeof(uint32_t), payload, size);
+	out->used += sizeof(uint32_t) + size;
+	return 0;
+
+}
+
+//estrae in message (DEFAULT_BLOCK_SIZE-METADATA_SIZE byte) il messaggio memorizzato nei stored byte di src, decompresso se compressed.
+//restituisce la lunghezza del messaggio (fino al primo byte nullo), oppure -1 se il messaggio compresso è danneggiato.
+long extract_message(const char *src, size_t stored, int compressed, char *message) {
+
+	long len;
+
+	if (compressed) {
+		len = lz4_decompress_block(src, stored, message, DEFAULT_BLOCK_SIZE-METADATA_SIZE);
+		return (len < 0) ? -1 : (long)strnlen(message, len);
+	}
+	//il payload non ha una lunghezza esplicita: è terminato dal primo byte nullo (o dalla fine dello spazio che occupa).
+	memcpy(message, src, stored);
+	return strnlen(message, stored);
+
+}
+
+//con la tabella dei metadati la catena può essere seguita senza toccare i data block: viene richiesta in anticipo (MADV_WILLNEED) la
+//lettura dei count data block della catena a partire da curr, in modo che una catena sparsa nell'immagine non costi una lettura
+//sincrona (un page fault) per ogni blocco.
+void prefetch_chain(struct sfs_image *img, int64_t curr, int count) {
+
+	for(; count>0 && curr>=0 && (uint64_t)curr<img->sb->total_data_blocks; count--) {
+		madvise(image_data_block(img, curr), DEFAULT_BLOCK_SIZE, MADV_WILLNEED);
+		curr = image_metadata(img, curr)->next_valid;
+	}
+
+}
+
+//esporta i messaggi validi dell'immagine NON montata path, seguendo la catena dei blocchi. Restituisce 0 in caso di successo, -1 altrimenti.
+int export_image(const char *path, struct out_buffer *out, uint64_t *exported) {
+
+	struct sfs_image img;
+	struct data_block_metadata *meta;
+	struct data_block_content *cont;
+	struct packed_header *hdr;
+	char message[DEFAULT_BLOCK_SIZE-METADATA_SIZE];
+	uint64_t steps;			//blocchi della catena attraversati
+	int64_t curr;
+	long len;
+	int slot;
+
+	if (image_open(&img, path, 0) < 0)
+		return -1;
+	//la catena segue l'ordine delle scritture, che per un'immagine appena importata coincide con l'ordine dei blocchi.
+	madvise(img.base, img.size, MADV_SEQUENTIAL);
+
+	for(curr=img.sb->first_valid, steps=0; curr!=-1; curr=meta->next_valid, steps++) {
+		if (curr < 0 || (uint64_t)curr >= img.sb->total_data_blocks || steps == img.sb->total_data_blocks) {
+			fprintf(stderr, "Broken block chain after %lu messages: run singlefilefsck on the image.\n", *exported);
+			image_close(&img);
+			return -1;
+		}
+		meta = image_metadata(&img, curr);
+		if (!meta->is_valid) {
+			fprintf(stderr, "Block %ld in the chain is not valid: run singlefilefsck on the image.\n", curr);
+			image_close(&img);
+			return -1;
+		}
+		if ((img.sb->features & FEAT_META_TABLE) && steps % (EXPORT_READAHEAD_BLOCKS/2) == 0)
+			prefetch_chain(&img, curr, EXPORT_READAHEAD_BLOCKS);
+		cont = image_data_block(&img, curr);
+		if (meta->flags & BLOCK_PACKED) {
+			hdr = (struct packed_header *)cont->payload;
+			for(slot=0; slot<hdr->slots && slot<PACKED_MAX_SLOTS; slot++) {
+				if (!(hdr->slot[slot].flags & SLOT_VALID))
+					continue;
+				len = (hdr->slot[slot].offset + hdr->slot[slot].length > DEFAULT_BLOCK_SIZE-METADATA_SIZE) ? -1 :
+					extract_message(cont->payload + hdr->slot[slot].offset, hdr->slot[slot].length, hdr->slot[slot].flags & SLOT_COMPRESSED, message);
+				if (len < 0) {
+					fprintf(stderr, "Block %ld holds a damaged packed message (slot %d): run singlefilefsck on the image.\n", curr, slot);
+					image_close(&img);
+					return -1;
+				}
+				if (append_record(out, message, len) < 0) {
+					image_close(&img);
+					return -1;
+				}
+				(*exported)++;
+			}
+			continue;
+		}
+		if (meta->flags & BLOCK_COMPRESSED)
+			len = (meta->stored_len > DEFAULT_BLOCK_SIZE-METADATA_SIZE) ? -1 : extract_message(cont->payload, meta->stored_len, 1, message);
+		else if ((meta->flags & BLOCK_LENGTH) && meta->length <= DEFAULT_BLOCK_SIZE-METADATA_SIZE) {
+			memcpy(message, cont->payload, meta->length);
+			len = meta->length;
+		}
+		else
+			len = extract_message(cont->payload, sizeof(message), 0, message);
+		if (len < 0) {
+			fprintf(stderr, "Block %ld holds a damaged compressed message: run singlefilefsck on the image.\n", curr);
+			image_close(&img);
+			return -1;
+		}
+		if (append_record(out, message, len) < 0) {
+			image_close(&img);
+			return -1;
+		}
+		(*exported)++;
+	}
+	image_close(&img);
+	return 0;
+
+}
+
+//esporta i messaggi del file path di un file system montato, leggendoli attraverso uno snapshot.
+//restituisce 0 in caso di successo, -1 altrimenti.
+int export_mounted(const char *path, struct out_buffer *out, uint64_t *exported) {
+
+	char payload[DEFAULT_BLOCK_SIZE-METADATA_SIZE];
+	uint64_t snapshot_seq;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror("Error opening the file");
+		return -1;
+	}
+	//lo snapshot viene creato con il mutex degli scrittori acquisito: in caso di contesa si ritenta, come per le system call.
+	while ((ret = ioctl(fd, SFS_IOC_SNAPSHOT, &snapshot_seq)) == -1 && errno == EBUSY) {}
+	if (ret == -1) {
+		perror("Error creating the snapshot");
+		close(fd);
+		return -1;
+	}
+	fprintf(stderr, "Exporting the snapshot of the messages with sequence number below %lu.\n", snapshot_seq);
+
+	//il buffer contiene l'intero payload di un blocco, per cui ogni read() restituisce esattamente un messaggio.
+	while ((ret = read(fd, payload, sizeof(payload))) > 0) {
+		if (append_record(out, payload, strnlen(payload, ret)) < 0) {
+			close(fd);
+			return -1;
+		}
+		(*exported)++;
+	}
+	if (ret == -1)
+		perror("Error reading the file");
+	close(fd);	//la chiusura del file rilascia lo snapshot
+	return (ret == -1) ? -1 : 0;
+
+}
+
+int main(int argc, char *argv[])
+{
+	struct out_buffer out;
+	struct timespec t_start, t_end;
+
+	//qui iniziano le variabili locali definite direttamente da me
+	int opt;
+	int mounted;			//flag che indica se l'argomento è il file di un file system montato (opzione -s)
+	char *output_path;		//file di output (opzione -o); di default stdout
+	uint64_t exported;
+	double seconds;
+	int ret;
+
+	output_path = NULL;
+	mounted = 0;
+	while ((opt = getopt(argc, argv, "o:s")) != -1) {
+		switch (opt) {
+			case 'o':
+				output_path = optarg;
+				break;
+			case 's':
+				mounted = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: singlefileexport [-o <output>] [-s] <image | mounted file>\n");
+				return -1;
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, "Usage: singlefileexport [-o <output>] [-s] <image | mounted file>\n");
+		return -1;
+	}
+
+	out.fd = output_path ? open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+	out.data = malloc(EXPORT_BUFFER_SIZE);
+	out.used = 0;
+	out.written = 0;
+	if (out.fd == -1 || !out.data) {
+		perror("Error preparing the output");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	exported = 0;
+	ret = mounted ? export_mounted(argv[optind], &out, &exported) : export_image(argv[optind], &out, &exported);
+	if (ret < 0 || flush_output(&out) < 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+	seconds = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+	fprintf(stderr, "Exported %lu messages (%lu bytes) in %.3f s (%.1f MB/s).\n", exported, out.written, seconds,
+		seconds > 0 ? (out.written / 1048576.0) / seconds : 0.0);
+
+	free(out.data);
+	if (output_path)
+		close(out.fd);
+	return 0;
+
+}
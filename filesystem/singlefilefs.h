@@ -21,9 +21,45 @@
 #define UNIQUE_FILE_NAME "the-file"
 
 //qui iniziano le define aggiunte da me
-#define FS_VERSION 1
-#define METADATA_SIZE 8								//numero di byte che compongono i metadati di ciascun blocco
-#define SUPERBLOCK_STRUCT_SIZE 6*sizeof(uint64_t)	//numero di byte occupati da struct onefilefs_sb_info
+#define FS_VERSION 3								//versione 3: metadati dei blocchi estesi a 64 byte (chiave e flag del messaggio)
+#define METADATA_SIZE 64							//numero di byte che compongono i metadati di ciascun blocco
+#define SUPERBLOCK_STRUCT_SIZE 18*sizeof(uint64_t)	//numero di byte occupati da struct onefilefs_sb_info
+#define METADATA_PER_BLOCK (DEFAULT_BLOCK_SIZE/METADATA_SIZE)	//numero di voci della tabella dei metadati contenute in un blocco
+
+#define BITMAP_BITS_PER_BLOCK (DEFAULT_BLOCK_SIZE*8)	//numero di data block descritti da un blocco della bitmap di allocazione
+#define BITMAP_START 2								//la bitmap di allocazione segue superblocco e inode del file
+
+//stato del file system (campo state del superblocco)
+#define FS_STATE_DIRTY 0							//montato (o smontato in modo non pulito): il riepilogo su disco non è affidabile
+#define FS_STATE_CLEAN 1							//smontato in modo pulito: bitmap e contatori su disco sono aggiornati
+
+//flag dell'offset di lseek() sul file: con SEEK_SET, i bit restanti indicano un numero di sequenza anziché l'indice di un messaggio
+#define SFS_SEEK_SEQ (1LL << 62)
+
+//feature del layout on-disk (campo features del superblocco)
+#define FEAT_META_TABLE 0x1							//i metadati dei blocchi sono in una tabella contigua subito dopo l'inode del file
+
+//flag del messaggio (campo flags dei metadati del blocco)
+#define BLOCK_KEYED 0x1								//il messaggio è stato scritto con una chiave (campo key), unica tra i messaggi validi
+#define BLOCK_CHECKSUM 0x2							//il campo checksum contiene il CRC32C dell'intero payload
+#define BLOCK_COMPRESSED 0x4						//il payload contiene il messaggio compresso con LZ4 (formato a blocchi), lungo stored_len byte
+#define BLOCK_PACKED 0x8							//il payload contiene più messaggi brevi, descritti dalla directory degli slot (struct packed_header)
+#define BLOCK_LENGTH 0x10							//il campo length contiene la lunghezza del messaggio (non compresso e non impacchettato)
+#define BLOCK_MOVED 0x20							//blocco non valido il cui messaggio è stato spostato dalla compattazione nel blocco next_valid
+
+//blocchi impacchettati: i messaggi occupano gli slot nell'ordine di scrittura e lo slot i ha numero di sequenza seq+i (seq dei metadati del blocco)
+#define PACKED_MAX_SLOTS 64							//numero massimo di messaggi di un blocco impacchettato
+#define PACKED_MAX_MESSAGE 1024						//lunghezza massima (memorizzata) di un messaggio impacchettato
+#define SLOT_VALID 0x1								//lo slot contiene un messaggio valido
+#define SLOT_COMPRESSED 0x2							//il messaggio dello slot è compresso con LZ4
+
+//indirizzo di un messaggio (valore restituito da put_data()): l'indice del blocco, con lo slot (+1) nei bit alti per i messaggi impacchettati
+#define PACKED_SLOT_SHIFT 48
+#define PACKED_ADDRESS(block, slot) ((((int64_t)(slot) + 1) << PACKED_SLOT_SHIFT) | (int64_t)(block))
+#define ADDRESS_BLOCK(address) ((address) & ((1LL << PACKED_SLOT_SHIFT) - 1))
+#define ADDRESS_SLOT(address) ((int)((address) >> PACKED_SLOT_SHIFT) - 1)	//-1 = messaggio che occupa l'intero blocco
+
+#define PAYLOAD_CSUM_SEED 0xFFFFFFFF				//valore iniziale del CRC32C del payload (senza inversione finale, come crc32c() del kernel)
 
 //inode definition
 struct onefilefs_inode {
@@ -48,23 +84,65 @@ struct onefilefs_sb_info {
 	uint64_t block_size;
 	//qui iniziano i campi definiti da me
 	uint64_t total_data_blocks;
-	uint64_t first_valid;	//primo blocco valido in ordine temporale
-	uint64_t last_valid;	//ultimo blocco valido in ordine temporale
+	int64_t first_valid;	//primo blocco valido in ordine temporale (-1 se non ci sono blocchi validi)
+	int64_t last_valid;		//ultimo blocco valido in ordine temporale (-1 se non ci sono blocchi validi)
+	uint64_t features;		//feature del layout on-disk (FEAT_*)
+	uint64_t meta_start;	//primo blocco della tabella dei metadati (significativo solo con FEAT_META_TABLE)
+	uint64_t meta_blocks;	//numero di blocchi occupati dalla tabella dei metadati (0 senza FEAT_META_TABLE)
+	uint64_t data_start;	//indice (assoluto) del blocco che ospita il data block di offset 0
+	uint64_t state;			//FS_STATE_CLEAN se il riepilogo (bitmap + contatori) è stato scritto da uno smontaggio pulito
+	uint64_t bitmap_start;	//primo blocco della bitmap di allocazione (bit i del byte i/8 = data block i valido)
+	uint64_t bitmap_blocks;	//numero di blocchi occupati dalla bitmap di allocazione
+	uint64_t valid_blocks;	//numero di data block validi (significativo solo con state == FS_STATE_CLEAN)
+	uint64_t next_seq;		//numero di sequenza che verrà assegnato al prossimo messaggio scritto
+	uint64_t keyed_blocks;	//numero di data block validi con chiave (significativo solo con state == FS_STATE_CLEAN)
+	uint64_t valid_messages;	//numero di messaggi validi, compresi quelli impacchettati (significativo solo con state == FS_STATE_CLEAN)
+	uint64_t moved_blocks;	//numero di blocchi marcati BLOCK_MOVED (significativo solo con state == FS_STATE_CLEAN)
 };
 
-//data block metadata definition
+//data block metadata definition (layout v3)
+//tutti i campi sono allineati naturalmente, per cui gli accessi si traducono in semplici load/store senza mascheramenti.
 struct data_block_metadata {
-	int next_valid : 31;	//indica il prossimo blocco reso valido in ordine temporale; serve a stabilire il corretto ordinamento delle scritture sui blocchi.
-	int prev_valid : 31;	//indica il precedente blocco reso valido in ordine temporale; serve a stabilire il corretto ordinamento delle scritture sui blocchi.
-	int is_valid : 2;		//flag che indica se il blocco è valido o meno.
-} __attribute__((packed));
+	int64_t next_valid;		//indica il prossimo blocco reso valido in ordine temporale; serve a stabilire il corretto ordinamento delle scritture sui blocchi (con BLOCK_MOVED, la nuova posizione del messaggio).
+	int64_t prev_valid;		//indica il precedente blocco reso valido in ordine temporale; serve a stabilire il corretto ordinamento delle scritture sui blocchi.
+	uint64_t seq;			//numero di sequenza del messaggio (crescente in ordine di scrittura, a partire da 1; 0 = non numerato).
+	uint64_t key;			//chiave del messaggio (significativa solo con BLOCK_KEYED).
+	uint64_t version;		//versione del messaggio: vale 0 alla scrittura e viene incrementata da ogni modifica in place del payload.
+	uint32_t checksum;		//CRC32C dell'intero payload (significativo solo con BLOCK_CHECKSUM).
+	uint32_t stored_len;	//numero di byte del payload occupati dal messaggio compresso (significativo solo con BLOCK_COMPRESSED).
+	uint32_t length;		//byte del payload occupati dal messaggio (significativo solo con BLOCK_LENGTH; senza, il messaggio termina al primo byte nullo).
+	uint32_t reserved;		//riservato per estensioni future del layout (vale 0).
+	uint32_t flags;			//flag del messaggio (BLOCK_*).
+	uint32_t is_valid;		//flag che indica se il blocco è valido o meno.
+};
 
 //data block complete definition
+//con FEAT_META_TABLE l'header in testa al blocco non viene utilizzato (i metadati stanno nella tabella), ma il payload
+//resta allo stesso offset in modo che la dimensione massima di un messaggio non dipenda dal layout scelto.
 struct data_block_content {
 	struct data_block_metadata metadata;
 	char payload[DEFAULT_BLOCK_SIZE-METADATA_SIZE];
 };
 
+//slot della directory di un blocco impacchettato
+struct packed_slot {
+	uint16_t offset;		//posizione del messaggio all'interno del payload
+	uint16_t length;		//byte del payload occupati dal messaggio
+	uint16_t flags;			//SLOT_*
+	uint16_t reserved;
+};
+
+//directory degli slot, in testa al payload di un blocco impacchettato; i messaggi seguono la directory, uno dopo l'altro.
+//gli slot non vengono mai riutilizzati; lo spazio dei messaggi invalidati torna disponibile con il rilascio dell'intero blocco oppure,
+//per l'ultimo blocco della catena, quando serve a un nuovo messaggio (reclaim_packed_space()).
+struct packed_header {
+	uint16_t slots;			//slot utilizzati
+	uint16_t live;			//slot validi (il blocco viene invalidato insieme al suo ultimo messaggio valido)
+	uint16_t end;			//primo byte libero del payload
+	uint16_t reserved;
+	struct packed_slot slot[PACKED_MAX_SLOTS];
+};
+
 //file.c
 extern const struct inode_operations onefilefs_inode_ops;
 extern const struct file_operations fops;
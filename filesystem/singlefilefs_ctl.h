@@ -0,0 +1,127 @@
+#ifndef _ONEFILEFSCTL_H
+#define _ONEFILEFSCTL_H
+
+#ifdef __KERNEL__
+#include <linux/ioctl.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+/*
+	Interfaccia del dispositivo di controllo /dev/singlefilefs (misc device registrato dal modulo), condivisa tra il modulo kernel
+	e il software di livello user. Il dispositivo offre l'intero insieme delle operazioni delle system call senza dipendere dalla
+	system call table: SFS_CTL_OP esegue una singola operazione, SFS_CTL_BATCH un array di operazioni con una sola chiamata.
+	Ogni apertura del dispositivo può inoltre predisporre una coppia di code circolari in memoria condivisa (SFS_CTL_RING_SETUP +
+	mmap()): l'utente accoda nella coda di sottomissione (SQ) le operazioni, un kthread del modulo le preleva a lotti, le esegue e
+	ne accoda l'esito nella coda dei completamenti (CQ). Una system call (SFS_CTL_RING_ENTER) serve soltanto a risvegliare il
+	kthread quando è addormentato (SFS_RING_NEED_WAKEUP) o ad attendere i completamenti.
+	Come in singlefilefs_ioctl.h, le strutture hanno campi naturalmente allineati e lo stesso layout per i processi a 32 e a 64 bit.
+*/
+
+#define SFS_CTL_DEVICE "/dev/singlefilefs"
+#define SFS_CTL_MAGIC 0xF6
+
+#define SFS_RING_MAX_ENTRIES 4096	//numero massimo di richieste della coda di sottomissione
+
+//operazioni (campo opcode di struct sfs_op e struct sfs_sqe) e system call corrispondenti, di cui riportano il risultato
+#define SFS_OP_PUT 1				//put_data(buf, len): il risultato è l'indirizzo del messaggio scritto
+#define SFS_OP_GET 2				//get_data(address, buf, len): il risultato è il numero di byte consegnati
+#define SFS_OP_INVALIDATE 3			//invalidate_data(address)
+#define SFS_OP_PUT_KEYED 4			//put_keyed_data(key, buf, len)
+#define SFS_OP_GET_BY_KEY 5			//get_data_by_key(key, buf, len)
+#define SFS_OP_INVALIDATE_BY_KEY 6	//invalidate_data_by_key(key)
+#define SFS_OP_UPDATE 7				//update_data(address, buf, len, 1): il messaggio mantiene la sua posizione
+#define SFS_OP_UPDATE_TO_TAIL 8		//update_data(address, buf, len, 0): il messaggio viene spostato in fondo all'ordine delle scritture
+#define SFS_OP_APPEND 9				//append_data(address, buf, len)
+#define SFS_OP_PUT_IF_TAIL 10		//put_data_if_tail(buf, len, seq)
+#define SFS_OP_UPDATE_IF 11			//update_data_if(address, buf, len, seq, version)
+#define SFS_OP_INVALIDATE_IF 12		//invalidate_data_if(address, seq, version)
+
+#define SFS_BATCH_STOP_ON_ERROR 0x1	//SFS_CTL_BATCH si ferma alla prima operazione con risultato negativo
+
+//operazione eseguita con SFS_CTL_OP o SFS_CTL_BATCH (i campi non usati dall'operazione vengono ignorati)
+struct sfs_op {
+	uint64_t opcode;		//SFS_OP_*
+	int64_t address;		//indirizzo del messaggio
+	uint64_t key;			//chiave del messaggio
+	uint64_t buf;			//indirizzo (user) del messaggio da scrivere o del buffer di destinazione
+	uint64_t len;			//byte di buf
+	uint64_t seq;			//condizione: numero di sequenza atteso (per SFS_OP_PUT_IF_TAIL, quello dell'ultimo messaggio valido)
+	uint64_t version;		//condizione: versione attesa
+	int64_t result;			//out: risultato della system call corrispondente (codice di errore negativo in caso di fallimento)
+};
+
+//argomento di SFS_CTL_BATCH
+struct sfs_batch {
+	uint64_t ops;			//indirizzo (user) di un array di count elementi di tipo struct sfs_op
+	uint64_t count;			//numero di operazioni
+	uint64_t flags;			//SFS_BATCH_*
+	uint64_t done;			//out: numero di operazioni eseguite (i loro result sono significativi)
+};
+
+//flag di sfs_ring_ctl.flags (scritti dal kernel)
+#define SFS_RING_NEED_WAKEUP 0x1	//il kthread si è addormentato: dopo aver accodato delle richieste bisogna invocare SFS_CTL_RING_ENTER
+
+//richiesta della coda di sottomissione (stessi campi di struct sfs_op, il risultato viene riportato nel completamento)
+struct sfs_sqe {
+	uint64_t opcode;		//SFS_OP_*
+	int64_t address;
+	uint64_t key;
+	uint64_t buf;
+	uint64_t len;
+	uint64_t seq;
+	uint64_t version;
+	uint64_t user_data;		//valore riportato invariato nel completamento
+};
+
+//completamento di una richiesta
+struct sfs_cqe {
+	uint64_t user_data;		//user_data della richiesta
+	int64_t result;			//valore che avrebbe restituito la system call corrispondente (codice di errore negativo in caso di fallimento)
+};
+
+//indici delle due code, all'inizio della mappatura. Gli indici crescono indefinitamente (modulo 2^32): la posizione di un elemento
+//è indice & mask. I campi scritti dal kernel e quelli scritti dall'utente stanno in linee di cache distinte.
+struct sfs_ring_ctl {
+	//scritti dal kernel
+	uint32_t sq_head;		//prossima richiesta che il kthread preleverà
+	uint32_t cq_tail;		//posizione del prossimo completamento
+	uint32_t flags;			//SFS_RING_*
+	uint32_t sq_mask;		//sq_entries - 1
+	uint32_t cq_mask;		//cq_entries - 1
+	uint32_t kernel_pad[11];
+	//scritti dall'utente
+	uint32_t sq_tail;		//posizione della prossima richiesta (va pubblicata dopo aver scritto la richiesta)
+	uint32_t cq_head;		//prossimo completamento da consumare (va pubblicato dopo aver letto il completamento)
+	uint32_t user_pad[14];
+};
+
+//argomento di SFS_CTL_RING_SETUP
+struct sfs_ring_params {
+	uint64_t sq_entries;	//in: richieste della coda di sottomissione (arrotondate alla potenza di 2 successiva); out: valore effettivo
+	uint64_t cq_entries;	//out: completamenti della coda dei completamenti (2 * sq_entries)
+	uint64_t size;			//out: byte da mappare con mmap() a partire dall'offset 0
+	uint64_t sqes_off;		//out: offset nella mappatura dell'array delle richieste (struct sfs_sqe)
+	uint64_t cqes_off;		//out: offset nella mappatura dell'array dei completamenti (struct sfs_cqe)
+};
+
+//argomento di SFS_CTL_RING_ENTER
+struct sfs_ring_enter {
+	uint64_t min_complete;	//in: numero di completamenti non ancora consumati da attendere (0 = nessuna attesa)
+	uint64_t ready;			//out: numero di completamenti non ancora consumati
+};
+
+//predispone le code di questa apertura del dispositivo e avvia il kthread che le serve (una sola volta per apertura).
+#define SFS_CTL_RING_SETUP _IOWR(SFS_CTL_MAGIC, 1, struct sfs_ring_params)
+//risveglia il kthread e, se min_complete > 0, attende che la coda dei completamenti contenga almeno min_complete elementi.
+#define SFS_CTL_RING_ENTER _IOWR(SFS_CTL_MAGIC, 2, struct sfs_ring_enter)
+//esegue un'operazione: restituisce il suo codice di errore oppure 0, scrivendo il risultato in result.
+#define SFS_CTL_OP _IOWR(SFS_CTL_MAGIC, 3, struct sfs_op)
+//esegue in ordine le operazioni di un array, scrivendo il risultato di ciascuna; restituisce 0 anche se qualche operazione fallisce
+//(ma un segnale può interrompere il lotto: done indica quante operazioni sono state eseguite). done viene scritto anche quando
+//SFS_CTL_BATCH fallisce con EFAULT, nel qual caso i result delle ultime operazioni eseguite possono essere andati persi.
+#define SFS_CTL_BATCH _IOWR(SFS_CTL_MAGIC, 4, struct sfs_batch)
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _ONEFILEFSIOCTL_H
+#define _ONEFILEFSIOCTL_H
+
+#ifdef __KERNEL__
+#include <linux/ioctl.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+/*
+	Interfaccia ioctl() del file del file system, condivisa tra il modulo kernel e il software di livello user.
+	Tutte le strutture hanno campi a 64 bit naturalmente allineati, per cui il layout è lo stesso per i processi a 32 e a 64 bit.
+*/
+
+#define SFS_IOC_MAGIC 0xF5
+
+#define SFS_MAX_PARTITIONS 1024		//numero massimo di partizioni restituite da SFS_IOC_PARTITION
+#define SFS_MAX_PATTERN 256			//lunghezza massima del pattern di SFS_IOC_SEARCH
+#define SFS_MAX_HITS 1024			//numero massimo di risultati restituiti da una chiamata di SFS_IOC_SEARCH
+
+//partizione dei messaggi validi: intervallo [start_seq, end_seq) di numeri di sequenza
+struct sfs_partition {
+	uint64_t start_seq;		//numero di sequenza del primo messaggio della partizione
+	uint64_t end_seq;		//primo numero di sequenza escluso dalla partizione
+	uint64_t count;			//numero di messaggi della partizione al momento della suddivisione
+	int64_t start_block;	//indirizzo del primo messaggio della partizione (indice del data block, con lo slot per un messaggio impacchettato)
+	uint64_t start_index;	//indice (posizione nel file) del primo messaggio della partizione
+};
+
+//argomento di SFS_IOC_PARTITION
+struct sfs_partition_request {
+	uint64_t parts;			//in: numero di partizioni richieste (al più SFS_MAX_PARTITIONS); out: numero di partizioni restituite
+	uint64_t total;			//out: numero di messaggi validi dello snapshot
+	uint64_t snapshot_seq;	//out: primo numero di sequenza escluso dallo snapshot (messaggi scritti dopo la suddivisione)
+	uint64_t partitions;	//indirizzo (user) di un array di parts elementi di tipo struct sfs_partition
+};
+
+//messaggio che contiene il pattern cercato con SFS_IOC_SEARCH
+struct sfs_search_hit {
+	int64_t block;			//indirizzo del messaggio (indice del data block, con lo slot per un messaggio impacchettato)
+	uint64_t seq;			//numero di sequenza del messaggio
+};
+
+//argomento di SFS_IOC_SEARCH
+struct sfs_search_request {
+	uint64_t pattern;		//indirizzo (user) della sequenza di byte da cercare
+	uint64_t pattern_len;	//lunghezza del pattern (da 1 a SFS_MAX_PATTERN byte)
+	uint64_t hits;			//indirizzo (user) di un array di max_hits elementi di tipo struct sfs_search_hit
+	uint64_t max_hits;		//in: capacità dell'array hits (al più SFS_MAX_HITS risultati per chiamata, anche se è maggiore)
+	uint64_t found;			//out: numero di elementi scritti in hits
+	uint64_t start_seq;		//in: minimo numero di sequenza dei messaggi da esaminare (0 = dall'inizio);
+							//out: numero di sequenza da cui proseguire la ricerca (0 = ricerca completata)
+	uint64_t scanned;		//out: numero di messaggi esaminati
+};
+
+//stato del messaggio di un data block, restituito da SFS_IOC_BLOCK_INFO
+struct sfs_block_info {
+	int64_t block;			//in: indirizzo del messaggio (-1 = ultimo messaggio valido); out: indirizzo del messaggio (-1 se non ci sono messaggi validi)
+	uint64_t is_valid;		//out: 1 se il blocco contiene un messaggio valido
+	uint64_t seq;			//out: numero di sequenza del messaggio
+	uint64_t version;		//out: versione del messaggio (incrementata da ogni modifica in place del payload)
+	uint64_t flags;			//out: flag del messaggio (BLOCK_*)
+	uint64_t key;			//out: chiave del messaggio (significativa solo con BLOCK_KEYED)
+	uint64_t length;		//out: lunghezza del messaggio (quella registrata nei metadati, anche oltre eventuali byte nulli; per un messaggio compresso, dopo la decompressione)
+	uint64_t stored_length;	//out: byte del payload occupati dal messaggio (minori di length se il messaggio è memorizzato compresso)
+};
+
+//suddivide i messaggi validi in (al più) parts partizioni contigue nell'ordine delle scritture, di dimensione quanto più possibile uguale.
+#define SFS_IOC_PARTITION _IOWR(SFS_IOC_MAGIC, 1, struct sfs_partition_request)
+//imposta il primo numero di sequenza escluso dalle letture di questa apertura del file (0 = nessun limite): raggiunto il limite,
+//read() restituisce 0 come alla fine del file.
+#define SFS_IOC_SET_LIMIT _IOW(SFS_IOC_MAGIC, 2, uint64_t)
+//fissa uno snapshot dei messaggi validi e vi associa questa apertura del file, riportandola all'inizio: le letture successive vedono
+//esattamente i messaggi validi al momento della chiamata, anche se nel frattempo vengono invalidati. Restituisce il primo numero di
+//sequenza escluso dallo snapshot.
+#define SFS_IOC_SNAPSHOT _IOR(SFS_IOC_MAGIC, 3, uint64_t)
+//rilascia lo snapshot di questa apertura del file (che torna a leggere la catena corrente, dall'inizio).
+#define SFS_IOC_RELEASE_SNAPSHOT _IO(SFS_IOC_MAGIC, 4)
+//cerca nei messaggi (per l'intera loro lunghezza), nell'ordine delle scritture, la sequenza di byte pattern e restituisce
+//indirizzo e numero di sequenza dei messaggi che la contengono. Se l'apertura del file ha uno snapshot, la ricerca avviene nello snapshot.
+#define SFS_IOC_SEARCH _IOWR(SFS_IOC_MAGIC, 5, struct sfs_search_request)
+//restituisce numero di sequenza, versione, flag e chiave del messaggio di un data block (o dell'ultimo messaggio valido), ovvero i
+//valori da indicare nelle system call condizionali (put_data_if_tail(), update_data_if(), invalidate_data_if()).
+#define SFS_IOC_BLOCK_INFO _IOWR(SFS_IOC_MAGIC, 6, struct sfs_block_info)
+//posiziona questa apertura del file sul primo messaggio della partizione (restituita da SFS_IOC_PARTITION) e ne imposta il limite
+//end_seq, come lseek(SFS_SEEK_SEQ | start_seq) seguita da SFS_IOC_SET_LIMIT ma senza attraversare la catena dall'inizio.
+#define SFS_IOC_SEEK_PARTITION _IOW(SFS_IOC_MAGIC, 7, struct sfs_partition)
+
+#endif
@@ -1,10 +1,16 @@
 #ifndef _ONEFILEFSKER_H
 #define _ONEFILEFSKER_H
 
+#include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/rhashtable.h>
+#include <linux/sched.h>
+#include <linux/seqlock.h>
 #include <linux/srcu.h>
 #include <linux/types.h>
 #include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/xarray.h>
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,15,0)
 #include <linux/atomic.h>
@@ -12,12 +18,156 @@
 #include <asm/atomic_32.h>
 #endif
 
+//parametri della scansione completa del dispositivo eseguita al montaggio dopo uno smontaggio non pulito
+#define SCAN_MAX_WORKERS 16				//numero massimo di kthread di scansione
+#define SCAN_MIN_BLOCKS_PER_WORKER 4096	//sotto questa soglia di data block per kthread non conviene parallelizzare
+#define SCAN_READAHEAD_BLOCKS 32		//numero di blocchi letti in anticipo (sb_breadahead) da ciascun kthread
+
+#define CHAIN_READAHEAD_BLOCKS 32		//numero di blocchi della catena letti in anticipo dagli attraversamenti ordinati (dev_read(), ioctl)
+#define CHAIN_NEXT_UNKNOWN (-2)			//voce di chain_next di un blocco di cui non si conosce ancora il successore
+
+//parametri della compattazione in background (opzione di montaggio "compact")
+#define COMPACT_INTERVAL_MS 1000		//intervallo tra due passate del kthread di compattazione
+#define COMPACT_SCAN_BLOCKS 1024		//numero massimo di blocchi della catena esaminati per passata (con write_mutex acquisito)
+#define COMPACT_BATCH 64				//numero massimo di blocchi spostati per passata
+#define COMPACT_RESERVE_SHARE 2			//i vecchi indici dei blocchi spostati occupano al più 1/COMPACT_RESERVE_SHARE dei blocchi non validi
+
+#define PAYLOAD_SEQ_BUCKETS 64			//numero di seqcount che proteggono i payload dalle modifiche in place (blocco i -> seqcount i % PAYLOAD_SEQ_BUCKETS)
+
 struct auxiliary_info {
 	uint64_t is_mounted;
 	atomic_t usages;			//tiene traccia del numero di thread che stanno correntemente eseguendo una funzione del modulo; se è > 0, lo smontaggio viene impedito.
 	struct mutex write_mutex;	//serve a sincronizzare gli scrittori tra loro (ma non coi lettori).
-	struct mutex off_mutex;		//serve a sincronizzare gli aggiornamenti del parametro *off della funzione dev_read().
 	struct srcu_struct srcu;	//è una struttura a supporto delle API per la sleepable RCU.
+	//layout on-disk del dispositivo montato (copiato dal superblocco in singlefilefs_fill_super())
+	uint64_t features;			//feature del layout (FEAT_*)
+	uint64_t meta_start;		//primo blocco della tabella dei metadati
+	uint64_t data_start;		//blocco che ospita il data block di offset 0
+	//opzioni di montaggio
+	int verify_on_read;			//opzione "verify": get_data() e dev_read() verificano il checksum del payload prima di consegnarlo
+	int compress;				//opzione "compress": put_data() memorizza i messaggi compressi con LZ4, se così occupano meno spazio
+	int pack;					//opzione "pack": put_data() impacchetta i messaggi brevi nell'ultimo blocco della catena
+	int compact;				//opzione "compact": un kthread sposta i blocchi validi in modo che l'ordine delle scritture diventi sequenziale
+	//indice in RAM dei blocchi allocati (ricostruito al montaggio, aggiornato sotto write_mutex)
+	unsigned long *valid_bitmap;	//bit i = data block i valido
+	uint64_t total_data_blocks;		//numero di data block del dispositivo (dimensione della bitmap)
+	uint64_t valid_blocks;			//numero di data block validi
+	uint64_t valid_messages;		//numero di messaggi validi (un blocco impacchettato ne contiene più d'uno)
+	uint64_t next_seq;				//numero di sequenza del prossimo messaggio (aggiornato sotto write_mutex)
+	//successori dei data block nella catena (solo senza la tabella dei metadati, dove next_valid si trova nel data block stesso):
+	//consente a prefetch_chain() di seguire la catena anche attraverso i blocchi non ancora in cache. È soltanto un suggerimento per
+	//la lettura anticipata: viene aggiornato dalle scritture dei collegamenti e da ogni lettura dei metadati, senza sincronizzazione.
+	int64_t *chain_next;			//blocco i -> next_valid del blocco i (CHAIN_NEXT_UNKNOWN se non ancora noto)
+	//snapshot attivi (SFS_IOC_SNAPSHOT) e blocchi invalidati che devono restare leggibili finché qualche snapshot li contiene
+	struct mutex snap_mutex;		//protegge snapshots, retained e retained_count (si acquisisce dopo write_mutex)
+	struct list_head snapshots;		//lista degli struct read_snapshot attivi
+	uint64_t inval_epoch;			//numero di invalidazioni eseguite dal montaggio (aggiornato sotto write_mutex)
+	struct xarray retained;			//numero di sequenza -> struct retained_block
+	struct xarray retained_count;	//data block -> numero di messaggi trattenuti che contiene (xa_mk_value())
+	unsigned long *retained_bitmap;	//bit i = data block i trattenuto per uno snapshot (non riutilizzabile da put_data())
+	//indice in RAM delle chiavi dei messaggi (ricostruito al montaggio, aggiornato sotto write_mutex, consultato sotto rcu_read_lock())
+	struct rhashtable key_index;	//chiave -> struct key_entry
+	uint64_t keyed_blocks;			//numero di data block validi con chiave
+	//modifiche in place dei payload (update_data(), append_data()): i lettori che copiano un payload ripetono la copia se nel
+	//frattempo il seqcount del blocco è cambiato, per cui vedono la versione precedente oppure quella nuova, mai una via di mezzo.
+	seqcount_t payload_seq[PAYLOAD_SEQ_BUCKETS];
+	//compattazione (aggiornata sotto write_mutex): il vecchio indice di un blocco spostato resta riservato (non riutilizzabile da
+	//put_data()) e viene tradotto nel nuovo finché il messaggio non viene invalidato, per cui gli indirizzi già restituiti restano validi.
+	struct task_struct *compactor;	//kthread di compattazione (NULL senza l'opzione "compact")
+	struct xarray remap;			//vecchio indice del blocco spostato -> nuovo indice (xa_mk_value())
+	struct xarray relocated;		//nuovo indice del blocco spostato -> vecchio indice (xa_mk_value())
+	uint64_t relocated_blocks;		//numero di blocchi spostati (e di vecchi indici riservati)
+	int64_t compact_block;			//blocco da cui riprende la passata successiva (-1 = da first_valid)
+	uint64_t compact_seq;			//numero di sequenza atteso in compact_block
+};
+
+//voce dell'indice delle chiavi: associa la chiave di un messaggio valido al suo data block.
+struct key_entry {
+	struct rhash_head node;
+	uint64_t key;
+	int64_t block;
+	struct rcu_head rcu;	//le voci rimosse vengono liberate dopo un grace period RCU (kfree_rcu())
 };
 
+static const struct rhashtable_params key_index_params = {
+	.key_len = sizeof(uint64_t),
+	.key_offset = offsetof(struct key_entry, key),
+	.head_offset = offsetof(struct key_entry, node),
+	.automatic_shrinking = true,
+};
+
+//vista consistente dei messaggi validi, fissata con SFS_IOC_SNAPSHOT: contiene i messaggi con numero di sequenza inferiore a seq
+//che erano validi dopo le prime epoch invalidazioni.
+struct read_snapshot {
+	struct list_head list;
+	uint64_t seq;			//primo numero di sequenza escluso dallo snapshot (next_seq al momento della creazione)
+	uint64_t epoch;			//valore di inval_epoch al momento della creazione
+	uint64_t count;			//numero di messaggi dello snapshot
+};
+
+//messaggio invalidato mentre era contenuto in uno snapshot attivo: il suo blocco resta intatto (e non riutilizzabile) finché serve a qualche snapshot.
+struct retained_block {
+	int64_t block;			//indirizzo del messaggio (indice del data block, con lo slot per un messaggio impacchettato)
+	uint64_t epoch;			//valore di inval_epoch dopo l'invalidazione del messaggio
+};
+
+//lettura anticipata lungo la catena di un attraversamento ordinato (cursore di lettura, SFS_IOC_PARTITION): le letture dei blocchi
+//successivi vengono accodate con sb_breadahead() una finestra alla volta, senza attenderne il completamento (prefetch_step()).
+struct chain_prefetch {
+	int64_t block;			//blocco raggiunto per ultimo dall'attraversamento (-1 = nessuno)
+	unsigned int ahead;		//blocchi della catena successivi a block di cui è già stata accodata la lettura
+};
+
+//cursore di lettura associato a ciascuna apertura del file (file->private_data), allocato da dev_open().
+//la posizione del file (f_pos) è l'indice del prossimo messaggio da leggere nell'ordine temporale delle scritture.
+struct read_cursor {
+	struct mutex lock;		//serializza le letture che condividono la stessa apertura del file
+	int started;			//0 finché la lettura non è iniziata: il primo blocco da leggere è first_valid
+	int64_t next_block;		//indirizzo del prossimo messaggio da leggere (-1 = fine del file)
+	uint32_t block_pos;		//byte del messaggio di next_block già restituiti
+	uint64_t seq;			//numero di sequenza di next_block (alla fine del file, minimo numero di sequenza dei messaggi successivi)
+	uint64_t index;			//indice del messaggio di next_block
+	loff_t pos;				//ultima posizione comunicata al VFS: se il chiamante ne usa una diversa, il cursore viene riposizionato
+	uint64_t limit_seq;		//primo numero di sequenza escluso dalle letture (0 = nessun limite), impostato con SFS_IOC_SET_LIMIT
+	//lettura attraverso uno snapshot: next_block/seq indicano il messaggio corrente dello snapshot (valido oppure trattenuto),
+	//mentre live_block/live_seq indicano la posizione corrispondente nella catena dei messaggi validi.
+	struct read_snapshot *snap;	//snapshot associato all'apertura del file (NULL = lettura della catena corrente)
+	int64_t live_block;
+	uint64_t live_seq;
+	struct chain_prefetch prefetch;	//lettura anticipata dei blocchi successivi della catena
+	//ultimo messaggio estratto (decompresso o copiato dal suo slot) da dev_read(): le letture successive dello stesso messaggio, con
+	//un buffer più corto del messaggio, lo riutilizzano finché il messaggio non viene modificato (stessa versione).
+	char *message;			//DEFAULT_BLOCK_SIZE-METADATA_SIZE byte, allocati alla prima lettura che ne ha bisogno (NULL = nessuno)
+	int64_t message_block;	//indirizzo del messaggio contenuto in message (-1 = nessuno)
+	uint64_t message_seq;	//numero di sequenza del messaggio contenuto in message
+	uint64_t message_version;	//versione del messaggio contenuto in message
+};
+
+//coppia di code in memoria condivisa di un'apertura del dispositivo di controllo (ctlDevice.c), allocata da SFS_CTL_RING_SETUP.
+//gli indici scritti dal kernel sono mantenuti anche in copia privata: quelli nella mappatura potrebbero essere alterati dall'utente.
+struct sfs_ring {
+	void *mem;						//mappatura condivisa (vmalloc_user()): struct sfs_ring_ctl, richieste, completamenti
+	size_t size;					//dimensione di mem (multipla della pagina)
+	struct sfs_ring_ctl *ctl;
+	struct sfs_sqe *sqes;
+	struct sfs_cqe *cqes;
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t sq_head;				//copia privata di ctl->sq_head
+	uint32_t cq_tail;				//copia privata di ctl->cq_tail
+	struct mm_struct *mm;			//spazio di indirizzamento del processo che ha predisposto le code (buffer delle richieste)
+	struct task_struct *worker;		//kthread che preleva ed esegue le richieste
+	wait_queue_head_t sq_wait;		//attesa del kthread (nuove richieste o spazio nella coda dei completamenti)
+	wait_queue_head_t cq_wait;		//attesa dei completamenti (SFS_CTL_RING_ENTER)
+};
+
+//stato di un'apertura del dispositivo di controllo (file->private_data), allocato da ctl_open().
+struct ctl_file {
+	struct mutex lock;				//serializza SFS_CTL_RING_SETUP
+	struct sfs_ring *ring;			//NULL finché le code non vengono predisposte
+};
+
+//devFunctions.c
+int compaction_thread(void *);
+
 #endif
@@ -1,15 +1,21 @@
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/rhashtable.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/srcu.h>
 #include <linux/string.h>
 #include <linux/time.h>
 #include <linux/timekeeping.h>
 #include <linux/types.h>
 #include <linux/version.h>
+#include <linux/xarray.h>
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,15,0)
 #include <linux/atomic.h>
@@ -31,6 +37,688 @@ static struct dentry_operations singlefilefs_dentry_ops = {
 struct auxiliary_info au_info = {0};
 struct super_block *global_sb;
 
+//collegamenti e numero di sequenza di un data block, raccolti durante la scansione completa per verificare (ed eventualmente
+//ricostruire) la catena dei blocchi validi.
+struct block_link {
+    int64_t next_valid;
+    int64_t prev_valid;
+    uint64_t seq;
+};
+
+//posizione di un data block valido nella catena ricostruita da repair_block_chain().
+struct chain_entry {
+    uint64_t seq;
+    uint64_t block;
+};
+
+//descrittore del lavoro assegnato a un kthread di scansione.
+struct scan_work {
+    struct super_block *sb;
+    uint64_t start;             //primo data block dell'intervallo
+    uint64_t end;               //primo data block escluso dall'intervallo
+    unsigned long *bitmap;
+    unsigned long *moved;
+    struct block_link *links;
+    uint64_t found;             //blocchi validi trovati nell'intervallo
+    uint64_t messages;          //messaggi validi trovati nell'intervallo
+    uint64_t max_seq;           //massimo numero di sequenza dei blocchi validi dell'intervallo
+    int ret;
+    struct completion done;
+};
+
+//restituisce il numero di messaggi validi del blocco impacchettato con contenuto db_cont (seq è il numero di sequenza del suo primo
+//slot) e aggiorna *max_seq con il numero di sequenza del suo ultimo slot.
+static uint64_t packed_messages(struct data_block_content *db_cont, uint64_t seq, uint64_t *max_seq) {
+
+    struct packed_header *hdr = (struct packed_header *)db_cont->payload;
+    uint64_t slots;
+
+    slots = min_t(uint64_t, hdr->slots, PACKED_MAX_SLOTS);
+    if (slots > 0)
+        *max_seq = max(*max_seq, seq + slots - 1);
+    return min_t(uint64_t, hdr->live, slots);
+
+}
+
+//questa funzione esamina i metadati dei data block di indice [start, end), marca nella bitmap quelli validi e ne registra i collegamenti in links.
+//le lapidi lasciate dalla compattazione (blocchi non validi con BLOCK_MOVED) vengono marcate in moved, con la nuova posizione in links[].next_valid.
+//in *valid viene restituito il numero di blocchi validi trovati nell'intervallo, in *messages il numero di messaggi validi che
+//contengono (per i blocchi impacchettati si legge anche la directory degli slot) e in *max_seq il loro massimo numero di sequenza.
+static int scan_block_range(struct super_block *sb, uint64_t start, uint64_t end, unsigned long *bitmap, unsigned long *moved, struct block_link *links, uint64_t *valid, uint64_t *messages, uint64_t *max_seq) {
+
+    struct buffer_head *bh;
+    struct buffer_head *data_bh;
+    struct data_block_metadata *table;
+    struct data_block_metadata *meta;
+    uint64_t offset;
+    uint64_t i;
+    uint64_t count;
+    uint64_t msgs;
+    uint64_t seq;
+
+    count = 0;
+    msgs = 0;
+    seq = 0;
+
+    //con la tabella dei metadati ogni blocco letto copre METADATA_PER_BLOCK data block.
+    if (au_info.features & FEAT_META_TABLE) {
+        offset = start;
+        while (offset < end) {
+            //all'inizio di ogni finestra si accodano in anticipo le letture dei blocchi successivi della tabella
+            if ((offset/METADATA_PER_BLOCK) % SCAN_READAHEAD_BLOCKS == 0 || offset == start)
+                for(i=offset/METADATA_PER_BLOCK; i<offset/METADATA_PER_BLOCK + SCAN_READAHEAD_BLOCKS && i<DIV_ROUND_UP(end, METADATA_PER_BLOCK); i++)
+                    sb_breadahead(sb, au_info.meta_start + i);
+            bh = sb_bread(sb, au_info.meta_start + offset/METADATA_PER_BLOCK);
+            if (!bh)
+                return -EIO;    //-EIO = errore di input/output
+            table = (struct data_block_metadata *)bh->b_data;
+            for(i=offset%METADATA_PER_BLOCK; i<METADATA_PER_BLOCK && offset<end; i++, offset++) {
+                if (!table[i].is_valid && (table[i].flags & BLOCK_MOVED)) {
+                    set_bit(offset, moved);
+                    links[offset].next_valid = table[i].next_valid;
+                }
+                if (table[i].is_valid) {
+                    set_bit(offset, bitmap);    //set_bit() è atomica: intervalli adiacenti possono condividere una word della bitmap.
+                    links[offset].next_valid = table[i].next_valid;
+                    links[offset].prev_valid = table[i].prev_valid;
+                    links[offset].seq = table[i].seq;
+                    seq = max(seq, table[i].seq);
+                    count++;
+                    if (!(table[i].flags & BLOCK_PACKED)) {
+                        msgs++;
+                        continue;
+                    }
+                    data_bh = sb_bread(sb, au_info.data_start + offset);
+                    if (!data_bh) {
+                        brelse(bh);
+                        return -EIO;    //-EIO = errore di input/output
+                    }
+                    msgs += packed_messages((struct data_block_content *)data_bh->b_data, table[i].seq, &seq);
+                    brelse(data_bh);
+                }
+            }
+            brelse(bh);
+        }
+    }
+    //altrimenti è necessario leggere ogni singolo data block.
+    else {
+        for(offset=start; offset<end; offset++) {
+            if (offset % SCAN_READAHEAD_BLOCKS == 0 || offset == start)
+                for(i=offset; i<offset + SCAN_READAHEAD_BLOCKS && i<end; i++)
+                    sb_breadahead(sb, au_info.data_start + i);
+            bh = sb_bread(sb, au_info.data_start + offset);
+            if (!bh)
+                return -EIO;    //-EIO = errore di input/output
+            meta = &(((struct data_block_content *)bh->b_data)->metadata);
+            if (!meta->is_valid && (meta->flags & BLOCK_MOVED)) {
+                set_bit(offset, moved);
+                links[offset].next_valid = meta->next_valid;
+            }
+            if (meta->is_valid) {
+                set_bit(offset, bitmap);
+                links[offset].next_valid = meta->next_valid;
+                links[offset].prev_valid = meta->prev_valid;
+                links[offset].seq = meta->seq;
+                seq = max(seq, meta->seq);
+                count++;
+                if (meta->flags & BLOCK_PACKED)
+                    msgs += packed_messages((struct data_block_content *)bh->b_data, meta->seq, &seq);
+                else
+                    msgs++;
+            }
+            brelse(bh);
+        }
+    }
+
+    *valid = count;
+    *messages = msgs;
+    *max_seq = seq;
+    return 0;
+
+}
+
+//corpo dei kthread di scansione: ciascuno esamina il proprio intervallo di data block.
+static int scan_worker(void *data) {
+
+    struct scan_work *work = (struct scan_work *)data;
+
+    work->ret = scan_block_range(work->sb, work->start, work->end, work->bitmap, work->moved, work->links, &(work->found), &(work->messages), &(work->max_seq));
+    complete(&(work->done));
+    return 0;
+
+}
+
+//questa funzione esegue la scansione completa del dispositivo suddividendola tra più kthread, uno per CPU (fino a SCAN_MAX_WORKERS).
+//gli intervalli sono allineati a METADATA_PER_BLOCK, così che nessun blocco della tabella dei metadati venga letto da due worker.
+static int parallel_scan(struct super_block *sb, unsigned long *bitmap, unsigned long *moved, struct block_link *links, uint64_t *valid, uint64_t *messages, uint64_t *max_seq) {
+
+    struct scan_work *works;
+    struct task_struct *task;
+    uint64_t total;
+    uint64_t chunk;
+    unsigned int nr_workers;
+    unsigned int i;
+    int ret;
+
+    total = au_info.total_data_blocks;
+    nr_workers = min_t(unsigned int, num_online_cpus(), SCAN_MAX_WORKERS);
+    nr_workers = min_t(uint64_t, nr_workers, DIV_ROUND_UP(total, SCAN_MIN_BLOCKS_PER_WORKER));
+    if (nr_workers <= 1)
+        return scan_block_range(sb, 0, total, bitmap, moved, links, valid, messages, max_seq);
+
+    chunk = roundup(DIV_ROUND_UP(total, nr_workers), METADATA_PER_BLOCK);
+    works = kcalloc(nr_workers, sizeof(struct scan_work), GFP_KERNEL);
+    if (!works)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+
+    for(i=0; i<nr_workers; i++) {
+        works[i].sb = sb;
+        works[i].start = min_t(uint64_t, i*chunk, total);
+        works[i].end = min_t(uint64_t, (i+1)*chunk, total);
+        works[i].bitmap = bitmap;
+        works[i].moved = moved;
+        works[i].links = links;
+        init_completion(&(works[i].done));
+        task = kthread_run(scan_worker, &(works[i]), "singlefilefs_scan/%u", i);
+        //se il kthread non può essere creato, il suo intervallo viene esaminato dal thread corrente.
+        if (IS_ERR(task))
+            scan_worker(&(works[i]));
+    }
+
+    ret = 0;
+    *valid = 0;
+    *messages = 0;
+    *max_seq = 0;
+    for(i=0; i<nr_workers; i++) {
+        wait_for_completion(&(works[i].done));
+        if (works[i].ret < 0)
+            ret = works[i].ret;
+        *valid += works[i].found;
+        *messages += works[i].messages;
+        *max_seq = max(*max_seq, works[i].max_seq);
+    }
+    printk("%s: device scanned by %u worker threads\n", MOD_NAME, nr_workers);
+
+    kfree(works);
+    return ret;
+
+}
+
+//ordinamento delle voci della catena ricostruita: per numero di sequenza e, a parità (messaggi non numerati), per indice del blocco.
+static int chain_entry_cmp(const void *a, const void *b) {
+
+    const struct chain_entry *x = a;
+    const struct chain_entry *y = b;
+
+    if (x->seq != y->seq)
+        return (x->seq < y->seq) ? -1 : 1;
+    if (x->block != y->block)
+        return (x->block < y->block) ? -1 : 1;
+    return 0;
+
+}
+
+//questa funzione scrive i collegamenti prev_valid e next_valid del data block di indice offset (usata solo al montaggio).
+static int write_block_links(struct super_block *sb, uint64_t offset, int64_t prev_valid, int64_t next_valid) {
+
+    struct buffer_head *bh;
+    struct data_block_metadata *meta;
+
+    if (au_info.features & FEAT_META_TABLE)
+        bh = sb_bread(sb, au_info.meta_start + offset/METADATA_PER_BLOCK);
+    else
+        bh = sb_bread(sb, au_info.data_start + offset);
+    if (!bh)
+        return -EIO;    //-EIO = errore di input/output
+    if (au_info.features & FEAT_META_TABLE)
+        meta = &(((struct data_block_metadata *)bh->b_data)[offset % METADATA_PER_BLOCK]);
+    else
+        meta = &(((struct data_block_content *)bh->b_data)->metadata);
+    meta->prev_valid = prev_valid;
+    meta->next_valid = next_valid;
+    mark_buffer_dirty(bh);
+    brelse(bh);
+    return 0;
+
+}
+
+//questa funzione scrive nel superblocco gli estremi first_valid e last_valid della catena, in maniera sincrona.
+static int write_chain_ends(struct super_block *sb, int64_t first_valid, int64_t last_valid) {
+
+    struct buffer_head *bh;
+    struct onefilefs_sb_info *sb_disk;
+
+    bh = sb_bread(sb, SB_BLOCK_NUMBER);
+    if (!bh)
+        return -EIO;    //-EIO = errore di input/output
+    sb_disk = (struct onefilefs_sb_info *)bh->b_data;
+    sb_disk->first_valid = first_valid;
+    sb_disk->last_valid = last_valid;
+    mark_buffer_dirty(bh);
+    sync_dirty_buffer(bh);
+    brelse(bh);
+    return 0;
+
+}
+
+//questa funzione cancella la lapide della compattazione (BLOCK_MOVED) del data block non valido di indice offset (usata solo al montaggio).
+static int clear_block_tombstone(struct super_block *sb, uint64_t offset) {
+
+    struct buffer_head *bh;
+    struct data_block_metadata *meta;
+
+    if (au_info.features & FEAT_META_TABLE)
+        bh = sb_bread(sb, au_info.meta_start + offset/METADATA_PER_BLOCK);
+    else
+        bh = sb_bread(sb, au_info.data_start + offset);
+    if (!bh)
+        return -EIO;    //-EIO = errore di input/output
+    if (au_info.features & FEAT_META_TABLE)
+        meta = &(((struct data_block_metadata *)bh->b_data)[offset % METADATA_PER_BLOCK]);
+    else
+        meta = &(((struct data_block_content *)bh->b_data)->metadata);
+    meta->flags &= ~BLOCK_MOVED;
+    mark_buffer_dirty(bh);
+    brelse(bh);
+    return 0;
+
+}
+
+//questa funzione ricostruisce la tabella di traduzione della compattazione (remap e relocated) dalle lapidi marcate in moved: una lapide
+//che punta a un blocco valido, non già indicato da un'altra lapide, torna a tradurre il suo indice. Le altre sono il residuo di
+//un'invalidazione interrotta da un crash e vengono cancellate (a meno che il montaggio non sia in sola lettura).
+static int load_relocations(struct super_block *sb, unsigned long *bitmap, unsigned long *moved, struct block_link *links) {
+
+    uint64_t origin;
+    int64_t forward;
+    int ret;
+
+    for_each_set_bit(origin, moved, au_info.total_data_blocks) {
+        forward = links[origin].next_valid;
+        if (forward >= 0 && (uint64_t)forward < au_info.total_data_blocks && test_bit(forward, bitmap) && !xa_load(&(au_info.relocated), forward)) {
+            ret = xa_err(xa_store(&(au_info.remap), origin, xa_mk_value(forward), GFP_KERNEL));
+            if (ret == 0)
+                ret = xa_err(xa_store(&(au_info.relocated), forward, xa_mk_value(origin), GFP_KERNEL));
+            if (ret < 0)
+                return ret;
+            au_info.relocated_blocks++;
+            continue;
+        }
+        if (!sb_rdonly(sb) && clear_block_tombstone(sb, origin) < 0)
+            return -EIO;    //-EIO = errore di input/output
+    }
+    if (au_info.relocated_blocks > 0)
+        printk("%s: %llu relocated blocks restored from the compaction tombstones\n", MOD_NAME, au_info.relocated_blocks);
+    return 0;
+
+}
+
+//questa funzione ricostruisce la catena dei blocchi validi a partire dai found blocchi marcati in bitmap, ordinandoli per numero di
+//sequenza: i numeri di sequenza crescono nell'ordine delle scritture (update_data() assegna un nuovo numero al messaggio spostato in
+//coda e la compattazione non li modifica), per cui l'ordine ottenuto coincide con quello della catena integra. Vengono riscritti
+//solo i collegamenti che cambiano; i blocchi validi non raggiungibili vengono riagganciati nella loro posizione. I data block vengono
+//scritti dal page-cache write back daemon: se il sistema si arresta prima, il montaggio successivo ripete la riparazione.
+static int repair_block_chain(struct super_block *sb, unsigned long *bitmap, struct block_link *links, uint64_t found) {
+
+    struct chain_entry *order;
+    uint64_t offset;
+    uint64_t num;
+    uint64_t i;
+    int64_t prev;
+    int64_t next;
+    int ret;
+
+    if (sb_rdonly(sb)) {
+        printk("%s: the block chain cannot be repaired on a read-only mount: run singlefilefsck -r on the device\n", MOD_NAME);
+        return -EUCLEAN;    //-EUCLEAN = struttura del file system da riparare
+    }
+    if (found == 0)
+        return write_chain_ends(sb, -1, -1);
+
+    order = kvmalloc_array(found, sizeof(struct chain_entry), GFP_KERNEL);
+    if (!order)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    num = 0;
+    for_each_set_bit(offset, bitmap, au_info.total_data_blocks) {
+        if (num == found)
+            break;
+        order[num].seq = links[offset].seq;
+        order[num].block = offset;
+        num++;
+    }
+    sort(order, num, sizeof(struct chain_entry), chain_entry_cmp, NULL);
+
+    ret = 0;
+    for(i=0; i<num && ret == 0; i++) {
+        prev = (i > 0) ? (int64_t)order[i-1].block : -1;
+        next = (i + 1 < num) ? (int64_t)order[i+1].block : -1;
+        if (links[order[i].block].prev_valid != prev || links[order[i].block].next_valid != next) {
+            ret = write_block_links(sb, order[i].block, prev, next);
+            links[order[i].block].prev_valid = prev;    //i collegamenti in RAM restano quelli su disco (vedi build_block_index())
+            links[order[i].block].next_valid = next;
+        }
+        cond_resched();
+    }
+    if (ret == 0)
+        ret = write_chain_ends(sb, order[0].block, order[num-1].block);
+    if (ret == 0)
+        printk("%s: block chain rebuilt from the sequence numbers of %llu valid blocks\n", MOD_NAME, num);
+    kvfree(order);
+    return ret;
+
+}
+
+//questa funzione verifica, a partire dai collegamenti raccolti durante la scansione, la catena dei blocchi validi che parte da first_valid.
+//se l'ultimo inserimento è stato interrotto da un crash dopo l'aggiornamento della vecchia coda, la catena termina oltre last_valid:
+//in tal caso la coda viene corretta nel superblocco. Una catena interrotta viene ricostruita (repair_block_chain()), mentre i blocchi
+//validi non raggiungibili da una catena integra vengono solo segnalati.
+static int check_block_chain(struct super_block *sb, unsigned long *bitmap, struct block_link *links, uint64_t found, int64_t first_valid, int64_t last_valid) {
+
+    int64_t curr;
+    int64_t prev;
+    uint64_t linked;
+
+    prev = -1;
+    linked = 0;
+    for(curr=first_valid; curr!=-1; prev=curr, curr=links[curr].next_valid) {
+        if (curr < 0 || curr >= au_info.total_data_blocks || !test_bit(curr, bitmap) ||
+            links[curr].prev_valid != prev || ++linked > found) {
+            printk("%s: broken block chain at block %lld (previous %lld): rebuilding it\n", MOD_NAME, curr, prev);
+            return repair_block_chain(sb, bitmap, links, found);
+        }
+    }
+
+    if (prev != last_valid) {
+        printk("%s: the block chain ends at block %lld, not at %lld: fixing the superblock\n", MOD_NAME, prev, last_valid);
+        if (!sb_rdonly(sb) && write_chain_ends(sb, first_valid, prev) < 0)
+            return -EIO;    //-EIO = errore di input/output
+    }
+
+    if (linked < found)
+        printk("%s: %llu valid blocks are not reachable from the block chain\n", MOD_NAME, found - linked);
+    return 0;
+
+}
+
+//questa funzione carica in RAM la bitmap di allocazione scritta su disco dall'ultimo smontaggio pulito.
+static int load_block_summary(struct super_block *sb, uint64_t bitmap_start, uint64_t bitmap_blocks, unsigned long *bitmap) {
+
+    struct buffer_head *bh;
+    uint64_t bytes;     //dimensione in byte della bitmap in RAM
+    uint64_t copied;
+    uint64_t i;
+
+    bytes = BITS_TO_LONGS(au_info.total_data_blocks) * sizeof(unsigned long);
+    if (bitmap_blocks < DIV_ROUND_UP(au_info.total_data_blocks, BITMAP_BITS_PER_BLOCK))
+        return -EINVAL; //-EINVAL = parametri non validi (in questo caso il layout del dispositivo)
+
+    for(i=0, copied=0; copied<bytes; i++, copied+=DEFAULT_BLOCK_SIZE) {
+        bh = sb_bread(sb, bitmap_start + i);
+        if (!bh)
+            return -EIO;    //-EIO = errore di input/output
+        memcpy((char *)bitmap + copied, bh->b_data, min_t(uint64_t, DEFAULT_BLOCK_SIZE, bytes - copied));
+        brelse(bh);
+    }
+
+    //i bit oltre l'ultimo data block non devono risultare allocati
+    if (au_info.total_data_blocks % BITS_PER_LONG)
+        bitmap[au_info.total_data_blocks / BITS_PER_LONG] &= (1UL << (au_info.total_data_blocks % BITS_PER_LONG)) - 1;
+
+    return 0;
+
+}
+
+//questa funzione scrive su disco la bitmap di allocazione e il numero di blocchi e di messaggi validi, e imposta lo stato del file system.
+//il riepilogo viene scritto in maniera sincrona prima del superblocco, in modo che FS_STATE_CLEAN non preceda mai i dati che certifica.
+static int store_block_summary(struct super_block *sb, uint64_t state) {
+
+    struct buffer_head *bh;
+    struct buffer_head *bitmap_bh;
+    struct onefilefs_sb_info *sb_disk;
+    uint64_t bytes;
+    uint64_t written;
+    uint64_t i;
+
+    bh = sb_bread(sb, SB_BLOCK_NUMBER);
+    if (!bh)
+        return -EIO;    //-EIO = errore di input/output
+    sb_disk = (struct onefilefs_sb_info *)bh->b_data;
+
+    if (state == FS_STATE_CLEAN) {
+        bytes = BITS_TO_LONGS(au_info.total_data_blocks) * sizeof(unsigned long);
+        for(i=0, written=0; i<sb_disk->bitmap_blocks; i++, written+=DEFAULT_BLOCK_SIZE) {
+            bitmap_bh = sb_bread(sb, sb_disk->bitmap_start + i);
+            if (!bitmap_bh) {
+                brelse(bh);
+                return -EIO;    //-EIO = errore di input/output
+            }
+            memset(bitmap_bh->b_data, 0, DEFAULT_BLOCK_SIZE);
+            if (written < bytes)
+                memcpy(bitmap_bh->b_data, (char *)au_info.valid_bitmap + written, min_t(uint64_t, DEFAULT_BLOCK_SIZE, bytes - written));
+            mark_buffer_dirty(bitmap_bh);
+            sync_dirty_buffer(bitmap_bh);
+            brelse(bitmap_bh);
+        }
+        sb_disk->valid_blocks = au_info.valid_blocks;
+        sb_disk->keyed_blocks = au_info.keyed_blocks;
+        sb_disk->valid_messages = au_info.valid_messages;
+        sb_disk->moved_blocks = au_info.relocated_blocks;
+    }
+
+    sb_disk->next_seq = au_info.next_seq;
+    sb_disk->state = state;
+    mark_buffer_dirty(bh);
+    sync_dirty_buffer(bh);  //lo stato va sempre scritto in maniera sincrona: è ciò che permette di riconoscere un crash.
+    brelse(bh);
+    return 0;
+
+}
+
+//funzione di rilascio delle voci dell'indice delle chiavi, invocata da rhashtable_free_and_destroy().
+static void free_key_entry(void *ptr, void *arg) {
+    kfree(ptr);
+}
+
+//questa funzione ricostruisce l'indice delle chiavi esaminando i metadati dei blocchi validi di bitmap. Se la bitmap è stata caricata
+//dal riepilogo di uno smontaggio pulito senza messaggi con chiave (keyed_blocks == 0 nel superblocco), l'esame viene saltato. Se due messaggi validi hanno la stessa chiave
+//(cosa che può accadere solo modificando l'immagine offline) resta associato quello di indice minore.
+//in caso di errore l'indice viene distrutto prima di restituire il codice di errore.
+static int build_key_index(struct super_block *sb, unsigned long *bitmap, int summary_used, uint64_t keyed_blocks) {
+
+    struct buffer_head *bh;
+    struct data_block_metadata *meta;
+    struct key_entry *entry;
+    uint64_t offset;
+    int ret;
+
+    ret = rhashtable_init(&(au_info.key_index), &key_index_params);
+    if (ret < 0)
+        return ret;
+    au_info.keyed_blocks = 0;
+    if (summary_used && keyed_blocks == 0)
+        return 0;
+
+    for_each_set_bit(offset, bitmap, au_info.total_data_blocks) {
+        if (au_info.features & FEAT_META_TABLE)
+            bh = sb_bread(sb, au_info.meta_start + offset/METADATA_PER_BLOCK);
+        else
+            bh = sb_bread(sb, au_info.data_start + offset);
+        if (!bh) {
+            ret = -EIO; //-EIO = errore di input/output
+            goto key_index_error;
+        }
+        if (au_info.features & FEAT_META_TABLE)
+            meta = &(((struct data_block_metadata *)bh->b_data)[offset % METADATA_PER_BLOCK]);
+        else
+            meta = &(((struct data_block_content *)bh->b_data)->metadata);
+        if (!(meta->flags & BLOCK_KEYED)) {
+            brelse(bh);
+            continue;
+        }
+
+        entry = kmalloc(sizeof(struct key_entry), GFP_KERNEL);
+        if (!entry) {
+            brelse(bh);
+            ret = -ENOMEM;  //-ENOMEM = errore di esaurimento della memoria
+            goto key_index_error;
+        }
+        entry->key = meta->key;
+        entry->block = offset;
+        brelse(bh);
+
+        au_info.keyed_blocks++;
+        ret = rhashtable_lookup_insert_fast(&(au_info.key_index), &(entry->node), key_index_params);
+        if (ret == -EEXIST) {
+            printk("%s: block %llu reuses the key %llu of another valid message: it is not indexed\n", MOD_NAME, offset, entry->key);
+            kfree(entry);
+            continue;
+        }
+        if (ret < 0) {
+            kfree(entry);
+            goto key_index_error;
+        }
+        cond_resched();
+    }
+    printk("%s: key index built (%llu keyed messages)\n", MOD_NAME, au_info.keyed_blocks);
+    return 0;
+
+key_index_error:
+    rhashtable_free_and_destroy(&(au_info.key_index), free_key_entry, NULL);
+    return ret;
+
+}
+
+//questa funzione rilascia gli indici in RAM costruiti da build_block_index() (bitmap di allocazione, indice delle chiavi, bitmap
+//dei blocchi trattenuti e successori dei blocchi). Può essere invocata anche se gli indici non sono stati costruiti, o lo sono stati solo in parte.
+static void release_block_index(void) {
+
+    if (au_info.valid_bitmap) {
+        rhashtable_free_and_destroy(&(au_info.key_index), free_key_entry, NULL);
+        kvfree(au_info.valid_bitmap);
+        au_info.valid_bitmap = NULL;
+    }
+    kvfree(au_info.retained_bitmap);
+    au_info.retained_bitmap = NULL;
+    kvfree(au_info.chain_next);
+    au_info.chain_next = NULL;
+
+}
+
+//questa funzione costruisce l'indice in RAM dei blocchi allocati: se l'ultimo smontaggio è stato pulito si usa il riepilogo
+//su disco, altrimenti (o se il riepilogo risulta incoerente) si esegue la scansione completa e parallela dei metadati del dispositivo,
+//seguita dalla verifica della catena dei blocchi validi. Un riepilogo con meno messaggi che blocchi validi (come quello delle immagini
+//scritte prima dell'introduzione dei blocchi impacchettati, che non registrano il numero di messaggi) è considerato incoerente.
+//il riepilogo non contiene la tabella di traduzione della compattazione: se ci sono lapidi (moved_blocks > 0), si esegue la scansione.
+static int build_block_index(struct super_block *sb, uint64_t state, uint64_t bitmap_start, uint64_t bitmap_blocks, uint64_t valid_blocks, uint64_t valid_messages, uint64_t keyed_blocks, uint64_t moved_blocks, int64_t first_valid, int64_t last_valid) {
+
+    unsigned long *bitmap;
+    unsigned long *moved;   //lapidi della compattazione trovate dalla scansione
+    struct block_link *links;
+    uint64_t found;
+    uint64_t messages;
+    uint64_t max_seq;
+    uint64_t i;
+    int summary_used;   //1 se la bitmap è stata caricata dal riepilogo su disco
+    int ret;
+
+    summary_used = 0;
+    bitmap = kvcalloc(BITS_TO_LONGS(au_info.total_data_blocks), sizeof(unsigned long), GFP_KERNEL);
+    if (!bitmap)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    //senza la tabella dei metadati, i successori dei blocchi vengono registrati in RAM per la lettura anticipata della catena:
+    //la scansione li fornisce tutti, altrimenti vengono appresi dalle letture e dalle scritture dei metadati.
+    if (!(au_info.features & FEAT_META_TABLE)) {
+        au_info.chain_next = kvmalloc_array(au_info.total_data_blocks, sizeof(int64_t), GFP_KERNEL);
+        if (!au_info.chain_next) {
+            kvfree(bitmap);
+            return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        }
+        for(i=0; i<au_info.total_data_blocks; i++)
+            au_info.chain_next[i] = CHAIN_NEXT_UNKNOWN;
+    }
+
+    if (state == FS_STATE_CLEAN && moved_blocks > 0) {
+        printk("%s: clean file system with %llu relocated blocks, scanning the device\n", MOD_NAME, moved_blocks);
+    }
+    else if (state == FS_STATE_CLEAN) {
+        ret = load_block_summary(sb, bitmap_start, bitmap_blocks, bitmap);
+        if (ret == 0 && bitmap_weight(bitmap, au_info.total_data_blocks) == valid_blocks && valid_messages >= valid_blocks) {
+            printk("%s: clean file system: allocation bitmap loaded from the on-disk summary (%llu valid blocks)\n", MOD_NAME, valid_blocks);
+            found = valid_blocks;
+            messages = valid_messages;
+            summary_used = 1;
+            goto index_ready;
+        }
+        printk("%s: the on-disk summary is inconsistent, falling back to a full scan\n", MOD_NAME);
+        memset(bitmap, 0, BITS_TO_LONGS(au_info.total_data_blocks) * sizeof(unsigned long));
+    }
+    else {
+        printk("%s: the file system was not cleanly unmounted, scanning the device\n", MOD_NAME);
+    }
+
+    links = kvmalloc_array(au_info.total_data_blocks, sizeof(struct block_link), GFP_KERNEL);
+    moved = kvcalloc(BITS_TO_LONGS(au_info.total_data_blocks), sizeof(unsigned long), GFP_KERNEL);
+    if (!links || !moved) {
+        kvfree(moved);
+        kvfree(links);
+        ret = -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        goto index_error;
+    }
+    ret = parallel_scan(sb, bitmap, moved, links, &found, &messages, &max_seq);
+    if (ret == 0)
+        ret = check_block_chain(sb, bitmap, links, found, first_valid, last_valid);
+    if (ret == 0)
+        ret = load_relocations(sb, bitmap, moved, links);
+    if (ret == 0 && au_info.chain_next)
+        for_each_set_bit(i, bitmap, au_info.total_data_blocks)
+            au_info.chain_next[i] = links[i].next_valid;
+    kvfree(moved);
+    kvfree(links);
+    if (ret < 0)
+        goto index_error;
+    printk("%s: device scan completed (%llu valid blocks, %llu valid messages)\n", MOD_NAME, found, messages);
+    //dopo un crash il contatore su disco può essere rimasto indietro rispetto ai messaggi effettivamente scritti.
+    if (au_info.next_seq <= max_seq)
+        au_info.next_seq = max_seq + 1;
+
+index_ready:
+    //bitmap dei blocchi trattenuti per gli snapshot (vuota al montaggio: gli snapshot non sopravvivono allo smontaggio)
+    au_info.retained_bitmap = kvcalloc(BITS_TO_LONGS(au_info.total_data_blocks), sizeof(unsigned long), GFP_KERNEL);
+    if (!au_info.retained_bitmap) {
+        ret = -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        goto index_error;
+    }
+
+    //indice delle chiavi dei messaggi (get_data_by_key() e invalidate_data_by_key())
+    ret = build_key_index(sb, bitmap, summary_used, keyed_blocks);
+    if (ret < 0)
+        goto index_error;
+
+    //da qui in poi gli indici sono completi e vengono rilasciati da release_block_index()
+    au_info.valid_bitmap = bitmap;
+    au_info.valid_blocks = found;
+    au_info.valid_messages = messages;
+
+    //finché il file system è montato, il riepilogo su disco non è affidabile: lo si marca subito come tale.
+    if (!sb_rdonly(sb)) {
+        ret = store_block_summary(sb, FS_STATE_DIRTY);
+        if (ret < 0) {
+            release_block_index();
+            return ret;
+        }
+    }
+    return 0;
+
+index_error:
+    kvfree(au_info.retained_bitmap);
+    au_info.retained_bitmap = NULL;
+    kvfree(au_info.chain_next);
+    au_info.chain_next = NULL;
+    kvfree(bitmap);
+    return ret;
+
+}
+
 //funzione che ha il compito di istanziare il superblocco del filesystem "singlefilefs"
 int singlefilefs_fill_super(struct super_block *sb, void *data, int silent) {   
 
@@ -39,11 +727,22 @@ int singlefilefs_fill_super(struct super_block *sb, void *data, int silent) {
     struct onefilefs_sb_info *sb_disk;
     struct timespec64 curr_time;
     uint64_t magic;
+    uint64_t version;
 
     //qui iniziano le variabili locali definite direttamente da me
     struct onefilefs_inode *inode_disk;
-    int num_mounted_blocks;
-    int num_expected_blocks;
+    uint64_t num_mounted_blocks;
+    uint64_t num_expected_blocks;
+    uint64_t fs_state;
+    uint64_t bitmap_start;
+    uint64_t bitmap_blocks;
+    uint64_t valid_blocks;
+    uint64_t valid_messages;
+    uint64_t keyed_blocks;
+    uint64_t moved_blocks;
+    int64_t first_valid;
+    int64_t last_valid;
+    int ret;
 
     //controllo preliminare sulla dimensione della struct onefilefs_sb_info (che mantiene tutti i dati del superblocco): se eccede la dimensione di un blocco, c'è un GROSSO problema.
     if (sizeof(struct onefilefs_sb_info) > DEFAULT_BLOCK_SIZE) {
@@ -62,21 +761,45 @@ int singlefilefs_fill_super(struct super_block *sb, void *data, int silent) {
     }
     sb_disk = (struct onefilefs_sb_info *)bh->b_data;
     magic = sb_disk->magic; //estrazione del magic number a partire dalle informazioni ottenute con sb_bread()
+    version = sb_disk->version; //estrazione della versione del layout on-disk
+
+    //copia in RAM della descrizione del layout, usata dalle funzioni di utils.c per localizzare payload e metadati dei blocchi
+    au_info.features = sb_disk->features;
+    au_info.meta_start = sb_disk->meta_start;
+    au_info.data_start = sb_disk->data_start;
+    if (au_info.data_start < 2 || ((au_info.features & FEAT_META_TABLE) &&
+        (au_info.meta_start < 2 || sb_disk->meta_blocks < DIV_ROUND_UP(sb_disk->total_data_blocks, METADATA_PER_BLOCK)))) {
+        printk("%s: inconsistent layout description in the superblock\n", MOD_NAME);
+        brelse(bh);
+        return -EINVAL; //-EINVAL = parametri non validi (in questo caso il layout del dispositivo)
+    }
     num_expected_blocks = sb_disk->total_data_blocks;   //estrazione del numero massimo di blocchi che è stato imposto a tempo di compilazione (DATA_BLOCKS)
+    au_info.total_data_blocks = num_expected_blocks;
+    //estrazione del riepilogo scritto dall'ultimo smontaggio
+    fs_state = sb_disk->state;
+    bitmap_start = sb_disk->bitmap_start;
+    bitmap_blocks = sb_disk->bitmap_blocks;
+    valid_blocks = sb_disk->valid_blocks;
+    valid_messages = sb_disk->valid_messages;
+    keyed_blocks = sb_disk->keyed_blocks;
+    moved_blocks = sb_disk->moved_blocks;
+    first_valid = sb_disk->first_valid;
+    last_valid = sb_disk->last_valid;
+    au_info.next_seq = sb_disk->next_seq ? sb_disk->next_seq : 1;    //i numeri di sequenza partono da 1
 
     brelse(bh);  //rilascio del buffer head bh
 
     //lettura dell'inode dell'unico file del file system
     bh = sb_bread(sb, SINGLEFILEFS_FILE_INODE_NUMBER);
-    if (!sb){
+    if (!bh){
         return -EIO;    //-EIO = errore di input/output
     }
     inode_disk = (struct onefilefs_inode *)bh->b_data;
     num_mounted_blocks = (inode_disk->file_size)/DEFAULT_BLOCK_SIZE;
+    brelse(bh); //rilascio del buffer head bh
 
     //check sul numero di blocchi effettivamente allocati, che non deve essere superiore a quello stabilito a tempo di compilazione (DATA_BLOCKS)
     if (num_mounted_blocks > num_expected_blocks) {
-        brelse(bh); //rilascio del buffer head bh
         return -EINVAL; //-EINVAL = parametri non validi (in questo caso struct super_block *sb)
     }
 
@@ -85,13 +808,26 @@ int singlefilefs_fill_super(struct super_block *sb, void *data, int silent) {
 	    return -EBADF;  //-EBADF = file descriptor non valido
     }
 
+    //check sulla versione del layout: un'immagine di una versione precedente va ricreata con singlefilemakefs.
+    if (version != FS_VERSION) {
+        printk("%s: unsupported on-disk layout version %llu (expected %d)\n", MOD_NAME, version, FS_VERSION);
+        return -EINVAL; //-EINVAL = parametri non validi (in questo caso il layout del dispositivo)
+    }
+
     sb->s_fs_info = NULL; //FS specific data (the magic number) already reported into the generic superblock
     sb->s_op = &singlefilefs_super_ops;
 
+    //costruzione dell'indice in RAM dei blocchi allocati (bitmap), usato da put_data() per trovare un blocco libero.
+    //da qui in poi un errore deve rilasciare gli indici (fill_release_index).
+    ret = build_block_index(sb, fs_state, bitmap_start, bitmap_blocks, valid_blocks, valid_messages, keyed_blocks, moved_blocks, first_valid, last_valid);
+    if (ret < 0)
+        return ret;
+
     //di seguito verrà allocato un inode per la root del file system
     root_inode = iget_locked(sb, 0);//get a root inode indexed with 0 from cache
     if (!root_inode){
-        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        ret = -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        goto fill_release_index;
     }
 
     /* inizializzazione dell'inode con le informazioni necessarie, come:
@@ -124,17 +860,34 @@ int singlefilefs_fill_super(struct super_block *sb, void *data, int silent) {
 
     //sb->s_root = puntatore al root inode
     sb->s_root = d_make_root(root_inode);
-    if (!sb->s_root)
-        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    if (!sb->s_root) {
+        ret = -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+        goto fill_release_index;
+    }
 
     sb->s_root->d_op = &singlefilefs_dentry_ops;//set our dentry operations
 
     //unlock the inode to make it usable
     unlock_new_inode(root_inode);
 
+    //avvio del kthread di compattazione (opzione "compact"): se non può essere creato, il file system funziona comunque senza compattazione.
+    au_info.compactor = NULL;
+    if (au_info.compact && !sb_rdonly(sb)) {
+        au_info.compactor = kthread_run(compaction_thread, NULL, "singlefilefs_compact");
+        if (IS_ERR(au_info.compactor)) {
+            printk("%s: could not start the compaction thread\n", MOD_NAME);
+            au_info.compactor = NULL;
+        }
+    }
+
     printk("%s: singlefilefs_fill_super() function executed successfully\n", MOD_NAME);
     return 0;
-    
+
+fill_release_index:
+    //il superblocco viene poi eliminato da singlefilefs_kill_superblock(), che trova gli indici già rilasciati
+    release_block_index();
+    return ret;
+
 }
 
 //called on file system unmounting
@@ -143,6 +896,14 @@ static void singlefilefs_kill_superblock(struct super_block *s) {
 
     //qui iniziano le variabili locali definite direttamente da me
     long unsigned int cmp_swap_output;
+    struct retained_block *rb;
+    unsigned long seq;
+
+    //il kthread di compattazione viene fermato per primo: kthread_stop() attende la fine dell'eventuale passata in corso.
+    if (au_info.compactor) {
+        kthread_stop(au_info.compactor);
+        au_info.compactor = NULL;
+    }
 
     if (atomic_read(&(au_info.usages)) != 0) {
         printk("%s: impossible to unmount the file system: some thread is executing some fs operations\n", MOD_NAME);
@@ -155,6 +916,20 @@ static void singlefilefs_kill_superblock(struct super_block *s) {
         return;
     }
 
+    //scrittura del riepilogo (bitmap di allocazione + contatori) e marcatura dello smontaggio pulito
+    if (au_info.valid_bitmap && !sb_rdonly(s) && store_block_summary(s, FS_STATE_CLEAN) < 0)
+        printk("%s: could not write the on-disk summary: the next mount will scan the device\n", MOD_NAME);
+    release_block_index();
+    //a file system smontato non ci sono più aperture del file, né quindi snapshot attivi: i blocchi trattenuti vengono rilasciati.
+    xa_for_each(&(au_info.retained), seq, rb)
+        kfree(rb);
+    xa_destroy(&(au_info.retained));
+    xa_destroy(&(au_info.retained_count));
+    //la tabella di traduzione della compattazione resta sul dispositivo (lapidi BLOCK_MOVED) e viene ricostruita al montaggio successivo.
+    xa_destroy(&(au_info.remap));
+    xa_destroy(&(au_info.relocated));
+    au_info.relocated_blocks = 0;
+
     cleanup_srcu_struct(&(au_info.srcu));   //cleanup struct srcu_struct
     kill_block_super(s);    //è lei che esegue effettivamente l'eliminazione del superblocco, eliminando le risorse ad esso associate.
     printk("%s: singlefilefs unmount successful\n", MOD_NAME);
@@ -162,6 +937,47 @@ static void singlefilefs_kill_superblock(struct super_block *s) {
 
 }
 
+//interpreta le opzioni di montaggio (separate da virgole); restituisce 0 oppure -EINVAL se un'opzione non è riconosciuta.
+//"verify" abilita la verifica dei checksum dei payload in lettura (get_data(), dev_read()), "noverify" la disabilita (default).
+//"compress" abilita la compressione LZ4 dei nuovi messaggi (put_data()), "nocompress" la disabilita (default).
+//"pack" abilita l'impacchettamento dei nuovi messaggi brevi nell'ultimo blocco della catena (put_data()), "nopack" lo disabilita (default).
+//"compact" avvia il kthread di compattazione dei blocchi validi nell'ordine delle scritture, "nocompact" lo disabilita (default).
+static int parse_mount_options(char *options, int *verify_on_read, int *compress, int *pack, int *compact) {
+
+    char *opt;
+
+    *verify_on_read = 0;
+    *compress = 0;
+    *pack = 0;
+    *compact = 0;
+    while (options && (opt = strsep(&options, ",")) != NULL) {
+        if (*opt == '\0')
+            continue;
+        if (strcmp(opt, "verify") == 0)
+            *verify_on_read = 1;
+        else if (strcmp(opt, "noverify") == 0)
+            *verify_on_read = 0;
+        else if (strcmp(opt, "compress") == 0)
+            *compress = 1;
+        else if (strcmp(opt, "nocompress") == 0)
+            *compress = 0;
+        else if (strcmp(opt, "pack") == 0)
+            *pack = 1;
+        else if (strcmp(opt, "nopack") == 0)
+            *pack = 0;
+        else if (strcmp(opt, "compact") == 0)
+            *compact = 1;
+        else if (strcmp(opt, "nocompact") == 0)
+            *compact = 0;
+        else {
+            printk("%s: opzione di montaggio non riconosciuta: %s\n", MOD_NAME, opt);
+            return -EINVAL; //-EINVAL = parametri non validi
+        }
+    }
+    return 0;
+
+}
+
 //called on file system mounting
 //funzione che ha il compito di allocare e inizializzare una nuova struttura dentry, che rappresenta la directory root del file system.
 struct dentry *singlefilefs_mount(struct file_system_type *fs_type, int flags, const char *dev_name, void *data) {
@@ -170,14 +986,23 @@ struct dentry *singlefilefs_mount(struct file_system_type *fs_type, int flags, c
 
     //qui iniziano le variabili locali definite direttamente da me
     static DEFINE_MUTEX(w_mutex);   //dichiarazione e definizione del mutex per le scritture
-    static DEFINE_MUTEX(o_mutex);   //dichiarazione e definizione del mutex per il parametro *off di dev_read()
+    static DEFINE_MUTEX(s_mutex);   //dichiarazione e definizione del mutex per gli snapshot
     int init_srcu_output;
     long unsigned int cmp_swap_output;
+    int verify_on_read;
+    int compress;
+    int pack;
+    int compact;
+    int i;
+
+    //le opzioni vengono interpretate prima di toccare au_info, che potrebbe descrivere un montaggio già attivo
+    if (parse_mount_options(data, &verify_on_read, &compress, &pack, &compact) < 0)
+        return ERR_PTR(-EINVAL);    //-EINVAL = parametri non validi
 
     //inizializzazione dei campi di tipo struct mutex e struct srcu_struct
     au_info.write_mutex = w_mutex;
-    au_info.off_mutex = o_mutex;
-    
+    au_info.snap_mutex = s_mutex;
+
     init_srcu_output = init_srcu_struct(&(au_info.srcu));
     if (init_srcu_output != 0) {    //error
         printk("%s: error mounting onefilefs", MOD_NAME);
@@ -189,6 +1014,25 @@ struct dentry *singlefilefs_mount(struct file_system_type *fs_type, int flags, c
         printk("%s: singlefilefs was already mounted\n", MOD_NAME);
         return ERR_PTR(-EEXIST);    //-EEXIST = file system già esistente; uso ERR_PTR perché devo restituire un valore di tipo pointer.
     }
+    au_info.verify_on_read = verify_on_read;
+    au_info.compress = compress;
+    au_info.pack = pack;
+    au_info.compact = compact;
+
+    //lo stato degli snapshot viene inizializzato solo dopo aver ottenuto il montaggio: un tentativo di montaggio concorrente
+    //(che fallisce con -EEXIST) non deve azzerare la lista e l'xarray di un montaggio già attivo.
+    INIT_LIST_HEAD(&(au_info.snapshots));
+    xa_init(&(au_info.retained));
+    xa_init(&(au_info.retained_count));
+    au_info.inval_epoch = 0;
+    //allo stesso modo i seqcount dei payload: un lettore del montaggio attivo potrebbe trovarsi in una sezione di lettura.
+    for(i=0; i<PAYLOAD_SEQ_BUCKETS; i++)
+        seqcount_init(&(au_info.payload_seq[i]));
+    //e le tabelle degli spostamenti della compattazione, consultate senza lock dai lettori del montaggio attivo.
+    xa_init(&(au_info.remap));
+    xa_init(&(au_info.relocated));
+    au_info.relocated_blocks = 0;
+    au_info.compact_block = -1;
 
     /*@param fs_type: tipo di file system
      *@param flags: opzioni di montaggio
@@ -0,0 +1,408 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "singlefilecrc.h"
+#include "singlefilefs.h"
+#include "singlefileimg.h"
+
+/*
+	singlefilefsck verifica (e, con l'opzione -r, ripara) un'immagine di singlefilefs NON montata:
+	- catena dei blocchi validi (prev_valid/next_valid) a partire da first_valid;
+	- corrispondenza tra la fine della catena e last_valid;
+	- blocchi validi non raggiungibili dalla catena (orfani);
+	- coerenza della bitmap di allocazione, di valid_blocks, valid_messages e keyed_blocks, se l'immagine risulta smontata in modo pulito;
+	- checksum (CRC32C) del payload dei blocchi validi che ne hanno uno (BLOCK_CHECKSUM);
+	- directory degli slot dei blocchi impacchettati (BLOCK_PACKED): slot entro il payload e numero di slot validi.
+	La scansione dei metadati è suddivisa tra più thread; la verifica della catena è invece sequenziale.
+	Un payload corrotto (o una directory degli slot incoerente) non può essere riparato (-r non scarta alcun blocco valido): viene solo segnalato.
+
+	Codici di uscita: 0 = nessun errore, 1 = errori riparati, 4 = errori non riparati, 8 = errore operativo.
+*/
+
+#define FSCK_MAX_THREADS 64
+#define FSCK_MIN_BLOCKS_PER_THREAD 4096	//sotto questa soglia di data block per thread non conviene parallelizzare
+
+//descrittore del lavoro assegnato a un thread di scansione
+struct fsck_work {
+	struct sfs_image *img;
+	uint64_t start;					//primo data block dell'intervallo
+	uint64_t end;					//primo data block escluso dall'intervallo
+	unsigned char *valid;			//valid[i] = 1 se il data block i è valido
+	uint64_t found;					//blocchi validi trovati nell'intervallo
+	uint64_t messages;				//messaggi validi trovati nell'intervallo (più d'uno per un blocco impacchettato)
+	uint64_t max_seq;				//massimo numero di sequenza dei messaggi dell'intervallo
+	uint64_t keyed;					//blocchi validi con chiave (BLOCK_KEYED) trovati nell'intervallo
+	uint64_t checksummed;			//blocchi validi con checksum (BLOCK_CHECKSUM) trovati nell'intervallo
+	uint64_t corrupted;				//blocchi validi il cui payload non corrisponde al checksum
+	int64_t first_corrupted;		//primo blocco corrotto dell'intervallo (-1 se nessuno)
+	uint64_t bad_directories;		//blocchi impacchettati con la directory degli slot incoerente
+	int64_t first_bad_directory;	//primo blocco impacchettato incoerente dell'intervallo (-1 se nessuno)
+	uint64_t bitmap_mismatches;		//blocchi per i quali la bitmap su disco non corrisponde a is_valid
+	int threaded;					//1 se l'intervallo è stato affidato a un thread (da attendere con pthread_join())
+};
+
+//FUNCTIONS PROTOTYPES
+long packed_live(struct data_block_content *);
+void *scan_range(void *);
+int block_linked(struct sfs_image *, unsigned char *, int64_t, int64_t);
+uint64_t append_fragment(struct sfs_image *, unsigned char *, uint64_t, uint64_t *, uint64_t);
+double elapsed(struct timespec *, struct timespec *);
+
+//verifica la directory degli slot del blocco impacchettato con contenuto cont: restituisce il numero di slot validi, oppure -1 se
+//la directory è incoerente (slot al di fuori dei dati, live diverso dal numero di slot validi, nessuno slot valido).
+long packed_live(struct data_block_content *cont) {
+
+	struct packed_header *hdr = (struct packed_header *)cont->payload;
+	long live;
+	int i;
+
+	if (hdr->slots > PACKED_MAX_SLOTS || hdr->end < sizeof(struct packed_header) || hdr->end > DEFAULT_BLOCK_SIZE-METADATA_SIZE)
+		return -1;
+	for(i=0, live=0; i<hdr->slots; i++) {
+		if (hdr->slot[i].offset < sizeof(struct packed_header) || hdr->slot[i].offset + hdr->slot[i].length > hdr->end)
+			return -1;
+		if (hdr->slot[i].flags & SLOT_VALID)
+			live++;
+	}
+	if (live == 0 || live != hdr->live)
+		return -1;
+	return live;
+
+}
+
+//corpo dei thread di scansione: marca in valid i data block validi dell'intervallo e confronta la bitmap su disco.
+void *scan_range(void *arg) {
+
+	struct fsck_work *work = (struct fsck_work *)arg;
+	struct onefilefs_sb_info *sb = work->img->sb;
+	struct data_block_metadata *meta;
+	unsigned char *bitmap;
+	uint64_t i;
+	long live;
+	int on_disk;
+
+	bitmap = (unsigned char *)image_block(work->img, sb->bitmap_start);
+	work->first_corrupted = -1;
+	work->first_bad_directory = -1;
+	for(i=work->start; i<work->end; i++) {
+		meta = image_metadata(work->img, i);
+		if (meta->is_valid) {
+			work->valid[i] = 1;
+			work->found++;
+			work->messages++;
+			if (meta->seq > work->max_seq)
+				work->max_seq = meta->seq;
+			//gli slot di un blocco impacchettato hanno numeri di sequenza consecutivi a partire da quello del blocco
+			if (meta->flags & BLOCK_PACKED) {
+				live = packed_live(image_data_block(work->img, i));
+				if (live < 0) {
+					if (work->bad_directories++ == 0)
+						work->first_bad_directory = i;
+				}
+				else {
+					work->messages += live - 1;
+					if (meta->seq + ((struct packed_header *)image_data_block(work->img, i)->payload)->slots - 1 > work->max_seq)
+						work->max_seq = meta->seq + ((struct packed_header *)image_data_block(work->img, i)->payload)->slots - 1;
+				}
+			}
+			if (meta->flags & BLOCK_KEYED)
+				work->keyed++;
+			if (meta->flags & BLOCK_CHECKSUM) {
+				work->checksummed++;
+				if (payload_checksum(image_data_block(work->img, i)->payload) != meta->checksum) {
+					if (work->corrupted++ == 0)
+						work->first_corrupted = i;
+				}
+			}
+		}
+		on_disk = (bitmap[i/8] >> (i%8)) & 1;
+		if (on_disk != work->valid[i])
+			work->bitmap_mismatches++;
+	}
+	return NULL;
+
+}
+
+//restituisce 1 se next è un data block valido, non ancora inserito nella catena ricostruita, il cui prev_valid punta a curr.
+int block_linked(struct sfs_image *img, unsigned char *valid, int64_t curr, int64_t next) {
+
+	if (next < 0 || (uint64_t)next >= img->sb->total_data_blocks || valid[next] != 1)
+		return 0;
+	return image_metadata(img, next)->prev_valid == curr;
+
+}
+
+//accoda in order[] il frammento di catena coerente che parte da head, marcandone i blocchi come inseriti (valid[i] = 2).
+//restituisce il nuovo numero di elementi di order[].
+uint64_t append_fragment(struct sfs_image *img, unsigned char *valid, uint64_t head, uint64_t *order, uint64_t num) {
+
+	int64_t curr;
+
+	curr = head;
+	order[num++] = curr;
+	valid[curr] = 2;
+	while (block_linked(img, valid, curr, image_metadata(img, curr)->next_valid)) {
+		curr = image_metadata(img, curr)->next_valid;
+		order[num++] = curr;
+		valid[curr] = 2;
+	}
+	return num;
+
+}
+
+//restituisce i secondi trascorsi tra start e end
+double elapsed(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sfs_image img;
+	struct onefilefs_sb_info *sb;
+	struct fsck_work *works;
+	pthread_t *tids;
+	struct timespec t_start, t_scan, t_end;
+
+	//qui iniziano le variabili locali definite direttamente da me
+	int opt;
+	int repair;				//flag che indica se gli errori vanno riparati (opzione -r)
+	long num_threads;
+	long i;
+	uint64_t total;
+	uint64_t chunk;
+	uint64_t found;
+	uint64_t messages;
+	uint64_t keyed;
+	uint64_t checksummed;
+	uint64_t corrupted;
+	int64_t first_corrupted;
+	uint64_t bad_directories;
+	int64_t first_bad_directory;
+	uint64_t linked;
+	uint64_t bitmap_mismatches;
+	uint64_t errors;
+	uint64_t scanned_bytes;
+	uint64_t num;
+	uint64_t block;
+	uint64_t *order;		//ordine temporale ricostruito dei blocchi validi (solo con -r)
+	uint64_t max_seq;
+	unsigned char *valid;
+	unsigned char *bitmap;
+	int64_t curr;
+	int64_t prev;
+
+	repair = 0;
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "rj:")) != -1) {
+		switch (opt) {
+			case 'r':
+				repair = 1;
+				break;
+			case 'j':
+				num_threads = atol(optarg);
+				break;
+			default:
+				printf("Usage: singlefilefsck [-r] [-j threads] <image>\n");
+				fflush(stdout);
+				return 8;
+		}
+	}
+	if (argc - optind != 1) {
+		printf("Usage: singlefilefsck [-r] [-j threads] <image>\n");
+		fflush(stdout);
+		return 8;
+	}
+
+	if (image_open(&img, argv[optind], repair) < 0) {
+		fflush(stdout);
+		return 8;
+	}
+	sb = img.sb;
+	total = sb->total_data_blocks;
+
+	valid = calloc(total, 1);
+	if (!valid) {
+		printf("Could not allocate the block map.\n");
+		image_close(&img);
+		return 8;
+	}
+
+	//scansione parallela dei metadati
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > FSCK_MAX_THREADS)
+		num_threads = FSCK_MAX_THREADS;
+	if ((uint64_t)num_threads > (total + FSCK_MIN_BLOCKS_PER_THREAD - 1) / FSCK_MIN_BLOCKS_PER_THREAD)
+		num_threads = (total + FSCK_MIN_BLOCKS_PER_THREAD - 1) / FSCK_MIN_BLOCKS_PER_THREAD;
+	if (num_threads < 1)
+		num_threads = 1;
+	chunk = (total + num_threads - 1) / num_threads;
+	works = calloc(num_threads, sizeof(struct fsck_work));
+	tids = calloc(num_threads, sizeof(pthread_t));
+	if (!works || !tids) {
+		printf("Could not allocate the scan threads.\n");
+		image_close(&img);
+		return 8;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	for(i=0; i<num_threads; i++) {
+		works[i].img = &img;
+		works[i].start = (i*chunk < total) ? i*chunk : total;
+		works[i].end = ((i+1)*chunk < total) ? (i+1)*chunk : total;
+		works[i].valid = valid;
+		works[i].threaded = (pthread_create(&tids[i], NULL, scan_range, &works[i]) == 0);
+		if (!works[i].threaded)
+			scan_range(&works[i]);	//se il thread non può essere creato, l'intervallo viene esaminato dal thread corrente
+	}
+	found = 0;
+	messages = 0;
+	max_seq = 0;
+	keyed = 0;
+	checksummed = 0;
+	corrupted = 0;
+	first_corrupted = -1;
+	bad_directories = 0;
+	first_bad_directory = -1;
+	bitmap_mismatches = 0;
+	for(i=0; i<num_threads; i++) {
+		if (works[i].threaded)
+			pthread_join(tids[i], NULL);
+		found += works[i].found;
+		messages += works[i].messages;
+		if (works[i].max_seq > max_seq)
+			max_seq = works[i].max_seq;
+		keyed += works[i].keyed;
+		checksummed += works[i].checksummed;
+		corrupted += works[i].corrupted;
+		if (first_corrupted == -1)
+			first_corrupted = works[i].first_corrupted;
+		bad_directories += works[i].bad_directories;
+		if (first_bad_directory == -1)
+			first_bad_directory = works[i].first_bad_directory;
+		bitmap_mismatches += works[i].bitmap_mismatches;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_scan);
+
+	errors = 0;
+	printf("Image: %lu data blocks, %lu valid (%lu messages), layout %s, %s.\n", total, found, messages,
+		(sb->features & FEAT_META_TABLE) ? "metadata table" : "inline metadata",
+		(sb->state == FS_STATE_CLEAN) ? "cleanly unmounted" : "NOT cleanly unmounted");
+
+	//il riepilogo su disco è significativo solo se l'immagine è stata smontata in modo pulito
+	if (sb->state == FS_STATE_CLEAN) {
+		if (bitmap_mismatches) {
+			printf("Allocation bitmap: %lu blocks do not match their metadata.\n", bitmap_mismatches);
+			errors++;
+		}
+		if (sb->valid_blocks != found) {
+			printf("Superblock: valid_blocks is %lu, but %lu blocks are valid.\n", sb->valid_blocks, found);
+			errors++;
+		}
+		if (sb->valid_messages != messages) {
+			printf("Superblock: valid_messages is %lu, but the valid blocks hold %lu messages.\n", sb->valid_messages, messages);
+			errors++;
+		}
+		if (sb->keyed_blocks != keyed) {
+			printf("Superblock: keyed_blocks is %lu, but %lu valid blocks have a key.\n", sb->keyed_blocks, keyed);
+			errors++;
+		}
+	}
+
+	//i payload corrotti vengono contati a parte, dato che la riparazione non può recuperarli
+	if (corrupted)
+		printf("Payload checksum: %lu of %lu checksummed valid blocks are corrupted (first: block %ld).\n", corrupted, checksummed, first_corrupted);
+	if (bad_directories)
+		printf("Packed blocks: %lu valid blocks have an inconsistent slot directory (first: block %ld).\n", bad_directories, first_bad_directory);
+	corrupted += bad_directories;
+
+	//verifica sequenziale della catena dei blocchi validi
+	prev = -1;
+	linked = 0;
+	for(curr=sb->first_valid; curr!=-1; prev=curr, curr=image_metadata(&img, curr)->next_valid) {
+		if (curr < 0 || (uint64_t)curr >= total || !valid[curr] || image_metadata(&img, curr)->prev_valid != prev || ++linked > found) {
+			printf("Block chain: broken link from block %ld to block %ld.\n", prev, curr);
+			errors++;
+			break;
+		}
+	}
+	if (curr == -1 && prev != sb->last_valid) {
+		printf("Superblock: the block chain ends at block %ld, but last_valid is %ld.\n", prev, sb->last_valid);
+		errors++;
+	}
+	if (linked < found) {
+		printf("Block chain: %lu valid blocks are not reachable from first_valid.\n", found - linked);
+		errors++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+	//con la tabella dei metadati, dei data block vengono letti soltanto i payload da verificare
+	scanned_bytes = ((sb->features & FEAT_META_TABLE) ? sb->meta_blocks + checksummed : total) * DEFAULT_BLOCK_SIZE;
+	printf("Checked %lu MB in %.3f s (scan %.3f s with %ld threads, %.1f MB/s).\n", scanned_bytes >> 20,
+		elapsed(&t_start, &t_end), elapsed(&t_start, &t_scan), num_threads,
+		(scanned_bytes / 1048576.0) / elapsed(&t_start, &t_scan));
+
+	if (errors == 0 && (!repair || sb->state == FS_STATE_CLEAN)) {
+		printf(corrupted ? "No structural errors found.\n" : "No errors found.\n");
+		image_close(&img);
+		return corrupted ? 4 : 0;
+	}
+	if (!repair) {
+		printf("%lu errors found: run again with -r to repair the image.\n", errors);
+		image_close(&img);
+		return 4;
+	}
+
+	/* riparazione: nessun blocco valido viene scartato. La catena ricostruita è formata dal prefisso coerente della catena
+	 * che parte da first_valid, seguito dagli altri frammenti coerenti (in ordine di indice del blocco di testa) e infine
+	 * dai blocchi rimasti (cicli), uno per volta. */
+	order = malloc((found ? found : 1) * sizeof(uint64_t));
+	if (!order) {
+		printf("Could not allocate the rebuilt block chain.\n");
+		image_close(&img);
+		return 8;
+	}
+	num = 0;
+	if (sb->first_valid >= 0 && (uint64_t)sb->first_valid < total && valid[sb->first_valid] == 1)
+		num = append_fragment(&img, valid, sb->first_valid, order, num);
+	for(block=0; block<total; block++)
+		if (valid[block] == 1 && !block_linked(&img, valid, image_metadata(&img, block)->prev_valid, block))
+			num = append_fragment(&img, valid, block, order, num);
+	for(block=0; block<total; block++)
+		if (valid[block] == 1)
+			num = append_fragment(&img, valid, block, order, num);
+
+	for(block=0; block<num; block++) {
+		image_metadata(&img, order[block])->prev_valid = (block == 0) ? -1 : (int64_t)order[block-1];
+		image_metadata(&img, order[block])->next_valid = (block == num-1) ? -1 : (int64_t)order[block+1];
+	}
+	sb->first_valid = num ? (int64_t)order[0] : -1;
+	sb->last_valid = num ? (int64_t)order[num-1] : -1;
+
+	//riscrittura del riepilogo: l'immagine riparata risulta smontata in modo pulito
+	bitmap = (unsigned char *)image_block(&img, sb->bitmap_start);
+	memset(bitmap, 0, sb->bitmap_blocks * DEFAULT_BLOCK_SIZE);
+	for(block=0; block<num; block++)
+		bitmap[order[block]/8] |= 1 << (order[block]%8);
+	sb->valid_blocks = num;
+	sb->valid_messages = messages;
+	sb->keyed_blocks = keyed;
+	if (sb->next_seq <= max_seq)
+		sb->next_seq = max_seq + 1;	//i numeri di sequenza non devono mai essere riassegnati
+	sb->state = FS_STATE_CLEAN;
+
+	printf("Image repaired: %lu valid blocks relinked, first_valid = %ld, last_valid = %ld.\n", num, sb->first_valid, sb->last_valid);
+	fflush(stdout);
+	free(order);
+	free(valid);
+	free(works);
+	free(tids);
+	image_close(&img);
+	return corrupted ? 4 : (errors ? 1 : 0);
+
+}
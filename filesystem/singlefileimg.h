@@ -0,0 +1,100 @@
+#ifndef _ONEFILEFSIMG_H
+#define _ONEFILEFSIMG_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "singlefilefs.h"
+
+/*
+	Accesso in user space (senza il modulo) a un'immagine di singlefilefs: l'immagine viene mappata in memoria
+	per intero e superblocco, bitmap di allocazione, metadati e payload dei data block vengono letti direttamente
+	dalla mappatura. Queste funzioni sono condivise dai tool offline (singlefilefsck, ...).
+*/
+
+struct sfs_image {
+	int fd;
+	char *base;						//inizio della mappatura dell'immagine
+	size_t size;					//dimensione in byte dell'immagine
+	struct onefilefs_sb_info *sb;	//superblocco (all'interno della mappatura)
+};
+
+//restituisce il puntatore al blocco (assoluto) di indice block all'interno della mappatura
+static inline char *image_block(struct sfs_image *img, uint64_t block) {
+	return img->base + block * DEFAULT_BLOCK_SIZE;
+}
+
+//restituisce il puntatore al data block di indice offset
+static inline struct data_block_content *image_data_block(struct sfs_image *img, uint64_t offset) {
+	return (struct data_block_content *)image_block(img, img->sb->data_start + offset);
+}
+
+//restituisce il puntatore ai metadati del data block di indice offset (nella tabella oppure in testa al blocco, a seconda del layout)
+static inline struct data_block_metadata *image_metadata(struct sfs_image *img, uint64_t offset) {
+	if (img->sb->features & FEAT_META_TABLE)
+		return &(((struct data_block_metadata *)image_block(img, img->sb->meta_start))[offset]);
+	return &(image_data_block(img, offset)->metadata);
+}
+
+//apre e mappa l'immagine path (in lettura+scrittura se writable != 0) e verifica che il superblocco descriva un layout
+//supportato e interamente contenuto nell'immagine. Restituisce 0 in caso di successo, -1 altrimenti.
+static int image_open(struct sfs_image *img, const char *path, int writable) {
+
+	struct stat st;
+	struct onefilefs_sb_info *sb;
+
+	img->fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (img->fd == -1) {
+		perror("Error opening the image");
+		return -1;
+	}
+	if (fstat(img->fd, &st) == -1 || st.st_size < 2*DEFAULT_BLOCK_SIZE) {
+		fprintf(stderr, "The image is too small to contain a singlefilefs.\n");
+		close(img->fd);
+		return -1;
+	}
+	img->size = st.st_size;
+	img->base = mmap(NULL, img->size, writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, img->fd, 0);
+	if (img->base == MAP_FAILED) {
+		perror("Error mapping the image");
+		close(img->fd);
+		return -1;
+	}
+	img->sb = sb = (struct onefilefs_sb_info *)img->base;
+
+	if (sb->magic != MAGIC || sb->block_size != DEFAULT_BLOCK_SIZE) {
+		fprintf(stderr, "Bad magic number or block size: this is not a singlefilefs image.\n");
+		goto image_error;
+	}
+	if (sb->version != FS_VERSION) {
+		fprintf(stderr, "Unsupported on-disk layout version %lu (expected %d).\n", sb->version, FS_VERSION);
+		goto image_error;
+	}
+	if (sb->data_start < BITMAP_START || (sb->data_start + sb->total_data_blocks) * DEFAULT_BLOCK_SIZE > img->size ||
+		sb->bitmap_blocks * BITMAP_BITS_PER_BLOCK < sb->total_data_blocks ||
+		((sb->features & FEAT_META_TABLE) && sb->meta_blocks * METADATA_PER_BLOCK < sb->total_data_blocks)) {
+		fprintf(stderr, "Inconsistent layout description in the superblock.\n");
+		goto image_error;
+	}
+	return 0;
+
+image_error:
+	munmap(img->base, img->size);
+	close(img->fd);
+	return -1;
+
+}
+
+//scrive su disco le eventuali modifiche e rilascia la mappatura
+static void image_close(struct sfs_image *img) {
+	msync(img->base, img->size, MS_SYNC);
+	munmap(img->base, img->size);
+	close(img->fd);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _ONEFILEFSLZ4_H
+#define _ONEFILEFSLZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+	Decompressore del formato a blocchi di LZ4 (lo stesso prodotto da LZ4_compress_default() nel kernel), usato dai tool
+	offline per leggere i messaggi memorizzati compressi senza dipendere dalla libreria liblz4. Ogni sequenza del blocco è:
+	token (4 bit di lunghezza dei letterali + 4 bit di lunghezza del match - 4), eventuali byte di estensione delle lunghezze
+	(255 = continua), letterali, offset del match a 16 bit little-endian. L'ultima sequenza contiene soltanto letterali.
+*/
+
+//legge l'estensione di una lunghezza (byte successivi al token, finché valgono 255). Restituisce -1 se l'input termina prima.
+static inline long lz4_read_length(const uint8_t **ip, const uint8_t *iend, long len) {
+
+	uint8_t b;
+
+	if (len != 15)
+		return len;
+	do {
+		if (*ip >= iend)
+			return -1;
+		b = *(*ip)++;
+		len += b;
+	} while (b == 255);
+	return len;
+
+}
+
+//decompressa i srclen byte di src in dst (capacità dstcap byte). Restituisce la lunghezza del messaggio decompresso oppure -1
+//se il blocco è danneggiato: non legge né scrive mai al di fuori dei buffer indicati.
+static inline long lz4_decompress_block(const char *src, size_t srclen, char *dst, size_t dstcap) {
+
+	const uint8_t *ip = (const uint8_t *)src;
+	const uint8_t *iend = ip + srclen;
+	uint8_t *op = (uint8_t *)dst;
+	uint8_t *oend = op + dstcap;
+	uint8_t *match;
+	long lit_len, match_len;
+	size_t offset;
+	uint8_t token;
+
+	while (ip < iend) {
+		token = *ip++;
+		lit_len = lz4_read_length(&ip, iend, token >> 4);
+		if (lit_len < 0 || lit_len > iend - ip || lit_len > oend - op)
+			return -1;
+		memcpy(op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if (ip == iend)		//ultima sequenza: soltanto letterali
+			return op - (uint8_t *)dst;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst))
+			return -1;
+		match_len = lz4_read_length(&ip, iend, token & 0xf);
+		if (match_len < 0)
+			return -1;
+		match_len += 4;
+		if (match_len > oend - op)
+			return -1;
+		//il match può sovrapporsi ai byte che sta producendo (offset < match_len): copia byte per byte
+		for(match=op-offset; match_len>0; match_len--)
+			*op++ = *match++;
+	}
+	return -1;	//un blocco non può terminare con un match
+
+}
+
+#endif
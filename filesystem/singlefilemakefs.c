@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -5,8 +7,10 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "singlefilecrc.h"
 #include "singlefilefs.h"
 #include "singlefilefs_init.h"
 
@@ -14,237 +18,449 @@
 	This singlefilemakefs will write the following information onto the disk
 	- BLOCK 0, superblock;
 	- BLOCK 1, inode of the unique file (the inode for root is volatile);
-	- BLOCK 2, ..., datablocks of the unique file 
+	- BLOCK 2, ..., allocation bitmap (BITMAP_BITS_PER_BLOCK data blocks per block);
+	- (only with -t) metadata table (METADATA_PER_BLOCK entries per block);
+	- datablocks of the unique file
+
+	L'immagine viene costruita in memoria e scritta con poche pwrite() di grandi dimensioni: i blocchi di testa
+	(superblocco, inode, bitmap ed eventuale tabella dei metadati) con una sola chiamata, i data block validi a lotti
+	di MKFS_BATCH_BLOCKS blocchi. I data block non validi valgono interamente zero e non vengono scritti: su un file
+	regolare restano dei "buchi" (ftruncate()), mentre su un dispositivo a blocchi vengono azzerati con fallocate().
+
+	Con l'opzione -i il contenuto iniziale del file non è quello di singlefilefs_init.h ma viene importato da un file
+	(o da stdin, con "-"): un messaggio per riga (newline incluso) oppure, con -l, record composti da una lunghezza
+	a 32 bit little-endian seguita dal payload. I messaggi vengono posti in data block consecutivi, già collegati tra loro.
+	Con l'opzione -p i messaggi brevi (al più PACKED_MAX_MESSAGE byte) vengono impacchettati, come farebbe put_data() con
+	l'opzione di montaggio "pack": ciascuno diventa uno slot dell'ultimo blocco impacchettato, finché questo ha spazio.
 */
 
+#define MKFS_BATCH_BLOCKS 256	//numero di data block accumulati in memoria prima di ogni scrittura (1MB)
+#define MKFS_INPUT_BUFFER (1<<20)	//dimensione del buffer di lettura del file da importare
+
+//lotto di data block consecutivi in attesa di essere scritti
+struct block_batch {
+	char *buffer;		//MKFS_BATCH_BLOCKS blocchi contigui
+	uint64_t first;		//indice (assoluto) del primo blocco del lotto
+	uint64_t count;		//numero di blocchi presenti nel lotto
+};
+
+//FUNCTIONS PROTOTYPES
+int flush_batch(int, struct block_batch *);
+char *batch_block(int, struct block_batch *, uint64_t);
+int zero_image(int, uint64_t);
+int next_message(FILE *, int, char **, size_t *, size_t *);
+void pack_message(struct packed_header *, char *, size_t);
+
+//scrive su disco i blocchi accumulati nel lotto. Restituisce 0 in caso di successo, -1 altrimenti.
+int flush_batch(int fd, struct block_batch *batch) {
+
+	ssize_t ret;
+	size_t nbytes;
+
+	if (batch->count == 0)
+		return 0;
+	nbytes = batch->count * DEFAULT_BLOCK_SIZE;
+	ret = pwrite(fd, batch->buffer, nbytes, batch->first * DEFAULT_BLOCK_SIZE);
+	if (ret != (ssize_t)nbytes) {
+		printf("Writing file datablocks has failed.\n");
+		fflush(stdout);
+		return -1;
+	}
+	batch->count = 0;
+	return 0;
+
+}
+
+//restituisce il buffer (azzerato) in cui costruire il blocco di indice block, scrivendo prima il lotto corrente
+//se è pieno o se block non ne è il prosecutore. Restituisce NULL in caso di errore di scrittura.
+char *batch_block(int fd, struct block_batch *batch, uint64_t block) {
+
+	char *buffer;
+
+	if (batch->count == MKFS_BATCH_BLOCKS || (batch->count > 0 && block != batch->first + batch->count)) {
+		if (flush_batch(fd, batch) < 0)
+			return NULL;
+	}
+	if (batch->count == 0)
+		batch->first = block;
+	buffer = batch->buffer + batch->count * DEFAULT_BLOCK_SIZE;
+	memset(buffer, 0, DEFAULT_BLOCK_SIZE);
+	batch->count++;
+	return buffer;
+
+}
+
+//porta a zero l'intero contenuto del dispositivo (size byte) senza scrivere i blocchi uno per uno:
+//un file regolare viene troncato e riesteso (i blocchi diventano "buchi"), un dispositivo a blocchi viene azzerato
+//con fallocate() e, se non supportata, con scritture di zeri di grandi dimensioni.
+int zero_image(int fd, uint64_t size) {
+
+	struct stat st;
+	char *zeroes;
+	uint64_t done;
+	size_t nbytes;
+
+	if (fstat(fd, &st) == -1) {
+		perror("Error reading the device attributes");
+		return -1;
+	}
+	if (S_ISREG(st.st_mode)) {
+		if (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1) {
+			perror("Error resizing the image");
+			return -1;
+		}
+		return 0;
+	}
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+		return 0;
+
+	zeroes = calloc(MKFS_BATCH_BLOCKS, DEFAULT_BLOCK_SIZE);
+	if (!zeroes) {
+		printf("Could not allocate the zero buffer.\n");
+		return -1;
+	}
+	for(done=0; done<size; done+=nbytes) {
+		nbytes = (size - done < MKFS_BATCH_BLOCKS * DEFAULT_BLOCK_SIZE) ? size - done : MKFS_BATCH_BLOCKS * DEFAULT_BLOCK_SIZE;
+		if (pwrite(fd, zeroes, nbytes, done) != (ssize_t)nbytes) {
+			perror("Error zeroing the device");
+			free(zeroes);
+			return -1;
+		}
+	}
+	free(zeroes);
+	return 0;
+
+}
+
+//legge da input il prossimo messaggio da importare, ponendolo in *message (riallocato se necessario) e la sua dimensione in *size.
+//restituisce 1 se è stato letto un messaggio, 0 se l'input è terminato, -1 in caso di input malformato.
+int next_message(FILE *input, int length_delimited, char **message, size_t *capacity, size_t *size) {
+
+	ssize_t line_size;
+	unsigned char length[4];
+
+	if (!length_delimited) {
+		line_size = getline(message, capacity, input);
+		if (line_size == -1)
+			return ferror(input) ? -1 : 0;
+		*size = line_size;
+		return 1;
+	}
+
+	if (fread(length, 1, sizeof(length), input) != sizeof(length))
+		return (feof(input) && !ferror(input)) ? 0 : -1;	//un record troncato viene comunque segnalato dal controllo successivo
+	*size = length[0] | (length[1] << 8) | (length[2] << 16) | ((size_t)length[3] << 24);
+	if (*size > DEFAULT_BLOCK_SIZE-METADATA_SIZE)
+		return -1;
+	if (*capacity < DEFAULT_BLOCK_SIZE) {
+		*message = realloc(*message, DEFAULT_BLOCK_SIZE);
+		if (!*message)
+			return -1;
+		*capacity = DEFAULT_BLOCK_SIZE;
+	}
+	if (fread(*message, 1, *size, input) != *size)
+		return -1;
+	return 1;
+
+}
+
+//accoda il messaggio (size byte) come nuovo slot del blocco impacchettato con directory hdr, che deve avere spazio.
+void pack_message(struct packed_header *hdr, char *message, size_t size) {
+
+	hdr->slot[hdr->slots].offset = hdr->end;
+	hdr->slot[hdr->slots].length = size;
+	hdr->slot[hdr->slots].flags = SLOT_VALID;
+	memcpy((char *)hdr + hdr->end, message, size);
+	hdr->end += size;
+	hdr->slots++;
+	hdr->live++;
+
+}
+
 int main(int argc, char *argv[])
 {
 	int fd;
-	long unsigned int nbytes;
 	ssize_t ret;
-	struct onefilefs_sb_info sb;
-	struct onefilefs_inode root_inode;
-	struct onefilefs_inode file_inode;
-	struct onefilefs_dir_record record;
-	char *block_padding;
+	struct onefilefs_sb_info *sb;
+	struct onefilefs_inode *file_inode;
 
 	//qui iniziano le variabili locali definite direttamente da me
-	int i, block_index;	//per i cicli for
-	int num_data_blocks;
-	int num_data_blocks_to_write;
-	struct data_block_metadata struct_metadata;
-	unsigned char *char_metadata;
+	int opt;
+	uint64_t num_data_blocks;
+	uint64_t num_data_blocks_to_write;
+	uint64_t num_default_blocks;	//numero di messaggi del contenuto di default (singlefilefs_init.h)
+	uint64_t block_index;
+	uint64_t num_messages;	//numero di messaggi scritti (con -p può superare il numero di data block)
+	char *end;
+	int pack;				//flag che indica se i messaggi brevi vanno impacchettati (opzione -p)
+	int length_delimited;	//flag che indica se i messaggi da importare sono preceduti dalla loro lunghezza (opzione -l)
+	int read_ret;
+	char *input_path;		//file da cui importare i messaggi (opzione -i)
+	char *payload;
+	char *message;			//buffer del messaggio letto dal file da importare
+	size_t message_capacity;
+	FILE *input;
+	struct timespec t_start, t_end;
+	double seconds;
+	int meta_table;			//flag che indica se i metadati dei blocchi vanno posti in una tabella contigua (opzione -t)
+	uint64_t meta_blocks;	//numero di blocchi occupati dalla tabella dei metadati
+	uint64_t bitmap_blocks;	//numero di blocchi occupati dalla bitmap di allocazione
+	uint64_t head_blocks;	//numero di blocchi che precedono i data block
+	uint64_t head_written;	//numero di blocchi di testa da scrivere (la parte finale della tabella dei metadati vale zero)
+	size_t payload_size;
+	char *head;				//superblocco, inode, bitmap ed eventuale tabella dei metadati, costruiti in memoria
+	char *block;
+	unsigned char *bitmap;
+	struct data_block_metadata *table;
+	struct data_block_metadata *struct_metadata;
+	struct data_block_metadata *last_metadata;
+	struct packed_header *last_packed;	//directory degli slot dell'ultimo blocco, se è impacchettato (NULL altrimenti)
+	struct block_batch batch;
+
+	meta_table = 0;
+	pack = 0;
+	length_delimited = 0;
+	input_path = NULL;
+	while ((opt = getopt(argc, argv, "ti:lp")) != -1) {
+		switch (opt) {
+			case 't':
+				meta_table = 1;
+				break;
+			case 'i':
+				input_path = optarg;
+				break;
+			case 'l':
+				length_delimited = 1;
+				break;
+			case 'p':
+				pack = 1;
+				break;
+			default:
+				printf("Usage: mkfs-singlefilefs [-t] [-p] [-i <input> [-l]] <device> <num_data_blocks>\n");
+				fflush(stdout);
+				return -1;
+		}
+	}
 
 	//il programma prende come argomento il dispositivo di destinazione in cui verrà creato il file system.
-	if (argc != 3) {
-		printf("Usage: mkfs-singlefilefs <device> <num_data_blocks>\n");
+	if (argc - optind != 2 || (length_delimited && !input_path)) {
+		printf("Usage: mkfs-singlefilefs [-t] [-p] [-i <input> [-l]] <device> <num_data_blocks>\n");
 		fflush(stdout);
 		return -1;
 	}
 
-	//inizializzazione di num_data_blocks e di num_data_blocks_to_write
-	num_data_blocks = atoi(argv[2]);	
-	num_data_blocks_to_write = sizeof(file_body)/sizeof(file_body[0]); //funziona perché stiamo dividendo la dimensione di un array di puntatori per la dimensione di un puntatore.
-
-	//sanity check sui valori di num_data_blocks e di num_data_blocks_to_write
-	if (num_data_blocks <= 0) {
-		printf("Invalid number of data blocks.\n");
+	//inizializzazione di num_data_blocks e di num_default_blocks
+	//il numero di data block deve essere un intero positivo, tutto cifre, e l'indice di ogni blocco deve stare nei bit dell'indirizzo
+	//di un messaggio riservati al blocco (ADDRESS_BLOCK()): in tal modo anche la dimensione del dispositivo in byte non eccede off_t.
+	errno = 0;
+	num_data_blocks = strtoull(argv[optind+1], &end, 10);
+	if (argv[optind+1][0] < '0' || argv[optind+1][0] > '9' || *end != '\0' || errno == ERANGE ||
+		num_data_blocks == 0 || num_data_blocks > (1ULL << PACKED_SLOT_SHIFT)) {
+		printf("Invalid number of data blocks (between 1 and %llu).\n", 1ULL << PACKED_SLOT_SHIFT);
 		fflush(stdout);
 		return -1;
 	}
-	if (num_data_blocks_to_write > num_data_blocks) {
+	num_default_blocks = input_path ? 0 : sizeof(file_body)/sizeof(file_body[0]); //funziona perché stiamo dividendo la dimensione di un array di puntatori per la dimensione di un puntatore.
+
+	//sanity check sul numero di messaggi del contenuto di default
+	if (num_default_blocks > num_data_blocks) {
 		printf("Number of data blocks to write exceeds number of data blocks.\n");
 		fflush(stdout);
 		return -1;
 	}
 
-	//apertura del dispositivo in modalità lettura+scrittura
-	fd = open(argv[1], O_RDWR);
+	//apertura del file da importare
+	input = NULL;
+	message = NULL;
+	message_capacity = 0;
+	if (input_path) {
+		input = strcmp(input_path, "-") ? fopen(input_path, "r") : stdin;
+		if (!input) {
+			perror("Error opening the input file");
+			fflush(stdout);
+			return -1;
+		}
+		setvbuf(input, NULL, _IOFBF, MKFS_INPUT_BUFFER);
+	}
+
+	//apertura del dispositivo in modalità lettura+scrittura (un'immagine su file regolare viene creata se non esiste)
+	fd = open(argv[optind], O_RDWR | O_CREAT, 0644);
 	if (fd == -1) {
 		perror("Error opening the device");
 		fflush(stdout);
 		return -1;
 	}
 
-	//pack the superblock
-	sb.version = FS_VERSION;	//file system version
-	sb.magic = MAGIC;
-	sb.block_size = DEFAULT_BLOCK_SIZE;
-	sb.total_data_blocks = num_data_blocks;
-	sb.first_valid = 0;
-	sb.last_valid = num_data_blocks_to_write - 1;
-	//scrittura del superblocco (block 0) del file system, che comprende info come numero di versione, magic number e dimensione dei blocchi.
-	ret = write(fd, (char *)&sb, SUPERBLOCK_STRUCT_SIZE);
+	bitmap_blocks = (num_data_blocks + BITMAP_BITS_PER_BLOCK - 1) / BITMAP_BITS_PER_BLOCK;
+	meta_blocks = meta_table ? (num_data_blocks + METADATA_PER_BLOCK - 1) / METADATA_PER_BLOCK : 0;
+	head_blocks = BITMAP_START + bitmap_blocks + meta_blocks;
 
-	if (ret != SUPERBLOCK_STRUCT_SIZE) {
-		printf("Bytes written [%d] are not equal to sb size.\n", (int)ret);
+	//azzeramento dell'intero dispositivo: da qui in poi vanno scritti soltanto i blocchi con contenuto non nullo.
+	if (zero_image(fd, (head_blocks + num_data_blocks) * DEFAULT_BLOCK_SIZE) < 0) {
 		fflush(stdout);
 		close(fd);
-		return ret;
-	}
-	printf("Super block written successfully\n");
-	fflush(stdout);
-
-	//padding for superblock
-	nbytes = DEFAULT_BLOCK_SIZE - SUPERBLOCK_STRUCT_SIZE;
-	block_padding = malloc(nbytes);
-	memset(block_padding, 0, nbytes);
-	ret = write(fd, block_padding, nbytes);	//padding per il superblocco
-
-	if (ret != nbytes) {
-		printf("The padding bytes are not written properly. Retry your mkfs\n");
-		fflush(stdout);
-		free(block_padding);
-		close(fd);
 		return -1;
 	}
-	printf("Padding in the superblock written sucessfully.\n");
-	fflush(stdout);
-	free(block_padding);
 
-	//write file inode
-	file_inode.mode = S_IFREG;
-	file_inode.inode_no = SINGLEFILEFS_FILE_INODE_NUMBER;
-	file_inode.file_size = num_data_blocks * DEFAULT_BLOCK_SIZE;
-	printf("File size is %ld\n",file_inode.file_size);
-	fflush(stdout);
-	//scrittura dell'inode del file (block 1), che comprende info come il numero di inode, la dimensione del file e i permessi d'accesso.
-	ret = write(fd, (char *)&file_inode, sizeof(file_inode));
-
-	if (ret != sizeof(root_inode)) {
-		printf("The file inode was not written properly.\n");
+	//il numero di messaggi da importare non è noto a priori: in tal caso la tabella dei metadati va allocata per intero.
+	head = calloc(input ? head_blocks : BITMAP_START + bitmap_blocks + (meta_table ? (num_default_blocks + METADATA_PER_BLOCK - 1) / METADATA_PER_BLOCK : 0), DEFAULT_BLOCK_SIZE);
+	batch.buffer = malloc(MKFS_BATCH_BLOCKS * DEFAULT_BLOCK_SIZE);
+	batch.count = 0;
+	if (!head || !batch.buffer) {
+		printf("Could not allocate the image buffers.\n");
 		fflush(stdout);
 		close(fd);
 		return -1;
 	}
-	printf("File inode written successfully.\n");
-	fflush(stdout);
-	
-	//padding for block 1
-	nbytes = DEFAULT_BLOCK_SIZE - sizeof(file_inode);
-	block_padding = malloc(nbytes);
-	memset(block_padding, 0, nbytes);
-	ret = write(fd, block_padding, nbytes);	//padding per l'inode del file
-
-	if (ret != nbytes) {
-		printf("The padding bytes are not written properly. Retry your mkfs\n");
-		fflush(stdout);
-		free(block_padding);
-		close(fd);
-		return -1;
-	}
-	printf("Padding in the inode block written sucessfully.\n");
-	fflush(stdout);
 
-	//write file datablocks
-	for(block_index=0; block_index<num_data_blocks; block_index++) {
-		free(block_padding);	//deallocazione del vecchio block_padding
+	//pack the superblock (block 0), che comprende info come numero di versione, magic number e dimensione dei blocchi.
+	sb = (struct onefilefs_sb_info *)head;
+	sb->version = FS_VERSION;	//file system version
+	sb->magic = MAGIC;
+	sb->block_size = DEFAULT_BLOCK_SIZE;
+	sb->total_data_blocks = num_data_blocks;
+	sb->features = meta_table ? FEAT_META_TABLE : 0;
+	sb->bitmap_start = BITMAP_START;
+	sb->bitmap_blocks = bitmap_blocks;
+	sb->meta_start = BITMAP_START + bitmap_blocks;	//la tabella (se presente) segue la bitmap di allocazione
+	sb->meta_blocks = meta_blocks;
+	sb->data_start = head_blocks;
+	//il file system appena creato è "pulito": bitmap e contatori su disco descrivono esattamente i blocchi validi.
+	sb->state = FS_STATE_CLEAN;
+
+	//pack the file inode (block 1), che comprende info come il numero di inode, la dimensione del file e i permessi d'accesso.
+	file_inode = (struct onefilefs_inode *)(head + DEFAULT_FILE_INODE_BLOCK * DEFAULT_BLOCK_SIZE);
+	file_inode->mode = S_IFREG;
+	file_inode->inode_no = SINGLEFILEFS_FILE_INODE_NUMBER;
+	file_inode->file_size = (uint64_t)num_data_blocks * DEFAULT_BLOCK_SIZE;
+	printf("File size is %ld\n", file_inode->file_size);
+	fflush(stdout);
 
-		//caso in cui ci sono effettivamente delle informazioni da riportare nel blocco block_index
-		if (block_index < num_data_blocks_to_write) {
-			//sanity check sulla dimensione dei dati effettivi da scrivere sul blocco block_index (non deve superare la dimensione della parte del blocco riservata al payload)
-			if (strlen(file_body[block_index]) > DEFAULT_BLOCK_SIZE-METADATA_SIZE) {
-				printf("Size of payload for datablock %d exceeds limit.\n", block_index);
+	//bitmap di allocazione (bit i del byte i/8 = data block i valido) ed eventuale tabella dei metadati:
+	//le voci dei blocchi inizialmente non validi restano a zero.
+	bitmap = (unsigned char *)(head + BITMAP_START * DEFAULT_BLOCK_SIZE);
+	table = (struct data_block_metadata *)(head + sb->meta_start * DEFAULT_BLOCK_SIZE);
+
+	//write file datablocks: solo quelli validi, dato che gli altri valgono interamente zero.
+	//ogni blocco viene collegato al successivo; il next_valid dell'ultimo viene corretto al termine dell'input.
+	last_metadata = NULL;
+	last_packed = NULL;
+	block_index = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	for(num_messages=0; ; num_messages++) {
+		if (input) {
+			read_ret = next_message(input, length_delimited, &message, &message_capacity, &payload_size);
+			if (read_ret == 0)
+				break;
+			if (read_ret < 0) {
+				printf("Malformed input: message %lu is truncated or longer than %d bytes.\n", num_messages, DEFAULT_BLOCK_SIZE-METADATA_SIZE);
 				fflush(stdout);
 				close(fd);
 				return -1;
 			}
+			payload = message;
+		}
+		else {
+			if (num_messages == num_default_blocks)
+				break;
+			payload = file_body[num_messages];
+			payload_size = strlen(payload);
+		}
 
-			if (block_index == num_data_blocks_to_write-1)	//caso in cui il blocco successivo sarà inizialmente invalido
-				struct_metadata.next_valid = -1;
-			else
-				struct_metadata.next_valid = block_index + 1;
-			
-			struct_metadata.prev_valid = block_index - 1;	//il blocco di indice 0 avrà prev_valid pari a -1; -1 significa "nessun blocco".
-			struct_metadata.is_valid = 1;
-
-			//conversione di struct_metadata in stringa (char_metadata)
-			char_metadata = (unsigned char *)&struct_metadata;
-
-			//scrittura dei metadati del blocco (1 solo byte per volta)
-			for(i=0; i<sizeof(struct data_block_metadata); i++) {
-				ret = write(fd, &char_metadata[i], 1);
-				if (ret != 1) {
-					printf("Writing file datablock has failed.\n");
-					fflush(stdout);
-					close(fd);
-					return -1;		
-				}
-
-			}
-
-			printf("Metadata of datablock %d written successfully.\n", block_index);
-			fflush(stdout);
-			
-			//scrittura del payload (dati effettivi) del blocco
-			ret = write(fd, file_body[block_index], strlen(file_body[block_index]));
-			if (ret != strlen(file_body[block_index])) {
-				printf("Writing file datablock has failed.\n");
-				fflush(stdout);
-				close(fd);
-				return -1;	
-			}
-			printf("Payload of datablock %d written successfully.\n", block_index);
-			fflush(stdout);
-
-			//padding per il blocco
-			nbytes = DEFAULT_BLOCK_SIZE - METADATA_SIZE - strlen(file_body[block_index]);
-			block_padding = malloc(nbytes);
-			memset(block_padding, 0, nbytes);
-			ret = write(fd, block_padding, nbytes);	//padding per il blocco dati block_index
-			if (ret != nbytes) {
-				printf("The padding bytes are not written properly. Retry your mkfs\n");
-				fflush(stdout);
-				free(block_padding);
-				close(fd);
-				return -1;
-			}
-			printf("Padding in datablock %d written sucessfully.\n", block_index);
+		//sanity check sulla dimensione dei dati effettivi da scrivere (non deve superare la dimensione della parte del blocco riservata al payload)
+		if (payload_size > DEFAULT_BLOCK_SIZE-METADATA_SIZE) {
+			printf("Size of payload for message %lu exceeds limit.\n", num_messages);
 			fflush(stdout);
+			close(fd);
+			return -1;
+		}
 
+		//con -p un messaggio breve viene accodato all'ultimo blocco, se è impacchettato e ha spazio (il blocco si trova ancora nel lotto in memoria)
+		if (pack && payload_size <= PACKED_MAX_MESSAGE && last_packed && last_packed->slots < PACKED_MAX_SLOTS &&
+			last_packed->end + payload_size <= DEFAULT_BLOCK_SIZE-METADATA_SIZE) {
+			pack_message(last_packed, payload, payload_size);
+			last_metadata->checksum = payload_checksum((char *)last_packed);
+			continue;
 		}
 
-		//caso in cui all'interno del blocco block_index va inserito esclusivamente padding
+		if (block_index == num_data_blocks) {
+			printf("The input contains more messages than data blocks can hold.\n");
+			fflush(stdout);
+			close(fd);
+			return -1;
+		}
+		block = batch_block(fd, &batch, head_blocks + block_index);
+		if (!block) {
+			close(fd);
+			return -1;
+		}
+		//con la tabella dei metadati l'header in testa al blocco non è utilizzato (e resta a zero)
+		struct_metadata = meta_table ? &table[block_index] : &(((struct data_block_content *)block)->metadata);
+		struct_metadata->next_valid = block_index + 1;
+		struct_metadata->prev_valid = (int64_t)block_index - 1;	//il blocco di indice 0 avrà prev_valid pari a -1; -1 significa "nessun blocco".
+		struct_metadata->seq = num_messages + 1;	//i messaggi iniziali vengono numerati nell'ordine dell'input
+		struct_metadata->is_valid = 1;
+		if (pack && payload_size <= PACKED_MAX_MESSAGE) {
+			last_packed = (struct packed_header *)((struct data_block_content *)block)->payload;
+			last_packed->end = sizeof(struct packed_header);
+			pack_message(last_packed, payload, payload_size);
+			struct_metadata->flags |= BLOCK_PACKED;
+		}
 		else {
-
-			struct_metadata.next_valid = -1;	//-1 significa "nessun blocco".
-			struct_metadata.prev_valid = -1;	//-1 significa "nessun blocco".
-			struct_metadata.is_valid = 0;
-
-			//conversione di struct_metadata in stringa (char_metadata)
-			char_metadata = (unsigned char *)&struct_metadata;
-
-			//scrittura dei metadati del blocco (1 solo byte per volta)
-			for(i=0; i<sizeof(struct data_block_metadata); i++) {
-				ret = write(fd, &char_metadata[i], 1);
-				if (ret != 1) {
-					printf("Writing file datablock has failed.\n");
-					fflush(stdout);
-					close(fd);
-					return -1;		
-				}
-
-			}
-
-			nbytes = DEFAULT_BLOCK_SIZE - METADATA_SIZE;
-			block_padding = malloc(nbytes);
-			memset(block_padding, 0, nbytes);
-			ret = write(fd, block_padding, nbytes);	//padding per il blocco dati block_index
-			if (ret != nbytes) {
-				printf("The padding bytes are not written properly. Retry your mkfs\n");
-				fflush(stdout);
-				free(block_padding);
-				close(fd);
-				return -1;
-			}
-
+			memcpy(((struct data_block_content *)block)->payload, payload, payload_size);
+			struct_metadata->length = payload_size;
+			struct_metadata->flags |= BLOCK_LENGTH;
+			last_packed = NULL;
 		}
-
+		//il checksum copre l'intero payload, compresi i byte nulli che seguono il messaggio
+		struct_metadata->checksum = payload_checksum(((struct data_block_content *)block)->payload);
+		struct_metadata->flags |= BLOCK_CHECKSUM;
+		bitmap[block_index/8] |= 1 << (block_index%8);
+		last_metadata = struct_metadata;
+		block_index++;
 	}
-
-	printf("Padded datablocks written successfully.\n");
+	//l'ultimo blocco si trova ancora nel lotto in memoria (o nella tabella dei metadati): non ha un successore.
+	num_data_blocks_to_write = block_index;
+	if (last_metadata)
+		last_metadata->next_valid = -1;
+	if (flush_batch(fd, &batch) < 0) {
+		close(fd);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	seconds = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+	printf("Datablocks (%lu valid, %lu messages) written successfully in %.3f s (%.1f MB/s).\n", num_data_blocks_to_write, num_messages, seconds,
+		seconds > 0 ? ((uint64_t)num_data_blocks_to_write * DEFAULT_BLOCK_SIZE / 1048576.0) / seconds : 0.0);
+	fflush(stdout);
+	if (input && input != stdin)
+		fclose(input);
+	free(message);
+
+	sb->first_valid = (num_data_blocks_to_write > 0) ? 0 : -1;
+	sb->last_valid = (int64_t)num_data_blocks_to_write - 1;
+	sb->valid_blocks = num_data_blocks_to_write;
+	sb->valid_messages = num_messages;
+	sb->next_seq = num_messages + 1;
+	head_written = BITMAP_START + bitmap_blocks + (meta_table ? (num_data_blocks_to_write + METADATA_PER_BLOCK - 1) / METADATA_PER_BLOCK : 0);
+
+	//scrittura dei blocchi di testa con un'unica chiamata (dopo i data block, così che il superblocco descriva sempre un'immagine completa)
+	ret = pwrite(fd, head, head_written * DEFAULT_BLOCK_SIZE, 0);
+	if (ret != (ssize_t)(head_written * DEFAULT_BLOCK_SIZE)) {
+		printf("The superblock, the file inode and the allocation bitmap were not written properly. Retry your mkfs\n");
+		fflush(stdout);
+		close(fd);
+		return -1;
+	}
+	printf("Super block, file inode, allocation bitmap (%lu blocks) and metadata table (%lu blocks) written successfully.\n", bitmap_blocks, meta_blocks);
 	fflush(stdout);
-	free(block_padding);
+
+	free(head);
+	free(batch.buffer);
+	if (fsync(fd) == -1) {
+		perror("Error flushing the device");
+		close(fd);
+		return -1;
+	}
 	close(fd);	//chiusura del file descriptor (i.e. del dispositivo)
 	return 0;
 
@@ -10,16 +10,37 @@
 #include "lib/include/scth.h"
 #include "filesystem/singlefilefs_src.c"
 #include "devFunctions.c"
+#include "ctlDevice.c"
 
-//variabile in cui verrà memorizzato l'indirizzo in cui è posta la syscall table (tale indirizzo è passato come parametro al presente modulo)
+//variabile in cui verrà memorizzato l'indirizzo in cui è posta la syscall table (tale indirizzo è passato come parametro al presente modulo).
+//se il parametro viene omesso, le system call non vengono installate e le operazioni sono disponibili soltanto attraverso il
+//dispositivo di controllo /dev/singlefilefs (vedi ctlDevice.c).
 unsigned long the_syscall_table = 0x0;
 module_param(the_syscall_table, ulong, 0660);
+int syscalls_installed = NO;
 
 unsigned long the_ni_syscall;
-unsigned long new_syscall_array[] = {0x0, 0x0, 0x0};
+unsigned long new_syscall_array[] = {0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
 #define HACKED_ENTRIES (int)(sizeof(new_syscall_array)/sizeof(unsigned long))
 int restore[HACKED_ENTRIES] = {[0 ... (HACKED_ENTRIES-1)]-1};
 
+//funzione che ripristina le voci della system call table sostituite da singlefilefs_init() (se sono state sostituite).
+static void restore_syscalls(void) {
+
+    int i;
+
+    if (!syscalls_installed)
+        return;
+    unprotect_memory();
+    for(i=0; i<HACKED_ENTRIES; i++) {
+        ((unsigned long *)the_syscall_table)[restore[i]] = the_ni_syscall;
+    }
+    protect_memory();
+    syscalls_installed = NO;
+    printk("%s: syscall table restored to its original content\n", MOD_NAME);
+
+}
+
 //funzione che registra il file system "singlefilefs" nel kernel Linux.
 static int singlefilefs_init(void) {
 
@@ -28,31 +49,57 @@ static int singlefilefs_init(void) {
     printk("%s: usleep example received sys_call_table address %px\n", MOD_NAME, (void*)the_syscall_table);
     printk("%s: initializing - hacked entries %d\n", MOD_NAME,HACKED_ENTRIES);
 
-    //definizione delle system call da sostuire alle prime tre ni_syscall
+    //definizione delle system call da sostuire alle prime undici ni_syscall
     new_syscall_array[0] = (unsigned long)sys_put_data;
     new_syscall_array[1] = (unsigned long)sys_get_data;
     new_syscall_array[2] = (unsigned long)sys_invalidate_data;
-
-    ret = get_entries(restore, HACKED_ENTRIES, (unsigned long *)the_syscall_table, &the_ni_syscall);
-    if (ret != HACKED_ENTRIES){
-        printk("%s: could not hack %d entries (just %d)\n", MOD_NAME, HACKED_ENTRIES, ret);
-        return -1;
+    new_syscall_array[3] = (unsigned long)sys_put_keyed_data;
+    new_syscall_array[4] = (unsigned long)sys_get_data_by_key;
+    new_syscall_array[5] = (unsigned long)sys_invalidate_data_by_key;
+    new_syscall_array[6] = (unsigned long)sys_update_data;
+    new_syscall_array[7] = (unsigned long)sys_append_data;
+    new_syscall_array[8] = (unsigned long)sys_put_data_if_tail;
+    new_syscall_array[9] = (unsigned long)sys_update_data_if;
+    new_syscall_array[10] = (unsigned long)sys_invalidate_data_if;
+
+    //registrazione del dispositivo di controllo /dev/singlefilefs (ioctl e code di sottomissione asincrona, vedi ctlDevice.c)
+    ret = misc_register(&ctl_device);
+    if (ret) {
+        printk("%s: failed to register control device - error %d\n", MOD_NAME, ret);
+        return ret;
     }
 
-    unprotect_memory();
-    for(i=0; i<HACKED_ENTRIES; i++) {
-        ((unsigned long *)the_syscall_table)[restore[i]] = (unsigned long)new_syscall_array[i];
+    if (the_syscall_table) {
+        ret = get_entries(restore, HACKED_ENTRIES, (unsigned long *)the_syscall_table, &the_ni_syscall);
+        if (ret != HACKED_ENTRIES){
+            printk("%s: could not hack %d entries (just %d)\n", MOD_NAME, HACKED_ENTRIES, ret);
+            misc_deregister(&ctl_device);
+            return -1;
+        }
+
+        unprotect_memory();
+        for(i=0; i<HACKED_ENTRIES; i++) {
+            ((unsigned long *)the_syscall_table)[restore[i]] = (unsigned long)new_syscall_array[i];
+        }
+        protect_memory();
+        syscalls_installed = YES;
+        printk("%s: all new system calls correctly installed on syscall table\n", MOD_NAME);
+    } else {
+        printk("%s: no syscall table address - operations available only through /dev/singlefilefs\n", MOD_NAME);
     }
-    protect_memory();
-    printk("%s: all new system calls correctly installed on syscall table\n", MOD_NAME);
 
     //register filesystem (type: onefilefs_type)
     ret = register_filesystem(&onefilefs_type);
-    if (likely(ret == 0))   //likely(): macro usata per fornire un suggerimento al compilatore sul percorso d'esecuzione più probabile.
+    if (likely(ret == 0)) { //likely(): macro usata per fornire un suggerimento al compilatore sul percorso d'esecuzione più probabile.
         printk("%s: sucessfully registered singlefilefs\n",MOD_NAME);
-    else
-        printk("%s: failed to register singlefilefs - error %d", MOD_NAME,ret);
+        return 0;
+    }
+    printk("%s: failed to register singlefilefs - error %d", MOD_NAME,ret);
 
+    //il modulo non viene caricato: si annulla quanto fatto finora in ordine inverso, perché né la system call table né il
+    //dispositivo /dev/singlefilefs devono continuare a puntare al codice del modulo dopo che è stato liberato.
+    restore_syscalls();
+    misc_deregister(&ctl_device);
     return ret; //return: valore intero che rappresenta il risultato della registrazione del file system
 
 }
@@ -60,15 +107,12 @@ static int singlefilefs_init(void) {
 //funzione che deregistra il file system "singlefilefs" precedentemente registrato con singlefilefs_init().
 static void singlefilefs_exit(void) {
 
-    int ret, i;
+    int ret;
 
     printk("%s: shutting down\n", MOD_NAME);
-    unprotect_memory();
-    for(i=0; i<HACKED_ENTRIES; i++) {
-        ((unsigned long *)the_syscall_table)[restore[i]] = the_ni_syscall;
-    }
-    protect_memory();
-    printk("%s: syscall table restored to its original content\n", MOD_NAME);
+    restore_syscalls();
+
+    misc_deregister(&ctl_device);
 
     //unregister file system
     ret = unregister_filesystem(&onefilefs_type);
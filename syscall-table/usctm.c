@@ -29,8 +29,10 @@
 #include <linux/errno.h>
 #include <linux/fs.h>
 #include <linux/interrupt.h>
+#include <linux/kallsyms.h>
 #include <linux/kernel.h>
 #include <linux/kprobes.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
@@ -81,6 +83,12 @@ module_param(sys_call_table_address, ulong, 0660);
 unsigned long sys_ni_syscall_address = 0x0;
 module_param(sys_ni_syscall_address, ulong, 0660);
 
+char *discovery_method = "none";	// how the table has been found: kallsyms, kernel image scan or full scan
+module_param(discovery_method, charp, 0440);
+
+unsigned long discovery_time_us = 0;	// time spent looking for the table
+module_param(discovery_time_us, ulong, 0440);
+
 
 int good_area(unsigned long * addr){
 
@@ -100,6 +108,30 @@ bad_area:
 
 
 
+/* This routine checks if addr is the begin of the syscall_table (pattern matching on the sys_ni_syscall entries).  */
+int check_table(unsigned long *addr){
+	if(
+		   ( (addr[FIRST_NI_SYSCALL] & 0x3  ) == 0 )		
+		   && (addr[FIRST_NI_SYSCALL] != 0x0 )			// not points to 0x0	
+		   && (addr[FIRST_NI_SYSCALL] > 0xffffffff00000000 )	// not points to a locatio lower than 0xffffffff00000000	
+//&& ( (addr[FIRST_NI_SYSCALL] & START) == START ) 	
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[SECOND_NI_SYSCALL] )
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[THIRD_NI_SYSCALL]	 )	
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[FOURTH_NI_SYSCALL] )
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[FIFTH_NI_SYSCALL] )	
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[SIXTH_NI_SYSCALL] )
+		&&   ( addr[FIRST_NI_SYSCALL] == addr[SEVENTH_NI_SYSCALL] )	
+		&&   (good_area(addr))
+	){
+		hacked_ni_syscall = (void*)(addr[FIRST_NI_SYSCALL]);				// save ni_syscall
+		sys_ni_syscall_address = (unsigned long)hacked_ni_syscall;
+		hacked_syscall_tbl = (void*)(addr);				// save syscall_table address
+		sys_call_table_address = (unsigned long) hacked_syscall_tbl;
+		return 1;
+	}
+	return 0;
+}
+
 /* This routine checks if the page contains the begin of the syscall_table.  */
 int validate_page(unsigned long *addr){
 	int i = 0;
@@ -115,48 +147,82 @@ int validate_page(unsigned long *addr){
 		) 
 			break;
 		// go for patter matching
-		addr = (unsigned long*) (page+i);
-		if(
-			   ( (addr[FIRST_NI_SYSCALL] & 0x3  ) == 0 )		
-			   && (addr[FIRST_NI_SYSCALL] != 0x0 )			// not points to 0x0	
-			   && (addr[FIRST_NI_SYSCALL] > 0xffffffff00000000 )	// not points to a locatio lower than 0xffffffff00000000	
-	//&& ( (addr[FIRST_NI_SYSCALL] & START) == START ) 	
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[SECOND_NI_SYSCALL] )
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[THIRD_NI_SYSCALL]	 )	
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[FOURTH_NI_SYSCALL] )
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[FIFTH_NI_SYSCALL] )	
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[SIXTH_NI_SYSCALL] )
-			&&   ( addr[FIRST_NI_SYSCALL] == addr[SEVENTH_NI_SYSCALL] )	
-			&&   (good_area(addr))
-		){
-			hacked_ni_syscall = (void*)(addr[FIRST_NI_SYSCALL]);				// save ni_syscall
-			sys_ni_syscall_address = (unsigned long)hacked_ni_syscall;
-			hacked_syscall_tbl = (void*)(addr);				// save syscall_table address
-			sys_call_table_address = (unsigned long) hacked_syscall_tbl;
-			return 1;
-		}
+		if(check_table((unsigned long*) (page+i))) return 1;
 	}
 	return 0;
 }
 
-/* This routines looks for the syscall table.  */
-void syscall_table_finder(void){
+/* This routine scans the pages in [from, to) looking for the syscall table.  */
+int scan_range(unsigned long from, unsigned long to){
 	unsigned long k; // current page
 	unsigned long candidate; // current page
 
-	for(k=START; k < MAX_ADDR; k+=4096){	
+	for(k=from; k < to; k+=4096){	
 		candidate = k;
 		if(
 			(sys_vtpmo(candidate) != NO_MAP) 	
 		){
 			// check if candidate maintains the syscall_table
-			if(validate_page( (unsigned long *)(candidate)) ){
-				printk("%s: syscall table found at %px\n",MODNAME,(void*)(hacked_syscall_tbl));
-				printk("%s: sys_ni_syscall found at %px\n",MODNAME,(void*)(hacked_ni_syscall));
-				break;
-			}
+			if(validate_page( (unsigned long *)(candidate)) ) return 1;
 		}
 	}
+	return 0;
+}
+
+typedef unsigned long (*kallsyms_lookup_name_t)(const char *name);
+
+/* This routine returns kallsyms_lookup_name, which is no longer exported since 5.7: its address
+   is taken from a kprobe registered (and immediately removed) on the symbol.  */
+kallsyms_lookup_name_t get_kallsyms_lookup_name(void){
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,7,0)
+	return kallsyms_lookup_name;
+#elif defined(CONFIG_KPROBES)
+	struct kprobe kp = { .symbol_name = "kallsyms_lookup_name" };
+	kallsyms_lookup_name_t lookup;
+
+	if(register_kprobe(&kp) < 0) return NULL;
+	lookup = (kallsyms_lookup_name_t)kp.addr;
+	unregister_kprobe(&kp);
+	return lookup;
+#else
+	return NULL;
+#endif
+}
+
+/* This routine resolves sys_call_table through the kernel symbol table (no memory scan). The symbol
+   is there only with CONFIG_KALLSYMS_ALL, and the address is accepted only if it passes the same
+   pattern matching used by the scan.  */
+int syscall_table_by_symbol(void){
+	kallsyms_lookup_name_t lookup;
+	unsigned long addr;
+
+	lookup = get_kallsyms_lookup_name();
+	if(!lookup) return 0;
+	addr = lookup("sys_call_table");
+	if(!addr || sys_vtpmo(addr) == NO_MAP) return 0;
+	return check_table((unsigned long *)addr);
+}
+
+/* This routines looks for the syscall table: first through the symbol table, then scanning the
+   kernel image, and only as a last resort scanning everything from START to MAX_ADDR.
+   The table is in the read-only data of the kernel image, which on x86_64 is mapped in
+   [__START_KERNEL_map, __START_KERNEL_map + KERNEL_IMAGE_SIZE) after the kernel text: the image
+   scan starts from the page of a kernel text function (kfree), skipping the pages before it.  */
+void syscall_table_finder(void){
+	u64 start = ktime_get_ns();
+
+	if(syscall_table_by_symbol())
+		discovery_method = "kallsyms";
+	else if(scan_range((unsigned long)kfree & ADDRESS_MASK, __START_KERNEL_map + KERNEL_IMAGE_SIZE))
+		discovery_method = "kernel image scan";
+	else if(scan_range(START, MAX_ADDR))
+		discovery_method = "full scan";
+	discovery_time_us = (ktime_get_ns() - start) / 1000;
+
+	if(hacked_syscall_tbl){
+		printk("%s: syscall table found at %px (%s, %lu us)\n",MODNAME,(void*)(hacked_syscall_tbl),discovery_method,discovery_time_us);
+		printk("%s: sys_ni_syscall found at %px\n",MODNAME,(void*)(hacked_ni_syscall));
+	}
 	
 }
 
@@ -0,0 +1,398 @@
+/* Questo file verifica il comportamento del dispositivo di controllo /dev/singlefilefs con il modulo caricato e il file system
+ * montato: ogni test esegue delle operazioni e controlla i risultati ottenuti, riportando le verifiche fallite. Vengono testati:
+ * 1) sottomissione e completamento delle richieste attraverso le code in memoria condivisa (SFS_CTL_RING_SETUP);
+ * 2) il flag SFS_RING_NEED_WAKEUP: con il kthread addormentato, una richiesta accodata viene eseguita solo dopo SFS_CTL_RING_ENTER;
+ * 3) la riesecuzione delle scritture completate con -EBUSY mentre un altro thread contende write_mutex;
+ * 4) SFS_CTL_BATCH con e senza SFS_BATCH_STOP_ON_ERROR.
+ * Il programma termina con exit code 0 se tutte le verifiche hanno successo, 1 altrimenti.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../user/sfs_lib.h"
+#include "../filesystem/singlefilefs.h"
+#include "../filesystem/singlefilefs_ctl.h"
+
+#define RING_ENTRIES 64         //richieste della coda di sottomissione usata dai test
+#define EBUSY_MESSAGES 256      //scritture sottomesse dal test della contesa
+#define SENTINEL 0x5f5f         //valore di result delle operazioni di un lotto non ancora eseguite
+
+//verifica una condizione: se è falsa, la riporta e la conta tra le verifiche fallite.
+#define CHECK(cond, ...) do {                                       \
+        if (!(cond)) {                                              \
+            printf("[FAIL] %s:%d: ", __func__, __LINE__);           \
+            printf(__VA_ARGS__);                                    \
+            printf("\n");                                           \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+//code mappate dal dispositivo di controllo
+struct ring {
+    int fd;
+    struct sfs_ring_ctl *ctl;
+    struct sfs_sqe *sqes;
+    struct sfs_cqe *cqes;
+    uint32_t sq_mask;
+    uint32_t cq_mask;
+};
+
+int failures;               //verifiche fallite
+volatile int contending;    //1 finché il thread di contesa deve continuare a scrivere
+
+//FUNCTIONS PROTOTYPES
+int ring_open(struct ring *, uint64_t);
+void ring_close(struct ring *);
+void ring_queue(struct ring *, uint64_t, char *, size_t);
+int ring_enter(struct ring *, uint64_t);
+int ring_reap(struct ring *, struct sfs_cqe *);
+void *contend_write_mutex(void *);
+void test_ring_roundtrip(void);
+void test_need_wakeup(void);
+void test_ebusy_resubmit(void);
+void test_batch_stop_on_error(void);
+
+//apre il dispositivo di controllo, predispone le code (entries richieste) e le mappa.
+int ring_open(struct ring *r, uint64_t entries) {
+
+    struct sfs_ring_params params;
+    void *mem;
+
+    r->fd = open(SFS_CTL_DEVICE, O_RDWR);
+    if (r->fd == -1)
+        return -1;
+    memset(&params, 0, sizeof(params));
+    params.sq_entries = entries;
+    if (ioctl(r->fd, SFS_CTL_RING_SETUP, &params) == -1) {
+        close(r->fd);
+        return -1;
+    }
+    mem = mmap(NULL, params.size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    if (mem == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+    r->ctl = (struct sfs_ring_ctl *)mem;
+    r->sqes = (struct sfs_sqe *)((char *)mem + params.sqes_off);
+    r->cqes = (struct sfs_cqe *)((char *)mem + params.cqes_off);
+    r->sq_mask = params.sq_entries - 1;
+    r->cq_mask = params.cq_entries - 1;
+    return 0;
+
+}
+
+void ring_close(struct ring *r) {
+    close(r->fd);   //la mappatura viene rilasciata all'uscita del processo
+}
+
+//accoda la scrittura del messaggio buf (len byte) e la pubblica, senza risvegliare il kthread.
+void ring_queue(struct ring *r, uint64_t user_data, char *buf, size_t len) {
+
+    struct sfs_sqe *sqe;
+    uint32_t tail;
+
+    tail = r->ctl->sq_tail;
+    sqe = &(r->sqes[tail & r->sq_mask]);
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = SFS_OP_PUT;
+    sqe->buf = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    __atomic_store_n(&(r->ctl->sq_tail), tail + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);    //sq_tail va pubblicato prima di leggere flags
+
+}
+
+//risveglia il kthread e attende che ci siano almeno min_complete completamenti da consumare.
+int ring_enter(struct ring *r, uint64_t min_complete) {
+
+    struct sfs_ring_enter enter;
+
+    memset(&enter, 0, sizeof(enter));
+    enter.min_complete = min_complete;
+    while (ioctl(r->fd, SFS_CTL_RING_ENTER, &enter) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+
+}
+
+//consuma un completamento, se disponibile, copiandolo in cqe. Restituisce 1 se c'era un completamento, 0 altrimenti.
+int ring_reap(struct ring *r, struct sfs_cqe *cqe) {
+
+    uint32_t head;
+
+    head = r->ctl->cq_head;
+    if (head == __atomic_load_n(&(r->ctl->cq_tail), __ATOMIC_ACQUIRE))
+        return 0;
+    *cqe = r->cqes[head & r->cq_mask];
+    __atomic_store_n(&(r->ctl->cq_head), head + 1, __ATOMIC_RELEASE);
+    return 1;
+
+}
+
+//corpo del thread che contende write_mutex al kthread delle code durante test_ebusy_resubmit().
+void *contend_write_mutex(void *arg) {
+
+    char source[] = "contesa di write_mutex";
+    long ret;
+
+    (void)arg;
+    while (contending) {
+        ret = sfs_put_data(source, sizeof(source) - 1);
+        if (ret >= 0)
+            sfs_invalidate_data(ret);   //se fallisce con EBUSY il messaggio resta: non altera le verifiche
+    }
+    return NULL;
+
+}
+
+//le scritture accodate vengono tutte completate, con lo user_data della richiesta, e i messaggi scritti sono leggibili.
+void test_ring_roundtrip(void) {
+
+    struct ring r;
+    struct sfs_cqe cqe;
+    char messages[RING_ENTRIES / 2][64];
+    char buf[DEFAULT_BLOCK_SIZE];
+    long addresses[RING_ENTRIES / 2];
+    int pending;
+    int i;
+    long ret;
+
+    if (ring_open(&r, RING_ENTRIES) == -1) {
+        CHECK(0, "ring setup failed: %s", strerror(errno));
+        return;
+    }
+    for(i=0; i<RING_ENTRIES / 2; i++) {
+        snprintf(messages[i], sizeof(messages[i]), "messaggio %d della coda", i);
+        addresses[i] = -1;
+        ring_queue(&r, i, messages[i], strlen(messages[i]));
+    }
+    pending = RING_ENTRIES / 2;
+    while (pending > 0) {
+        if (ring_enter(&r, 1) == -1) {
+            CHECK(0, "SFS_CTL_RING_ENTER failed: %s", strerror(errno));
+            break;
+        }
+        while (ring_reap(&r, &cqe)) {
+            CHECK(cqe.user_data < RING_ENTRIES / 2, "unexpected user_data %lu", cqe.user_data);
+            if (cqe.user_data >= RING_ENTRIES / 2)
+                continue;
+            if (cqe.result == -EBUSY) {
+                ring_queue(&r, cqe.user_data, messages[cqe.user_data], strlen(messages[cqe.user_data]));
+                continue;
+            }
+            CHECK(cqe.result >= 0, "put of message %lu failed: %s", cqe.user_data, strerror(-cqe.result));
+            CHECK(addresses[cqe.user_data] == -1, "message %lu completed twice", cqe.user_data);
+            addresses[cqe.user_data] = cqe.result;
+            pending--;
+        }
+    }
+    for(i=0; i<RING_ENTRIES / 2; i++) {
+        if (addresses[i] < 0)
+            continue;
+        memset(buf, 0, sizeof(buf));
+        ret = sfs_get_data(addresses[i], buf, sizeof(buf));
+        CHECK(ret == (long)strlen(messages[i]) && memcmp(buf, messages[i], ret) == 0,
+            "message %d at %ld reads back as \"%.*s\" (%ld)", i, addresses[i], ret > 0 ? (int)ret : 0, buf, ret);
+    }
+    ring_close(&r);
+
+}
+
+//con il kthread addormentato (SFS_RING_NEED_WAKEUP), una richiesta accodata resta in attesa fino a SFS_CTL_RING_ENTER.
+void test_need_wakeup(void) {
+
+    struct ring r;
+    struct sfs_cqe cqe;
+    char message[] = "messaggio accodato al kthread addormentato";
+    int waited;
+
+    if (ring_open(&r, RING_ENTRIES) == -1) {
+        CHECK(0, "ring setup failed: %s", strerror(errno));
+        return;
+    }
+    //senza richieste il kthread si addormenta e lo annuncia
+    for(waited=0; waited<1000 && !(__atomic_load_n(&(r.ctl->flags), __ATOMIC_ACQUIRE) & SFS_RING_NEED_WAKEUP); waited++)
+        usleep(1000);
+    CHECK(r.ctl->flags & SFS_RING_NEED_WAKEUP, "the idle worker did not set SFS_RING_NEED_WAKEUP");
+    usleep(50000);  //il kthread ha certamente ricontrollato le code ed è in attesa
+
+    do {
+        ring_queue(&r, 1, message, strlen(message));
+        usleep(100000);
+        CHECK(r.ctl->cq_tail == r.ctl->cq_head, "a request was completed without SFS_CTL_RING_ENTER");
+        if (ring_enter(&r, 1) == -1) {
+            CHECK(0, "SFS_CTL_RING_ENTER failed: %s", strerror(errno));
+            break;
+        }
+        CHECK(ring_reap(&r, &cqe), "no completion after SFS_CTL_RING_ENTER");
+        CHECK(cqe.user_data == 1, "unexpected user_data %lu", cqe.user_data);
+        //con -EBUSY la richiesta viene riaccodata, dopo che il kthread si è riaddormentato
+        if (cqe.result == -EBUSY) {
+            while (!(__atomic_load_n(&(r.ctl->flags), __ATOMIC_ACQUIRE) & SFS_RING_NEED_WAKEUP))
+                usleep(1000);
+            usleep(50000);
+        }
+    } while (cqe.result == -EBUSY);
+    CHECK(cqe.result >= 0, "put failed: %s", strerror(-cqe.result));
+    ring_close(&r);
+
+}
+
+//le scritture completate con -EBUSY (write_mutex conteso da un altro thread) vanno a buon fine quando vengono riaccodate.
+void test_ebusy_resubmit(void) {
+
+    struct ring r;
+    struct sfs_cqe cqe;
+    pthread_t tid;
+    char (*messages)[64];
+    char buf[DEFAULT_BLOCK_SIZE];
+    long *addresses;
+    uint64_t busy;
+    int queued;
+    int pending;
+    int i;
+    long ret;
+
+    messages = calloc(EBUSY_MESSAGES, sizeof(*messages));
+    addresses = calloc(EBUSY_MESSAGES, sizeof(long));
+    if (!messages || !addresses || ring_open(&r, RING_ENTRIES) == -1) {
+        CHECK(0, "test setup failed");
+        free(messages);
+        free(addresses);
+        return;
+    }
+    contending = 1;
+    if (pthread_create(&tid, NULL, contend_write_mutex, NULL) != 0) {
+        CHECK(0, "could not create the contending thread");
+        ring_close(&r);
+        free(messages);
+        free(addresses);
+        return;
+    }
+
+    busy = 0;
+    queued = 0;
+    pending = 0;
+    while (queued < EBUSY_MESSAGES || pending > 0) {
+        //al più RING_ENTRIES richieste in volo: la coda dei completamenti (2 * RING_ENTRIES) non può riempirsi
+        for(; queued < EBUSY_MESSAGES && pending < RING_ENTRIES; queued++, pending++) {
+            snprintf(messages[queued], sizeof(messages[queued]), "messaggio %d scritto durante la contesa", queued);
+            addresses[queued] = -1;
+            ring_queue(&r, queued, messages[queued], strlen(messages[queued]));
+        }
+        if (ring_enter(&r, 1) == -1) {
+            CHECK(0, "SFS_CTL_RING_ENTER failed: %s", strerror(errno));
+            break;
+        }
+        while (ring_reap(&r, &cqe)) {
+            if (cqe.user_data >= (uint64_t)queued) {
+                CHECK(0, "unexpected user_data %lu", cqe.user_data);
+                continue;
+            }
+            if (cqe.result == -EBUSY) {
+                busy++;
+                ring_queue(&r, cqe.user_data, messages[cqe.user_data], strlen(messages[cqe.user_data]));
+                continue;
+            }
+            CHECK(cqe.result >= 0, "put of message %lu failed: %s", cqe.user_data, strerror(-cqe.result));
+            CHECK(addresses[cqe.user_data] == -1, "message %lu completed twice", cqe.user_data);
+            addresses[cqe.user_data] = cqe.result;
+            pending--;
+        }
+    }
+    contending = 0;
+    pthread_join(tid, NULL);
+
+    for(i=0; i<EBUSY_MESSAGES; i++) {
+        if (addresses[i] < 0)
+            continue;
+        memset(buf, 0, sizeof(buf));
+        ret = sfs_get_data(addresses[i], buf, sizeof(buf));
+        CHECK(ret == (long)strlen(messages[i]) && memcmp(buf, messages[i], ret) == 0, "message %d at %ld does not read back", i, addresses[i]);
+    }
+    printf("test_ebusy_resubmit: %lu submissions completed with EBUSY and resubmitted\n", busy);
+    ring_close(&r);
+    free(messages);
+    free(addresses);
+
+}
+
+//con SFS_BATCH_STOP_ON_ERROR il lotto si ferma alla prima operazione fallita; senza, le esegue tutte.
+void test_batch_stop_on_error(void) {
+
+    struct sfs_op ops[3];
+    char first[] = "prima operazione del lotto";
+    char third[] = "terza operazione del lotto";
+    long dead;
+    long done;
+    int stop;
+
+    //indirizzo di un messaggio già invalidato: la sua invalidazione fallisce
+    while ((dead = sfs_put_data(first, sizeof(first) - 1)) < 0 && errno == EBUSY) {}
+    CHECK(dead >= 0, "put failed: %s", strerror(errno));
+    if (dead < 0)
+        return;
+    while (sfs_invalidate_data(dead) < 0 && errno == EBUSY) {}
+
+    for(stop=1; stop>=0; stop--) {
+        do {
+            memset(ops, 0, sizeof(ops));
+            ops[0].opcode = SFS_OP_PUT;
+            ops[0].buf = (uint64_t)(uintptr_t)first;
+            ops[0].len = sizeof(first) - 1;
+            ops[1].opcode = SFS_OP_INVALIDATE;
+            ops[1].address = dead;
+            ops[2].opcode = SFS_OP_PUT;
+            ops[2].buf = (uint64_t)(uintptr_t)third;
+            ops[2].len = sizeof(third) - 1;
+            ops[0].result = ops[1].result = ops[2].result = SENTINEL;
+            done = sfs_batch(ops, 3, stop ? SFS_BATCH_STOP_ON_ERROR : 0);
+        } while (done > 0 && (ops[0].result == -EBUSY || ops[1].result == -EBUSY));
+        CHECK(done >= 0, "SFS_CTL_BATCH failed: %s", strerror(errno));
+        if (done < 0)
+            return;
+        CHECK(ops[0].result >= 0, "first put failed: %s", strerror(-ops[0].result));
+        CHECK(ops[1].result < 0 && ops[1].result != SENTINEL, "invalidating a dead message returned %ld", ops[1].result);
+        if (stop) {
+            CHECK(done == 2, "the batch stopped after %ld operations instead of 2", done);
+            CHECK(ops[2].result == SENTINEL, "the operation after the failed one was executed (result %ld)", ops[2].result);
+        }
+        else {
+            CHECK(done == 3, "the batch executed %ld operations instead of 3", done);
+            CHECK(ops[2].result != SENTINEL && (ops[2].result >= 0 || ops[2].result == -EBUSY), "third put returned %ld", ops[2].result);
+        }
+    }
+
+}
+
+int main(void) {
+
+    if (!sfs_using_device()) {
+        printf("%s is not available: load the module and mount the file system first.\n", SFS_CTL_DEVICE);
+        return 1;
+    }
+
+    test_ring_roundtrip();
+    test_need_wakeup();
+    test_ebusy_resubmit();
+    test_batch_stop_on_error();
+
+    if (failures) {
+        printf("%d checks failed.\n", failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+
+}
@@ -13,7 +13,7 @@
 #include <unistd.h>
 
 #include "test.h"
-#include "../user/user.h"
+#include "../user/sfs_lib.h"
 #include "../filesystem/singlefilefs.h"
 
 pthread_barrier_t barrier;  //barriera che serve a far partire tutti i thread contemporaneamente con l'invocazione delle operazioni
@@ -29,7 +29,7 @@ void *invoke_put_data(void *arg) {
     pthread_t tid;
     char source[SIZE_SOURCE_STR];   //primo parametro della syscall put_data()
     size_t size;                    //secondo parametro della syscall put_data()
-    int ret;
+    long ret;
     unsigned long timestamp;
 
     tid = *(pthread_t *)arg;
@@ -46,14 +46,14 @@ void *invoke_put_data(void *arg) {
     fflush(stdout);
 
     while(1) {
-        ret = syscall(PUT_SYSCALL, (char *)source, size);
+        ret = sfs_put_data((char *)source, size);
         if (!(ret < 0 && errno == EBUSY))   //caso in cui non ci sono stati problemi di concorrenza
             break;
 
     }
 
     RDTSC(timestamp);
-    printf("\n[THREAD %ld] Ho terminato l'esecuzione di put_data() sul blocco %d. Timestamp = %lu.\n", tid, ret, timestamp);
+    printf("\n[THREAD %ld] Ho terminato l'esecuzione di put_data() sul blocco %ld. Timestamp = %lu.\n", tid, ret, timestamp);
     fflush(stdout);
 
     if (ret < 0) {
@@ -70,10 +70,10 @@ void *invoke_put_data(void *arg) {
 void *invoke_get_data(void *arg) {
 
     pthread_t tid;
-    int offset;                             //primo parametro della syscall get_data()
+    long offset;                            //primo parametro della syscall get_data()
     char destination[DEFAULT_BLOCK_SIZE];   //secondo parametro della syscall get_data()
     size_t size;                            //terzo parametro della syscall get_data()
-    int ret;
+    long ret;
     unsigned long timestamp;
 
     tid = *(pthread_t *)arg;
@@ -81,7 +81,7 @@ void *invoke_get_data(void *arg) {
     fflush(stdout);
 
     size = (size_t)DEFAULT_BLOCK_SIZE-METADATA_SIZE;
-    offset = (int)(tid % TEST_BLOCKS);    //il blocco da leggere viene scelto in base al thread ID.
+    offset = (long)(tid % TEST_BLOCKS);   //il blocco da leggere viene scelto in base al thread ID.
 
     pthread_barrier_wait(&barrier); //attendo che tutti gli altri thread child raggiungano la barriera.
 
@@ -89,10 +89,10 @@ void *invoke_get_data(void *arg) {
     printf("\n[THREAD %ld] Sto per invocare get_data(). Timestamp = %lu.\n", tid, timestamp);
     fflush(stdout);
 
-    ret = syscall(GET_SYSCALL, offset, (char *)destination, size);
+    ret = sfs_get_data(offset, (char *)destination, size);
 
     RDTSC(timestamp);
-    printf("\n[THREAD %ld] Ho terminato l'esecuzione di get_data() sul blocco %d. Timestamp = %lu.\n", tid, offset, timestamp);
+    printf("\n[THREAD %ld] Ho terminato l'esecuzione di get_data() sul blocco %ld. Timestamp = %lu.\n", tid, offset, timestamp);
     fflush(stdout);
 
     if (ret < 0) {
@@ -109,15 +109,15 @@ void *invoke_get_data(void *arg) {
 void *invoke_invalidate_data(void *arg) {
 
     pthread_t tid;
-    int offset; //parametro della system call invalidate_data()
-    int ret;
+    long offset; //parametro della system call invalidate_data()
+    long ret;
     unsigned long timestamp;
 
     tid = *(pthread_t *)arg;
     printf("[THREAD %ld] Eccomi qua, all'interno della funzione invoke_invalidate_data().\n", tid);
     fflush(stdout);
 
-    offset = (int)(tid % TEST_BLOCKS);    //il blocco da invalidare viene scelto in base al thread ID.
+    offset = (long)(tid % TEST_BLOCKS);   //il blocco da invalidare viene scelto in base al thread ID.
 
     pthread_barrier_wait(&barrier); //attendo che tutti gli altri thread child raggiungano la barriera.
 
@@ -126,14 +126,14 @@ void *invoke_invalidate_data(void *arg) {
     fflush(stdout);
 
     while(1) {
-        ret = syscall(INVALIDATE_SYSCALL, offset);
+        ret = sfs_invalidate_data(offset);
         if (!(ret < 0 && errno == EBUSY))   //caso in cui non ci sono stati problemi di concorrenza
             break;
 
     }
 
     RDTSC(timestamp);
-    printf("\n[THREAD %ld] Ho terminato l'esecuzione di invalidate_data() sul blocco %d. Timestamp = %lu.\n", tid, offset, timestamp);
+    printf("\n[THREAD %ld] Ho terminato l'esecuzione di invalidate_data() sul blocco %ld. Timestamp = %lu.\n", tid, offset, timestamp);
     fflush(stdout);
 
     if (ret < 0) {
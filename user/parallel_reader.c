@@ -0,0 +1,155 @@
+/* Questo programma legge i messaggi validi del file del file system con più thread: il file viene suddiviso con
+ * SFS_IOC_PARTITION in tante partizioni quanti sono i thread e ogni thread legge la propria partizione con un'apertura
+ * separata del file (e quindi con un proprio cursore di lettura), posizionandosi con SFS_IOC_SEEK_PARTITION direttamente
+ * sul primo messaggio della partizione, che ne imposta anche il limite. Al termine viene riportato il throughput ottenuto.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../filesystem/singlefilefs.h"
+#include "../filesystem/singlefilefs_ioctl.h"
+
+#define DEFAULT_FILE_PATH "./mount/" UNIQUE_FILE_NAME    //file letto se non ne viene indicato uno sulla riga di comando
+
+//descrittore del lavoro assegnato a un thread di lettura
+struct reader_work {
+    const char *path;
+    struct sfs_partition part;
+    uint64_t messages;      //messaggi letti
+    uint64_t bytes;         //byte di payload letti (fino al primo byte nullo di ciascun messaggio)
+    int error;              //errno dell'eventuale errore
+};
+
+//FUNCTIONS PROTOTYPES
+void *read_partition(void *);
+
+//corpo dei thread di lettura: legge i messaggi della partizione assegnata fino alla fine del file (ovvero fino al limite end_seq).
+void *read_partition(void *arg) {
+
+    struct reader_work *work = (struct reader_work *)arg;
+    char buf[DEFAULT_BLOCK_SIZE];
+    ssize_t ret;
+    int fd;
+
+    fd = open(work->path, O_RDONLY);
+    if (fd == -1) {
+        work->error = errno;
+        return NULL;
+    }
+    if (ioctl(fd, SFS_IOC_SEEK_PARTITION, &(work->part)) == -1) {
+        work->error = errno;
+        close(fd);
+        return NULL;
+    }
+    //buf contiene l'intero payload di un blocco, per cui ogni read() restituisce esattamente un messaggio.
+    while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+        work->messages++;
+        work->bytes += strnlen(buf, ret);
+    }
+    if (ret == -1)
+        work->error = errno;
+    close(fd);
+    return NULL;
+
+}
+
+int main(int argc, char **argv) {
+
+    struct sfs_partition_request req;
+    struct sfs_partition *parts;
+    struct reader_work *works;
+    pthread_t *tids;
+    struct timespec t_start, t_end;
+    const char *path;
+    long num_threads;
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t i;
+    double seconds;
+    int opt;
+    int fd;
+    int ret;
+
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_threads = atol(optarg);
+                break;
+            default:
+                printf("Usage: parallel_reader [-j threads] [file]\n");
+                return -1;
+        }
+    }
+    path = (optind < argc) ? argv[optind] : DEFAULT_FILE_PATH;
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > SFS_MAX_PARTITIONS)
+        num_threads = SFS_MAX_PARTITIONS;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Error opening the file");
+        return -1;
+    }
+    parts = calloc(num_threads, sizeof(struct sfs_partition));
+    works = calloc(num_threads, sizeof(struct reader_work));
+    tids = calloc(num_threads, sizeof(pthread_t));
+    if (!parts || !works || !tids) {
+        printf("Could not allocate the reader threads.\n");
+        close(fd);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    memset(&req, 0, sizeof(req));
+    req.parts = num_threads;
+    req.partitions = (uint64_t)(uintptr_t)parts;
+    ret = ioctl(fd, SFS_IOC_PARTITION, &req);
+    close(fd);
+    if (ret == -1) {
+        perror("Error partitioning the file");
+        return -1;
+    }
+    printf("%lu valid messages (sequence numbers below %lu) split into %lu partitions.\n", req.total, req.snapshot_seq, req.parts);
+
+    for(i=0; i<req.parts; i++) {
+        works[i].path = path;
+        works[i].part = parts[i];
+        if (pthread_create(&tids[i], NULL, read_partition, &works[i]) != 0) {
+            printf("Could not create reader thread %lu.\n", i);
+            return -1;
+        }
+    }
+    messages = 0;
+    bytes = 0;
+    for(i=0; i<req.parts; i++) {
+        pthread_join(tids[i], NULL);
+        if (works[i].error)
+            printf("Partition %lu [%lu, %lu): %s\n", i, works[i].part.start_seq, works[i].part.end_seq, strerror(works[i].error));
+        else if (works[i].messages != works[i].part.count)
+            printf("Partition %lu [%lu, %lu): %lu messages read, %lu expected (concurrent writes or invalidations).\n", i,
+                works[i].part.start_seq, works[i].part.end_seq, works[i].messages, works[i].part.count);
+        messages += works[i].messages;
+        bytes += works[i].bytes;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    seconds = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    printf("Read %lu messages (%lu bytes) with %lu threads in %.3f s (%.1f messages/s).\n", messages, bytes, req.parts, seconds,
+        seconds > 0 ? messages / seconds : 0.0);
+
+    free(parts);
+    free(works);
+    free(tids);
+    return 0;
+
+}
@@ -0,0 +1,229 @@
+/* Questo programma scrive nel file system, un messaggio per riga, le righe di un file di testo (o dello standard input)
+ * attraverso le code di sottomissione asincrona del dispositivo di controllo /dev/singlefilefs (SFS_CTL_RING_SETUP): fino a
+ * depth messaggi vengono accodati senza attenderne l'esito, mentre il kthread del modulo li preleva e li scrive. Una system
+ * call (SFS_CTL_RING_ENTER) serve soltanto quando il kthread è addormentato o per attendere i completamenti quando tutti i
+ * buffer sono occupati. Le scritture fallite per contesa di write_mutex (-EBUSY) vengono riaccodate. Al termine viene
+ * riportato il throughput ottenuto.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../filesystem/singlefilefs.h"
+#include "../filesystem/singlefilefs_ctl.h"
+
+#define DEFAULT_DEPTH 256       //richieste accodate al più contemporaneamente
+
+//code mappate dal dispositivo di controllo
+struct ring {
+    int fd;
+    struct sfs_ring_ctl *ctl;
+    struct sfs_sqe *sqes;
+    struct sfs_cqe *cqes;
+    uint32_t sq_mask;
+    uint32_t cq_mask;
+};
+
+//FUNCTIONS PROTOTYPES
+int ring_open(struct ring *, uint64_t);
+void ring_submit(struct ring *, uint64_t, char *, size_t);
+int ring_wait(struct ring *, uint64_t);
+
+//apre il dispositivo di controllo, predispone le code (entries richieste) e le mappa.
+int ring_open(struct ring *r, uint64_t entries) {
+
+    struct sfs_ring_params params;
+    void *mem;
+
+    r->fd = open(SFS_CTL_DEVICE, O_RDWR);
+    if (r->fd == -1)
+        return -1;
+    memset(&params, 0, sizeof(params));
+    params.sq_entries = entries;
+    if (ioctl(r->fd, SFS_CTL_RING_SETUP, &params) == -1)
+        return -1;
+    mem = mmap(NULL, params.size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    if (mem == MAP_FAILED)
+        return -1;
+    r->ctl = (struct sfs_ring_ctl *)mem;
+    r->sqes = (struct sfs_sqe *)((char *)mem + params.sqes_off);
+    r->cqes = (struct sfs_cqe *)((char *)mem + params.cqes_off);
+    r->sq_mask = params.sq_entries - 1;
+    r->cq_mask = params.cq_entries - 1;
+    return 0;
+
+}
+
+//accoda la scrittura del messaggio buf (len byte) e la pubblica; risveglia il kthread se si è addormentato.
+void ring_submit(struct ring *r, uint64_t user_data, char *buf, size_t len) {
+
+    struct sfs_ring_enter enter;
+    struct sfs_sqe *sqe;
+    uint32_t tail;
+
+    tail = r->ctl->sq_tail;
+    sqe = &(r->sqes[tail & r->sq_mask]);
+    sqe->opcode = SFS_OP_PUT;
+    sqe->buf = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    __atomic_store_n(&(r->ctl->sq_tail), tail + 1, __ATOMIC_RELEASE);
+
+    //sq_tail va pubblicato prima di leggere flags (vedi ring_worker() nel modulo)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(r->ctl->flags), __ATOMIC_RELAXED) & SFS_RING_NEED_WAKEUP) {
+        memset(&enter, 0, sizeof(enter));
+        ioctl(r->fd, SFS_CTL_RING_ENTER, &enter);
+    }
+
+}
+
+//attende che ci siano almeno min_complete completamenti da consumare.
+int ring_wait(struct ring *r, uint64_t min_complete) {
+
+    struct sfs_ring_enter enter;
+
+    memset(&enter, 0, sizeof(enter));
+    enter.min_complete = min_complete;
+    while (ioctl(r->fd, SFS_CTL_RING_ENTER, &enter) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+
+}
+
+int main(int argc, char **argv) {
+
+    struct ring r;
+    struct sfs_cqe *cqe;
+    struct timespec t_start, t_end;
+    FILE *input;
+    char **buffers;         //buffer dei messaggi: restano occupati finché la scrittura non viene completata
+    size_t *lengths;
+    uint64_t *free_slots;   //pila dei buffer liberi
+    uint64_t num_free;
+    uint64_t depth;
+    uint64_t written, failed;
+    uint64_t slot;
+    uint32_t head;
+    size_t len;
+    double seconds;
+    int eof;
+    int opt;
+
+    depth = DEFAULT_DEPTH;
+    while ((opt = getopt(argc, argv, "q:")) != -1) {
+        switch (opt) {
+            case 'q':
+                depth = atol(optarg);
+                break;
+            default:
+                printf("Usage: ring_writer [-q depth] [file]\n");
+                return -1;
+        }
+    }
+    if (depth < 1)
+        depth = 1;
+    if (depth > SFS_RING_MAX_ENTRIES)
+        depth = SFS_RING_MAX_ENTRIES;
+    input = (optind < argc) ? fopen(argv[optind], "r") : stdin;
+    if (!input) {
+        perror("Error opening the input file");
+        return -1;
+    }
+
+    if (ring_open(&r, depth) == -1) {
+        perror("Error setting up the submission ring");
+        return -1;
+    }
+    buffers = calloc(depth, sizeof(char *));
+    lengths = calloc(depth, sizeof(size_t));
+    free_slots = calloc(depth, sizeof(uint64_t));
+    if (!buffers || !lengths || !free_slots) {
+        printf("Could not allocate the message buffers.\n");
+        return -1;
+    }
+    for(slot=0; slot<depth; slot++) {
+        buffers[slot] = malloc(DEFAULT_BLOCK_SIZE);
+        if (!buffers[slot]) {
+            printf("Could not allocate the message buffers.\n");
+            return -1;
+        }
+        free_slots[slot] = slot;
+    }
+    num_free = depth;
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    written = 0;
+    failed = 0;
+    eof = 0;
+    while (!eof || num_free < depth) {
+        //accodamento delle righe successive, finché ci sono buffer liberi
+        while (!eof && num_free > 0) {
+            slot = free_slots[num_free - 1];
+            if (!fgets(buffers[slot], DEFAULT_BLOCK_SIZE, input)) {
+                eof = 1;
+                break;
+            }
+            len = strlen(buffers[slot]);
+            if (len > 0 && buffers[slot][len - 1] == '\n')
+                buffers[slot][--len] = '\0';
+            if (len == 0)
+                continue;
+            num_free--;
+            lengths[slot] = len;
+            ring_submit(&r, slot, buffers[slot], len);
+        }
+
+        //consumo dei completamenti disponibili (attendendone almeno uno se non c'è altro da fare)
+        head = r.ctl->cq_head;
+        if (head == __atomic_load_n(&(r.ctl->cq_tail), __ATOMIC_ACQUIRE)) {
+            if (num_free == depth)
+                continue;
+            if (ring_wait(&r, 1) == -1) {
+                perror("Error waiting for completions");
+                return -1;
+            }
+        }
+        while (head != __atomic_load_n(&(r.ctl->cq_tail), __ATOMIC_ACQUIRE)) {
+            cqe = &(r.cqes[head & r.cq_mask]);
+            slot = cqe->user_data;
+            if (cqe->result == -EBUSY) {
+                //write_mutex era occupato: la scrittura viene riaccodata (c'è sempre posto, il buffer era tra quelli in volo)
+                ring_submit(&r, slot, buffers[slot], lengths[slot]);
+            } else {
+                if (cqe->result < 0) {
+                    printf("Message of %zu bytes not written: %s\n", lengths[slot], strerror(-cqe->result));
+                    failed++;
+                } else {
+                    written++;
+                }
+                free_slots[num_free++] = slot;
+            }
+            head++;
+            __atomic_store_n(&(r.ctl->cq_head), head, __ATOMIC_RELEASE);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    seconds = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    printf("Wrote %lu messages (%lu failed) with queue depth %lu in %.3f s (%.1f messages/s).\n", written, failed, depth, seconds,
+        seconds > 0 ? written / seconds : 0.0);
+
+    for(slot=0; slot<depth; slot++)
+        free(buffers[slot]);
+    free(buffers);
+    free(lengths);
+    free(free_slots);
+    close(r.fd);
+    return 0;
+
+}
@@ -0,0 +1,203 @@
+/* Implementazione della libreria descritta in sfs_lib.h: ogni operazione viene descritta con una struct sfs_op, eseguita con
+ * SFS_CTL_OP sul dispositivo di controllo oppure, se il dispositivo non è disponibile, tradotta nella system call corrispondente.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sfs_lib.h"
+#include "user.h"
+
+#define FD_UNKNOWN -2       //il dispositivo non è ancora stato aperto
+
+static int sfs_fd = FD_UNKNOWN;     //descrittore del dispositivo di controllo (-1 = dispositivo non disponibile)
+
+//restituisce il descrittore del dispositivo di controllo (aprendolo alla prima chiamata) oppure -1 se non è disponibile.
+static int sfs_device(void) {
+
+    int fd = __atomic_load_n(&sfs_fd, __ATOMIC_ACQUIRE);
+    int expected = FD_UNKNOWN;
+
+    if (fd != FD_UNKNOWN)
+        return fd;
+    fd = open(SFS_CTL_DEVICE, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        fd = -1;
+    //se un altro thread ha aperto il dispositivo nel frattempo, si usa il suo descrittore
+    if (!__atomic_compare_exchange_n(&sfs_fd, &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (fd >= 0)
+            close(fd);
+        fd = expected;
+    }
+    return fd;
+
+}
+
+//esegue op con la system call corrispondente.
+static long sfs_syscall(const struct sfs_op *op) {
+
+    char *buf = (char *)(uintptr_t)op->buf;
+
+    switch (op->opcode) {
+        case SFS_OP_PUT:
+            return syscall(PUT_SYSCALL, buf, op->len);
+        case SFS_OP_GET:
+            return syscall(GET_SYSCALL, op->address, buf, op->len);
+        case SFS_OP_INVALIDATE:
+            return syscall(INVALIDATE_SYSCALL, op->address);
+        case SFS_OP_PUT_KEYED:
+            return syscall(PUT_KEYED_SYSCALL, op->key, buf, op->len);
+        case SFS_OP_GET_BY_KEY:
+            return syscall(GET_BY_KEY_SYSCALL, op->key, buf, op->len);
+        case SFS_OP_INVALIDATE_BY_KEY:
+            return syscall(INVALIDATE_BY_KEY_SYSCALL, op->key);
+        case SFS_OP_UPDATE:
+            return syscall(UPDATE_SYSCALL, op->address, buf, op->len, 1);
+        case SFS_OP_UPDATE_TO_TAIL:
+            return syscall(UPDATE_SYSCALL, op->address, buf, op->len, 0);
+        case SFS_OP_APPEND:
+            return syscall(APPEND_SYSCALL, op->address, buf, op->len);
+        case SFS_OP_PUT_IF_TAIL:
+            return syscall(PUT_IF_TAIL_SYSCALL, buf, op->len, op->seq);
+        case SFS_OP_UPDATE_IF:
+            return syscall(UPDATE_IF_SYSCALL, op->address, buf, op->len, op->seq, op->version);
+        case SFS_OP_INVALIDATE_IF:
+            return syscall(INVALIDATE_IF_SYSCALL, op->address, op->seq, op->version);
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+}
+
+long sfs_execute(struct sfs_op *op) {
+
+    int fd = sfs_device();
+    long ret;
+
+    if (fd >= 0) {
+        if (ioctl(fd, SFS_CTL_OP, op) == -1) {
+            op->result = -errno;
+            return -1;
+        }
+        return op->result;
+    }
+    ret = sfs_syscall(op);
+    op->result = (ret < 0) ? -errno : ret;
+    return ret;
+
+}
+
+long sfs_batch(struct sfs_op *ops, size_t count, uint64_t flags) {
+
+    struct sfs_batch batch;
+    int fd = sfs_device();
+    size_t i;
+
+    if (fd >= 0) {
+        memset(&batch, 0, sizeof(batch));
+        batch.ops = (uint64_t)(uintptr_t)ops;
+        batch.count = count;
+        batch.flags = flags;
+        if (ioctl(fd, SFS_CTL_BATCH, &batch) == -1)
+            return -1;
+        return batch.done;
+    }
+    //senza dispositivo il lotto viene eseguito con una system call per operazione
+    for(i=0; i<count; i++) {
+        if (sfs_execute(&ops[i]) < 0 && (flags & SFS_BATCH_STOP_ON_ERROR))
+            return i + 1;
+    }
+    return count;
+
+}
+
+int sfs_using_device(void) {
+
+    return sfs_device() >= 0;
+
+}
+
+long sfs_put_data(char *source, size_t size) {
+
+    struct sfs_op op = {.opcode = SFS_OP_PUT, .buf = (uint64_t)(uintptr_t)source, .len = size};
+    return sfs_execute(&op);
+
+}
+
+long sfs_get_data(long offset, char *destination, size_t size) {
+
+    struct sfs_op op = {.opcode = SFS_OP_GET, .address = offset, .buf = (uint64_t)(uintptr_t)destination, .len = size};
+    return sfs_execute(&op);
+
+}
+
+long sfs_invalidate_data(long offset) {
+
+    struct sfs_op op = {.opcode = SFS_OP_INVALIDATE, .address = offset};
+    return sfs_execute(&op);
+
+}
+
+long sfs_put_keyed_data(uint64_t key, char *source, size_t size) {
+
+    struct sfs_op op = {.opcode = SFS_OP_PUT_KEYED, .key = key, .buf = (uint64_t)(uintptr_t)source, .len = size};
+    return sfs_execute(&op);
+
+}
+
+long sfs_get_data_by_key(uint64_t key, char *destination, size_t size) {
+
+    struct sfs_op op = {.opcode = SFS_OP_GET_BY_KEY, .key = key, .buf = (uint64_t)(uintptr_t)destination, .len = size};
+    return sfs_execute(&op);
+
+}
+
+long sfs_invalidate_data_by_key(uint64_t key) {
+
+    struct sfs_op op = {.opcode = SFS_OP_INVALIDATE_BY_KEY, .key = key};
+    return sfs_execute(&op);
+
+}
+
+long sfs_update_data(long offset, char *source, size_t size, int keep_order) {
+
+    struct sfs_op op = {.opcode = keep_order ? SFS_OP_UPDATE : SFS_OP_UPDATE_TO_TAIL, .address = offset,
+        .buf = (uint64_t)(uintptr_t)source, .len = size};
+    return sfs_execute(&op);
+
+}
+
+long sfs_append_data(long offset, char *source, size_t size) {
+
+    struct sfs_op op = {.opcode = SFS_OP_APPEND, .address = offset, .buf = (uint64_t)(uintptr_t)source, .len = size};
+    return sfs_execute(&op);
+
+}
+
+long sfs_put_data_if_tail(char *source, size_t size, uint64_t tail_seq) {
+
+    struct sfs_op op = {.opcode = SFS_OP_PUT_IF_TAIL, .buf = (uint64_t)(uintptr_t)source, .len = size, .seq = tail_seq};
+    return sfs_execute(&op);
+
+}
+
+long sfs_update_data_if(long offset, char *source, size_t size, uint64_t seq, uint64_t version) {
+
+    struct sfs_op op = {.opcode = SFS_OP_UPDATE_IF, .address = offset, .buf = (uint64_t)(uintptr_t)source, .len = size,
+        .seq = seq, .version = version};
+    return sfs_execute(&op);
+
+}
+
+long sfs_invalidate_data_if(long offset, uint64_t seq, uint64_t version) {
+
+    struct sfs_op op = {.opcode = SFS_OP_INVALIDATE_IF, .address = offset, .seq = seq, .version = version};
+    return sfs_execute(&op);
+
+}
@@ -0,0 +1,37 @@
+#ifndef _SFS_LIB_H
+#define _SFS_LIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../filesystem/singlefilefs_ctl.h"
+
+/*
+	Libreria di livello user per le operazioni del modulo. Alla prima chiamata viene aperto il dispositivo di controllo
+	/dev/singlefilefs e le operazioni vengono eseguite con SFS_CTL_OP / SFS_CTL_BATCH; se il dispositivo non è disponibile
+	(modulo precedente), vengono invece invocate le system call installate nella system call table (numeri in user.h).
+	Ogni funzione ha la stessa semantica della system call corrispondente: in caso di errore restituisce -1 e imposta errno
+	(EBUSY compreso, per cui la chiamata va ripetuta se write_mutex era occupato).
+*/
+
+long sfs_put_data(char *source, size_t size);
+long sfs_get_data(long offset, char *destination, size_t size);
+long sfs_invalidate_data(long offset);
+long sfs_put_keyed_data(uint64_t key, char *source, size_t size);
+long sfs_get_data_by_key(uint64_t key, char *destination, size_t size);
+long sfs_invalidate_data_by_key(uint64_t key);
+long sfs_update_data(long offset, char *source, size_t size, int keep_order);
+long sfs_append_data(long offset, char *source, size_t size);
+long sfs_put_data_if_tail(char *source, size_t size, uint64_t tail_seq);
+long sfs_update_data_if(long offset, char *source, size_t size, uint64_t seq, uint64_t version);
+long sfs_invalidate_data_if(long offset, uint64_t seq, uint64_t version);
+
+//esegue l'operazione op (SFS_OP_*), scrivendone il risultato in op->result; restituisce il risultato come le funzioni precedenti.
+long sfs_execute(struct sfs_op *op);
+//esegue in ordine le count operazioni di ops con una sola chiamata (flags: SFS_BATCH_*), scrivendo il risultato di ciascuna.
+//restituisce il numero di operazioni eseguite oppure -1.
+long sfs_batch(struct sfs_op *ops, size_t count, uint64_t flags);
+//restituisce 1 se le operazioni passano dal dispositivo di controllo, 0 se passano dalle system call.
+int sfs_using_device(void);
+
+#endif
@@ -1,21 +1,31 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-#include "user.h"
+#include "sfs_lib.h"
 #include "../filesystem/singlefilefs.h"
+#include "../filesystem/singlefilefs_ioctl.h"
+
+#define FILE_PATH "../mount/" UNIQUE_FILE_NAME   //file del file system montato, usato per i comandi ioctl() (SFS_IOC_SEARCH, SFS_IOC_BLOCK_INFO)
+#define SEARCH_HITS 64                          //risultati restituiti da ogni chiamata di SFS_IOC_SEARCH
 
 //FUNCTIONS PROTOTYPES
 char multichoice(char *, char[], int);
 void clear_stdin(void);
 void clear_stdin_after_fgets(char *, int);
+int read_key(uint64_t *);
 
 void put_operation(void);
 void get_operation(void);
 void invalidate_operation(void);
+void update_operation(void);
+void info_operation(void);
+void search_operation(void);
 
 //funzione ausiliaria che si occupa di acquisire da stdin un valore tra tanti possibili
 char multichoice(char *question, char choices[], int num)
@@ -79,12 +89,40 @@ void clear_stdin_after_fgets(char *source, int source_size) {
 
 }
 
+//funzione ausiliaria che acquisisce da stdin la chiave di un messaggio; restituisce 0 in caso di successo, -1 se l'input non è conforme.
+int read_key(uint64_t *key) {
+
+    int ret;
+
+    printf("Which key?\n");
+    fflush(stdout);
+    ret = scanf("%lu", key);
+    //caso in cui sono rimasti dei residui nello standard input
+    if (getchar() != '\n')
+        clear_stdin();
+    if (ret != 1) {
+        printf("Sorry, the provided input is incorrect. Please try again.\nPress Enter to continue...\n");
+        fflush(stdout);
+        return -1;
+    }
+    return 0;
+
+}
+
 void put_operation() {
 
     char *source;
     size_t size;
-    int ret;
+    long ret;
     int source_size;
+    uint64_t key;
+    char keyed;
+    char yes_no[] = {'y', 'n'};
+
+    //il messaggio può essere associato a una chiave, con cui potrà poi essere letto o invalidato al posto dell'indice del blocco.
+    keyed = multichoice("Would you like to associate a key with the message?", yes_no, sizeof(yes_no)/sizeof(char));
+    if (keyed == 'y' && read_key(&key) < 0)
+        return;
 
     //inizializzazione di size a un valore invalido; rimarrà tale se l'input fornito dall'utente non è conforme.
     size = -1;  //corrisponde a MAX_VALUE_FOR_SIZE_T - 1
@@ -122,7 +160,10 @@ void put_operation() {
     clear_stdin_after_fgets(source, source_size);
 
     while(1) {
-        ret = syscall(PUT_SYSCALL, source, size);
+        if (keyed == 'y')
+            ret = sfs_put_keyed_data(key, source, size);
+        else
+            ret = sfs_put_data(source, size);
         if (!(ret < 0 && errno == EBUSY))   //caso in cui non ci sono stati problemi di concorrenza
             break;
         //caso in cui ci sono stati problemi di concorrenza
@@ -131,11 +172,16 @@ void put_operation() {
 
     }
     if (ret < 0) {
-        printf("[ERROR] A problem occurred during syscall execution. Maybe there is no free device block.\nPress Enter to continue...\n");
+        printf("[ERROR] A problem occurred during syscall execution. Maybe there is no free device block%s.\nPress Enter to continue...\n",
+            (keyed == 'y') ? " or the key is already in use" : "");
         fflush(stdout);
     }
     else {
-        printf("INDEX OF WRITTEN BLOCK: %d\nPress Enter to continue...\n", ret);
+        //un messaggio impacchettato (opzione di montaggio "pack") ha un indirizzo che comprende anche lo slot del blocco
+        if (ADDRESS_SLOT(ret) >= 0)
+            printf("ADDRESS OF WRITTEN MESSAGE: %ld (device block %lld, slot %d)\nPress Enter to continue...\n", ret, ADDRESS_BLOCK(ret), ADDRESS_SLOT(ret));
+        else
+            printf("INDEX OF WRITTEN BLOCK: %ld\nPress Enter to continue...\n", ret);
         fflush(stdout);
     }
 
@@ -147,22 +193,33 @@ void put_operation() {
 
 void get_operation() {
 
-    int offset;
+    long offset;
     char *destination;
     size_t size;
-    int ret;
+    long ret;
     size_t destination_size;
+    uint64_t key;
+    char by;
+    char offset_key[] = {'o', 'k'};
 
     //inizializzazione di offset e size a valori invalidi; rimarranno tali se l'input fornito dall'utente non è conforme.
     offset = -1;
     size = -1;  //corrisponde a MAX_VALUE_FOR_SIZE_T - 1
 
-    printf("Which device block would you like to read?\n");
-    fflush(stdout);
-    scanf("%d", &offset);
-    //caso in cui sono rimasti dei residui nello standard input
-    if (getchar() != '\n')
-        clear_stdin(); 
+    by = multichoice("Would you like to read a data block by (o)ffset or a message by (k)ey?", offset_key, sizeof(offset_key)/sizeof(char));
+    if (by == 'k') {
+        if (read_key(&key) < 0)
+            return;
+        offset = 0;
+    }
+    else {
+        printf("Which device block (or packed message address) would you like to read?\n");
+        fflush(stdout);
+        scanf("%ld", &offset);
+        //caso in cui sono rimasti dei residui nello standard input
+        if (getchar() != '\n')
+            clear_stdin(); 
+    }
 
     //sanity check
     if (offset < 0) {
@@ -198,14 +255,17 @@ void get_operation() {
         exit(-1);      
     }
 
-    ret = syscall(GET_SYSCALL, offset, destination, size);
+    if (by == 'k')
+        ret = sfs_get_data_by_key(key, destination, size);
+    else
+        ret = sfs_get_data(offset, destination, size);
     if (ret < 0) {
         printf("[ERROR] A problem occurred during syscall execution. Maybe the selected device block is invalid or does not exist.\nPress Enter to continue...\n");
         fflush(stdout);
     }
     else {
         printf("READ DATA: %s\n", destination);
-        printf("NUMBER OF READ BYTES: %d\nPress Enter to continue...\n", ret);
+        printf("NUMBER OF READ BYTES: %ld\nPress Enter to continue...\n", ret);
         fflush(stdout);
     }
 
@@ -217,18 +277,29 @@ void get_operation() {
 
 void invalidate_operation() {
 
-    int offset;
-    int ret;
+    long offset;
+    long ret;
+    uint64_t key;
+    char by;
+    char offset_key[] = {'o', 'k'};
 
     //inizializzazione di offset a un valore invalido; rimarrà tale se l'input fornito dall'utente non è conforme.
     offset = -1;
 
-    printf("Which device block would you like to invalidate?\n");
-    fflush(stdout);
-    scanf("%d", &offset);
-    //caso in cui sono rimasti dei residui nello standard input
-    if (getchar() != '\n')
-        clear_stdin(); 
+    by = multichoice("Would you like to invalidate a data block by (o)ffset or a message by (k)ey?", offset_key, sizeof(offset_key)/sizeof(char));
+    if (by == 'k') {
+        if (read_key(&key) < 0)
+            return;
+        offset = 0;
+    }
+    else {
+        printf("Which device block (or packed message address) would you like to invalidate?\n");
+        fflush(stdout);
+        scanf("%ld", &offset);
+        //caso in cui sono rimasti dei residui nello standard input
+        if (getchar() != '\n')
+            clear_stdin(); 
+    }
 
     //sanity check
     if (offset < 0) {
@@ -238,7 +309,10 @@ void invalidate_operation() {
     }
 
     while(1) {
-        ret = syscall(INVALIDATE_SYSCALL, offset);
+        if (by == 'k')
+            ret = sfs_invalidate_data_by_key(key);
+        else
+            ret = sfs_invalidate_data(offset);
         if (!(ret < 0 && errno == EBUSY))   //caso in cui non ci sono stati problemi di concorrenza
             break;
         //caso in cui ci sono stati problemi di concorrenza
@@ -251,7 +325,10 @@ void invalidate_operation() {
         fflush(stdout);
     }
     else {
-        printf("Invalidation of device block %d was successful.\nPress Enter to continue...\n", offset);
+        if (by == 'k')
+            printf("Invalidation of the message with key %lu was successful.\nPress Enter to continue...\n", key);
+        else
+            printf("Invalidation of device block %ld was successful.\nPress Enter to continue...\n", offset);
         fflush(stdout);
     }
 
@@ -259,9 +336,224 @@ void invalidate_operation() {
 
 }
 
+void update_operation() {
+
+    long offset;
+    char *source;
+    size_t size;
+    long ret;
+    int source_size;
+    char mode;
+    char keep_order;
+    char replace_append[] = {'r', 'a'};
+    char yes_no[] = {'y', 'n'};
+
+    //inizializzazione di offset e size a valori invalidi; rimarranno tali se l'input fornito dall'utente non è conforme.
+    offset = -1;
+    size = -1;  //corrisponde a MAX_VALUE_FOR_SIZE_T - 1
+
+    printf("Which device block would you like to update?\n");
+    fflush(stdout);
+    scanf("%ld", &offset);
+    //caso in cui sono rimasti dei residui nello standard input
+    if (getchar() != '\n')
+        clear_stdin();
+
+    //sanity check
+    if (offset < 0) {
+        printf("Sorry, the provided input is incorrect. Please try again.\nPress Enter to continue...\n");
+        fflush(stdout);
+        return;
+    }
+
+    //il payload può essere sostituito (eventualmente spostando il messaggio in fondo all'ordine delle scritture) oppure esteso.
+    mode = multichoice("Would you like to (r)eplace the message or (a)ppend to it?", replace_append, sizeof(replace_append)/sizeof(char));
+    keep_order = 'y';
+    if (mode == 'r')
+        keep_order = multichoice("Should the message keep its position in the order of the writes?", yes_no, sizeof(yes_no)/sizeof(char));
+
+    printf("How many bytes would you like to write on the device block?\n");
+    fflush(stdout);
+    scanf("%lu", &size);
+    //caso in cui sono rimasti dei residui nello standard input
+    if (getchar() != '\n')
+        clear_stdin();
+
+    //sanity check
+    if (size > INT_MAX) {
+        printf("Sorry, the provided input is incorrect. Please try again.\nPress Enter to continue...\n");
+        fflush(stdout);
+        return;
+    }
+
+    //qui viene stabilito quanti byte devono essere allocati per il buffer source.
+    if (size < DEFAULT_BLOCK_SIZE-METADATA_SIZE)
+        source_size = (int)size;
+    else
+        source_size = DEFAULT_BLOCK_SIZE-METADATA_SIZE;
+
+    source = malloc(source_size);
+    if (!source) {
+        printf("[ERRORE] Problema di allocazione della memoria.\n");
+        fflush(stdout);
+        exit(-1);
+    }
+
+    printf("Please insert here the data you would like to write on the device block.\n");
+    fflush(stdout);
+    fgets(source, source_size, stdin);
+    clear_stdin_after_fgets(source, source_size);
+
+    while(1) {
+        if (mode == 'a')
+            ret = sfs_append_data(offset, source, size);
+        else
+            ret = sfs_update_data(offset, source, size, keep_order == 'y');
+        if (!(ret < 0 && errno == EBUSY))   //caso in cui non ci sono stati problemi di concorrenza
+            break;
+        //caso in cui ci sono stati problemi di concorrenza
+        printf("[CONCURRENCY ISSUE] Trying to call %s() again...\n", (mode == 'a') ? "append_data" : "update_data");
+        fflush(stdout);
+
+    }
+    if (ret < 0) {
+        printf("[ERROR] A problem occurred during syscall execution. Maybe the selected device block is invalid, does not exist or has no room left.\nPress Enter to continue...\n");
+        fflush(stdout);
+    }
+    else {
+        printf("NEW LENGTH OF THE MESSAGE: %ld\nPress Enter to continue...\n", ret);
+        fflush(stdout);
+    }
+
+    //cleanup
+    free(source);
+    return;
+
+}
+
+void info_operation() {
+
+    struct sfs_block_info info;
+    long offset;
+    int fd;
+
+    //inizializzazione di offset a un valore invalido; rimarrà tale se l'input fornito dall'utente non è conforme.
+    offset = -2;
+
+    printf("Which device block or packed message address would you like to inspect (-1 for the last valid message)?\n");
+    fflush(stdout);
+    scanf("%ld", &offset);
+    //caso in cui sono rimasti dei residui nello standard input
+    if (getchar() != '\n')
+        clear_stdin();
+
+    //sanity check
+    if (offset < -1) {
+        printf("Sorry, the provided input is incorrect. Please try again.\nPress Enter to continue...\n");
+        fflush(stdout);
+        return;
+    }
+
+    fd = open(FILE_PATH, O_RDONLY);
+    if (fd == -1) {
+        printf("[ERROR] Could not open %s. Maybe the file system is not mounted.\nPress Enter to continue...\n", FILE_PATH);
+        fflush(stdout);
+        return;
+    }
+    memset(&info, 0, sizeof(info));
+    info.block = offset;
+    if (ioctl(fd, SFS_IOC_BLOCK_INFO, &info) == -1) {
+        printf("[ERROR] A problem occurred while inspecting the device block. Maybe it does not exist.\nPress Enter to continue...\n");
+        fflush(stdout);
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    //numero di sequenza e versione sono i valori attesi dalle system call condizionali (update_data_if(), invalidate_data_if(), ...)
+    if (info.block == -1)
+        printf("There are no valid messages (tail sequence number 0).\n");
+    else if (!info.is_valid)
+        printf("DEVICE BLOCK %ld: invalid\n", info.block);
+    else {
+        printf("DEVICE BLOCK %ld: sequence number %lu, version %lu, length %lu", info.block, info.seq, info.version, info.length);
+        if (info.flags & BLOCK_KEYED)
+            printf(", key %lu", info.key);
+        if (info.flags & BLOCK_COMPRESSED)
+            printf(", compressed to %lu bytes", info.stored_length);
+        if (info.flags & BLOCK_PACKED)
+            printf(", packed in slot %d of device block %lld (%lu bytes stored)", ADDRESS_SLOT(info.block), ADDRESS_BLOCK(info.block), info.stored_length);
+        printf("\n");
+    }
+    printf("Press Enter to continue...\n");
+    fflush(stdout);
+    return;
+
+}
+
+void search_operation() {
+
+    char pattern[SFS_MAX_PATTERN + 1];
+    struct sfs_search_request req;
+    struct sfs_search_hit hits[SEARCH_HITS];
+    uint64_t found;
+    uint64_t scanned;
+    uint64_t i;
+    size_t len;
+    int fd;
+
+    printf("Which text would you like to search for in the messages?\n");
+    fflush(stdout);
+    if (fgets(pattern, sizeof(pattern), stdin) == NULL)
+        pattern[0] = '\0';
+    clear_stdin_after_fgets(pattern, sizeof(pattern));
+    len = strcspn(pattern, "\n");
+
+    //sanity check
+    if (len == 0) {
+        printf("Sorry, the provided input is incorrect. Please try again.\nPress Enter to continue...\n");
+        fflush(stdout);
+        return;
+    }
+
+    fd = open(FILE_PATH, O_RDONLY);
+    if (fd == -1) {
+        printf("[ERROR] Could not open %s. Maybe the file system is not mounted.\nPress Enter to continue...\n", FILE_PATH);
+        fflush(stdout);
+        return;
+    }
+
+    //la ricerca viene eseguita nel kernel: ogni chiamata restituisce al più SEARCH_HITS risultati e il punto da cui proseguire.
+    memset(&req, 0, sizeof(req));
+    req.pattern = (uint64_t)(uintptr_t)pattern;
+    req.pattern_len = len;
+    req.hits = (uint64_t)(uintptr_t)hits;
+    found = 0;
+    scanned = 0;
+    do {
+        req.max_hits = SEARCH_HITS;
+        if (ioctl(fd, SFS_IOC_SEARCH, &req) == -1) {
+            printf("[ERROR] A problem occurred during the search.\nPress Enter to continue...\n");
+            fflush(stdout);
+            close(fd);
+            return;
+        }
+        for(i=0; i<req.found; i++)
+            printf("MATCHING DEVICE BLOCK: %ld (sequence number %lu)\n", hits[i].block, hits[i].seq);
+        found += req.found;
+        scanned += req.scanned;
+    } while (req.start_seq != 0);
+    close(fd);
+
+    printf("%lu matching messages out of %lu.\nPress Enter to continue...\n", found, scanned);
+    fflush(stdout);
+    return;
+
+}
+
 int main(int argc, char **argv) {
 
-    char options[] = {'1', '2', '3', '4'};
+    char options[] = {'1', '2', '3', '4', '5', '6', '7'};
     char selected_command;
 
     while(1) {
@@ -270,7 +562,10 @@ int main(int argc, char **argv) {
         printf("1) Write on a data block\n");
         printf("2) Read a data block\n");
         printf("3) Invalidate a data block\n");
-        printf("4) Quit\n");
+        printf("4) Update a data block\n");
+        printf("5) Inspect a data block\n");
+        printf("6) Search the messages\n");
+        printf("7) Quit\n");
         fflush(stdout);
 
         selected_command = multichoice("Please select an option", options, sizeof(options)/sizeof(char));
@@ -289,6 +584,18 @@ int main(int argc, char **argv) {
                 break;
 
             case '4':
+                update_operation();
+                break;
+
+            case '5':
+                info_operation();
+                break;
+
+            case '6':
+                search_operation();
+                break;
+
+            case '7':
                 printf("Bye!\n");
                 fflush(stdout);
                 return 0;
@@ -1,8 +1,18 @@
 #ifndef _USER_H
 #define _USER_H
 
+//numeri delle system call installate dal modulo, usati da sfs_lib.c solo se il dispositivo di controllo non è disponibile
+
 #define PUT_SYSCALL 134
 #define GET_SYSCALL 156
 #define INVALIDATE_SYSCALL 174
+#define PUT_KEYED_SYSCALL 177
+#define GET_BY_KEY_SYSCALL 178
+#define INVALIDATE_BY_KEY_SYSCALL 180
+#define UPDATE_SYSCALL 181
+#define APPEND_SYSCALL 182
+#define PUT_IF_TAIL_SYSCALL 183
+#define UPDATE_IF_SYSCALL 184
+#define INVALIDATE_IF_SYSCALL 185
 
 #endif
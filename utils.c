@@ -1,8 +1,16 @@
 #include <linux/buffer_head.h>
+#include <linux/crc32c.h>
+#include <linux/lz4.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/pagemap.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/xarray.h>
+#include <asm/byteorder.h>
 
 #include "filesystem/singlefilefs.h"
 #include "filesystem/singlefilefs_ker.h"
@@ -10,12 +18,225 @@
 
 //UTILS FUNCTIONS PROTOTYPES
 struct onefilefs_sb_info *get_superblock_info(struct super_block *);
-struct data_block_content *get_block_content(struct super_block *, int);
-struct data_block_metadata *get_block_metadata(struct super_block *, int);
-int set_superblock_info(struct super_block *, int, int);
-int set_block_content(struct super_block *, int, int, char *, size_t);
-int set_block_metadata(struct super_block *, int, int, int);
-int invalidate_block_content(struct super_block *, int);
+struct data_block_content *get_block_content(struct super_block *, uint64_t);
+struct data_block_metadata *get_block_metadata(struct super_block *, uint64_t);
+int64_t find_free_block(struct super_block *, uint64_t);
+int set_superblock_info(struct super_block *, int64_t, int64_t);
+int set_block_content(struct super_block *, uint64_t, int64_t, uint64_t, uint32_t, uint64_t, char *, size_t);
+int set_block_metadata(struct super_block *, uint64_t, int64_t, int);
+int set_block_links(struct super_block *, uint64_t, int64_t, int64_t, uint64_t);
+int payload_intact(struct data_block_metadata *, struct data_block_content *);
+int read_message(struct data_block_metadata *, struct data_block_content *, int, char *);
+size_t compress_message(char *, size_t, char **);
+int64_t set_block_payload(struct super_block *, uint64_t, size_t, char *, size_t);
+void init_packed_payload(char *, char *, size_t, uint16_t);
+int add_packed_message(struct super_block *, uint64_t, char *, size_t, uint16_t);
+int reclaim_packed_space(struct super_block *, uint64_t);
+int invalidate_packed_slot(struct super_block *, uint64_t, int);
+int invalidate_block_content(struct super_block *, uint64_t);
+int copy_block(struct super_block *, uint64_t, uint64_t);
+int set_block_forward(struct super_block *, uint64_t, int64_t);
+void publish_block_state(struct super_block *, uint64_t, int);
+unsigned int prefetch_chain(struct super_block *, int64_t, unsigned int);
+void prefetch_step(struct super_block *, struct chain_prefetch *, int64_t);
+int snapshot_contains(uint64_t);
+void retain_block(struct retained_block *, uint64_t, uint64_t);
+void prune_retained_blocks(void);
+int64_t lookup_key(uint64_t);
+int insert_key(uint64_t, int64_t);
+void remove_key(uint64_t, int64_t);
+void move_key(uint64_t, int64_t, int64_t);
+int drop_relocation(struct super_block *, uint64_t);
+const char *find_pattern(const char *, size_t, const char *, size_t);
+
+//indice (assoluto, sul dispositivo) del blocco che ospita il data block di indice offset.
+static inline sector_t data_block_number(uint64_t offset) {
+    return au_info.data_start + offset;
+}
+
+//indice (assoluto, sul dispositivo) del blocco della tabella dei metadati che ospita la voce del data block di indice offset.
+static inline sector_t meta_block_number(uint64_t offset) {
+    return au_info.meta_start + offset/METADATA_PER_BLOCK;
+}
+
+//questa funzione restituisce il puntatore ai metadati del data block di indice offset all'interno del buffer bh
+//(che è un blocco della tabella dei metadati oppure il data block stesso, a seconda del layout).
+static inline struct data_block_metadata *metadata_in_buffer(struct buffer_head *bh, uint64_t offset) {
+
+    if (au_info.features & FEAT_META_TABLE)
+        return &(((struct data_block_metadata *)bh->b_data)[offset % METADATA_PER_BLOCK]);
+    return &(((struct data_block_content *)bh->b_data)->metadata);
+
+}
+
+//CRC32C dell'intero payload di un data block (crc32c() usa l'implementazione accelerata disponibile, ad esempio l'istruzione crc32 di SSE4.2).
+static inline uint32_t payload_checksum(const char *payload) {
+    return crc32c(PAYLOAD_CSUM_SEED, payload, DEFAULT_BLOCK_SIZE - METADATA_SIZE);
+}
+
+//lunghezza del messaggio non compresso che occupa l'intero payload del data block con metadati db_meta: quella registrata nei
+//metadati (BLOCK_LENGTH) oppure, per i messaggi scritti senza, la posizione del primo byte nullo.
+static inline size_t payload_length(struct data_block_metadata *db_meta, const char *payload) {
+    if ((db_meta->flags & BLOCK_LENGTH) && db_meta->length <= DEFAULT_BLOCK_SIZE - METADATA_SIZE)
+        return db_meta->length;
+    return strnlen(payload, DEFAULT_BLOCK_SIZE - METADATA_SIZE);
+}
+
+//restituisce 1 se il blocco impacchettato con directory hdr ha uno slot libero e lo spazio per un messaggio di size byte.
+static inline int packed_room(struct packed_header *hdr, size_t size) {
+    return hdr->slots < PACKED_MAX_SLOTS && hdr->end + size <= DEFAULT_BLOCK_SIZE - METADATA_SIZE;
+}
+
+//restituisce 1 se il blocco impacchettato con directory hdr ha uno slot libero e, recuperando lo spazio dei messaggi non più validi
+//(reclaim_packed_space()), avrebbe spazio per un messaggio di size byte.
+static inline int packed_reclaimable(struct packed_header *hdr, size_t size) {
+
+    size_t used;
+    int slot;
+
+    if (hdr->slots >= PACKED_MAX_SLOTS || hdr->live == hdr->slots)
+        return 0;
+    used = sizeof(struct packed_header);
+    for(slot=0; slot<hdr->slots; slot++)
+        if (hdr->slot[slot].flags & SLOT_VALID)
+            used += hdr->slot[slot].length;
+    return used + size <= DEFAULT_BLOCK_SIZE - METADATA_SIZE;
+
+}
+
+//scompone l'indirizzo di un messaggio (il valore restituito da put_data()) nello slot (-1 = messaggio che occupa l'intero blocco)
+//e nell'indice del data block, che viene restituito. Un indirizzo negativo viene restituito invariato.
+static inline int64_t split_address(int64_t address, int *slot) {
+    if (address < 0) {
+        *slot = -1;
+        return address;
+    }
+    *slot = ADDRESS_SLOT(address);
+    return ADDRESS_BLOCK(address);
+}
+
+//restituisce l'indirizzo attuale del messaggio di indirizzo address: se il suo blocco è stato spostato dalla compattazione, l'indice
+//del blocco viene sostituito da quello della nuova posizione (lo slot resta lo stesso). Un indirizzo negativo viene restituito invariato.
+static inline int64_t resolve_address(int64_t address) {
+
+    void *entry;
+
+    if (address < 0)
+        return address;
+    entry = xa_load(&(au_info.remap), ADDRESS_BLOCK(address));
+    if (!entry)
+        return address;
+    return (address - ADDRESS_BLOCK(address)) | (int64_t)xa_to_value(entry);
+
+}
+
+//inverso di resolve_address(): restituisce l'indirizzo con cui l'utente conosce il messaggio che si trova all'indirizzo address, ovvero
+//quello con l'indice originario del blocco se il blocco vi è stato spostato dalla compattazione. Un indirizzo negativo viene restituito invariato.
+static inline int64_t origin_address(int64_t address) {
+
+    void *entry;
+
+    if (address < 0)
+        return address;
+    entry = xa_load(&(au_info.relocated), ADDRESS_BLOCK(address));
+    if (!entry)
+        return address;
+    return (address - ADDRESS_BLOCK(address)) | (int64_t)xa_to_value(entry);
+
+}
+
+//restituisce l'indice del primo slot valido, a partire da from, del blocco impacchettato con contenuto db_cont (-1 se non ve ne sono).
+//può essere invocata senza il seqcount del blocco: gli slot contati da slots sono già completi (vedi add_packed_message()).
+static int next_live_slot(struct data_block_content *db_cont, int from) {
+
+    struct packed_header *hdr = (struct packed_header *)db_cont->payload;
+    int slots;
+
+    slots = min_t(int, READ_ONCE(hdr->slots), PACKED_MAX_SLOTS);
+    smp_rmb();  //in coppia con smp_wmb() di add_packed_message()
+    for(; from<slots; from++)
+        if (READ_ONCE(hdr->slot[from].flags) & SLOT_VALID)
+            return from;
+    return -1;
+
+}
+
+//restituisce l'indice dell'ultimo slot valido, prima di before, del blocco impacchettato con contenuto db_cont (-1 se non ve ne sono).
+static int prev_live_slot(struct data_block_content *db_cont, int before) {
+
+    struct packed_header *hdr = (struct packed_header *)db_cont->payload;
+    int slot;
+
+    slot = min_t(int, READ_ONCE(hdr->slots), PACKED_MAX_SLOTS);
+    smp_rmb();  //in coppia con smp_wmb() di add_packed_message()
+    for(slot=min(slot, before)-1; slot>=0; slot--)
+        if (READ_ONCE(hdr->slot[slot].flags) & SLOT_VALID)
+            return slot;
+    return -1;
+
+}
+
+//restituisce 1 se lo slot slot (-1 = intero blocco) del data block con metadati db_meta e contenuto db_cont contiene un messaggio
+//valido. Un indirizzo senza slot non è valido per un blocco impacchettato, né un indirizzo con slot per un blocco ordinario.
+static int message_is_live(struct data_block_metadata *db_meta, struct data_block_content *db_cont, int slot) {
+
+    struct packed_header *hdr = (struct packed_header *)db_cont->payload;
+
+    if (!db_meta->is_valid)
+        return 0;
+    if (slot < 0)
+        return !(db_meta->flags & BLOCK_PACKED);
+    if (!(db_meta->flags & BLOCK_PACKED) || slot >= min_t(int, READ_ONCE(hdr->slots), PACKED_MAX_SLOTS))
+        return 0;
+    return (READ_ONCE(hdr->slot[slot].flags) & SLOT_VALID) != 0;
+
+}
+
+//questa funzione restituisce l'indirizzo dell'ultimo messaggio del data block valido di indice offset (l'ultimo slot valido, se il blocco
+//è impacchettato) e ne scrive in *seq il numero di sequenza. Restituisce -1 in caso di errore.
+static int64_t last_message_of(struct super_block *global_sb, int64_t offset, uint64_t *seq) {
+
+    struct data_block_metadata *db_meta;
+    struct data_block_content *db_cont;
+    int slot;
+
+    db_meta = get_block_metadata(global_sb, offset);
+    if (db_meta == NULL)
+        return -1;
+    *seq = db_meta->seq;
+    if (!(db_meta->flags & BLOCK_PACKED))
+        return offset;
+    db_cont = get_block_content(global_sb, offset);
+    if (db_cont == NULL)
+        return -1;
+    slot = prev_live_slot(db_cont, PACKED_MAX_SLOTS);
+    if (slot < 0)
+        return -1;
+    *seq = db_meta->seq + slot;
+    return PACKED_ADDRESS(offset, slot);
+
+}
+
+//seqcount che protegge il payload del data block di indice offset dalle modifiche in place.
+static inline seqcount_t *payload_seqcount(uint64_t offset) {
+    return &(au_info.payload_seq[offset % PAYLOAD_SEQ_BUCKETS]);
+}
+
+//registra in chain_next il successore next del data block di indice offset (senza la tabella dei metadati; vedi prefetch_chain()).
+//la voce viene scritta solo se cambia, per non sporcare la cache line condivisa dai lettori.
+static inline void note_chain_next(uint64_t offset, int64_t next) {
+    if (au_info.chain_next && offset < au_info.total_data_blocks && READ_ONCE(au_info.chain_next[offset]) != next)
+        WRITE_ONCE(au_info.chain_next[offset], next);
+}
+
+//questa funzione restituisce il buffer head del blocco che ospita i metadati del data block di indice offset.
+static inline struct buffer_head *read_metadata_buffer(struct super_block *global_sb, uint64_t offset) {
+
+    if (au_info.features & FEAT_META_TABLE)
+        return sb_bread(global_sb, meta_block_number(offset));
+    return sb_bread(global_sb, data_block_number(offset));
+
+}
 
 //questa funzione restituisce il puntatore alla struttura dati che comprende le informazioni contenute nel superblocco del dispositivo.
 struct onefilefs_sb_info *get_superblock_info(struct super_block *global_sb) {
@@ -36,13 +257,14 @@ struct onefilefs_sb_info *get_superblock_info(struct super_block *global_sb) {
 
 }
 
-//questa funzione restituisce il puntatore alla struttura dati che comprende il contenuto di un blocco dati.
-struct data_block_content *get_block_content(struct super_block *global_sb, int block_num) {
+//questa funzione restituisce il puntatore alla struttura dati che comprende il contenuto del data block di indice offset.
+//NB: con FEAT_META_TABLE il campo metadata della struttura restituita non è significativo (va usata get_block_metadata()).
+struct data_block_content *get_block_content(struct super_block *global_sb, uint64_t offset) {
 
     struct buffer_head *bh;
     struct data_block_content *db_cont;
 
-    bh = sb_bread(global_sb, block_num);
+    bh = sb_bread(global_sb, data_block_number(offset));
     if (!(global_sb && bh)) {
         return NULL;
     }
@@ -55,21 +277,46 @@ struct data_block_content *get_block_content(struct super_block *global_sb, int
 
 }
 
-//questa funzione restituisce il puntatore alla struttura dati che comprende i metadati di un blocco dati.
-struct data_block_metadata *get_block_metadata(struct super_block *global_sb, int block_num) {
+//questa funzione restituisce il puntatore alla struttura dati che comprende i metadati del data block di indice offset.
+struct data_block_metadata *get_block_metadata(struct super_block *global_sb, uint64_t offset) {
 
-    struct data_block_content *db_cont;
+    struct buffer_head *bh;
+    struct data_block_metadata *db_meta;
 
-    db_cont = get_block_content(global_sb, block_num);
-    if (db_cont == NULL) {
+    bh = read_metadata_buffer(global_sb, offset);
+    if (!(global_sb && bh)) {
         return NULL;
     }
-    return &(db_cont->metadata);
+
+    db_meta = metadata_in_buffer(bh, offset);
+    note_chain_next(offset, READ_ONCE(db_meta->next_valid));
+    //rilascio del buffer head bh
+    brelse(bh);
+
+    return db_meta;
+
+}
+
+//questa funzione cerca il primo data block libero (i.e. non valido) del dispositivo e ne restituisce l'indice.
+//la ricerca avviene sulla bitmap di allocazione in RAM (deve essere invocata con write_mutex acquisito).
+//restituisce -ENOMEM se non ci sono blocchi liberi.
+int64_t find_free_block(struct super_block *global_sb, uint64_t total_data_blocks) {
+
+    uint64_t offset;
+
+    //i blocchi invalidati ma ancora contenuti in qualche snapshot non possono essere riutilizzati, così come i vecchi indici dei
+    //blocchi spostati dalla compattazione (che vengono ancora tradotti nei nuovi).
+    offset = find_first_zero_bit(au_info.valid_bitmap, total_data_blocks);
+    while (offset < total_data_blocks && (test_bit(offset, au_info.retained_bitmap) || xa_load(&(au_info.remap), offset)))
+        offset = find_next_zero_bit(au_info.valid_bitmap, total_data_blocks, offset + 1);
+    if (offset >= total_data_blocks)
+        return -ENOMEM;
+    return (int64_t)offset;
 
 }
 
 //questa funzione scrive sul superblocco del dispositivo
-int set_superblock_info(struct super_block *global_sb, int new_first_valid, int new_last_valid) {
+int set_superblock_info(struct super_block *global_sb, int64_t new_first_valid, int64_t new_last_valid) {
 
     struct buffer_head *bh;
     struct onefilefs_sb_info *new_sb_disk;
@@ -82,6 +329,7 @@ int set_superblock_info(struct super_block *global_sb, int new_first_valid, int
 
     new_sb_disk->first_valid = new_first_valid;
     new_sb_disk->last_valid = new_last_valid;
+    new_sb_disk->next_seq = au_info.next_seq;
 
     //segnalazione al SO che il superblocco è stato modificato e che le modifiche devono essere sincronizzate col device sottostante
     mark_buffer_dirty(bh);
@@ -97,24 +345,22 @@ int set_superblock_info(struct super_block *global_sb, int new_first_valid, int
 
 }
 
-//questa funzione scrive su uno specifico blocco all'interno del dispositivo (metadati+payload)
-int set_block_content(struct super_block *global_sb, int block_num, int new_prev_valid, char *source, size_t size) {
+//questa funzione scrive sul data block di indice offset (metadati+payload); seq è il numero di sequenza assegnato al messaggio,
+//flags i suoi flag (BLOCK_*) e key la sua chiave (significativa solo con BLOCK_KEYED).
+int set_block_content(struct super_block *global_sb, uint64_t offset, int64_t new_prev_valid, uint64_t seq, uint32_t flags, uint64_t key, char *source, size_t size) {
 
     struct buffer_head *bh;
+    struct buffer_head *meta_bh;
     struct data_block_content *new_db_cont;
+    struct data_block_metadata *new_db_meta;
     int i;  //indice per il ciclo for
 
-    bh = sb_bread(global_sb, block_num);
+    bh = sb_bread(global_sb, data_block_number(offset));
     if (!(global_sb && bh)) {
         return -1;  //error condition
     }
     new_db_cont = (struct data_block_content *)bh->b_data;
 
-    //modifico opportunamente i metadati del blocco target (eccetto is_last che è un valore fisso).
-    new_db_cont->metadata.next_valid = -1;              //è l'ultimo blocco reso valido in ordine temporale per cui non può avere un next.
-    new_db_cont->metadata.prev_valid = new_prev_valid;  //settaggio del blocco valido precedente nell'ordine temporale
-    new_db_cont->metadata.is_valid = 1;                 //il blocco interessato nella put_data() deve chiaramente risultare valido.
-
     //ora ricopio un byte per volta la stringa di input all'interno della porzione del blocco riservata al payload.
     for(i=0; i<DEFAULT_BLOCK_SIZE-METADATA_SIZE; i++) {
         if (i<size)
@@ -124,6 +370,79 @@ int set_block_content(struct super_block *global_sb, int block_num, int new_prev
             
     }
 
+    //con la tabella dei metadati, il payload viene reso persistente prima della voce che rende valido il blocco.
+    if (au_info.features & FEAT_META_TABLE) {
+        mark_buffer_dirty(bh);
+        #ifdef SYNC
+        sync_dirty_buffer(bh);
+        #endif
+        meta_bh = sb_bread(global_sb, meta_block_number(offset));
+        if (!meta_bh) {
+            brelse(bh);
+            return -1;  //error condition
+        }
+    }
+    else {
+        meta_bh = bh;
+    }
+    new_db_meta = metadata_in_buffer(meta_bh, offset);
+
+    //modifico opportunamente i metadati del blocco target (eccetto is_last che è un valore fisso).
+    new_db_meta->next_valid = -1;              //è l'ultimo blocco reso valido in ordine temporale per cui non può avere un next.
+    note_chain_next(offset, -1);
+    new_db_meta->prev_valid = new_prev_valid;  //settaggio del blocco valido precedente nell'ordine temporale
+    new_db_meta->seq = seq;
+    new_db_meta->key = (flags & BLOCK_KEYED) ? key : 0;
+    new_db_meta->version = 0;
+    new_db_meta->checksum = payload_checksum(new_db_cont->payload);
+    new_db_meta->stored_len = (flags & BLOCK_COMPRESSED) ? size : 0;
+    //la lunghezza di un messaggio compresso o impacchettato è nota dalla decompressione o dalla directory degli slot
+    if (!(flags & (BLOCK_COMPRESSED | BLOCK_PACKED))) {
+        new_db_meta->length = size;
+        flags |= BLOCK_LENGTH;
+    }
+    else
+        new_db_meta->length = 0;
+    new_db_meta->reserved = 0;
+    new_db_meta->flags = flags | BLOCK_CHECKSUM;
+    new_db_meta->is_valid = 1;                 //il blocco interessato nella put_data() deve chiaramente risultare valido.
+
+    //segnalazione al SO che il blocco è stato modificato e che le modifiche devono essere sincronizzate col device sottostante
+    mark_buffer_dirty(meta_bh);
+
+    //se non si vuole utilizzare il page-cache write back daemon, la scrittura del blocco viene riportata nel device in maniera sincrona.
+    #ifdef SYNC
+    sync_dirty_buffer(meta_bh);
+    #endif
+
+    //rilascio dei buffer head
+    if (meta_bh != bh)
+        brelse(meta_bh);
+    brelse(bh);
+    return 0;
+
+}
+
+//questa funzione scrive solo i metadati del data block di indice offset
+int set_block_metadata(struct super_block *global_sb, uint64_t offset, int64_t pointed_block, int set_next) {
+
+    struct buffer_head *bh;
+    struct data_block_metadata *new_db_meta;
+
+    bh = read_metadata_buffer(global_sb, offset);
+    if (!(global_sb && bh)) {
+        return -1;  //error condition
+    }
+    new_db_meta = metadata_in_buffer(bh, offset);
+
+    //modifico opportunamente i metadati del blocco target
+    if (set_next == YES) {
+        new_db_meta->next_valid = pointed_block;
+        note_chain_next(offset, pointed_block);
+    }
+    else
+        new_db_meta->prev_valid = pointed_block;
+
     //segnalazione al SO che il blocco è stato modificato e che le modifiche devono essere sincronizzate col device sottostante
     mark_buffer_dirty(bh);
 
@@ -138,23 +457,22 @@ int set_block_content(struct super_block *global_sb, int block_num, int new_prev
 
 }
 
-//questa funzione scrive solo i metadati su uno specifico blocco all'interno del dispositivo
-int set_block_metadata(struct super_block *global_sb, int block_num, int pointed_block, int set_next) {
+//questa funzione scrive i collegamenti e il numero di sequenza del data block di indice offset (che viene spostato nella catena).
+int set_block_links(struct super_block *global_sb, uint64_t offset, int64_t prev_valid, int64_t next_valid, uint64_t seq) {
 
     struct buffer_head *bh;
-    struct data_block_content *new_db_cont;
+    struct data_block_metadata *new_db_meta;
 
-    bh = sb_bread(global_sb, block_num);
+    bh = read_metadata_buffer(global_sb, offset);
     if (!(global_sb && bh)) {
         return -1;  //error condition
     }
-    new_db_cont = (struct data_block_content *)bh->b_data;
+    new_db_meta = metadata_in_buffer(bh, offset);
 
-    //modifico opportunamente i metadati del blocco target
-    if (set_next == YES)
-        new_db_cont->metadata.next_valid = pointed_block;
-    else
-        new_db_cont->metadata.prev_valid = pointed_block;
+    new_db_meta->prev_valid = prev_valid;
+    new_db_meta->next_valid = next_valid;
+    note_chain_next(offset, next_valid);
+    new_db_meta->seq = seq;
 
     //segnalazione al SO che il blocco è stato modificato e che le modifiche devono essere sincronizzate col device sottostante
     mark_buffer_dirty(bh);
@@ -170,20 +488,378 @@ int set_block_metadata(struct super_block *global_sb, int block_num, int pointed
 
 }
 
-//questa funzione marca uno specifico blocco all'interno del dispositivo come invalido
-int invalidate_block_content(struct super_block *global_sb, int block_num) {
+//questa funzione modifica in place il payload del data block di indice offset: i size byte di source vengono scritti a partire
+//dalla posizione pos e il resto del payload viene azzerato, incrementando la versione del messaggio (che resta memorizzato
+//non compresso, lungo pos+size byte: con un messaggio compresso, pos deve valere 0). La scrittura avviene
+//all'interno della sezione di scrittura del seqcount del blocco (con la preemption disabilitata, per non far attendere a lungo
+//i lettori che trovano il seqcount dispari); deve essere invocata con write_mutex acquisito, che serializza gli scrittori
+//dello stesso seqcount. Restituisce la nuova versione del messaggio, oppure -1 in caso di errore.
+int64_t set_block_payload(struct super_block *global_sb, uint64_t offset, size_t pos, char *source, size_t size) {
 
     struct buffer_head *bh;
-    struct data_block_content *new_db_cont;
+    struct buffer_head *meta_bh;
+    struct data_block_content *db_cont;
+    struct data_block_metadata *db_meta;
+    seqcount_t *seqcount;
+    int64_t version;
 
-    bh = sb_bread(global_sb, block_num);
+    bh = sb_bread(global_sb, data_block_number(offset));
     if (!(global_sb && bh)) {
         return -1;  //error condition
     }
-    new_db_cont = (struct data_block_content *)bh->b_data;
+    //con la tabella dei metadati, la versione si trova in un blocco distinto da quello del payload.
+    meta_bh = (au_info.features & FEAT_META_TABLE) ? read_metadata_buffer(global_sb, offset) : bh;
+    if (!meta_bh) {
+        brelse(bh);
+        return -1;  //error condition
+    }
+    db_cont = (struct data_block_content *)bh->b_data;
+    db_meta = metadata_in_buffer(meta_bh, offset);
+    seqcount = payload_seqcount(offset);
+
+    preempt_disable();
+    write_seqcount_begin(seqcount);
+    memcpy(&(db_cont->payload[pos]), source, size);
+    memset(&(db_cont->payload[pos + size]), 0, DEFAULT_BLOCK_SIZE - METADATA_SIZE - pos - size);
+    version = ++(db_meta->version);
+    db_meta->checksum = payload_checksum(db_cont->payload);
+    db_meta->flags = (db_meta->flags & ~BLOCK_COMPRESSED) | BLOCK_CHECKSUM | BLOCK_LENGTH;
+    db_meta->stored_len = 0;
+    db_meta->length = pos + size;
+    write_seqcount_end(seqcount);
+    preempt_enable();
+
+    //segnalazione al SO che i blocchi sono stati modificati e che le modifiche devono essere sincronizzate col device sottostante
+    mark_buffer_dirty(bh);
+    if (meta_bh != bh)
+        mark_buffer_dirty(meta_bh);
+
+    //se non si vuole utilizzare il page-cache write back daemon, la scrittura dei blocchi viene riportata nel device in maniera sincrona.
+    #ifdef SYNC
+    sync_dirty_buffer(bh);
+    if (meta_bh != bh)
+        sync_dirty_buffer(meta_bh);
+    #endif
+
+    //rilascio dei buffer head
+    if (meta_bh != bh)
+        brelse(meta_bh);
+    brelse(bh);
+    return version;
+
+}
+
+//restituisce 1 se il payload db_cont corrisponde al checksum registrato nei metadati db_meta (sempre vero per i messaggi scritti
+//senza checksum). Per un confronto coerente con le modifiche in place va invocata all'interno di una sezione di lettura del seqcount del blocco.
+int payload_intact(struct data_block_metadata *db_meta, struct data_block_content *db_cont) {
+    return !(db_meta->flags & BLOCK_CHECKSUM) || payload_checksum(db_cont->payload) == db_meta->checksum;
+}
+
+//copia in buffer (DEFAULT_BLOCK_SIZE-METADATA_SIZE byte) il payload del messaggio così come è stato scritto: decompresso se
+//compresso e completato con byte nulli. Con slot >= 0 il messaggio è quello dello slot indicato di un blocco impacchettato,
+//altrimenti quello che occupa l'intero blocco. Restituisce la lunghezza del messaggio, oppure -1 se il messaggio è danneggiato
+//(o lo slot non esiste).
+//Per una copia coerente con le modifiche in place va invocata all'interno di una sezione di lettura del seqcount del blocco.
+int read_message(struct data_block_metadata *db_meta, struct data_block_content *db_cont, int slot, char *buffer) {
+
+    struct packed_header *hdr;
+    struct packed_slot entry;
+    const char *source;
+    size_t stored;
+    int compressed;
+    int len;
+
+    if (slot >= 0) {
+        hdr = (struct packed_header *)db_cont->payload;
+        if (!(db_meta->flags & BLOCK_PACKED) || slot >= min_t(int, READ_ONCE(hdr->slots), PACKED_MAX_SLOTS))
+            return -1;
+        entry = hdr->slot[slot];
+        if (entry.offset < sizeof(struct packed_header) || entry.offset + entry.length > DEFAULT_BLOCK_SIZE - METADATA_SIZE)
+            return -1;
+        source = db_cont->payload + entry.offset;
+        stored = entry.length;
+        compressed = entry.flags & SLOT_COMPRESSED;
+    }
+    else {
+        if (!(db_meta->flags & BLOCK_COMPRESSED)) {
+            memcpy(buffer, db_cont->payload, DEFAULT_BLOCK_SIZE - METADATA_SIZE);
+            return payload_length(db_meta, buffer);
+        }
+        if (db_meta->stored_len > DEFAULT_BLOCK_SIZE - METADATA_SIZE)
+            return -1;
+        source = db_cont->payload;
+        stored = db_meta->stored_len;
+        compressed = 1;
+    }
+
+    if (compressed) {
+        //LZ4_decompress_safe() non legge né scrive mai al di fuori dei buffer indicati, anche con un input danneggiato
+        len = LZ4_decompress_safe(source, buffer, stored, DEFAULT_BLOCK_SIZE - METADATA_SIZE);
+        if (len < 0)
+            return -1;
+    }
+    else {
+        memcpy(buffer, source, stored);
+        len = stored;
+    }
+    memset(buffer + len, 0, DEFAULT_BLOCK_SIZE - METADATA_SIZE - len);
+    return len;
+
+}
+
+//comprime con LZ4 i size byte di source. Se il risultato è più corto del messaggio originale, in *compressed viene restituito
+//un buffer (da liberare con kfree()) che lo contiene e ne viene restituita la lunghezza; altrimenti restituisce 0.
+//la memoria di lavoro di LZ4 (LZ4_MEM_COMPRESS byte) viene allocata a ogni chiamata, per cui la compressione può avvenire
+//prima di acquisire write_mutex e più scrittori comprimono in parallelo.
+size_t compress_message(char *source, size_t size, char **compressed) {
+
+    void *wrkmem;
+    char *dest;
+    int len;
+
+    if (size == 0)
+        return 0;
+    wrkmem = kmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+    dest = kmalloc(size, GFP_KERNEL);
+    len = 0;
+    if (wrkmem && dest)
+        len = LZ4_compress_default(source, dest, size, size - 1, wrkmem);   //0 se il risultato non sta in size-1 byte
+    kfree(wrkmem);
+    if (len <= 0) {
+        kfree(dest);
+        return 0;
+    }
+    *compressed = dest;
+    return len;
+
+}
+
+//questa funzione prepara in payload (DEFAULT_BLOCK_SIZE-METADATA_SIZE byte) il contenuto di un nuovo blocco impacchettato,
+//il cui unico slot contiene i size byte di source (con i flag slot_flags, oltre a SLOT_VALID).
+void init_packed_payload(char *payload, char *source, size_t size, uint16_t slot_flags) {
+
+    struct packed_header *hdr;
+
+    memset(payload, 0, DEFAULT_BLOCK_SIZE - METADATA_SIZE);
+    hdr = (struct packed_header *)payload;
+    hdr->slots = 1;
+    hdr->live = 1;
+    hdr->end = sizeof(struct packed_header) + size;
+    hdr->slot[0].offset = sizeof(struct packed_header);
+    hdr->slot[0].length = size;
+    hdr->slot[0].flags = SLOT_VALID | slot_flags;
+    memcpy(payload + sizeof(struct packed_header), source, size);
+
+}
+
+//questa funzione accoda i size byte di source, come nuovo slot, al blocco impacchettato di indice offset (che deve avere spazio,
+//vedi packed_room()). La scrittura avviene nella sezione di scrittura del seqcount del blocco, come per set_block_payload(), e il
+//nuovo slot viene contato solo dopo che il suo contenuto è stato scritto: chi scorre la directory senza seqcount (il cursore di
+//lettura) lo vede completo oppure non lo vede affatto. Deve essere invocata con write_mutex acquisito.
+//restituisce l'indice del nuovo slot, oppure -1 in caso di errore.
+int add_packed_message(struct super_block *global_sb, uint64_t offset, char *source, size_t size, uint16_t slot_flags) {
+
+    struct buffer_head *bh;
+    struct buffer_head *meta_bh;
+    struct data_block_content *db_cont;
+    struct data_block_metadata *db_meta;
+    struct packed_header *hdr;
+    seqcount_t *seqcount;
+    int slot;
+
+    bh = sb_bread(global_sb, data_block_number(offset));
+    if (!(global_sb && bh)) {
+        return -1;  //error condition
+    }
+    meta_bh = (au_info.features & FEAT_META_TABLE) ? read_metadata_buffer(global_sb, offset) : bh;
+    if (!meta_bh) {
+        brelse(bh);
+        return -1;  //error condition
+    }
+    db_cont = (struct data_block_content *)bh->b_data;
+    db_meta = metadata_in_buffer(meta_bh, offset);
+    hdr = (struct packed_header *)db_cont->payload;
+    seqcount = payload_seqcount(offset);
+    slot = hdr->slots;
+
+    preempt_disable();
+    write_seqcount_begin(seqcount);
+    memcpy(db_cont->payload + hdr->end, source, size);
+    hdr->slot[slot].offset = hdr->end;
+    hdr->slot[slot].length = size;
+    hdr->slot[slot].flags = SLOT_VALID | slot_flags;
+    hdr->slot[slot].reserved = 0;
+    hdr->end += size;
+    hdr->live++;
+    smp_wmb();  //lo slot diventa visibile (slots) dopo il suo contenuto
+    WRITE_ONCE(hdr->slots, slot + 1);
+    db_meta->checksum = payload_checksum(db_cont->payload);
+    write_seqcount_end(seqcount);
+    preempt_enable();
+
+    //segnalazione al SO che i blocchi sono stati modificati e che le modifiche devono essere sincronizzate col device sottostante
+    mark_buffer_dirty(bh);
+    if (meta_bh != bh)
+        mark_buffer_dirty(meta_bh);
+
+    //se non si vuole utilizzare il page-cache write back daemon, la scrittura dei blocchi viene riportata nel device in maniera sincrona.
+    #ifdef SYNC
+    sync_dirty_buffer(bh);
+    if (meta_bh != bh)
+        sync_dirty_buffer(meta_bh);
+    #endif
+
+    //rilascio dei buffer head
+    if (meta_bh != bh)
+        brelse(meta_bh);
+    brelse(bh);
+    return slot;
+
+}
+
+//questa funzione recupera lo spazio del payload occupato dai messaggi non più validi del blocco impacchettato di indice offset: i
+//messaggi validi vengono avvicinati all'inizio del payload, nell'ordine degli slot, e gli slot non validi restano nella directory con
+//lunghezza 0 (l'indice dello slot determina il numero di sequenza, per cui gli slot non vengono mai riutilizzati). La scrittura avviene
+//nella sezione di scrittura del seqcount del blocco, per cui chi copia un messaggio valido ripete la copia dalla nuova posizione.
+//Il contenuto dei messaggi non validi va perso: il chiamante deve assicurarsi che nessun lettore possa ancora leggerli (nessuno
+//snapshot attivo e un grace period trascorso dalla loro invalidazione). Deve essere invocata con write_mutex acquisito.
+//restituisce il numero di byte recuperati, oppure -1 in caso di errore.
+int reclaim_packed_space(struct super_block *global_sb, uint64_t offset) {
+
+    struct buffer_head *bh;
+    struct buffer_head *meta_bh;
+    struct data_block_content *db_cont;
+    struct data_block_metadata *db_meta;
+    struct packed_header *hdr;
+    seqcount_t *seqcount;
+    uint16_t pos;
+    int reclaimed;
+    int slot;
+
+    bh = sb_bread(global_sb, data_block_number(offset));
+    if (!(global_sb && bh)) {
+        return -1;  //error condition
+    }
+    meta_bh = (au_info.features & FEAT_META_TABLE) ? read_metadata_buffer(global_sb, offset) : bh;
+    if (!meta_bh) {
+        brelse(bh);
+        return -1;  //error condition
+    }
+    db_cont = (struct data_block_content *)bh->b_data;
+    db_meta = metadata_in_buffer(meta_bh, offset);
+    hdr = (struct packed_header *)db_cont->payload;
+    seqcount = payload_seqcount(offset);
+
+    //gli slot occupano il payload nell'ordine dei loro indici, per cui ogni messaggio valido si sposta verso l'inizio (memmove())
+    preempt_disable();
+    write_seqcount_begin(seqcount);
+    pos = sizeof(struct packed_header);
+    for(slot=0; slot<hdr->slots && slot<PACKED_MAX_SLOTS; slot++) {
+        if (!(hdr->slot[slot].flags & SLOT_VALID)) {
+            hdr->slot[slot].offset = pos;
+            hdr->slot[slot].length = 0;
+            continue;
+        }
+        if (hdr->slot[slot].offset != pos)
+            memmove(db_cont->payload + pos, db_cont->payload + hdr->slot[slot].offset, hdr->slot[slot].length);
+        hdr->slot[slot].offset = pos;
+        pos += hdr->slot[slot].length;
+    }
+    reclaimed = hdr->end - pos;
+    memset(db_cont->payload + pos, 0, hdr->end - pos);
+    hdr->end = pos;
+    db_meta->checksum = payload_checksum(db_cont->payload);
+    write_seqcount_end(seqcount);
+    preempt_enable();
+
+    //segnalazione al SO che i blocchi sono stati modificati e che le modifiche devono essere sincronizzate col device sottostante
+    mark_buffer_dirty(bh);
+    if (meta_bh != bh)
+        mark_buffer_dirty(meta_bh);
+
+    //se non si vuole utilizzare il page-cache write back daemon, la scrittura dei blocchi viene riportata nel device in maniera sincrona.
+    #ifdef SYNC
+    sync_dirty_buffer(bh);
+    if (meta_bh != bh)
+        sync_dirty_buffer(meta_bh);
+    #endif
+
+    //rilascio dei buffer head
+    if (meta_bh != bh)
+        brelse(meta_bh);
+    brelse(bh);
+    return reclaimed;
+
+}
+
+//questa funzione marca come invalido lo slot slot del blocco impacchettato di indice offset, che deve contenere almeno un altro
+//messaggio valido (l'ultimo messaggio valido si invalida insieme al blocco). Il contenuto dello slot non viene modificato, per cui
+//una lettura già iniziata (o uno snapshot che contiene il messaggio) lo vede ancora intatto. Deve essere invocata con write_mutex acquisito.
+int invalidate_packed_slot(struct super_block *global_sb, uint64_t offset, int slot) {
+
+    struct buffer_head *bh;
+    struct buffer_head *meta_bh;
+    struct data_block_content *db_cont;
+    struct data_block_metadata *db_meta;
+    struct packed_header *hdr;
+    seqcount_t *seqcount;
+
+    bh = sb_bread(global_sb, data_block_number(offset));
+    if (!(global_sb && bh)) {
+        return -1;  //error condition
+    }
+    meta_bh = (au_info.features & FEAT_META_TABLE) ? read_metadata_buffer(global_sb, offset) : bh;
+    if (!meta_bh) {
+        brelse(bh);
+        return -1;  //error condition
+    }
+    db_cont = (struct data_block_content *)bh->b_data;
+    db_meta = metadata_in_buffer(meta_bh, offset);
+    hdr = (struct packed_header *)db_cont->payload;
+    seqcount = payload_seqcount(offset);
+
+    preempt_disable();
+    write_seqcount_begin(seqcount);
+    WRITE_ONCE(hdr->slot[slot].flags, hdr->slot[slot].flags & ~SLOT_VALID);
+    hdr->live--;
+    db_meta->checksum = payload_checksum(db_cont->payload);
+    write_seqcount_end(seqcount);
+    preempt_enable();
+
+    //segnalazione al SO che i blocchi sono stati modificati e che le modifiche devono essere sincronizzate col device sottostante
+    mark_buffer_dirty(bh);
+    if (meta_bh != bh)
+        mark_buffer_dirty(meta_bh);
+
+    //se non si vuole utilizzare il page-cache write back daemon, la scrittura dei blocchi viene riportata nel device in maniera sincrona.
+    #ifdef SYNC
+    sync_dirty_buffer(bh);
+    if (meta_bh != bh)
+        sync_dirty_buffer(meta_bh);
+    #endif
+
+    //rilascio dei buffer head
+    if (meta_bh != bh)
+        brelse(meta_bh);
+    brelse(bh);
+    return 0;
+
+}
+
+//questa funzione marca il data block di indice offset come invalido
+int invalidate_block_content(struct super_block *global_sb, uint64_t offset) {
+
+    struct buffer_head *bh;
+    struct data_block_metadata *new_db_meta;
+
+    bh = read_metadata_buffer(global_sb, offset);
+    if (!(global_sb && bh)) {
+        return -1;  //error condition
+    }
+    new_db_meta = metadata_in_buffer(bh, offset);
 
     //è sufficiente portare a 0 il valore di is_valid affinché il blocco target risulti invalido.
-    new_db_cont->metadata.is_valid = 0;
+    new_db_meta->is_valid = 0;
 
     //segnalazione al SO che il blocco è stato modificato e che le modifiche devono essere sincronizzate col device sottostante
     mark_buffer_dirty(bh);
@@ -198,3 +874,438 @@ int invalidate_block_content(struct super_block *global_sb, int block_num) {
     return 0;    
 
 }
+
+//questa funzione copia il data block valido di indice from (metadati+payload) nel data block libero di indice to, che diventa valido
+//con gli stessi collegamenti, lo stesso numero di sequenza e la stessa versione (deve essere invocata con write_mutex acquisito).
+int copy_block(struct super_block *global_sb, uint64_t from, uint64_t to) {
+
+    struct buffer_head *src_bh;
+    struct buffer_head *src_meta_bh;
+    struct buffer_head *bh;
+    struct buffer_head *meta_bh;
+    struct data_block_metadata *new_db_meta;
+    int ret;
+
+    ret = -1;
+    src_bh = sb_bread(global_sb, data_block_number(from));
+    bh = sb_bread(global_sb, data_block_number(to));
+    if (!(global_sb && src_bh && bh))
+        goto copy_out;
+    memcpy(((struct data_block_content *)bh->b_data)->payload, ((struct data_block_content *)src_bh->b_data)->payload, DEFAULT_BLOCK_SIZE - METADATA_SIZE);
+
+    //come in set_block_content(), con la tabella dei metadati il payload viene reso persistente prima della voce che rende valido il blocco.
+    src_meta_bh = src_bh;
+    meta_bh = bh;
+    if (au_info.features & FEAT_META_TABLE) {
+        mark_buffer_dirty(bh);
+        #ifdef SYNC
+        sync_dirty_buffer(bh);
+        #endif
+        src_meta_bh = read_metadata_buffer(global_sb, from);
+        meta_bh = read_metadata_buffer(global_sb, to);
+        if (!(src_meta_bh && meta_bh))
+            goto copy_meta_out;
+    }
+    new_db_meta = metadata_in_buffer(meta_bh, to);
+    memcpy(new_db_meta, metadata_in_buffer(src_meta_bh, from), sizeof(struct data_block_metadata));
+    new_db_meta->is_valid = 1;
+
+    //segnalazione al SO che il blocco è stato modificato e che le modifiche devono essere sincronizzate col device sottostante
+    mark_buffer_dirty(meta_bh);
+
+    //se non si vuole utilizzare il page-cache write back daemon, la scrittura del blocco viene riportata nel device in maniera sincrona.
+    #ifdef SYNC
+    sync_dirty_buffer(meta_bh);
+    #endif
+    ret = 0;
+
+copy_meta_out:
+    //rilascio dei buffer head
+    if (meta_bh != bh)
+        brelse(meta_bh);
+    if (src_meta_bh != src_bh)
+        brelse(src_meta_bh);
+copy_out:
+    brelse(bh);
+    brelse(src_bh);
+    return ret;
+
+}
+
+//questa funzione trasforma il data block di indice offset (l'indice originario di un messaggio spostato dalla compattazione) in una
+//lapide: il blocco non è valido, ha il flag BLOCK_MOVED e next_valid indica la posizione attuale del messaggio (forward). Le lapidi
+//permettono al montaggio successivo di ricostruire la tabella di traduzione. Con forward == -1 la lapide viene cancellata.
+int set_block_forward(struct super_block *global_sb, uint64_t offset, int64_t forward) {
+
+    struct buffer_head *bh;
+    struct data_block_metadata *new_db_meta;
+
+    bh = read_metadata_buffer(global_sb, offset);
+    if (!(global_sb && bh)) {
+        return -1;  //error condition
+    }
+    new_db_meta = metadata_in_buffer(bh, offset);
+
+    new_db_meta->is_valid = 0;
+    if (forward == -1) {
+        new_db_meta->flags &= ~BLOCK_MOVED;
+    }
+    else {
+        new_db_meta->next_valid = forward;
+        new_db_meta->flags |= BLOCK_MOVED;
+    }
+
+    //segnalazione al SO che il blocco è stato modificato e che le modifiche devono essere sincronizzate col device sottostante
+    mark_buffer_dirty(bh);
+
+    //se non si vuole utilizzare il page-cache write back daemon, la scrittura del blocco viene riportata nel device in maniera sincrona.
+    #ifdef SYNC
+    sync_dirty_buffer(bh);
+    #endif
+
+    //rilascio del buffer head bh
+    brelse(bh);
+    return 0;
+
+}
+
+//questa funzione aggiorna il bit del data block di indice offset nella bitmap di allocazione in RAM e rimuove le eventuali
+//mappature (dev_mmap()) della pagina corrispondente del file, in modo che il prossimo accesso la rimappi in base alla nuova validità.
+//l'aggiornamento avviene con la pagina del blocco bloccata, come il controllo eseguito da dev_mmap_fault(): un fault concorrente
+//non può quindi installare la pagina di un blocco appena invalidato (deve essere invocata con write_mutex acquisito).
+void publish_block_state(struct super_block *global_sb, uint64_t offset, int valid) {
+
+    struct buffer_head *bh;
+    struct inode *the_inode;
+
+    bh = sb_bread(global_sb, data_block_number(offset));
+    if (bh)
+        lock_page(bh->b_page);
+
+    if (valid == YES)
+        set_bit(offset, au_info.valid_bitmap);
+    else
+        clear_bit(offset, au_info.valid_bitmap);
+
+    //se l'inode del file non è in cache, il file non è aperto e quindi non può essere mappato.
+    the_inode = ilookup(global_sb, SINGLEFILEFS_FILE_INODE_NUMBER);
+    if (the_inode) {
+        unmap_mapping_range(the_inode->i_mapping, (loff_t)offset << PAGE_SHIFT, PAGE_SIZE, 1);
+        iput(the_inode);
+    }
+
+    if (bh) {
+        unlock_page(bh->b_page);
+        brelse(bh);
+    }
+
+}
+
+//questa funzione accoda la lettura (sb_breadahead()) di al più count data block della catena a partire da quello di indice block, senza
+//attenderne il completamento. Con la tabella dei metadati i collegamenti si leggono dalla tabella (METADATA_PER_BLOCK voci per blocco),
+//per cui la catena può essere seguita per intero; altrimenti i collegamenti di un blocco sono scritti nel blocco stesso: per i blocchi
+//non ancora in cache si usa l'indice in RAM chain_next, che registra i collegamenti scritti o letti dal montaggio. Al primo blocco
+//mancante di cui non si conosce il successore, se l'ultimo passo era sequenziale sul dispositivo (come accade dopo singlefilemakefs
+//o la compattazione), vengono letti in anticipo anche i blocchi fisicamente successivi.
+//restituisce il numero di blocchi coperti (già in cache oppure in lettura), compreso quello di partenza.
+unsigned int prefetch_chain(struct super_block *global_sb, int64_t block, unsigned int count) {
+
+    struct buffer_head *bh;
+    struct data_block_metadata *db_meta;
+    int64_t prev;
+    int64_t next;
+    unsigned int covered;
+
+    prev = -1;
+    covered = 0;
+    while (covered < count && block >= 0 && (uint64_t)block < au_info.total_data_blocks) {
+        if (au_info.features & FEAT_META_TABLE) {
+            sb_breadahead(global_sb, data_block_number(block));
+            db_meta = get_block_metadata(global_sb, block);
+            if (db_meta == NULL)
+                break;
+            next = READ_ONCE(db_meta->next_valid);
+        }
+        else {
+            bh = sb_getblk(global_sb, data_block_number(block));
+            if (!bh)
+                break;
+            if (buffer_uptodate(bh)) {
+                db_meta = metadata_in_buffer(bh, block);
+                next = READ_ONCE(db_meta->next_valid);
+                note_chain_next(block, next);
+                brelse(bh);
+            }
+            else {
+                brelse(bh);
+                sb_breadahead(global_sb, data_block_number(block));
+                next = au_info.chain_next ? READ_ONCE(au_info.chain_next[block]) : CHAIN_NEXT_UNKNOWN;
+                if (next == CHAIN_NEXT_UNKNOWN) {
+                    covered++;
+                    if (prev != -1 && block == prev + 1)
+                        for(block++; covered < count && (uint64_t)block < au_info.total_data_blocks; block++, covered++)
+                            sb_breadahead(global_sb, data_block_number(block));
+                    break;
+                }
+            }
+        }
+        covered++;
+        prev = block;
+        block = next;
+    }
+    return covered;
+
+}
+
+//questa funzione va invocata a ogni passo di un attraversamento ordinato della catena, con l'indirizzo del messaggio raggiunto: quando
+//l'attraversamento passa a un nuovo blocco e ha consumato metà della finestra letta in anticipo, accoda la lettura dei
+//CHAIN_READAHEAD_BLOCKS blocchi successivi, in modo che un attraversamento a freddo non attenda una lettura sincrona per ogni blocco.
+void prefetch_step(struct super_block *global_sb, struct chain_prefetch *prefetch, int64_t address) {
+
+    int64_t block;
+
+    if (address < 0)
+        return;
+    block = ADDRESS_BLOCK(address);
+    if (block == prefetch->block)
+        return;     //altro messaggio dello stesso blocco impacchettato
+    prefetch->block = block;
+    if (prefetch->ahead > CHAIN_READAHEAD_BLOCKS / 2) {
+        prefetch->ahead--;
+        return;
+    }
+    //senza la tabella dei metadati, su una catena non sequenziale la finestra si ferma al primo blocco non ancora letto di cui
+    //chain_next non conosce il successore: in tal caso la lettura anticipata viene ripetuta al passo successivo.
+    prefetch->ahead = prefetch_chain(global_sb, block, CHAIN_READAHEAD_BLOCKS);
+    if (prefetch->ahead > 0)
+        prefetch->ahead--;
+
+}
+
+//questa funzione restituisce 1 se il messaggio con numero di sequenza seq è contenuto in qualche snapshot attivo
+//(deve essere invocata con write_mutex acquisito, prima dell'invalidazione del messaggio).
+int snapshot_contains(uint64_t seq) {
+
+    struct read_snapshot *snap;
+    int found;
+
+    found = 0;
+    mutex_lock(&(au_info.snap_mutex));
+    list_for_each_entry(snap, &(au_info.snapshots), list) {
+        if (seq < snap->seq) {
+            found = 1;
+            break;
+        }
+    }
+    mutex_unlock(&(au_info.snap_mutex));
+    return found;
+
+}
+
+//questa funzione trattiene il messaggio di indirizzo address (con numero di sequenza seq), appena invalidato, per gli snapshot che
+//lo contengono: il suo data block non verrà riutilizzato finché prune_retained_blocks() non rilascia l'ultimo dei suoi messaggi trattenuti.
+//rb è preallocato dal chiamante (con write_mutex acquisito), in modo che l'invalidazione non possa fallire a metà.
+void retain_block(struct retained_block *rb, uint64_t address, uint64_t seq) {
+
+    void *count;
+    uint64_t block;
+    int ret;
+
+    block = ADDRESS_BLOCK(address);
+    rb->block = address;
+    rb->epoch = au_info.inval_epoch;
+    mutex_lock(&(au_info.snap_mutex));
+    count = xa_load(&(au_info.retained_count), block);
+    ret = xa_err(xa_store(&(au_info.retained_count), block, xa_mk_value(count ? xa_to_value(count) + 1 : 1), GFP_KERNEL));
+    if (ret == 0 && xa_is_err(xa_store(&(au_info.retained), seq, rb, GFP_KERNEL))) {
+        //il contatore torna al valore precedente (la voce esiste già, per cui la scrittura non alloca memoria)
+        if (count)
+            xa_store(&(au_info.retained_count), block, count, GFP_KERNEL);
+        else
+            xa_erase(&(au_info.retained_count), block);
+        ret = -ENOMEM;
+    }
+    if (ret < 0) {
+        printk("%s: could not retain message %llu for the active snapshots: it will be missing from them\n", MOD_NAME, address);
+        kfree(rb);
+    }
+    else {
+        set_bit(block, au_info.retained_bitmap);
+    }
+    mutex_unlock(&(au_info.snap_mutex));
+
+}
+
+//questa funzione rilascia i messaggi trattenuti che non sono più contenuti in alcuno snapshot attivo: un messaggio serve a uno
+//snapshot se ne faceva parte (seq inferiore a quello dello snapshot) ed è stato invalidato dopo la sua creazione. Più messaggi
+//impacchettati possono trattenere lo stesso blocco: il suo bit nella bitmap dei blocchi trattenuti viene azzerato solo quando il
+//contatore del blocco (retained_count) si annulla, per cui find_free_block(), che consulta la bitmap con il solo write_mutex
+//acquisito, non vede mai libero un blocco ancora trattenuto. Deve essere invocata con snap_mutex acquisito.
+void prune_retained_blocks(void) {
+
+    struct retained_block *rb;
+    struct read_snapshot *snap;
+    unsigned long seq;
+    uint64_t count;
+    int needed;
+
+    xa_for_each(&(au_info.retained), seq, rb) {
+        needed = 0;
+        list_for_each_entry(snap, &(au_info.snapshots), list) {
+            if (seq < snap->seq && rb->epoch > snap->epoch) {
+                needed = 1;
+                break;
+            }
+        }
+        if (!needed) {
+            xa_erase(&(au_info.retained), seq);
+            count = xa_to_value(xa_load(&(au_info.retained_count), ADDRESS_BLOCK(rb->block)));
+            if (count > 1) {
+                xa_store(&(au_info.retained_count), ADDRESS_BLOCK(rb->block), xa_mk_value(count - 1), GFP_KERNEL);
+            }
+            else {
+                xa_erase(&(au_info.retained_count), ADDRESS_BLOCK(rb->block));
+                clear_bit(ADDRESS_BLOCK(rb->block), au_info.retained_bitmap);
+            }
+            kfree(rb);
+        }
+    }
+
+}
+
+//questa funzione restituisce il data block associato alla chiave key nell'indice delle chiavi, oppure -1 se la chiave non è presente.
+//il blocco restituito va verificato dal chiamante (flag BLOCK_KEYED e campo key dei metadati): nel frattempo il messaggio può
+//essere stato invalidato e il blocco riutilizzato.
+int64_t lookup_key(uint64_t key) {
+
+    struct key_entry *entry;
+    int64_t block;
+
+    rcu_read_lock();
+    entry = rhashtable_lookup(&(au_info.key_index), &key, key_index_params);
+    block = entry ? READ_ONCE(entry->block) : -1;
+    rcu_read_unlock();
+    return block;
+
+}
+
+//questa funzione associa la chiave key al data block di indice block nell'indice delle chiavi (deve essere invocata con write_mutex acquisito).
+//restituisce 0, -EEXIST se la chiave è già associata a un messaggio valido oppure -ENOMEM.
+int insert_key(uint64_t key, int64_t block) {
+
+    struct key_entry *entry;
+    int ret;
+
+    entry = kmalloc(sizeof(struct key_entry), GFP_KERNEL);
+    if (!entry)
+        return -ENOMEM; //-ENOMEM = errore di esaurimento della memoria
+    entry->key = key;
+    entry->block = block;
+    ret = rhashtable_lookup_insert_fast(&(au_info.key_index), &(entry->node), key_index_params);
+    if (ret < 0)
+        kfree(entry);
+    return ret;
+
+}
+
+//questa funzione rimuove la chiave key, se è associata al data block di indice block, dall'indice delle chiavi (deve essere invocata
+//con write_mutex acquisito). La voce viene liberata dopo un grace period RCU, per cui una lookup_key() concorrente può ancora consultarla.
+void remove_key(uint64_t key, int64_t block) {
+
+    struct key_entry *entry;
+
+    rcu_read_lock();
+    entry = rhashtable_lookup(&(au_info.key_index), &key, key_index_params);
+    if (entry && entry->block == block && rhashtable_remove_fast(&(au_info.key_index), &(entry->node), key_index_params) == 0)
+        kfree_rcu(entry, rcu);
+    rcu_read_unlock();
+
+}
+
+//questa funzione associa la chiave key, se è associata al data block di indice from, al data block di indice to in cui la compattazione
+//ha spostato il messaggio (deve essere invocata con write_mutex acquisito). La voce viene aggiornata in place, per cui una lookup_key()
+//concorrente trova il vecchio blocco oppure il nuovo, mai nessuno dei due.
+void move_key(uint64_t key, int64_t from, int64_t to) {
+
+    struct key_entry *entry;
+
+    rcu_read_lock();
+    entry = rhashtable_lookup(&(au_info.key_index), &key, key_index_params);
+    if (entry && entry->block == from)
+        WRITE_ONCE(entry->block, to);
+    rcu_read_unlock();
+
+}
+
+//questa funzione dimentica il vecchio indice del data block di indice offset, se vi è stato spostato dalla compattazione: la lapide
+//(BLOCK_MOVED) viene cancellata dal disco e il vecchio indice torna riutilizzabile da put_data(). Va invocata quando il messaggio viene
+//invalidato, prima di invalidare il blocco (con write_mutex acquisito). Restituisce 0, oppure -1 in caso di errore.
+int drop_relocation(struct super_block *global_sb, uint64_t offset) {
+
+    void *origin;
+
+    origin = xa_load(&(au_info.relocated), offset);
+    if (!origin)
+        return 0;
+    if (set_block_forward(global_sb, xa_to_value(origin), -1) < 0)
+        return -1;  //error condition
+    xa_erase(&(au_info.relocated), offset);
+    xa_erase(&(au_info.remap), xa_to_value(origin));
+    au_info.relocated_blocks--;
+    return 0;
+
+}
+
+//costanti per il confronto di 8 byte alla volta (SWAR) di find_pattern()
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+
+//legge 8 byte consecutivi (anche non allineati) a partire da p; il byte p[k] occupa i bit [8k, 8k+8) del risultato.
+static inline uint64_t load_word(const char *p) {
+
+    __le64 word;
+
+    memcpy(&word, p, sizeof(word));
+    return le64_to_cpu(word);
+
+}
+
+/* questa funzione restituisce il puntatore alla prima occorrenza di pattern (m byte, m > 0) in text (len byte), oppure NULL.
+ * Il testo viene esaminato 8 posizioni alla volta: per ogni posizione i della parola si confrontano contemporaneamente il primo
+ * byte del pattern con text[i] e l'ultimo con text[i+m-1] (XOR con i due byte replicati su tutta la parola); le posizioni in cui
+ * entrambi coincidono hanno un byte nullo in (a ^ first) | (b ^ last), che viene individuato con il classico test
+ * (x - 0x01..01) & ~x & 0x80..80. Solo per queste posizioni candidate si confronta l'intero pattern con memcmp().
+ */
+const char *find_pattern(const char *text, size_t len, const char *pattern, size_t m) {
+
+    uint64_t first;
+    uint64_t last;
+    uint64_t x;
+    uint64_t candidates;
+    size_t i;
+    unsigned int k;
+
+    if (m == 0 || m > len)
+        return NULL;
+    first = SWAR_ONES * (unsigned char)pattern[0];
+    last = SWAR_ONES * (unsigned char)pattern[m-1];
+
+    //finché entrambe le parole (text+i e text+i+m-1) sono interamente contenute nel testo
+    for(i=0; i+m-1+sizeof(uint64_t) <= len; i+=sizeof(uint64_t)) {
+        x = (load_word(text + i) ^ first) | (load_word(text + i + m - 1) ^ last);
+        candidates = (x - SWAR_ONES) & ~x & SWAR_HIGHS;
+        //il test può segnalare anche posizioni che non coincidono (a causa del prestito), ma mai perderne una: vengono tutte verificate.
+        while (candidates) {
+            k = __ffs(candidates) / 8;
+            if (memcmp(text + i + k, pattern, m) == 0)
+                return text + i + k;
+            candidates &= candidates - 1;
+        }
+    }
+    //posizioni residue
+    for(; i+m <= len; i++)
+        if (text[i] == pattern[0] && memcmp(text + i, pattern, m) == 0)
+            return text + i;
+    return NULL;
+
+}